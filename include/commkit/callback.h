@@ -46,6 +46,9 @@
  * Disable the callback:
  *
  *    onEvent.disconnect();
+ *
+ * Each call goes through a std::function, which may allocate for a lambda
+ * with bigger captures; see Delegate and Signal for where that matters.
  */
 
 namespace commkit
@@ -73,7 +76,7 @@ public:
     template <class T>
     void connect(RT (T::*memberfunc)(Args...), T *t)
     {
-        target = do_bind<T, Args...>(memberfunc, t);
+        target = do_bind(memberfunc, t);
     }
 
     void disconnect()
@@ -81,6 +84,11 @@ public:
         target = nullptr;
     }
 
+    bool connected() const
+    {
+        return bool(target);
+    }
+
     void operator()(Args... args)
     {
         if (target) {
@@ -91,52 +99,13 @@ public:
 private:
     Target target;
 
-    /*
-     * specializations of std::bind(), based on arity.
-     * saves callers from having the specify the number
-     * of placeholders manually.
-     *
-     * I'm not sure how to expand Args... directly within std::bind,
-     * so do this manually for the max number of params we want to support.
-     */
-
+    // a member function, called directly rather than through std::bind()
     template <class T>
-    static Target do_bind(RT (T::*memberfunc)(), T *t)
-    {
-        return std::bind(memberfunc, t);
-    }
-
-    template <class T, typename P1>
-    static Target do_bind(RT (T::*memberfunc)(P1), T *t)
-    {
-        return std::bind(memberfunc, t, std::placeholders::_1);
-    }
-
-    template <class T, typename P1, typename P2>
-    static Target do_bind(RT (T::*memberfunc)(P1, P2), T *t)
-    {
-        return std::bind(memberfunc, t, std::placeholders::_1, std::placeholders::_2);
-    }
-
-    template <class T, typename P1, typename P2, typename P3>
-    static Target do_bind(RT (T::*memberfunc)(P1, P2, P3), T *t)
-    {
-        return std::bind(memberfunc, t, std::placeholders::_1, std::placeholders::_2,
-                         std::placeholders::_3);
-    }
-
-    template <class T, typename P1, typename P2, typename P3, typename P4>
-    static Target do_bind(RT (T::*memberfunc)(P1, P2, P3, P4), T *t)
-    {
-        return std::bind(memberfunc, t, std::placeholders::_1, std::placeholders::_2,
-                         std::placeholders::_3, std::placeholders::_4);
-    }
-
-    template <class T, typename P1, typename P2, typename P3, typename P4, typename P5>
-    static Target do_bind(RT (T::*memberfunc)(P1, P2, P3, P4, P5), T *t)
+    static Target do_bind(RT (T::*memberfunc)(Args...), T *t)
     {
-        return std::bind(memberfunc, t, std::placeholders::_1, std::placeholders::_2,
-                         std::placeholders::_3, std::placeholders::_4, std::placeholders::_5);
+        return [memberfunc, t](Args... args) {
+            return (t->*memberfunc)(std::forward<Args>(args)...);
+        };
     }
 };
 
@@ -6,6 +6,8 @@
 
 #include <commkit/callback.h>
 #include <commkit/chrono.h>
+#include <commkit/delegate.h>
+#include <commkit/executor.h>
 #include <commkit/types.h>
 #include <commkit/topic.h>
 #include <commkit/make_unique_cpp11.h>
@@ -13,3 +15,4 @@
 #include <commkit/publisher.h>
 #include <commkit/subscriber.h>
 #include <commkit/rtps.h>
+#include <commkit/waitset.h>
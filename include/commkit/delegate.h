@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Allocation-free callbacks, for the paths Callback (a std::function) is
+ * too heavy for. Usage:
+ *
+ * A Delegate holds one target, its captures stored inline. A target too
+ * big for the storage doesn't compile, rather than going to the heap:
+ *
+ *    Delegate<void(int)> d([&count](int v) { count += v; });
+ *    d(5);
+ *
+ * Bind a member function, the call made directly, with no std::bind:
+ *
+ *    Handler h;
+ *    auto d = Delegate<void(int)>::bind<Handler, &Handler::eventHandler>(&h);
+ *
+ * or, with the member function chosen at run time:
+ *
+ *    auto d = Delegate<void(int)>::bind(&Handler::eventHandler, &h);
+ *
+ * A Signal holds up to a fixed number of them, called in turn:
+ *
+ *    Signal<void(int)> onEvent;
+ *    int id = onEvent.connect(myEventHandler); // -1 when full
+ *    onEvent(5);
+ *    onEvent.disconnect(id);
+ */
+
+namespace commkit
+{
+
+// room for a lambda capturing a few pointers, or a bound member function
+static constexpr size_t DELEGATE_STORAGE = 4 * sizeof(void *);
+
+template <typename Sig, size_t Size = DELEGATE_STORAGE>
+class Delegate;
+template <typename RT, typename... Args, size_t Size>
+class Delegate<RT(Args...), Size>
+{
+public:
+    Delegate() : invoker(nullptr), manager(nullptr)
+    {
+    }
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<
+                              typename std::decay<F>::type, Delegate>::value>::type>
+    Delegate(F &&f) : invoker(nullptr), manager(nullptr)
+    {
+        assign(std::forward<F>(f));
+    }
+
+    Delegate(const Delegate &other) : invoker(nullptr), manager(nullptr)
+    {
+        copyFrom(other);
+    }
+
+    Delegate &operator=(const Delegate &other)
+    {
+        if (this != &other) {
+            reset();
+            copyFrom(other);
+        }
+        return *this;
+    }
+
+    // the storage is inline, so a move is a copy that empties 'other'
+    Delegate(Delegate &&other) : invoker(nullptr), manager(nullptr)
+    {
+        copyFrom(other);
+        other.reset();
+    }
+
+    Delegate &operator=(Delegate &&other)
+    {
+        if (this != &other) {
+            reset();
+            copyFrom(other);
+            other.reset();
+        }
+        return *this;
+    }
+
+    ~Delegate()
+    {
+        reset();
+    }
+
+    template <class T, RT (T::*memberfunc)(Args...)>
+    static Delegate bind(T *t)
+    {
+        Delegate d;
+        new (&d.storage) T *(t);
+        d.invoker = &invokeMember<T, memberfunc>;
+        d.manager = &manage<T *>;
+        return d;
+    }
+
+    template <class T>
+    static Delegate bind(RT (T::*memberfunc)(Args...), T *t)
+    {
+        return Delegate(BoundMember<T>{memberfunc, t});
+    }
+
+    void reset()
+    {
+        if (manager) {
+            manager(OP_DESTROY, &storage, nullptr);
+        }
+        invoker = nullptr;
+        manager = nullptr;
+    }
+
+    explicit operator bool() const
+    {
+        return invoker != nullptr;
+    }
+
+    RT operator()(Args... args)
+    {
+        return invoker(&storage, std::forward<Args>(args)...);
+    }
+
+private:
+    typedef RT (*Invoker)(void *, Args &&...);
+    enum Op { OP_COPY, OP_DESTROY };
+    typedef void (*Manager)(Op, void *, const void *);
+
+    template <class T>
+    struct BoundMember {
+        RT (T::*memberfunc)(Args...);
+        T *t;
+
+        RT operator()(Args... args)
+        {
+            return (t->*memberfunc)(std::forward<Args>(args)...);
+        }
+    };
+
+    template <typename F>
+    void assign(F &&f)
+    {
+        typedef typename std::decay<F>::type Target;
+        static_assert(sizeof(Target) <= Size, "callback too big for the Delegate's storage");
+        static_assert(alignof(Target) <= alignof(std::max_align_t),
+                      "callback too strictly aligned for the Delegate's storage");
+
+        new (&storage) Target(std::forward<F>(f));
+        invoker = &invoke<Target>;
+        manager = &manage<Target>;
+    }
+
+    void copyFrom(const Delegate &other)
+    {
+        if (other.manager) {
+            other.manager(OP_COPY, &storage, &other.storage);
+        }
+        invoker = other.invoker;
+        manager = other.manager;
+    }
+
+    template <typename Target>
+    static RT invoke(void *s, Args &&... args)
+    {
+        return (*static_cast<Target *>(s))(std::forward<Args>(args)...);
+    }
+
+    template <class T, RT (T::*memberfunc)(Args...)>
+    static RT invokeMember(void *s, Args &&... args)
+    {
+        return ((*static_cast<T **>(s))->*memberfunc)(std::forward<Args>(args)...);
+    }
+
+    template <typename Target>
+    static void manage(Op op, void *dst, const void *src)
+    {
+        if (op == OP_COPY) {
+            new (dst) Target(*static_cast<const Target *>(src));
+        } else {
+            static_cast<Target *>(dst)->~Target();
+        }
+    }
+
+    typename std::aligned_storage<Size, alignof(std::max_align_t)>::type storage;
+    Invoker invoker;
+    Manager manager; // null when empty
+};
+
+/*
+ * Up to 'Slots' Delegates, called in slot order. connect() takes the
+ * lowest free slot, so a handler connected after another's disconnect()
+ * may run ahead of those connected before it. It returns the slot taken,
+ * to disconnect() by, or -1 when all are taken.
+ * As with Callback, connecting and calling aren't synchronised: connect
+ * handlers before anything can call them.
+ */
+template <typename Sig, unsigned Slots = 4, size_t Size = DELEGATE_STORAGE>
+class Signal;
+template <typename... Args, unsigned Slots, size_t Size>
+class Signal<void(Args...), Slots, Size>
+{
+public:
+    typedef Delegate<void(Args...), Size> Target;
+
+    Signal() : used(0)
+    {
+    }
+    Signal(const Signal &other) = delete;       // non construction-copyable
+    Signal &operator=(const Signal &) = delete; // non copyable
+
+    int connect(Target t)
+    {
+        for (unsigned i = 0; i < Slots; ++i) {
+            if (!targets[i]) {
+                targets[i] = std::move(t);
+                used = std::max(used, i + 1);
+                return int(i);
+            }
+        }
+        return -1;
+    }
+
+    template <class T>
+    int connect(void (T::*memberfunc)(Args...), T *t)
+    {
+        return connect(Target::bind(memberfunc, t));
+    }
+
+    void disconnect(int slot)
+    {
+        if (slot >= 0 && unsigned(slot) < Slots) {
+            targets[slot].reset();
+        }
+        while (used > 0 && !targets[used - 1]) {
+            used--;
+        }
+    }
+
+    void disconnect()
+    {
+        for (unsigned i = 0; i < used; ++i) {
+            targets[i].reset();
+        }
+        used = 0;
+    }
+
+    bool connected() const
+    {
+        return used > 0;
+    }
+
+    void operator()(Args... args)
+    {
+        for (unsigned i = 0; i < used; ++i) {
+            if (targets[i]) {
+                // not forwarded: every target gets the same arguments
+                targets[i](args...);
+            }
+        }
+    }
+
+private:
+    Target targets[Slots];
+    unsigned used; // targets from here on are empty
+};
+
+} // namespace commkit
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <memory>
+
+#include <commkit/chrono.h>
+#include <commkit/delegate.h>
+#include <commkit/types.h>
+#include <commkit/visibility.h>
+
+namespace commkit
+{
+
+class ExecutorImpl;
+
+/*
+ * Options to configure an Executor.
+ */
+struct COMMKIT_API ExecutorOpts {
+    unsigned queueDepth;     // posted tasks waiting at once, beyond which post() fails
+    unsigned maxSubscribers; // attached at once
+
+    /*
+     * Worker threads of the Executor's own, which run everything from
+     * init() until it's destroyed, each from a queue of its own and
+     * stealing from the others' when it runs out. 0 runs things only in
+     * spin() / spinOnce().
+     */
+    unsigned threads;
+
+    ExecutorOpts() : queueDepth(1024), maxSubscribers(64), threads(0)
+    {
+    }
+};
+
+/*
+ * Runs subscribers' message callbacks, timers and posted tasks on whichever
+ * thread spins it, one at a time, rather than on the threads samples
+ * arrive on. Usage:
+ *
+ *    commkit::Executor ex;
+ *    ex.init();
+ *    ex.add(sub); // sub->onMessage (and onMessageRef) now run in spin()
+ *    ex.addTimer(std::chrono::milliseconds(10), [&] { controlStep(); });
+ *    ex.spin();   // until ex.stop(), from any thread
+ *
+ * An attached subscriber with new samples is queued once, however many
+ * arrive before its callbacks run, so they should drain it with take().
+ * Callbacks, timers and tasks run in the order they became ready. Nothing
+ * is allocated to queue or run them.
+ *
+ * With ExecutorOpts::threads, they run on a pool of threads instead (and
+ * in spin(), should anyone call it), as many at once as there are
+ * threads. One subscriber's callbacks still never run at once, nor does
+ * one timer, so a subscriber's samples are still handled in order; those
+ * of different subscribers, and posted tasks, may not be.
+ */
+class COMMKIT_API Executor
+{
+public:
+    typedef Delegate<void()> Task;
+
+    Executor();
+    ~Executor();
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    bool init(const ExecutorOpts &opts = ExecutorOpts());
+
+    /*
+     * Attach a subscriber, or detach it, from any thread. The Executor
+     * keeps it alive while attached, and a subscriber can be attached to
+     * one Executor at a time. Once remove() returns, its callbacks are no
+     * longer queued, though one already running may still finish.
+     */
+    bool add(SubscriberPtr s);
+    void remove(SubscriberPtr s);
+
+    // run 't' in spin(); false if queueDepth tasks are already waiting
+    bool post(const Task &t);
+
+    /*
+     * Run 't' every 'period', the first a period from now, until removed
+     * by the ID returned. A timer that falls behind runs once and skips
+     * the periods it missed.
+     */
+    int addTimer(clock::duration period, const Task &t);
+    void removeTimer(int id);
+
+    /*
+     * Run whatever's ready, waiting up to 'timeout' for something to be
+     * if nothing is. Returns whether anything ran.
+     */
+    bool spinOnce(clock::duration timeout);
+
+    // spinOnce() until stop()
+    void spin();
+    void stop();
+
+private:
+    std::unique_ptr<ExecutorImpl> impl;
+};
+
+} // namespace commkit
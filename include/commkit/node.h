@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
@@ -14,6 +16,120 @@ namespace commkit
 
 class NodeImpl;
 
+/*
+ * Ways a Node can exchange samples with other Nodes, see NodeOpts::transports.
+ */
+enum TransportKind {
+    // RTPS over UDPv4. Always used, for discovery if nothing else, and the
+    // fallback for any peer no other transport reaches.
+    TRANSPORT_UDP,
+
+    // a ring per topic in shared memory (in /dev/shm), for peers on this
+    // host that also use it. A subscriber that falls further behind than
+    // ringSlots samples loses the oldest, so best effort topics only;
+    // reliable ones stay with RTPS.
+    TRANSPORT_SHARED_MEMORY,
+
+    // UDP beside RTPS, moving datagrams a batch per syscall (sendmmsg() and
+    // recvmmsg()), for peers that also use it. Best effort topics only;
+    // reliable ones stay with RTPS. Sends wait up to batchLatency for more
+    // datagrams to go with them, or for batchSize to be reached. With
+    // segmentSize, large samples go as runs of datagrams of that size,
+    // which the kernel segments (UDP GSO) and coalesces (UDP GRO) where it
+    // can: suits bulk topics. Loaned samples (see Publisher::loan()) bigger
+    // than zeroCopyThreshold are sent from the loan itself (MSG_ZEROCOPY),
+    // which isn't recycled until the kernel is done with it. With
+    // busyPoll, the receiving thread spins on its socket rather than
+    // sleeping until it's readable, for the lowest latency at the cost of
+    // a core (best pinned to one, see busyPollCpu).
+    TRANSPORT_UDP_BATCHED,
+};
+
+/*
+ * How a transport's own sockets receive, see TransportDescriptor::ioEngine.
+ */
+enum IoEngine {
+    // a recvmmsg() per batch of datagrams
+    IO_ENGINE_DEFAULT,
+
+    // io_uring: a multishot receive into buffers provided once, with
+    // datagrams reaped from memory shared with the kernel. Linux 6.0 or
+    // later; elsewhere, or if io_uring is disabled, IO_ENGINE_DEFAULT.
+    IO_ENGINE_IO_URING,
+};
+
+struct COMMKIT_API TransportDescriptor {
+    TransportKind kind;
+
+    // a subscriber reached by several transports keeps only the samples
+    // arriving by the highest priority one; UDP is always the lowest
+    int priority;
+
+    unsigned ringSlots; // TRANSPORT_SHARED_MEMORY
+
+    unsigned batchSize;                     // TRANSPORT_UDP_BATCHED
+    std::chrono::microseconds batchLatency; // TRANSPORT_UDP_BATCHED; zero to send at once
+    IoEngine ioEngine;                      // TRANSPORT_UDP_BATCHED
+    unsigned segmentSize; // TRANSPORT_UDP_BATCHED; datagram size, headers included, e.g. 1472
+    size_t zeroCopyThreshold; // TRANSPORT_UDP_BATCHED; bytes, zero for never
+    bool busyPoll;            // TRANSPORT_UDP_BATCHED
+    int busyPollCpu;          // TRANSPORT_UDP_BATCHED; -1 for any
+
+    TransportDescriptor(TransportKind k = TRANSPORT_UDP, int prio = 0)
+        : kind(k), priority(prio), ringSlots(64), batchSize(32), batchLatency(0),
+          ioEngine(IO_ENGINE_DEFAULT), segmentSize(0), zeroCopyThreshold(0), busyPoll(false),
+          busyPollCpu(-1)
+    {
+    }
+};
+
+/*
+ * What a thread a Node runs is for, see NodeOpts::threads.
+ */
+enum ThreadRole {
+    // Fast-RTPS' own: its event thread, and those receiving and listening
+    // on its sockets. Fast-RTPS starts these itself, so they're adopted:
+    // the thread creating the participant, or one of its endpoints, is
+    // named "ck-rtps" meanwhile, and the threads it starts, which inherit
+    // that name, are taken to be these.
+    THREAD_RTPS,
+
+    THREAD_SENDER,   // sends for async publishers
+    THREAD_RECEIVER, // a transport's receiving (shared memory, batched UDP)
+    THREAD_FLUSHER,  // batched UDP's sends once batchLatency has passed
+    THREAD_BUFFERS,  // by-reference publishers' buffer handouts
+    THREAD_DISPATCH, // handlers for samples from publishers in this process
+
+    THREAD_ROLES, // how many there are
+};
+
+/*
+ * Scheduling for the threads of a role. Linux only; ignored elsewhere.
+ */
+struct COMMKIT_API ThreadOpts {
+    // sched_setscheduler() policy and priority, e.g. SCHED_FIFO and 50;
+    // a policy of -1 leaves threads as they're started
+    int policy;
+    int priority;
+
+    // CPUs they may run on, bit n for CPU n; zero for any
+    uint64_t cpus;
+
+    ThreadOpts() : policy(-1), priority(0), cpus(0)
+    {
+    }
+};
+
+/*
+ * A thread a Node runs, see Node::threads().
+ */
+struct COMMKIT_API ThreadInfo {
+    ThreadRole role;
+    int tid;          // as in /proc/self/task
+    std::string name; // as in /proc/self/task/<tid>/comm
+    bool applied;     // whether its ThreadOpts took
+};
+
 /*
  * Options to configure a Node.
  */
@@ -23,9 +139,53 @@ struct COMMKIT_API NodeOpts {
     std::vector<std::string> unicastLocators;   // where to send runtime data
     std::vector<std::string> multicastLocators; // where to send discovery data
 
+    /*
+     * UDP socket buffer sizes, bytes. The defaults suit small samples;
+     * raise them for large or fragmented samples (see Topic::framed),
+     * particularly on best effort topics, where a burst of datagrams that
+     * overflows the receive buffer is simply lost.
+     */
+    uint32_t sendSocketBufferSize;
+    uint32_t listenSocketBufferSize;
+
+    /*
+     * Deliver samples between publishers and subscribers of this node
+     * (every Node in the process on the same domain) directly, copying
+     * each into the subscriber's history rather than going through RTPS
+     * and the network stack. Subscribers elsewhere are unaffected.
+     *
+     * publish() queues the sample and returns; the subscriber's onMessage
+     * handlers run on a dispatch thread of the node's (or its Executor's,
+     * if attached), as they would on Fast-RTPS' listener thread. Every
+     * Node on a domain shares this setting: init() fails if it disagrees
+     * with a Node already on the domain.
+     */
+    bool intraProcess;
+
+    /*
+     * How samples reach Nodes in other processes: each publisher writes to
+     * every transport with subscribers listening, and over UDP to any
+     * subscriber no other transport reaches. At most one of each kind;
+     * TRANSPORT_UDP is added if missing. Every Node on a domain shares
+     * these: init() fails if they disagree, by kind, priority or the
+     * kind's settings, with a Node already on the domain.
+     */
+    std::vector<TransportDescriptor> transports;
+
+    /*
+     * Scheduling for the threads of each role, applied as each starts.
+     * Real-time policies need CAP_SYS_NICE (or RLIMIT_RTPRIO); a thread
+     * refused them runs as it was started (see ThreadInfo::applied). The
+     * threads are the domain's, so every Node on it shares these: init()
+     * fails if they disagree with a Node already on the domain.
+     */
+    ThreadOpts threads[THREAD_ROLES];
+
     static constexpr uint32_t DefaultDomain = 80;
 
-    NodeOpts() : domainID(DefaultDomain)
+    NodeOpts()
+        : domainID(DefaultDomain), sendSocketBufferSize(8712), listenSocketBufferSize(17424),
+          intraProcess(true), transports(1, TransportDescriptor(TRANSPORT_UDP))
     {
     }
 };
@@ -47,12 +207,17 @@ public:
     SubscriberPtr createSubscriber(const Topic &t);
     PublisherPtr createPublisher(const Topic &t);
 
+    // the threads running for this Node now (for every Node on its domain)
+    std::vector<ThreadInfo> threads() const;
+
 private:
     Node(std::shared_ptr<NodeImpl> ni) : impl(ni)
     {
     }
 
-    static std::shared_ptr<NodeImpl> getImpl(const NodeOpts &opts);
+    // 'matchOpts': fail, rather than share the domain's NodeImpl, if it
+    // was set up differently
+    static std::shared_ptr<NodeImpl> getImpl(const NodeOpts &opts, bool matchOpts = true);
 
     std::shared_ptr<NodeImpl> impl;
 };
@@ -3,6 +3,7 @@
 #include <string>
 
 #include <commkit/callback.h>
+#include <commkit/chrono.h>
 #include <commkit/topic.h>
 #include <commkit/types.h>
 #include <commkit/visibility.h>
@@ -18,12 +19,89 @@ class NodeImpl;
 class Publisher;
 class PublisherImpl;
 
+/*
+ * What an async Publisher does with a sample when its queue is full.
+ */
+enum OverflowPolicy {
+    OVERFLOW_DROP_OLDEST, // evict the oldest queued sample to make room
+    OVERFLOW_DROP_NEWEST, // drop the new sample, publish() still returns true
+    OVERFLOW_FAIL         // drop the new sample, publish() returns false
+};
+
 struct COMMKIT_API PublicationOpts {
     bool reliable;            //
     unsigned maxBlockingTime; // only relevant if reliable is true
     unsigned history; // number of samples to retain, to help late joining nodes to 'catch up'
+    unsigned loanSlots; // number of buffers that may be loan()ed at once
+
+    /*
+     * In async mode, publish() and friends only queue the sample;
+     * a sender thread owned by the Node does the RTPS write, so the
+     * caller never blocks on the network.
+     */
+    bool async;
+    unsigned asyncQueueDepth;
+    OverflowPolicy overflowPolicy;
+
+    /*
+     * By-reference topics (Topic::byReference): buffers in the shared pool.
+     * The last 'history' samples published are kept for subscribers, and
+     * the rest are free to loan() once subscribers have released them, so
+     * this must be more than history.
+     */
+    unsigned sharedBuffers;
+
+    PublicationOpts()
+        : reliable(true), maxBlockingTime(500), history(1), loanSlots(1), async(false),
+          asyncQueueDepth(64), overflowPolicy(OVERFLOW_DROP_OLDEST), sharedBuffers(4)
+    {
+    }
+};
+
+/*
+ * One sample passed to Publisher::publishBatch().
+ */
+struct COMMKIT_API BatchSample {
+    const uint8_t *bytes;
+    size_t len;
+    clock::time_point sourceTimestamp; // TIME_POINT_INVALID means 'now'
+
+    BatchSample() : bytes(nullptr), len(0), sourceTimestamp(TIME_POINT_INVALID)
+    {
+    }
+
+    BatchSample(const uint8_t *b, size_t l, clock::time_point ts = TIME_POINT_INVALID)
+        : bytes(b), len(l), sourceTimestamp(ts)
+    {
+    }
+};
+
+/*
+ * Sizes of the samples published so far, see Publisher::payloadSizeStats().
+ * Percentiles are approximate: they may read up to 25% high.
+ */
+struct COMMKIT_API PayloadSizeStats {
+    uint64_t count;
+    size_t max;
+    size_t p50;
+    size_t p90;
+    size_t p99;
+
+    PayloadSizeStats() : count(0), max(0), p50(0), p90(0), p99(0)
+    {
+    }
+};
+
+/*
+ * How samples over a transport's zeroCopyThreshold went, a count per send
+ * (a datagram, or a run of them), see Publisher::zeroCopyStats().
+ */
+struct COMMKIT_API ZeroCopyStats {
+    uint64_t sent;      // straight from the loan
+    uint64_t copied;    // from the loan, but the kernel copied after all (as over loopback)
+    uint64_t fallbacks; // copied first, not being loaned or the kernel unable
 
-    PublicationOpts() : reliable(true), maxBlockingTime(500), history(1)
+    ZeroCopyStats() : sent(0), copied(0), fallbacks(0)
     {
     }
 };
@@ -39,16 +117,63 @@ public:
     std::string datatype();
     std::string name() const;
 
+    /*
+     * Zero-copy publishing: loan() a buffer from the publisher's pool,
+     * serialize into it, then either commit() it to send, or discard() it.
+     * Several loans may be outstanding at once (see PublicationOpts::loanSlots)
+     * and may be committed in any order, from any thread.
+     * loan() returns false if len exceeds the topic size or the pool is exhausted,
+     * or if on a framed topic the sample would need fragmenting; use publish().
+     * On by-reference topics, buffers come from the shared pool, so a sample
+     * is never copied at all.
+     */
+    bool loan(uint8_t **b, size_t len);
+    bool commit(const uint8_t *b, size_t len);
+    void discard(const uint8_t *b);
+    unsigned loansOutstanding() const;
+
+    // equivalent to loan() / commit()
     bool reserve(uint8_t **b, size_t len);
     bool publishReserved(const uint8_t *b, size_t len);
 
 #ifndef COMMKIT_NO_CAPNP
     bool publish(capnp::MessageBuilder &mb);
+
+    /*
+     * A message builder owned by this publisher, for publish(MessageBuilder &).
+     * Each call starts a new, empty message. The builder's memory is allocated
+     * once and reused, and a message that fits its first segment (sized to the
+     * topic's maxPayloadSize, or 8 KB on dynamic topics) is sent without being
+     * flattened, so steady state publishing does no heap allocation.
+     * Not for use from several threads at once.
+     */
+    capnp::MessageBuilder &capnBuilder();
 #endif
 
     bool publish(const uint8_t *b, size_t len);
+
+    /*
+     * Publish several samples at once. On framed topics (Topic::framed) they're
+     * packed into as few RTPS samples as the topic size allows, each keeping
+     * its own sequence number and source timestamp; otherwise this is the same
+     * as calling publish() for each. On framed topics, samples too big for one
+     * datagram are fragmented, and reassembled by the Subscriber.
+     * Returns the number of samples sent, which may be short on error.
+     */
+    size_t publishBatch(const BatchSample *samples, size_t n);
+
     unsigned matchedSubscribers() const;
 
+    // async mode only: samples waiting to be sent, and samples dropped on overflow
+    unsigned queueDepth() const;
+    uint64_t queueDrops() const;
+
+    // sizes of everything passed to publish() and friends, for right-sizing topics
+    PayloadSizeStats payloadSizeStats() const;
+
+    // zero-copy sends, and the times they couldn't be; see ZeroCopyStats
+    ZeroCopyStats zeroCopyStats() const;
+
     Callback<void(const PublisherPtr)> onSubscriberConnected;
     Callback<void(const PublisherPtr)> onSubscriberDisconnected;
 
@@ -5,6 +5,7 @@
 
 #include <commkit/callback.h>
 #include <commkit/chrono.h>
+#include <commkit/delegate.h>
 #include <commkit/topic.h>
 #include <commkit/types.h>
 #include <commkit/visibility.h>
@@ -16,7 +17,10 @@
 namespace commkit
 {
 
+class ExecutorImpl;
+class LoanPool;
 class NodeImpl;
+class SharedBufferMap;
 class Subscriber;
 class SubscriberImpl;
 
@@ -27,8 +31,30 @@ struct COMMKIT_API SubscriptionOpts {
     bool reliable;
     int timeBasedFilterHere; // todo
     unsigned history;
+    unsigned loanSlots; // number of samples that may be held via takeLoan() at once
 
-    SubscriptionOpts() : reliable(false), timeBasedFilterHere(0), history(1)
+    /*
+     * Framed topics: fragmented samples being reassembled at once. Buffers are
+     * allocated up front, sized to Topic::maxPayloadSize or, on dynamically
+     * sized topics, maxReassemblySize. A sample not completed within
+     * reassemblyTimeout (or pushed out by newer ones) is discarded.
+     * Timeouts are checked as samples are read, by peek(), take() and
+     * the like, so an overdue sample holds its buffer until the next.
+     */
+    unsigned reassemblyBuffers;
+    size_t maxReassemblySize;
+    clock::duration reassemblyTimeout;
+
+    /*
+     * Fill in Payload's receive timestamps, and keep latencyStats(). Off,
+     * nothing is read from the clock for them.
+     */
+    bool timestamps;
+
+    SubscriptionOpts()
+        : reliable(false), timeBasedFilterHere(0), history(1), loanSlots(1), reassemblyBuffers(2),
+          maxReassemblySize(1024 * 1024), reassemblyTimeout(std::chrono::seconds(1)),
+          timestamps(false)
     {
     }
 };
@@ -37,7 +63,8 @@ struct COMMKIT_API SubscriptionOpts {
  * Type to return received data.
  * Subscriber::peek() and Subscriber::take() populate this with
  * a pointer to internally received data, in order to avoid an
- * additional copy step.
+ * additional copy step. On by-reference topics (Topic::byReference)
+ * that's the publisher's buffer, which is read only.
  */
 struct COMMKIT_API Payload {
     uint8_t *bytes;
@@ -49,9 +76,22 @@ struct COMMKIT_API Payload {
      */
     clock::time_point sourceTimestamp;
 
+    /*
+     * With SubscriptionOpts::timestamps, on our clock, else (or where
+     * there's no telling) TIME_POINT_INVALID:
+     *
+     *   kernelTimestamp:   the datagram reached the kernel (batched UDP only)
+     *   receiveTimestamp:  commkit queued the sample for us (not over RTPS)
+     *   dispatchTimestamp: peek() / take() and friends handed it over
+     */
+    clock::time_point kernelTimestamp;
+    clock::time_point receiveTimestamp;
+    clock::time_point dispatchTimestamp;
+
     Payload()
         : bytes(nullptr), len(0), sequence(SEQUENCE_NUMBER_INVALID),
-          sourceTimestamp(TIME_POINT_INVALID)
+          sourceTimestamp(TIME_POINT_INVALID), kernelTimestamp(TIME_POINT_INVALID),
+          receiveTimestamp(TIME_POINT_INVALID), dispatchTimestamp(TIME_POINT_INVALID)
     {
     }
 
@@ -60,6 +100,87 @@ struct COMMKIT_API Payload {
 #endif // COMMKIT_NO_CAPNP
 };
 
+/*
+ * Where received samples' time went, see Subscriber::latencyStats(), from
+ * Payload's timestamps. Each stage counts the samples it could be told for:
+ *
+ *   network:  sourceTimestamp to kernelTimestamp
+ *   stack:    kernelTimestamp to receiveTimestamp
+ *   dispatch: receiveTimestamp to dispatchTimestamp
+ *   total:    sourceTimestamp to dispatchTimestamp
+ *
+ * sourceTimestamp is the publisher's clock, and the rest ours. Network and
+ * total are recorded for every publisher, so for those on other hosts
+ * they're only as good as the hosts' clock synchronisation (PTP, say):
+ * an offset between the clocks is added to every sample, and samples that
+ * seem to arrive before they were sent aren't counted. Percentiles may
+ * read up to 25% high.
+ */
+struct COMMKIT_API LatencyStats {
+    struct Stage {
+        uint64_t count;
+        clock::duration p50;
+        clock::duration p90;
+        clock::duration p99;
+        clock::duration max;
+
+        Stage() : count(0), p50(0), p90(0), p99(0), max(0)
+        {
+        }
+    };
+
+    Stage network;
+    Stage stack;
+    Stage dispatch;
+    Stage total;
+};
+
+/*
+ * A received sample on loan from a Subscriber, see Subscriber::takeLoan().
+ *
+ * The sample is written once, directly into a buffer from the Subscriber's
+ * loan pool, and stays valid until the loan is released (or destroyed),
+ * regardless of any later peek() / take() calls. Several loans can be held
+ * at once, up to SubscriptionOpts::loanSlots.
+ */
+class COMMKIT_API PayloadLoan
+{
+public:
+    PayloadLoan();
+    ~PayloadLoan();
+
+    PayloadLoan(PayloadLoan &&other);
+    PayloadLoan &operator=(PayloadLoan &&other);
+
+    PayloadLoan(const PayloadLoan &) = delete;
+    PayloadLoan &operator=(const PayloadLoan &) = delete;
+
+    bool valid() const
+    {
+        return pool != nullptr || shared != nullptr;
+    }
+
+    void release();
+
+    const Payload &operator*() const
+    {
+        return payload;
+    }
+
+    const Payload *operator->() const
+    {
+        return &payload;
+    }
+
+private:
+    Payload payload;
+    std::shared_ptr<LoanPool> pool;
+    std::shared_ptr<SharedBufferMap> shared; // by-reference topics, in place of pool
+    int slot;
+
+    friend class SubscriberImpl;
+};
+
 /*
  * Subscriber subscribes to a topic described by a name and datatype.
  * It reports new
@@ -71,11 +192,53 @@ public:
 
     bool init(const SubscriptionOpts &opts);
 
+    /*
+     * Samples from publishers in this process (see NodeOpts::intraProcess)
+     * are read first. Unlike others, peek() leaves such a sample in place,
+     * so peeking again returns it until it's taken.
+     */
     bool peek(Payload *p);
     bool take(Payload *p);
+    bool takeLoan(PayloadLoan *l);
+
+    /*
+     * Drain (or peek at) up to n samples in one call, filling loans[0..n).
+     * Returns the number filled. At most SubscriptionOpts::loanSlots
+     * samples can be on loan at once.
+     */
+    size_t takeBatch(PayloadLoan *loans, size_t n);
+    size_t peekBatch(PayloadLoan *loans, size_t n);
+
     void waitForMessage();
+
+    /*
+     * As waitForMessage(), but spinning rather than sleeping, so there's no
+     * wakeup to wait for: trades this thread's core for latency. Returns
+     * false should 'timeout' pass first. Best paired with a transport that
+     * spins too (see TransportDescriptor::busyPoll).
+     */
+    bool spinForMessage(clock::duration timeout);
+
+    /*
+     * A descriptor to wait on with epoll() / poll() alongside others, so
+     * one thread can wait on many subscribers: readable while there are
+     * unread samples, until a peek() / take() (or takeLoan() and friends)
+     * finds none left, so drain it before waiting again. As with
+     * waitForMessage(), samples from publishers in this process may make
+     * it readable early. It's ours, not to be read or closed. Made on the
+     * first call; -1 before init(), or off Linux.
+     */
+    int eventFd();
+
     unsigned matchedPublishers() const;
 
+    // framed topics: fragmented samples (not fragments) discarded before
+    // they could be reassembled
+    uint64_t reassemblyDrops() const;
+
+    // empty unless SubscriptionOpts::timestamps
+    LatencyStats latencyStats() const;
+
     // XXX: make this const once TopicDataType.getName() is const
     std::string datatype();
     std::string name() const;
@@ -84,12 +247,21 @@ public:
     Callback<void(const SubscriberPtr)> onPublisherDisconnected;
     Callback<void(SubscriberPtr)> onMessage;
 
+    /*
+     * As onMessage, called first, but allocation-free (see Signal), with up
+     * to four handlers, and given the Subscriber rather than a copy of its
+     * SubscriberPtr.
+     */
+    Signal<void(Subscriber &)> onMessageRef;
+
 private:
     Subscriber(const Topic &t, std::shared_ptr<NodeImpl> n);
 
     std::unique_ptr<SubscriberImpl> impl;
 
     friend class Node; // for private ctor
+    friend class ExecutorImpl;
+    friend class SubscriberImpl;
 };
 
 } // namespace commkit
@@ -10,23 +10,63 @@
 namespace commkit
 {
 
+// Topic::maxPayloadSize for topics whose samples vary widely in size.
+constexpr size_t PAYLOAD_SIZE_DYNAMIC = 0;
+
+// largest sample on a dynamically sized topic: what fits in one UDP datagram
+// once RTPS headers are added (less frame overhead on framed topics).
+constexpr size_t PAYLOAD_SIZE_LIMIT = 64000;
+
 struct Topic {
     std::string name;
     std::string datatype;
-    size_t maxPayloadSize; // ugh, this is currently required by fast-rtps. need a workaround.
 
-    Topic(const std::string &n, const std::string &dt, size_t maxSz)
-        : name(n), datatype(dt), maxPayloadSize(maxSz)
+    /*
+     * Largest sample that will be published, or PAYLOAD_SIZE_DYNAMIC.
+     *
+     * Fixed size topics preallocate every buffer (and RTPS history entry)
+     * at maxPayloadSize. Dynamically sized topics take buffers sized to
+     * each sample from size-class pools instead, at the cost of a little
+     * slack per buffer. They aren't free, though: each publisher and
+     * subscriber sets aside pools up to PAYLOAD_SIZE_LIMIT, and Fast-RTPS
+     * before 1.6 sizes all history at the limit, so only ask for one
+     * where samples really do vary widely. Publisher::payloadSizeStats()
+     * can help pick a fixed size instead.
+     */
+    size_t maxPayloadSize;
+
+    // samples carry a commkit frame header, which allows several to be sent
+    // together via Publisher::publishBatch(), and samples too big for one
+    // datagram to be fragmented. publishers and subscribers must agree.
+    bool framed;
+
+    /*
+     * Samples stay in a pool of buffers shared by the publisher, and only a
+     * small descriptor of each is sent; subscribers map the pool and read
+     * samples in place. For large samples between processes on one host,
+     * such as camera frames: subscribers elsewhere can't read them.
+     * Needs a fixed maxPayloadSize, and can't be framed. See
+     * PublicationOpts::sharedBuffers. Publishers and subscribers must agree.
+     */
+    bool byReference;
+
+    Topic(const std::string &n, const std::string &dt, size_t maxSz, bool f = false)
+        : name(n), datatype(dt), maxPayloadSize(maxSz), framed(f), byReference(false)
+    {
+    }
+
+    bool dynamic() const
     {
+        return maxPayloadSize == PAYLOAD_SIZE_DYNAMIC;
     }
 
 #ifndef COMMKIT_NO_CAPNP
     static std::string COMMKIT_API capn_type_id(capnp::Schema schema);
 
     template <typename T>
-    static Topic capn(const std::string &n)
+    static Topic capn(const std::string &n, size_t maxSz = 1024)
     {
-        return Topic(n, capn_type_id(capnp::Schema::from<T>()), 1024);
+        return Topic(n, capn_type_id(capnp::Schema::from<T>()), maxSz);
     }
 #endif
 };
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <commkit/chrono.h>
+#include <commkit/types.h>
+#include <commkit/visibility.h>
+
+namespace commkit
+{
+
+class WaitSetImpl;
+
+/*
+ * A condition of the application's own to wake a WaitSet with, say to shut
+ * down a thread waiting on it. Once triggered, it stays so (and wakes any
+ * WaitSet it's attached to) until reset().
+ */
+class COMMKIT_API GuardCondition
+{
+public:
+    GuardCondition();
+    ~GuardCondition();
+
+    GuardCondition(const GuardCondition &) = delete;
+    GuardCondition &operator=(const GuardCondition &) = delete;
+
+    // from any thread
+    void trigger();
+    void reset();
+
+    bool triggered() const
+    {
+        return flag.load();
+    }
+
+private:
+    int fd; // readable while triggered, -1 if it couldn't be made
+    std::mutex mtx; // so fd and flag agree
+    std::atomic<bool> flag;
+
+    friend class WaitSetImpl;
+};
+
+/*
+ * Options to configure a WaitSet.
+ */
+struct COMMKIT_API WaitSetOpts {
+    unsigned maxEntries; // subscribers and guard conditions attached at once
+
+    WaitSetOpts() : maxEntries(64)
+    {
+    }
+};
+
+/*
+ * Waits on several subscribers, and guard conditions, at once from one
+ * thread, with a timeout, for whichever have something to read. Usage:
+ *
+ *    commkit::WaitSet ws;
+ *    ws.init();
+ *    ws.attach(gps);
+ *    ws.attach(imu);
+ *    ws.attach(&quit);
+ *    while (ws.wait(std::chrono::milliseconds(500)) && !quit.triggered()) {
+ *        for (auto &s : ws.readySubscribers()) {
+ *            while (s->take(&p)) { ... }
+ *        }
+ *    }
+ *    // timed out: gps and imu have both gone quiet
+ *
+ * A subscriber is ready while it has unread samples (see
+ * Subscriber::eventFd()), so should be drained before waiting again, and
+ * a guard condition while triggered. wait() allocates nothing, its
+ * results going into room set aside by init().
+ *
+ * Attached subscribers are kept alive by the WaitSet until detached;
+ * guard conditions must be detached before they're destroyed. Linux only:
+ * elsewhere init() fails.
+ */
+class COMMKIT_API WaitSet
+{
+public:
+    WaitSet();
+    ~WaitSet();
+
+    WaitSet(const WaitSet &) = delete;
+    WaitSet &operator=(const WaitSet &) = delete;
+
+    bool init(const WaitSetOpts &opts = WaitSetOpts());
+
+    // from any thread, though not while wait() is reading its results
+    bool attach(SubscriberPtr s);
+    void detach(const SubscriberPtr &s);
+    bool attach(GuardCondition *g);
+    void detach(GuardCondition *g);
+
+    /*
+     * Wait up to 'timeout', rounded up to the millisecond, for anything
+     * attached to be ready, returning how many are, or 0 on timeout. Which
+     * ones are left in readySubscribers() and readyGuards() until the next
+     * call. As with waitForMessage(), a subscriber that's had samples from
+     * a publisher in this process may turn out to have none left to take.
+     */
+    size_t wait(clock::duration timeout);
+
+    const std::vector<SubscriberPtr> &readySubscribers() const;
+    const std::vector<GuardCondition *> &readyGuards() const;
+
+private:
+    std::unique_ptr<WaitSetImpl> impl;
+};
+
+} // namespace commkit
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace commkit
+{
+
+/*
+ * Fixed-capacity lock-free queue, after Dmitry Vyukov's bounded MPMC queue:
+ * http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * Any number of threads may push() and pop() concurrently. Nothing is
+ * allocated after construction. Capacity is rounded up to a power of two.
+ *
+ * Although our main use has a single consumer, allowing producers to pop()
+ * as well lets them evict the oldest entry when the queue is full.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t cap) : head(0), tail(0)
+    {
+        size_t n = 2;
+        while (n < cap) {
+            n <<= 1;
+        }
+        mask = n - 1;
+
+        cells.reset(new Cell[n]);
+        for (size_t i = 0; i < n; ++i) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    bool push(const T &v)
+    {
+        Cell *c;
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        c->data = v;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T *v)
+    {
+        Cell *c;
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        *v = std::move(c->data); // so nothing it holds lingers in the cell
+        c->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // approximate when other threads are active
+    size_t size() const
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static constexpr size_t CacheLineSize = 64;
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // keep producers and consumers off each other's cache lines
+    char pad0[CacheLineSize];
+    std::atomic<size_t> head;
+    char pad1[CacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[CacheLineSize - sizeof(std::atomic<size_t>)];
+};
+
+} // namespace commkit
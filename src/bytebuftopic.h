@@ -1,7 +1,22 @@
 #pragma once
 
+#include <fastrtps/config.h>
 #include <fastrtps/TopicDataType.h>
 
+#include <functional>
+
+#include "loanpool.h"
+
+/*
+ * Fast-RTPS 1.6 can size each RTPS history entry to its sample, rather than
+ * preallocating them all at the type size; we use that for dynamically
+ * sized topics. Older versions preallocate at PAYLOAD_SIZE_LIMIT.
+ */
+#if defined(FASTRTPS_VERSION_MAJOR) &&                                                            \
+    (FASTRTPS_VERSION_MAJOR > 1 || (FASTRTPS_VERSION_MAJOR == 1 && FASTRTPS_VERSION_MINOR >= 6))
+#define COMMKIT_RTPS_DYNAMIC_HISTORY
+#endif
+
 /*
  * This is a bit terrible. Some explanation.
  *
@@ -18,11 +33,76 @@
  * publish(), if it is not required by serialize().
  */
 
+/*
+ * One piece of a gather list, see ByteBufTopicData(const ByteBufFragment *, size_t).
+ */
+struct ByteBufFragment {
+    const uint8_t *bytes;
+    size_t len;
+};
+
 struct ByteBufTopicData {
-    ByteBufTopicData() : buf(nullptr), len(0), cap(0)
+    ByteBufTopicData()
+        : buf(nullptr), len(0), cap(0), owned(true), frags(nullptr), nfrags(0), pool(nullptr),
+          slot(commkit::LoanPool::InvalidSlot)
+    {
+    }
+
+    /*
+     * Wrap memory owned by someone else (a caller's buffer, or a LoanPool slot).
+     * The buffer is never reallocated or freed; write() fails if it's too small.
+     */
+    ByteBufTopicData(uint8_t *b, size_t sz)
+        : buf(b), len(sz), cap(sz), owned(false), frags(nullptr), nfrags(0), pool(nullptr),
+          slot(commkit::LoanPool::InvalidSlot)
+    {
+    }
+
+    /*
+     * Outgoing only: the data is the concatenation of 'n' fragments, which
+     * read() gathers straight into the serialized payload. The fragments
+     * must stay valid until the write completes.
+     */
+    ByteBufTopicData(const ByteBufFragment *f, size_t n)
+        : buf(nullptr), len(0), cap(0), owned(false), frags(f), nfrags(n), pool(nullptr),
+          slot(commkit::LoanPool::InvalidSlot)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            len += f[i].len;
+        }
+    }
+
+    /*
+     * Incoming only: write() takes the smallest slot from 'p' that fits the
+     * sample, so buffers are sized per sample rather than to the topic's
+     * largest. The slot is released on destruction unless taken by takeSlot().
+     */
+    explicit ByteBufTopicData(commkit::LoanPool *p)
+        : buf(nullptr), len(0), cap(0), owned(false), frags(nullptr), nfrags(0), pool(p),
+          slot(commkit::LoanPool::InvalidSlot)
+    {
+    }
+
+    ~ByteBufTopicData()
+    {
+        if (owned) {
+            free(buf);
+        }
+        if (pool && slot != commkit::LoanPool::InvalidSlot) {
+            pool->release(slot);
+        }
+    }
+
+    int takeSlot()
     {
+        int s = slot;
+        slot = commkit::LoanPool::InvalidSlot;
+        return s;
     }
 
+    ByteBufTopicData(const ByteBufTopicData &) = delete;
+    ByteBufTopicData &operator=(const ByteBufTopicData &) = delete;
+
     bool write(const uint8_t *b, size_t sz)
     {
         if (ensureCap(sz)) {
@@ -35,6 +115,10 @@ struct ByteBufTopicData {
 
     size_t read(uint8_t *b, size_t maxlen)
     {
+        if (frags) {
+            return gather(b, maxlen);
+        }
+
         size_t n = std::min(len, maxlen);
         memcpy(b, buf, n);
         return n;
@@ -42,7 +126,14 @@ struct ByteBufTopicData {
 
     bool ensureCap(size_t sz)
     {
-        if (cap < sz) {
+        // from a pool, even an empty sample gets a slot, so it can be loaned out
+        if (cap < sz || (pool && slot == commkit::LoanPool::InvalidSlot)) {
+            if (pool) {
+                return acquireSlot(sz);
+            }
+            if (!owned) {
+                return false;
+            }
             if (buf) {
                 free(buf);
             }
@@ -56,9 +147,43 @@ struct ByteBufTopicData {
         return true;
     }
 
+    bool acquireSlot(size_t sz)
+    {
+        if (slot != commkit::LoanPool::InvalidSlot) {
+            pool->release(slot);
+        }
+        slot = pool->acquire(sz);
+        if (slot == commkit::LoanPool::InvalidSlot) {
+            buf = nullptr;
+            len = cap = 0;
+            return false;
+        }
+        buf = pool->buffer(slot);
+        cap = pool->slotSize(slot);
+        return true;
+    }
+
+    size_t gather(uint8_t *b, size_t maxlen)
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < nfrags && n < maxlen; ++i) {
+            size_t l = std::min(frags[i].len, maxlen - n);
+            memcpy(b + n, frags[i].bytes, l);
+            n += l;
+        }
+        return n;
+    }
+
     uint8_t *buf;
     size_t len;
     size_t cap;
+    bool owned;
+
+    const ByteBufFragment *frags;
+    size_t nfrags;
+
+    commkit::LoanPool *pool;
+    int slot;
 };
 
 class ByteBufTopicDataType : public eprosima::fastrtps::TopicDataType
@@ -87,9 +212,16 @@ public:
     bool deserialize(eprosima::fastrtps::rtps::SerializedPayload_t *payload, void *data)
     {
         auto bb = static_cast<ByteBufTopicData *>(data);
-        bb->write(payload->data, payload->length);
-        return true;
+        return bb->write(payload->data, payload->length);
+    }
+
+#ifdef COMMKIT_RTPS_DYNAMIC_HISTORY
+    std::function<uint32_t()> getSerializedSizeProvider(void *data)
+    {
+        auto bb = static_cast<ByteBufTopicData *>(data);
+        return [bb]() { return static_cast<uint32_t>(bb->len); };
     }
+#endif
 
     void *createData()
     {
@@ -0,0 +1,74 @@
+#ifndef COMMKIT_NO_CAPNP
+#include "capnbuilder.h"
+
+#include <new>
+
+namespace commkit
+{
+
+CapnBuilder::CapnBuilder() : nwords(0), live(false)
+{
+}
+
+CapnBuilder::~CapnBuilder()
+{
+    destroy();
+}
+
+capnp::MessageBuilder &CapnBuilder::reset(size_t maxBytes)
+{
+    /*
+     * capnp's builder zeroes the part of a first segment it was given that
+     * its message used as it's destroyed, which is all that needs zeroing;
+     * anything past that is still zero from last time.
+     */
+
+    size_t want = maxBytes / sizeof(capnp::word);
+    if (want < 2) {
+        want = 2;
+    }
+
+    destroy();
+
+    if (nwords < want) {
+        // first use (or the topic grew): value-initialized, so zeroed
+        words.reset(new capnp::word[want]());
+        nwords = want;
+    }
+
+    new (&storage) capnp::MallocMessageBuilder(kj::arrayPtr(words.get() + 1, nwords - 1));
+    live = true;
+    return *builder();
+}
+
+bool CapnBuilder::flat(const uint8_t **b, size_t *len)
+{
+    if (!live) {
+        return false;
+    }
+
+    auto segments = builder()->getSegmentsForOutput();
+    if (segments.size() != 1 || segments[0].begin() != words.get() + 1) {
+        return false;
+    }
+
+    // single segment table: (segment count - 1), segment size in words
+    uint32_t *table = reinterpret_cast<uint32_t *>(words.get());
+    table[0] = 0;
+    table[1] = segments[0].size();
+
+    *b = reinterpret_cast<const uint8_t *>(words.get());
+    *len = (1 + segments[0].size()) * sizeof(capnp::word);
+    return true;
+}
+
+void CapnBuilder::destroy()
+{
+    if (live) {
+        builder()->~MallocMessageBuilder();
+        live = false;
+    }
+}
+
+} // namespace commkit
+#endif // COMMKIT_NO_CAPNP
@@ -0,0 +1,93 @@
+#pragma once
+
+#ifndef COMMKIT_NO_CAPNP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include <capnp/message.h>
+
+namespace commkit
+{
+
+/*
+ * A capnp::MessageBuilder that's reused from one message to the next.
+ *
+ * The builder's first segment is a buffer we own, allocated once, with one
+ * word reserved in front of it for the stream framing segment table. A
+ * message that fits in the first segment can then be sent straight from that
+ * buffer, already in the layout capnp::messageToFlatArray() would produce,
+ * with no flattening copy. reset() constructs a fresh builder in place, the
+ * old one having zeroed the words its message used (capnp requires a
+ * zeroed first segment), so steady state publishing performs no heap
+ * allocation.
+ *
+ * The buffer is ours rather than a Publisher::loan() slot: loan slots are
+ * recycled dirty, and would need their whole first segment zeroed for
+ * every message, where this one only ever has the words a message used
+ * zeroed. Sending it is then the same as publish() from a caller's
+ * buffer: copied once by the RTPS layer (or, in async mode and on framed
+ * and by-reference topics, into a loan slot first).
+ *
+ * Messages that outgrow the first segment still work; capnp allocates the
+ * extra segments from the heap, and they go out via the multi-segment path.
+ */
+class CapnBuilder
+{
+public:
+    CapnBuilder();
+    ~CapnBuilder();
+
+    CapnBuilder(const CapnBuilder &) = delete;
+    CapnBuilder &operator=(const CapnBuilder &) = delete;
+
+    /*
+     * Start a new message, discarding any current one. 'maxBytes' is the
+     * largest serialized message (segment table included) that flat()
+     * should be able to return.
+     */
+    capnp::MessageBuilder &reset(size_t maxBytes);
+
+    capnp::MessageBuilder &message()
+    {
+        return *builder();
+    }
+
+    bool owns(const capnp::MessageBuilder &mb) const
+    {
+        return live && &mb == builder();
+    }
+
+    /*
+     * If the current message is a single segment held in our buffer,
+     * write the segment table in front of it and return the whole
+     * serialized message in place.
+     */
+    bool flat(const uint8_t **b, size_t *len);
+
+private:
+    capnp::MallocMessageBuilder *builder()
+    {
+        return reinterpret_cast<capnp::MallocMessageBuilder *>(&storage);
+    }
+
+    const capnp::MallocMessageBuilder *builder() const
+    {
+        return reinterpret_cast<const capnp::MallocMessageBuilder *>(&storage);
+    }
+
+    void destroy();
+
+    std::unique_ptr<capnp::word[]> words; // segment table word + first segment
+    size_t nwords;
+
+    typename std::aligned_storage<sizeof(capnp::MallocMessageBuilder),
+                                  alignof(capnp::MallocMessageBuilder)>::type storage;
+    bool live;
+};
+
+} // namespace commkit
+
+#endif // COMMKIT_NO_CAPNP
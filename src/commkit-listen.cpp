@@ -82,7 +82,7 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    commkit::Topic topic(topic_name, type_id, 1024);
+    commkit::Topic topic(topic_name, type_id, commkit::PAYLOAD_SIZE_DYNAMIC);
 
     auto sub = node.createSubscriber(topic);
     if (sub == nullptr) {
@@ -0,0 +1,60 @@
+#include <commkit/executor.h>
+#include "executorimpl.h"
+
+namespace commkit
+{
+
+Executor::Executor() : impl(new ExecutorImpl())
+{
+}
+
+Executor::~Executor()
+{
+}
+
+bool Executor::init(const ExecutorOpts &opts)
+{
+    return impl->init(opts);
+}
+
+bool Executor::add(SubscriberPtr s)
+{
+    return impl->add(std::move(s));
+}
+
+void Executor::remove(SubscriberPtr s)
+{
+    impl->remove(s);
+}
+
+bool Executor::post(const Task &t)
+{
+    return impl->post(t);
+}
+
+int Executor::addTimer(clock::duration period, const Task &t)
+{
+    return impl->addTimer(period, t);
+}
+
+void Executor::removeTimer(int id)
+{
+    impl->removeTimer(id);
+}
+
+bool Executor::spinOnce(clock::duration timeout)
+{
+    return impl->spinOnce(timeout);
+}
+
+void Executor::spin()
+{
+    impl->spin();
+}
+
+void Executor::stop()
+{
+    impl->stop();
+}
+
+} // namespace commkit
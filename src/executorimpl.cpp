@@ -0,0 +1,405 @@
+#include "executorimpl.h"
+#include "subscriberimpl.h"
+#include "chronoimpl.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif // __linux__
+
+namespace commkit
+{
+
+ExecutorImpl::ExecutorImpl()
+    : nextQueue(0), queueDepth(0), posted(0), maxSubscribers(0), nextTimerId(0),
+      nextDue(std::numeric_limits<int64_t>::max()), timersAdded(0), overflowing(false),
+      shutdown(false), sleepers(0), stopping(false)
+{
+}
+
+ExecutorImpl::~ExecutorImpl()
+{
+    /*
+     * Workers finish what they're running, and subscribers, which hold on
+     * to us while attached, are let go, waiting out any in the middle of
+     * queueing to us.
+     */
+
+    shutdown = true;
+    {
+        std::lock_guard<std::mutex> guard(waitMtx);
+        waitCv.notify_all();
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    std::vector<SubscriberPtr> attached;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        attached.swap(subs);
+    }
+    for (auto &s : attached) {
+        s->impl->detach(this);
+    }
+}
+
+bool ExecutorImpl::init(const ExecutorOpts &opts)
+{
+    if (!queues.empty() || opts.queueDepth == 0) {
+        return false;
+    }
+
+    queueDepth = opts.queueDepth;
+    maxSubscribers = opts.maxSubscribers;
+    size_t n = std::max(opts.threads, 1u);
+    for (size_t i = 0; i < n; ++i) {
+        queues.emplace_back(new BoundedQueue<Work>(queueDepth + maxSubscribers));
+    }
+    subs.reserve(maxSubscribers);
+    overflow.reserve(maxSubscribers);
+
+    for (unsigned i = 0; i < opts.threads; ++i) {
+        workers.emplace_back(&ExecutorImpl::worker, this, i);
+    }
+    return true;
+}
+
+bool ExecutorImpl::add(SubscriberPtr s)
+{
+    if (queues.empty() || !s) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mtx);
+    if (subs.size() >= maxSubscribers || !s->impl->attach(this)) {
+        return false;
+    }
+    subs.push_back(std::move(s));
+    return true;
+}
+
+void ExecutorImpl::remove(const SubscriberPtr &s)
+{
+    if (!s) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        auto it = std::find(subs.begin(), subs.end(), s);
+        if (it == subs.end()) {
+            return;
+        }
+        subs.erase(it);
+    }
+    // any left in the queues are skipped, see run()
+    s->impl->detach(this);
+}
+
+bool ExecutorImpl::post(const Executor::Task &t)
+{
+    if (queues.empty() || !t) {
+        return false;
+    }
+    if (posted.fetch_add(1) >= queueDepth) {
+        posted--;
+        return false;
+    }
+
+    Work w;
+    w.task = t;
+    push(w, nextQueue++);
+    wake();
+    return true;
+}
+
+void ExecutorImpl::ready(const SubscriberPtr &s, uint32_t generation)
+{
+    Work w;
+    w.sub = s;
+    w.generation = generation;
+    push(w, nextQueue++);
+    wake();
+}
+
+void ExecutorImpl::push(Work &w, size_t first)
+{
+    for (size_t i = 0; i < queues.size(); ++i) {
+        if (queues[(first + i) % queues.size()]->push(w)) {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(mtx);
+    overflow.push_back(w);
+    overflowing = true;
+}
+
+int ExecutorImpl::addTimer(clock::duration period, const Executor::Task &t)
+{
+    if (!t || period <= clock::duration::zero()) {
+        return -1;
+    }
+
+    Timer tm;
+    tm.period = period;
+    tm.next = clock::now() + period;
+    tm.task = t;
+    tm.running = false;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        tm.id = nextTimerId++;
+        timers.push_back(tm);
+        updateDue();
+        timersAdded++;
+    }
+    // a runner may be sleeping past our first deadline
+    wake();
+    return tm.id;
+}
+
+void ExecutorImpl::removeTimer(int id)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    timers.erase(std::remove_if(timers.begin(), timers.end(),
+                                [id](const Timer &tm) { return tm.id == id; }),
+                 timers.end());
+    updateDue();
+}
+
+void ExecutorImpl::updateDue()
+{
+    // with mtx held
+    int64_t due = std::numeric_limits<int64_t>::max();
+    for (auto &tm : timers) {
+        if (!tm.running) {
+            due = std::min(due, toInt64(tm.next));
+        }
+    }
+    nextDue = due;
+}
+
+bool ExecutorImpl::spinOnce(clock::duration timeout)
+{
+    /*
+     * With worker threads, the caller joins in alongside them.
+     */
+
+    if (queues.empty()) {
+        return false;
+    }
+    if (runReady(0)) {
+        return true;
+    }
+    wait(clock::now() + timeout, stopping);
+    return runReady(0);
+}
+
+void ExecutorImpl::spin()
+{
+    while (!stopping) {
+        spinOnce(std::chrono::seconds(1));
+    }
+    stopping = false;
+}
+
+void ExecutorImpl::stop()
+{
+    stopping = true;
+    std::lock_guard<std::mutex> guard(waitMtx);
+    waitCv.notify_all();
+}
+
+void ExecutorImpl::worker(size_t home)
+{
+#ifdef __linux__
+    char name[16];
+    snprintf(name, sizeof(name), "ck-exec-%u", unsigned(home));
+    pthread_setname_np(pthread_self(), name);
+#endif // __linux__
+
+    while (!shutdown) {
+        if (!runReady(home)) {
+            wait(clock::now() + std::chrono::seconds(1), shutdown);
+        }
+    }
+}
+
+bool ExecutorImpl::runReady(size_t home)
+{
+    /*
+     * Only what's queued as we start, so a subscriber that keeps being
+     * requeued doesn't hold up the timers. Out of our own, we steal one
+     * from another queue, so a busy runner's backlog is spread about.
+     */
+
+    bool ran = runTimers();
+    ran = runOverflow(home) || ran;
+
+    BoundedQueue<Work> &own = *queues[home];
+    size_t n = own.size();
+    Work w;
+    for (size_t i = 0; i < n && own.pop(&w); ++i) {
+        run(w, home);
+        ran = true;
+    }
+    for (size_t i = 1; !ran && i < queues.size(); ++i) {
+        if (queues[(home + i) % queues.size()]->pop(&w)) {
+            run(w, home);
+            ran = true;
+        }
+    }
+    w = Work(); // don't hold on to the last subscriber
+    return ran;
+}
+
+bool ExecutorImpl::runTimers()
+{
+    /*
+     * One timer at a time, mtx released while it runs, so it may add and
+     * remove timers itself. A timer running on one thread isn't due on
+     * another until it's done. Nothing's locked until one's due.
+     */
+
+    bool ran = false;
+    clock::time_point now = clock::now();
+    if (toInt64(now) < nextDue.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    for (;;) {
+        Executor::Task task;
+        int id;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            auto due = timers.end();
+            for (auto it = timers.begin(); it != timers.end(); ++it) {
+                if (!it->running && it->next <= now &&
+                    (due == timers.end() || it->next < due->next)) {
+                    due = it;
+                }
+            }
+            if (due == timers.end()) {
+                return ran;
+            }
+            due->next += due->period;
+            if (due->next <= now) {
+                due->next = now + due->period;
+            }
+            due->running = true;
+            task = due->task;
+            id = due->id;
+            updateDue();
+        }
+
+        task();
+        ran = true;
+
+        std::lock_guard<std::mutex> guard(mtx);
+        for (auto &tm : timers) {
+            if (tm.id == id) {
+                tm.running = false;
+            }
+        }
+        updateDue();
+    }
+}
+
+bool ExecutorImpl::runOverflow(size_t home)
+{
+    if (!overflowing.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    Work w;
+    bool ran = false;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            if (overflow.empty()) {
+                overflowing = false;
+                return ran;
+            }
+            w = overflow.front();
+            overflow.erase(overflow.begin());
+        }
+        run(w, home);
+        ran = true;
+    }
+}
+
+void ExecutorImpl::run(Work &w, size_t home)
+{
+    if (!w.sub) {
+        posted--;
+        w.task();
+        return;
+    }
+
+    // skip what was queued before the subscriber was removed (or added
+    // again since)
+    SubscriberImpl *impl = w.sub->impl.get();
+    uint64_t s = impl->scheduleState();
+    if (!impl->attachedTo(this) || SubscriberImpl::generationOf(s) != w.generation) {
+        return;
+    }
+
+    SubscriberImpl::callHandlers(w.sub);
+
+    // more arrived meanwhile: back of the line, so others get a turn
+    if (impl->unschedule(w.generation, SubscriberImpl::notifiedOf(s))) {
+        push(w, home);
+        wake();
+    }
+}
+
+void ExecutorImpl::wait(clock::time_point deadline, const std::atomic<bool> &done)
+{
+    /*
+     * Sleeps to the earliest timer's deadline at the latest. A timer added
+     * meanwhile may be due sooner, so that ends the wait too, for the
+     * caller to come back with the new deadline.
+     */
+
+    uint64_t added;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        for (auto &tm : timers) {
+            if (!tm.running) {
+                deadline = std::min(deadline, tm.next);
+            }
+        }
+        added = timersAdded;
+    }
+
+    // pairs with wake(): either we see what was queued, or it sees us
+    sleepers++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::unique_lock<std::mutex> lk(waitMtx);
+    waitCv.wait_until(lk, deadline, [this, &done, added] {
+        if (overflowing || done || timersAdded != added) {
+            return true;
+        }
+        for (auto &q : queues) {
+            if (q->size() > 0) {
+                return true;
+            }
+        }
+        return false;
+    });
+    sleepers--;
+}
+
+void ExecutorImpl::wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(waitMtx);
+        waitCv.notify_one();
+    }
+}
+
+} // namespace commkit
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <commkit/executor.h>
+#include <commkit/subscriber.h>
+#include "boundedqueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace commkit
+{
+
+class ExecutorImpl
+{
+public:
+    ExecutorImpl();
+    ~ExecutorImpl();
+
+    bool init(const ExecutorOpts &opts);
+
+    bool add(SubscriberPtr s);
+    void remove(const SubscriberPtr &s);
+    bool post(const Executor::Task &t);
+    int addTimer(clock::duration period, const Executor::Task &t);
+    void removeTimer(int id);
+
+    bool spinOnce(clock::duration timeout);
+    void spin();
+    void stop();
+
+    // from SubscriberImpl::notify(), on the thread a sample arrived on
+    void ready(const SubscriberPtr &s, uint32_t generation);
+
+private:
+    // a subscriber to run the handlers of, or else a task
+    struct Work {
+        SubscriberPtr sub;
+        uint32_t generation; // the sub's attach(), see SubscriberImpl::schedule
+        Executor::Task task;
+
+        Work() : generation(0)
+        {
+        }
+    };
+
+    struct Timer {
+        int id;
+        clock::duration period;
+        clock::time_point next;
+        Executor::Task task;
+        bool running; // on another thread, which reschedules it after
+    };
+
+    bool runReady(size_t home);
+    bool runTimers();
+    void updateDue();
+    bool runOverflow(size_t home);
+    void run(Work &w, size_t home);
+    void push(Work &w, size_t first);
+    // until there's something to run, or 'done'
+    void wait(clock::time_point deadline, const std::atomic<bool> &done);
+    void wake();
+    void worker(size_t home);
+
+    /*
+     * Subscribers and tasks, in the order they became ready: one queue per
+     * worker thread (or just the one, for spin()). Work is spread across
+     * them, and a runner that's out of its own steals from the others.
+     * Each has room for every subscriber at once, besides queueDepth
+     * tasks, as each subscriber is only queued once at a time.
+     */
+    std::vector<std::unique_ptr<BoundedQueue<Work>>> queues;
+    std::atomic<size_t> nextQueue; // round-robin, for ready() and post()
+    size_t queueDepth;
+    std::atomic<size_t> posted; // tasks queued, to queueDepth
+
+    std::mutex mtx; // guards all below, to overflowing
+    std::vector<SubscriberPtr> subs;
+    size_t maxSubscribers;
+    std::vector<Timer> timers;
+    int nextTimerId;
+    std::atomic<int64_t> nextDue; // nanoseconds: the earliest timer not running
+    std::atomic<uint64_t> timersAdded; // so wait() sees a deadline sooner than its own
+
+    // should a subscriber find every queue full anyway (stale entries of
+    // those removed can take up room), it's run from here instead
+    std::vector<Work> overflow;
+    std::atomic<bool> overflowing;
+
+    std::vector<std::thread> workers;
+    std::atomic<bool> shutdown;
+
+    // wait(): woken by ready(), post(), addTimer() and stop()
+    std::mutex waitMtx;
+    std::condition_variable waitCv;
+    std::atomic<unsigned> sleepers;
+    std::atomic<bool> stopping;
+};
+
+} // namespace commkit
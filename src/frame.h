@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <commkit/topic.h>
+#include "sharedbuffers.h"
+
+/*
+ * Wire format for framed topics (Topic::framed).
+ *
+ * Every RTPS sample on a framed topic starts with a FrameHeader. A batch frame
+ * carries 'count' samples, each preceded by a FrameEntry and padded so the
+ * next entry (and so every sample) stays 8-byte aligned:
+ *
+ *   FrameHeader | FrameEntry | data... pad | FrameEntry | data... pad | ...
+ *
+ * Each entry has its own sequence number and source timestamp, which the
+ * Subscriber reports in place of the RTPS ones. A plain publish() on a framed
+ * topic is sent as a batch of one.
+ *
+ * A sample too big for one RTPS sample is split across several fragment
+ * frames, each holding a FragmentEntry and one contiguous piece of the data:
+ *
+ *   FrameHeader | FragmentEntry | data...
+ *
+ * The Subscriber reassembles them by (writer, sequence) before reporting
+ * the sample. Each fragment is its own RTPS sample, so on reliable topics
+ * a lost fragment is retransmitted on its own.
+ *
+ * Fields are in host byte order; all commkit targets are little-endian.
+ */
+
+namespace commkit
+{
+
+enum FrameKind : uint8_t {
+    FRAME_BATCH = 1,
+    FRAME_FRAGMENT = 2,
+};
+
+struct FrameHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t kind;
+    uint32_t count;
+};
+
+struct FrameEntry {
+    int64_t sequence;
+    int64_t timestamp; // nanoseconds, publisher's clock
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct FragmentEntry {
+    int64_t sequence;
+    int64_t timestamp; // nanoseconds, publisher's clock
+    uint32_t total;    // length of the whole sample
+    uint32_t offset;   // of this fragment's data within the sample
+};
+
+constexpr uint16_t FRAME_MAGIC = 0xc0c0;
+constexpr uint8_t FRAME_VERSION = 1;
+
+// offset of the first sample's data within a frame
+constexpr size_t FRAME_DATA_OFFSET = sizeof(FrameHeader) + sizeof(FrameEntry);
+
+// framed topics get at least this much room per RTPS sample so that small
+// samples can be batched; sized to stay within a typical 1500 byte MTU
+// once RTPS/UDP/IP headers are added.
+constexpr size_t FRAME_MIN_TYPE_SIZE = 1400;
+
+inline size_t framePad(size_t len)
+{
+    return (len + 7) & ~size_t(7);
+}
+
+inline size_t frameEntrySpace(size_t len)
+{
+    return sizeof(FrameEntry) + framePad(len);
+}
+
+// largest sample on a dynamically sized framed topic, which may be fragmented
+constexpr size_t FRAGMENTED_SIZE_LIMIT = 16 * 1024 * 1024;
+
+/*
+ * RTPS type size to register for a topic: framed topics need room for
+ * the frame overhead on top of the largest sample, up to the datagram
+ * limit, beyond which samples are fragmented. By-reference topics only
+ * send descriptors.
+ */
+inline size_t rtpsTypeSize(const Topic &t)
+{
+    if (t.byReference) {
+        return sizeof(BufferDescriptor);
+    }
+    if (t.dynamic()) {
+        return PAYLOAD_SIZE_LIMIT;
+    }
+    if (!t.framed) {
+        return t.maxPayloadSize;
+    }
+    size_t sz = sizeof(FrameHeader) + frameEntrySpace(t.maxPayloadSize);
+    if (sz > PAYLOAD_SIZE_LIMIT) {
+        return PAYLOAD_SIZE_LIMIT;
+    }
+    return sz > FRAME_MIN_TYPE_SIZE ? sz : FRAME_MIN_TYPE_SIZE;
+}
+
+/*
+ * Largest sample that can be published on a topic.
+ */
+inline size_t maxSampleSize(const Topic &t)
+{
+    if (!t.dynamic()) {
+        return t.maxPayloadSize;
+    }
+    return t.framed ? FRAGMENTED_SIZE_LIMIT : PAYLOAD_SIZE_LIMIT;
+}
+
+// data carried by each fragment, given the RTPS type size
+inline size_t fragmentSpace(size_t typeSize)
+{
+    return typeSize - sizeof(FrameHeader) - sizeof(FragmentEntry);
+}
+
+// RTPS samples needed for a sample of 'len' bytes
+inline size_t fragmentCount(size_t len, size_t typeSize)
+{
+    if (sizeof(FrameHeader) + frameEntrySpace(len) <= typeSize) {
+        return 1;
+    }
+    size_t space = fragmentSpace(typeSize);
+    return (len + space - 1) / space;
+}
+
+/*
+ * Write one fragment frame to 'b', which has room for the frame header,
+ * FragmentEntry and 'len' bytes. Returns the frame length.
+ */
+inline size_t writeFragment(uint8_t *b, int64_t sequence, int64_t timestamp, uint32_t total,
+                            uint32_t offset, const uint8_t *data, size_t len)
+{
+    FrameHeader *h = reinterpret_cast<FrameHeader *>(b);
+    h->magic = FRAME_MAGIC;
+    h->version = FRAME_VERSION;
+    h->kind = FRAME_FRAGMENT;
+    h->count = 1;
+
+    FragmentEntry *e = reinterpret_cast<FragmentEntry *>(b + sizeof(FrameHeader));
+    e->sequence = sequence;
+    e->timestamp = timestamp;
+    e->total = total;
+    e->offset = offset;
+
+    memcpy(b + sizeof(FrameHeader) + sizeof(FragmentEntry), data, len);
+    return sizeof(FrameHeader) + sizeof(FragmentEntry) + len;
+}
+
+/*
+ * Validate a fragment frame and find its entry and data.
+ */
+inline bool readFragment(const uint8_t *b, size_t len, const FragmentEntry **e,
+                         const uint8_t **data, size_t *dataLen)
+{
+    if (len < sizeof(FrameHeader) + sizeof(FragmentEntry)) {
+        return false;
+    }
+
+    const FrameHeader *h = reinterpret_cast<const FrameHeader *>(b);
+    if (h->magic != FRAME_MAGIC || h->version != FRAME_VERSION || h->kind != FRAME_FRAGMENT) {
+        return false;
+    }
+
+    const FragmentEntry *fe = reinterpret_cast<const FragmentEntry *>(b + sizeof(FrameHeader));
+    size_t n = len - sizeof(FrameHeader) - sizeof(FragmentEntry);
+    if (fe->offset > fe->total || n > fe->total - fe->offset) {
+        return false;
+    }
+
+    *e = fe;
+    *data = b + sizeof(FrameHeader) + sizeof(FragmentEntry);
+    *dataLen = n;
+    return true;
+}
+
+// smallest loan pool slot on dynamically sized topics
+constexpr size_t DYNAMIC_MIN_SLOT_SIZE = 256;
+
+/*
+ * Packs samples into a frame in a caller provided buffer.
+ */
+class FrameWriter
+{
+public:
+    FrameWriter(uint8_t *b, size_t cap) : buf(b), capacity(cap), used(sizeof(FrameHeader))
+    {
+        header()->magic = FRAME_MAGIC;
+        header()->version = FRAME_VERSION;
+        header()->kind = FRAME_BATCH;
+        header()->count = 0;
+    }
+
+    bool fits(size_t len) const
+    {
+        return used + sizeof(FrameEntry) + len <= capacity;
+    }
+
+    // pointer to where the next sample's data will go
+    uint8_t *nextData() const
+    {
+        return buf + used + sizeof(FrameEntry);
+    }
+
+    /*
+     * Add an entry for 'len' bytes, which the caller has already written
+     * to nextData(). Returns false if it doesn't fit.
+     */
+    bool commit(size_t len, int64_t sequence, int64_t timestamp)
+    {
+        if (!fits(len)) {
+            return false;
+        }
+        FrameEntry *e = reinterpret_cast<FrameEntry *>(buf + used);
+        e->sequence = sequence;
+        e->timestamp = timestamp;
+        e->len = len;
+        e->reserved = 0;
+        used += frameEntrySpace(len);
+        header()->count++;
+        return true;
+    }
+
+    bool append(const uint8_t *b, size_t len, int64_t sequence, int64_t timestamp)
+    {
+        if (!fits(len)) {
+            return false;
+        }
+        memcpy(nextData(), b, len);
+        return commit(len, sequence, timestamp);
+    }
+
+    unsigned count() const
+    {
+        return header()->count;
+    }
+
+    // bytes to send; the last entry's padding may be cut short at the end of the buffer
+    size_t length() const
+    {
+        return used > capacity ? capacity : used;
+    }
+
+private:
+    FrameHeader *header() const
+    {
+        return reinterpret_cast<FrameHeader *>(buf);
+    }
+
+    uint8_t *buf;
+    size_t capacity;
+    size_t used;
+};
+
+/*
+ * Walks the entries of a received frame, validating as it goes.
+ */
+class FrameReader
+{
+public:
+    FrameReader() : buf(nullptr), len(0), pos(0), remaining(0)
+    {
+    }
+
+    bool reset(const uint8_t *b, size_t l)
+    {
+        buf = b;
+        len = l;
+        pos = sizeof(FrameHeader);
+        remaining = 0;
+
+        if (l < sizeof(FrameHeader)) {
+            return false;
+        }
+
+        const FrameHeader *h = reinterpret_cast<const FrameHeader *>(b);
+        if (h->magic != FRAME_MAGIC || h->version != FRAME_VERSION || h->kind != FRAME_BATCH) {
+            return false;
+        }
+        remaining = h->count;
+        return true;
+    }
+
+    /*
+     * Look at the next entry without consuming it.
+     */
+    bool peek(const FrameEntry **e, const uint8_t **data) const
+    {
+        if (remaining == 0 || pos + sizeof(FrameEntry) > len) {
+            return false;
+        }
+        const FrameEntry *fe = reinterpret_cast<const FrameEntry *>(buf + pos);
+        if (pos + sizeof(FrameEntry) + fe->len > len) {
+            return false; // truncated
+        }
+        *e = fe;
+        *data = buf + pos + sizeof(FrameEntry);
+        return true;
+    }
+
+    void advance()
+    {
+        const FrameEntry *e;
+        const uint8_t *data;
+        if (peek(&e, &data)) {
+            pos += frameEntrySpace(e->len);
+            remaining--;
+        } else {
+            remaining = 0;
+        }
+    }
+
+    bool next(const FrameEntry **e, const uint8_t **data)
+    {
+        if (!peek(e, data)) {
+            return false;
+        }
+        advance();
+        return true;
+    }
+
+private:
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    unsigned remaining;
+};
+
+} // namespace commkit
@@ -0,0 +1,198 @@
+#include "loanpool.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+namespace commkit
+{
+
+// out of line definitions, for when these are odr-used (e.g. bound to a reference)
+constexpr size_t LoanPool::CacheLineSize;
+constexpr int LoanPool::InvalidSlot;
+constexpr unsigned LoanPool::MaxSizeClasses;
+
+LoanPool::LoanPool() : mem(nullptr), memSize(0), nslots(0), nclasses(0)
+{
+}
+
+LoanPool::~LoanPool()
+{
+    free(mem);
+}
+
+bool LoanPool::init(unsigned slots, size_t slotSize)
+{
+    /*
+     * Allocate a single class of 'slots' buffers. May only be called once.
+     */
+
+    return allocate(slots, &slotSize, 1);
+}
+
+bool LoanPool::initSizeClasses(unsigned slotsPerClass, size_t minSize, size_t maxSize)
+{
+    /*
+     * Allocate 'slotsPerClass' buffers in each of a range of sizes, from
+     * minSize growing by a factor of 4 up to maxSize. May only be called once.
+     */
+
+    if (minSize == 0 || minSize > maxSize) {
+        return false;
+    }
+
+    size_t sizes[MaxSizeClasses];
+    unsigned n = 0;
+    for (size_t sz = minSize; sz < maxSize && n < MaxSizeClasses - 1; sz *= 4) {
+        sizes[n++] = sz;
+    }
+    sizes[n++] = maxSize;
+
+    return allocate(slotsPerClass, sizes, n);
+}
+
+bool LoanPool::allocate(unsigned slotsPerClass, const size_t *sizes, unsigned n)
+{
+    assert(mem == nullptr && "LoanPool::init() called twice");
+
+    if (slotsPerClass == 0 || n == 0 || n > MaxSizeClasses) {
+        return false;
+    }
+
+    size_t total = 0;
+    for (unsigned c = 0; c < n; ++c) {
+        if (sizes[c] == 0) {
+            return false;
+        }
+        SizeClass &sc = classes[c];
+        sc.size = sizes[c];
+        sc.stride = (sizes[c] + CacheLineSize - 1) & ~(CacheLineSize - 1);
+        sc.offset = total;
+        sc.first = c * slotsPerClass;
+        sc.count = slotsPerClass;
+        total += sc.stride * slotsPerClass;
+    }
+
+    void *p;
+    if (posix_memalign(&p, CacheLineSize, total) != 0) {
+        return false;
+    }
+    memset(p, 0, total);
+
+    unsigned slots = n * slotsPerClass;
+    refs.reset(new std::atomic<unsigned>[slots]);
+    for (unsigned i = 0; i < slots; ++i) {
+        refs[i] = 0;
+    }
+    next.reset(new std::atomic<unsigned>[n]);
+    for (unsigned c = 0; c < n; ++c) {
+        next[c] = 0;
+    }
+
+    mem = static_cast<uint8_t *>(p);
+    memSize = total;
+    nslots = slots;
+    nclasses = n;
+    return true;
+}
+
+int LoanPool::acquire(size_t len)
+{
+    /*
+     * Find a free slot of at least 'len' bytes and take the first reference
+     * to it, trying the smallest class that fits first.
+     * Returns InvalidSlot if there's nothing suitable.
+     */
+
+    for (unsigned c = 0; c < nclasses; ++c) {
+        const SizeClass &sc = classes[c];
+        if (sc.size < len) {
+            continue;
+        }
+
+        unsigned start = next[c].load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < sc.count; ++i) {
+            unsigned slot = sc.first + (start + i) % sc.count;
+            unsigned expected = 0;
+            if (refs[slot].compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+                next[c].store(slot - sc.first + 1, std::memory_order_relaxed);
+                return slot;
+            }
+        }
+    }
+    return InvalidSlot;
+}
+
+bool LoanPool::hasFree(size_t len) const
+{
+    for (unsigned c = 0; c < nclasses; ++c) {
+        const SizeClass &sc = classes[c];
+        if (sc.size < len) {
+            continue;
+        }
+        for (unsigned i = 0; i < sc.count; ++i) {
+            if (refs[sc.first + i].load(std::memory_order_relaxed) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void LoanPool::retain(int slot)
+{
+    assert(slot >= 0 && unsigned(slot) < nslots);
+    refs[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool LoanPool::release(int slot)
+{
+    /*
+     * Drop a reference. Returns true if this was the last one
+     * and the slot is free again.
+     */
+
+    assert(slot >= 0 && unsigned(slot) < nslots);
+    unsigned prev = refs[slot].fetch_sub(1, std::memory_order_release);
+    assert(prev > 0 && "LoanPool slot released too many times");
+    return (prev == 1);
+}
+
+int LoanPool::slotOf(const uint8_t *b) const
+{
+    uintptr_t base = reinterpret_cast<uintptr_t>(mem);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(b);
+    if (mem == nullptr || addr < base || addr - base >= memSize) {
+        return InvalidSlot;
+    }
+
+    size_t off = addr - base;
+    unsigned c = nclasses - 1;
+    while (off < classes[c].offset) {
+        c--;
+    }
+
+    const SizeClass &sc = classes[c];
+    if ((off - sc.offset) % sc.stride != 0) {
+        return InvalidSlot;
+    }
+
+    int slot = sc.first + (off - sc.offset) / sc.stride;
+    if (refs[slot].load(std::memory_order_relaxed) == 0) {
+        return InvalidSlot;
+    }
+    return slot;
+}
+
+unsigned LoanPool::outstanding() const
+{
+    unsigned n = 0;
+    for (unsigned i = 0; i < nslots; ++i) {
+        if (refs[i].load(std::memory_order_relaxed) != 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+} // namespace commkit
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace commkit
+{
+
+/*
+ * Fixed-capacity pool of buffers ("slots").
+ *
+ * All memory is allocated up front by init(), in one block with each slot
+ * starting on its own cache line, so acquire()/release() never touch the heap.
+ *
+ * A pool holds one or more size classes of slots. init() creates a single
+ * class of equally sized slots; initSizeClasses() creates a range of them,
+ * for data whose size isn't known in advance, and acquire(len) picks the
+ * smallest free slot that fits. Slot numbers are unique across classes.
+ *
+ * Slots are reference counted: acquire() hands out a free slot holding one
+ * reference, retain() adds another, and the slot returns to the pool when the
+ * last reference is released. All operations are lock-free and may be called
+ * from any thread.
+ */
+class LoanPool
+{
+public:
+    static constexpr size_t CacheLineSize = 64;
+    static constexpr int InvalidSlot = -1;
+    static constexpr unsigned MaxSizeClasses = 8;
+
+    LoanPool();
+    ~LoanPool();
+
+    LoanPool(const LoanPool &) = delete;
+    LoanPool &operator=(const LoanPool &) = delete;
+
+    bool init(unsigned slots, size_t slotSize);
+    bool initSizeClasses(unsigned slotsPerClass, size_t minSize, size_t maxSize);
+
+    // a free slot of at least 'len' bytes
+    int acquire(size_t len = 0);
+    void retain(int slot);
+    bool release(int slot);
+
+    // whether acquire(len) would currently succeed
+    bool hasFree(size_t len) const;
+
+    uint8_t *buffer(int slot) const
+    {
+        const SizeClass &sc = sizeClass(slot);
+        return mem + sc.offset + (slot - sc.first) * sc.stride;
+    }
+
+    // slot index for a pointer previously returned by buffer(),
+    // or InvalidSlot if 'b' is not the start of an outstanding slot.
+    int slotOf(const uint8_t *b) const;
+
+    unsigned capacity() const
+    {
+        return nslots;
+    }
+
+    // size of the largest slots
+    size_t slotSize() const
+    {
+        return nclasses ? classes[nclasses - 1].size : 0;
+    }
+
+    size_t slotSize(int slot) const
+    {
+        return sizeClass(slot).size;
+    }
+
+    unsigned outstanding() const;
+
+private:
+    struct SizeClass {
+        size_t size;
+        size_t stride;  // size rounded up to a cache line
+        size_t offset;  // of the first slot within mem
+        unsigned first; // slot number of the first slot
+        unsigned count;
+    };
+
+    bool allocate(unsigned slotsPerClass, const size_t *sizes, unsigned n);
+
+    const SizeClass &sizeClass(int slot) const
+    {
+        unsigned c = 0;
+        while (c + 1 < nclasses && unsigned(slot) >= classes[c + 1].first) {
+            c++;
+        }
+        return classes[c];
+    }
+
+    uint8_t *mem;
+    size_t memSize;
+    unsigned nslots;
+
+    SizeClass classes[MaxSizeClasses];
+    unsigned nclasses;
+
+    std::unique_ptr<std::atomic<unsigned>[]> refs;
+    std::unique_ptr<std::atomic<unsigned>[]> next; // per class, where acquire() starts looking
+};
+
+} // namespace commkit
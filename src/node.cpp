@@ -18,7 +18,7 @@ Node::~Node()
 {
 }
 
-std::shared_ptr<NodeImpl> Node::getImpl(const NodeOpts &opts)
+std::shared_ptr<NodeImpl> Node::getImpl(const NodeOpts &opts, bool matchOpts)
 {
     /*
      * cache of NodeImpls, keyed by domainID.
@@ -39,6 +39,8 @@ std::shared_ptr<NodeImpl> Node::getImpl(const NodeOpts &opts)
             return nullptr;
         }
         cache[opts.domainID] = impl;
+    } else if (matchOpts && !impl->matches(opts)) {
+        return nullptr; // every publisher and subscriber on it would have to agree
     }
     return impl;
 }
@@ -70,7 +72,7 @@ Node Node::find(uint32_t domainID)
 
     NodeOpts opts;
     opts.domainID = domainID;
-    auto i = getImpl(opts);
+    auto i = getImpl(opts, false);
     assert(i != nullptr && "didn't find existing node");
     return Node(i);
 }
@@ -99,4 +101,9 @@ std::shared_ptr<Publisher> Node::createPublisher(const Topic &t)
     return pub;
 }
 
+std::vector<ThreadInfo> Node::threads() const
+{
+    return impl->listThreads();
+}
+
 } // namespace commkit
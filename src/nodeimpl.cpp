@@ -1,4 +1,9 @@
 #include "nodeimpl.h"
+#include "boundedqueue.h"
+#include "publisherimpl.h"
+#include "subscriberimpl.h"
+
+#include <algorithm>
 
 #include <fastrtps/Domain.h>
 #include <fastrtps/participant/Participant.h>
@@ -9,17 +14,108 @@ using namespace eprosima::fastrtps;
 namespace commkit
 {
 
+// subscribers awaiting their handlers at once; each is queued at most once
+static constexpr size_t DISPATCH_QUEUE_DEPTH = 1024;
+
+struct NodeImpl::Dispatcher {
+    Dispatcher() : queue(DISPATCH_QUEUE_DEPTH), running(true), wakePending(false)
+    {
+    }
+
+    BoundedQueue<std::shared_ptr<Subscriber>> queue;
+    std::thread thread;
+    std::mutex wakeMtx; // guards running
+    std::condition_variable wakeCv;
+    bool running;
+    std::atomic<bool> wakePending;
+};
+
 NodeImpl::NodeImpl()
+    : part(nullptr), senderRunning(false), wakePending(false), intraProcess(true)
 {
 }
 
 NodeImpl::~NodeImpl()
 {
+    if (sender.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(wakeMtx);
+            senderRunning = false;
+        }
+        wakeCv.notify_one();
+        sender.join();
+    }
+
+    if (dispatcher) {
+        {
+            std::lock_guard<std::mutex> guard(dispatcher->wakeMtx);
+            dispatcher->running = false;
+        }
+        dispatcher->wakeCv.notify_one();
+        // a handler there may have let go of the last Subscriber, and it us
+        if (dispatcher->thread.get_id() == std::this_thread::get_id()) {
+            dispatcher->thread.detach();
+        } else {
+            dispatcher->thread.join();
+        }
+    }
+
     if (part != nullptr) {
         Domain::removeParticipant(part);
     }
 }
 
+// the transports 'opts' asks for, as a NodeImpl runs them
+static std::vector<TransportDescriptor> transportsFor(const NodeOpts &opts)
+{
+    // RTPS can't do without UDP, for discovery at least
+    std::vector<TransportDescriptor> descs = opts.transports;
+    auto isUdp = [](const TransportDescriptor &d) { return d.kind == TRANSPORT_UDP; };
+    if (std::none_of(descs.begin(), descs.end(), isUdp)) {
+        descs.push_back(TransportDescriptor(TRANSPORT_UDP));
+    }
+    std::stable_sort(descs.begin(), descs.end(),
+                     [](const TransportDescriptor &a, const TransportDescriptor &b) {
+                         return a.priority > b.priority;
+                     });
+    return descs;
+}
+
+// whether two descriptors ask for the same transport, by the settings of its kind
+static bool sameTransport(const TransportDescriptor &a, const TransportDescriptor &b)
+{
+    if (a.kind != b.kind || a.priority != b.priority) {
+        return false;
+    }
+    switch (a.kind) {
+    case TRANSPORT_SHARED_MEMORY:
+        return a.ringSlots == b.ringSlots;
+    case TRANSPORT_UDP_BATCHED:
+        return a.batchSize == b.batchSize && a.batchLatency == b.batchLatency &&
+               a.ioEngine == b.ioEngine && a.segmentSize == b.segmentSize &&
+               a.zeroCopyThreshold == b.zeroCopyThreshold && a.busyPoll == b.busyPoll &&
+               a.busyPollCpu == b.busyPollCpu;
+    default:
+        return true;
+    }
+}
+
+bool NodeImpl::matches(const NodeOpts &opts) const
+{
+    if (opts.intraProcess != intraProcess) {
+        return false;
+    }
+    for (int r = 0; r < THREAD_ROLES; ++r) {
+        const ThreadOpts &a = opts.threads[r], &b = threadOpts[r];
+        if (a.policy != b.policy || a.priority != b.priority || a.cpus != b.cpus) {
+            return false;
+        }
+    }
+    std::vector<TransportDescriptor> descs = transportsFor(opts);
+    return descs.size() == transportDescs.size() &&
+           std::equal(descs.begin(), descs.end(), transportDescs.begin(), sameTransport);
+}
+
 bool NodeImpl::init(const NodeOpts &opts)
 {
     ParticipantAttributes pa;
@@ -30,13 +126,261 @@ bool NodeImpl::init(const NodeOpts &opts)
     pa.rtps.builtin.domainId = opts.domainID;
     pa.rtps.builtin.leaseDuration = c_TimeInfinite;
 
-    pa.rtps.sendSocketBufferSize = 8712;
-    pa.rtps.listenSocketBufferSize = 17424;
-
     pa.rtps.setName(opts.name.c_str());
 
-    part = Domain::createParticipant(pa);
+    intraProcess = opts.intraProcess;
+    std::copy(opts.threads, opts.threads + THREAD_ROLES, threadOpts);
+    threads.configure(threadOpts);
+
+    transportDescs = transportsFor(opts);
+    for (auto &d : transportDescs) {
+        for (auto &t : transports) {
+            if (t->kind() == d.kind) {
+                return false;
+            }
+        }
+        std::unique_ptr<Transport> t = Transport::create(d, &threads);
+        if (!t || !t->configure(opts, &pa)) {
+            return false;
+        }
+        transports.push_back(std::move(t));
+    }
+
+    // Fast-RTPS starts its threads as it creates the participant
+    {
+        ThreadRegistry::Adopter adopter(&threads, THREAD_RTPS, "ck-rtps");
+        part = Domain::createParticipant(pa);
+    }
     return (part != nullptr);
 }
 
+void NodeImpl::addAsyncPublisher(PublisherImpl *p)
+{
+    std::lock_guard<std::mutex> guard(asyncMtx);
+    asyncPubs.push_back(p);
+
+    if (!sender.joinable()) {
+        senderRunning = true;
+        sender = std::thread(&NodeImpl::senderLoop, this);
+    }
+}
+
+void NodeImpl::removeAsyncPublisher(PublisherImpl *p)
+{
+    /*
+     * Once this returns, the sender thread is no longer touching 'p': it
+     * takes p's flushMtx before letting go of asyncMtx, so once 'p' is off
+     * the list, it's either done with it or won't start.
+     *
+     * Those after 'p' shift down, so the sender may pass one over in its
+     * current round; it's woken for another.
+     */
+
+    {
+        std::lock_guard<std::mutex> guard(asyncMtx);
+        asyncPubs.erase(std::remove(asyncPubs.begin(), asyncPubs.end(), p), asyncPubs.end());
+    }
+    std::lock_guard<std::mutex> flushing(p->flushMtx);
+    if (sender.joinable()) {
+        wakeSender();
+    }
+}
+
+void NodeImpl::wakeSender()
+{
+    /*
+     * Called from publish() in async mode after queueing a sample.
+     *
+     * Only the first caller after the sender starts waiting takes the lock,
+     * and the sender only holds it while deciding whether to sleep, so
+     * this never waits on network I/O.
+     */
+
+    if (!wakePending.exchange(true)) {
+        std::lock_guard<std::mutex> guard(wakeMtx);
+        wakeCv.notify_one();
+    }
+}
+
+void NodeImpl::addLocalPublisher(PublisherImpl *p)
+{
+    /*
+     * Start delivering from 'p' directly to each matching subscriber
+     * of ours (see PublisherImpl::write()).
+     */
+
+    if (!intraProcess) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(localMtx);
+    localPubs.push_back(p);
+    for (auto s : localSubs) {
+        if (localMatch(p, s)) {
+            p->attachLocal(s);
+        }
+    }
+}
+
+void NodeImpl::removeLocalPublisher(PublisherImpl *p)
+{
+    std::lock_guard<std::mutex> guard(localMtx);
+    localPubs.erase(std::remove(localPubs.begin(), localPubs.end(), p), localPubs.end());
+}
+
+void NodeImpl::addLocalSubscriber(SubscriberImpl *s)
+{
+    if (!intraProcess) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(localMtx);
+    if (!dispatcher) {
+        dispatcher = std::make_shared<Dispatcher>();
+        dispatcher->thread = std::thread(&NodeImpl::dispatchLoop, dispatcher, &threads);
+    }
+    localSubs.push_back(s);
+    for (auto p : localPubs) {
+        if (localMatch(p, s)) {
+            p->attachLocal(s);
+        }
+    }
+}
+
+void NodeImpl::removeLocalSubscriber(SubscriberImpl *s)
+{
+    /*
+     * Once this returns, no publisher is delivering to 's'.
+     */
+
+    std::lock_guard<std::mutex> guard(localMtx);
+    localSubs.erase(std::remove(localSubs.begin(), localSubs.end(), s), localSubs.end());
+    for (auto p : localPubs) {
+        p->detachLocal(s);
+    }
+}
+
+bool NodeImpl::dispatch(const std::shared_ptr<Subscriber> &s)
+{
+    /*
+     * Called from publish(), as wakeSender() is: only the first caller
+     * since the dispatch thread last looked takes the lock.
+     */
+
+    Dispatcher *d = dispatcher.get(); // set before any publisher reaches 's'
+    if (d == nullptr || !d->queue.push(s)) {
+        return false;
+    }
+    if (!d->wakePending.exchange(true)) {
+        std::lock_guard<std::mutex> guard(d->wakeMtx);
+        d->wakeCv.notify_one();
+    }
+    return true;
+}
+
+void NodeImpl::dispatchLoop(std::shared_ptr<Dispatcher> d, ThreadRegistry *threads)
+{
+    /*
+     * Dispatch thread: run the handlers of each subscriber queued by
+     * dispatch().
+     *
+     * Anything here can be the last to hold a Subscriber, so can take the
+     * NodeImpl down with it, registry and all: so only 'd' is touched
+     * once we've started, and we never leave() the registry, which goes
+     * when the NodeImpl does.
+     */
+
+    threads->enter(THREAD_DISPATCH, "ck-dispatch");
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(d->wakeMtx);
+            d->wakeCv.wait(lk, [&d] { return d->wakePending.load() || !d->running; });
+            if (!d->running) {
+                return;
+            }
+            d->wakePending = false;
+        }
+
+        std::shared_ptr<Subscriber> s;
+        while (d->queue.pop(&s)) {
+            SubscriberImpl::dispatched(s);
+            s.reset();
+        }
+    }
+}
+
+bool NodeImpl::isLocal(const rtps::GUID_t &guid) const
+{
+    return intraProcess && guid.guidPrefix == part->getGuid().guidPrefix;
+}
+
+TransportTopic NodeImpl::transportTopic(const std::string &name, size_t maxSampleSize,
+                                        bool reliable)
+{
+    /*
+     * Samples within our participant are already delivered directly
+     * when intraProcess is set, so transports needn't carry them.
+     */
+
+    TransportTopic t;
+    t.name = name;
+    t.maxSampleSize = maxSampleSize;
+    t.reliable = reliable;
+    t.self = part->getGuid().guidPrefix.value;
+    t.skipSelf = intraProcess;
+    t.loans = nullptr;
+    t.timestamps = false;
+    return t;
+}
+
+bool NodeImpl::localMatch(PublisherImpl *p, SubscriberImpl *s)
+{
+    /*
+     * The same rules RTPS would apply, so that each subscriber hears from
+     * a local publisher by exactly one route: same topic and type, and
+     * a best effort publisher can't satisfy a reliable subscriber.
+     */
+
+    return p->name() == s->name() && p->datatype() == s->datatype() &&
+           (p->isReliable() || !s->isReliable());
+}
+
+void NodeImpl::senderLoop()
+{
+    /*
+     * Sender thread: sleep until a publisher has queued something,
+     * then drain every async publisher's queue.
+     */
+
+    ThreadRegistry::Scope scope(&threads, THREAD_SENDER, "ck-sender");
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(wakeMtx);
+            wakeCv.wait(lk, [this] { return wakePending.load() || !senderRunning; });
+            if (!senderRunning) {
+                return;
+            }
+            wakePending = false;
+        }
+
+        // one publisher at a time, so a write that blocks holds up only
+        // the sender, not publishers being added or removed
+        for (size_t i = 0;; ++i) {
+            std::unique_lock<std::mutex> flushing;
+            PublisherImpl *p;
+            {
+                std::lock_guard<std::mutex> guard(asyncMtx);
+                if (i >= asyncPubs.size()) {
+                    break;
+                }
+                p = asyncPubs[i];
+                flushing = std::unique_lock<std::mutex>(p->flushMtx);
+            }
+            p->flushQueue();
+        }
+    }
+}
+
 } // namespace commkit
@@ -1,14 +1,27 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <commkit/node.h>
 
 #include <fastrtps/participant/Participant.h>
 
+#include "threadregistry.h"
+#include "transport.h"
+
 namespace commkit
 {
 
+class PublisherImpl;
+class Subscriber;
+class SubscriberImpl;
+
 class NodeImpl
 {
 public:
@@ -17,9 +30,79 @@ public:
 
     bool init(const NodeOpts &opts);
 
+    // async publishers, serviced by our sender thread
+    void addAsyncPublisher(PublisherImpl *p);
+    void removeAsyncPublisher(PublisherImpl *p);
+    void wakeSender();
+
+    // intra-process delivery: matches up our own publishers and subscribers
+    void addLocalPublisher(PublisherImpl *p);
+    void removeLocalPublisher(PublisherImpl *p);
+    void addLocalSubscriber(SubscriberImpl *s);
+    void removeLocalSubscriber(SubscriberImpl *s);
+
+    // run a local subscriber's handlers on our dispatch thread, rather
+    // than the publisher's. false if it couldn't be queued
+    bool dispatch(const std::shared_ptr<Subscriber> &s);
+
+    // see NodeOpts::intraProcess
+    bool intraProcessEnabled() const
+    {
+        return intraProcess;
+    }
+
+    // whether a Node asking for 'opts' could share us: intraProcess,
+    // transports and threads, which every Node on a domain shares, agree
+    bool matches(const NodeOpts &opts) const;
+
+    // whether an RTPS endpoint belongs to our participant
+    bool isLocal(const eprosima::fastrtps::rtps::GUID_t &guid) const;
+
+    // see Node::threads()
+    std::vector<ThreadInfo> listThreads()
+    {
+        return threads.list();
+    }
+
+    // a topic as our transports see it
+    TransportTopic transportTopic(const std::string &name, size_t maxSampleSize, bool reliable);
+
 private:
+    void senderLoop();
+
+    struct Dispatcher;
+    static void dispatchLoop(std::shared_ptr<Dispatcher> d, ThreadRegistry *threads);
+    static bool localMatch(PublisherImpl *p, SubscriberImpl *s);
+
     eprosima::fastrtps::Participant *part;
 
+    std::mutex asyncMtx; // guards asyncPubs; each one's flushMtx is held while sending
+    std::vector<PublisherImpl *> asyncPubs;
+
+    std::thread sender; // started with the first async publisher
+    bool senderRunning;
+    std::mutex wakeMtx;
+    std::condition_variable wakeCv;
+    std::atomic<bool> wakePending;
+
+    bool intraProcess;
+
+    // ours, our transports' and Fast-RTPS'; outlives the transports
+    ThreadOpts threadOpts[THREAD_ROLES];
+    ThreadRegistry threads;
+
+    // see NodeOpts::transports; highest priority first
+    std::vector<TransportDescriptor> transportDescs;
+    std::vector<std::unique_ptr<Transport>> transports;
+
+    std::mutex localMtx; // guards localPubs, localSubs, dispatcher
+    std::vector<PublisherImpl *> localPubs;
+    std::vector<SubscriberImpl *> localSubs;
+
+    // started with the first local subscriber. shared with its thread,
+    // which may be the one to drop the last reference to us
+    std::shared_ptr<Dispatcher> dispatcher;
+
     friend class PublisherImpl;
     friend class SubscriberImpl;
 };
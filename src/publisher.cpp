@@ -28,35 +28,53 @@ std::string Publisher::name() const
     return impl->name();
 }
 
+bool Publisher::loan(uint8_t **b, size_t len)
+{
+    return impl->loan(b, len);
+}
+
+bool Publisher::commit(const uint8_t *b, size_t len)
+{
+    return impl->commit(b, len);
+}
+
+void Publisher::discard(const uint8_t *b)
+{
+    impl->discard(b);
+}
+
+unsigned Publisher::loansOutstanding() const
+{
+    return impl->loansOutstanding();
+}
+
 bool Publisher::reserve(uint8_t **b, size_t len)
 {
-    return impl->reserve(b, len);
+    return impl->loan(b, len);
 }
 
 bool Publisher::publishReserved(const uint8_t *b, size_t len)
 {
-    return impl->publishReserved(b, len);
+    return impl->commit(b, len);
 }
 
 #ifndef COMMKIT_NO_CAPNP
 bool Publisher::publish(capnp::MessageBuilder &mb)
 {
     /*
-     * For now, we use messageToFlatArray() but this is not ideal,
-     * as it involves a copy.
-     *
-     * Ideally, we'd either
-     * a) write to pre-allocated space to begin with,
-     *  but we don't always know how much space to reserve
-     * b) write the segments out as fragments, as suggested in
-     * http://stackoverflow.com/questions/32041315/how-to-send-capn-proto-message-over-zmq
-     *
-     * We may also want to use a packed variant, not sure yet.
+     * Our own builder (see capnBuilder()) can usually be sent in place.
      */
 
-    auto words = capnp::messageToFlatArray(mb);
-    auto bytes = words.asBytes();
-    return impl->publish(bytes.begin(), bytes.size());
+    if (impl->capnBuilderOwns(mb)) {
+        return impl->publishCapnBuilder();
+    }
+
+    return impl->publishSegments(mb);
+}
+
+capnp::MessageBuilder &Publisher::capnBuilder()
+{
+    return impl->capnBuilder();
 }
 #endif
 
@@ -65,9 +83,34 @@ bool Publisher::publish(const uint8_t *b, size_t len)
     return impl->publish(b, len);
 }
 
+size_t Publisher::publishBatch(const BatchSample *samples, size_t n)
+{
+    return impl->publishBatch(samples, n);
+}
+
 unsigned Publisher::matchedSubscribers() const
 {
     return impl->matchedSubscribers();
 }
 
+unsigned Publisher::queueDepth() const
+{
+    return impl->queueDepth();
+}
+
+uint64_t Publisher::queueDrops() const
+{
+    return impl->queueDrops();
+}
+
+PayloadSizeStats Publisher::payloadSizeStats() const
+{
+    return impl->payloadSizeStats();
+}
+
+ZeroCopyStats Publisher::zeroCopyStats() const
+{
+    return impl->zeroCopyStats();
+}
+
 } // namespace commkit
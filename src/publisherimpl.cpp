@@ -1,19 +1,40 @@
 #include "publisherimpl.h"
+#include "subscriberimpl.h"
 #include "nodeimpl.h"
 #include "chronoimpl.h"
 #include "bytebuftopic.h"
+#include "frame.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #include <fastrtps/Domain.h>
 #include <fastrtps/qos/QosPolicies.h>
 #include <fastrtps/attributes/PublisherAttributes.h>
 
+#ifndef COMMKIT_NO_CAPNP
+#include <capnp/serialize.h>
+#endif
+
 namespace commkit
 {
 
+#ifndef COMMKIT_NO_CAPNP
+// more segments than this are flattened rather than gathered
+static constexpr size_t CAPN_MAX_GATHER_SEGMENTS = 32;
+
+// capnBuilder() first segment on dynamically sized topics; capnp's own default
+static constexpr size_t CAPN_DYNAMIC_SEGMENT_SIZE = 8192;
+#endif
+
 PublisherImpl::PublisherImpl(const Topic &t, std::shared_ptr<NodeImpl> n)
-    : frpub(nullptr), matchedSubs(0), reserved(false), node(n), topicName(t.name)
+    : frpub(nullptr), matchedSubs(0), node(n), reliable(false), topicName(t.name),
+      framed(t.framed), dynamic(t.dynamic()), byReference(t.byReference),
+      maxPayloadSize(maxSampleSize(t)),
+      dataOffset(t.framed ? FRAME_DATA_OFFSET : 0), nextSequence(1),
+      overflowPolicy(OVERFLOW_DROP_OLDEST), drops(0), localCount(0),
+      matchGeneration(0), routesGeneration(UINT64_MAX), transportRoutes(0), rtpsRoute(false)
 {
     /*
      * NB: we require 'pub' to be initialized separately via setPublisher(),
@@ -21,14 +42,21 @@ PublisherImpl::PublisherImpl(const Topic &t, std::shared_ptr<NodeImpl> n)
      * a shared_ptr to the about to be created Publisher does not yet exist.
      */
     topicDataType.setName(t.datatype.c_str());
-
-    // ugh, payload size must be defined
-    assert(t.maxPayloadSize > 0 && "Topic::maxPayloadSize must be specified");
-    topicDataType.setSize(t.maxPayloadSize);
+    topicDataType.setSize(rtpsTypeSize(t));
 }
 
 PublisherImpl::~PublisherImpl()
 {
+    node->removeLocalPublisher(this);
+
+    if (queue) {
+        node->removeAsyncPublisher(this);
+        QueuedSample qs;
+        while (queue->pop(&qs)) {
+            loans.release(qs.slot);
+        }
+    }
+
     if (frpub != nullptr) {
         eprosima::fastrtps::Domain::removePublisher(frpub);
     }
@@ -43,12 +71,29 @@ bool PublisherImpl::init(const PublicationOpts &opts)
     pa.times.heartbeatPeriod = toRtpsDuration(std::chrono::milliseconds(100));
     // XXX: configure history
 
+    reliable = opts.reliable;
     if (opts.reliable) {
         pa.qos.m_reliability.kind = eprosima::fastrtps::RELIABLE_RELIABILITY_QOS;
     } else {
         pa.qos.m_reliability.kind = eprosima::fastrtps::BEST_EFFORT_RELIABILITY_QOS;
     }
 
+#ifdef COMMKIT_RTPS_DYNAMIC_HISTORY
+    if (dynamic) {
+        pa.historyMemoryPolicy = eprosima::fastrtps::rtps::DYNAMIC_RESERVE_MEMORY_MODE;
+    }
+#endif
+
+    // keep every fragment of the last 'history' samples, so any of them
+    // can be retransmitted; the history only grows this big if it's used
+    size_t frags = framed ? fragmentCount(maxPayloadSize, topicDataType.m_typeSize) : 1;
+    if (frags > 1) {
+        pa.topic.historyQos.kind = eprosima::fastrtps::KEEP_LAST_HISTORY_QOS;
+        pa.topic.historyQos.depth = std::max(opts.history, 1u) * frags;
+        pa.topic.resourceLimitsQos.max_samples = pa.topic.historyQos.depth;
+        pa.topic.resourceLimitsQos.allocated_samples = std::max(opts.history, 1u);
+    }
+
     // fast-rtps requires datatype to be regsitered before we can
     // create the publisher.
 
@@ -57,57 +102,152 @@ bool PublisherImpl::init(const PublicationOpts &opts)
         eprosima::fastrtps::Domain::registerType(node->part, &topicDataType);
     }
 
-    frpub = eprosima::fastrtps::Domain::createPublisher(node->part, pa, this);
-    return (frpub != nullptr);
+    // all loan() buffers are allocated here, none on the publish path.
+    // async publishers also need a buffer for each queued sample.
+    unsigned slots = std::max(opts.loanSlots, 1u);
+    if (opts.async) {
+        queue.reset(new BoundedQueue<QueuedSample>(std::max(opts.asyncQueueDepth, 1u)));
+        overflowPolicy = opts.overflowPolicy;
+        slots += queue->capacity();
+    }
+
+    // dynamically sized topics get slots in a range of sizes instead
+    size_t sz = topicDataType.m_typeSize;
+    bool ok = dynamic ? loans.initSizeClasses(slots, DYNAMIC_MIN_SLOT_SIZE, sz)
+                      : loans.init(slots, sz);
+    if (!ok) {
+        return false;
+    }
+
+    // by-reference topics: samples are written straight into the shared
+    // pool, and the loan slots above only carry their descriptors
+    if (byReference) {
+        shared.reset(new SharedBufferPool());
+        if (framed || dynamic ||
+            !shared->init(opts.sharedBuffers, maxPayloadSize, std::max(opts.history, 1u),
+                          &node->threads)) {
+            return false;
+        }
+    }
+
+    // subscribers must see us on other transports before they hear from us
+    // over RTPS, so they know to ignore that copy. a transport that can't
+    // carry the topic is simply left out.
+    TransportTopic tt = node->transportTopic(name(), sz, reliable);
+    tt.loans = &loans;
+    for (auto &t : node->transports) {
+        std::unique_ptr<TransportWriter> w = t->createWriter(tt);
+        if (w) {
+            transportWriters.push_back(std::move(w));
+        }
+    }
+
+    {
+        ThreadRegistry::Adopter adopter(&node->threads, THREAD_RTPS, "ck-rtps");
+        frpub = eprosima::fastrtps::Domain::createPublisher(node->part, pa, this);
+    }
+    if (frpub == nullptr) {
+        return false;
+    }
+    guid = frpub->getGuid();
+
+    if (queue) {
+        node->addAsyncPublisher(this);
+    }
+    node->addLocalPublisher(this);
+    return true;
 }
 
-bool PublisherImpl::reserve(uint8_t **b, size_t len)
+bool PublisherImpl::loan(uint8_t **b, size_t len)
 {
     /*
      * Get a pointer to a buffer to serialize an outgoing message into.
-     * Must be followed by a call to commit() to actually send the data.
+     * Must be followed by a call to commit() to actually send the data,
+     * or discard() to give it back.
      *
      * Allows the serializer to write directly to the buffer that will
-     * be sent over the wire, so avoids an extra copy step.
+     * be handed to the RTPS layer, so avoids an extra copy step.
+     * On framed topics, room is left in front for the frame header.
+     *
+     * Buffers come from a fixed pool allocated in init(); returns false
+     * if they're all out on loan.
      */
 
-    if (len > topicDataType.m_typeSize) {
+    if (len > maxPayloadSize) {
         return false;
     }
 
-    if (!topicData.ensureCap(len)) {
+    if (shared) {
+        *b = shared->acquire();
+        return *b != nullptr;
+    }
+
+    int slot = loans.acquire(dataOffset + (framed ? framePad(len) : len));
+    if (slot == LoanPool::InvalidSlot) {
         return false;
     }
 
-    *b = topicData.buf;
-    reserved = true;
+    *b = loans.buffer(slot) + dataOffset;
     return true;
 }
 
-bool PublisherImpl::publishReserved(const uint8_t *b, size_t len)
+bool PublisherImpl::commit(const uint8_t *b, size_t len)
 {
     /*
-     * Send data that has been written to topicData via reserve().
+     * Send data that has been written to a buffer from loan(),
+     * and return the buffer to the pool.
+     *
+     * By-reference topics send the buffer's descriptor instead, and the
+     * buffer goes back to the pool once subscribers are done with it.
      */
 
-    assert(reserved && "publishReserved() called without first calling reserve()");
-    reserved = false;
+    if (shared) {
+        BufferDescriptor d;
+        if (len > maxPayloadSize || !shared->commit(b, len, &d)) {
+            discard(b);
+            return false;
+        }
+        sizes.record(len);
+        return send(reinterpret_cast<const uint8_t *>(&d), sizeof(d));
+    }
 
-    // sanity check, make sure caller is passing back reserved data
-    if (b != topicData.buf) {
+    // sanity check, make sure caller is passing back loaned data
+    int slot = loanedSlot(b);
+    if (slot == LoanPool::InvalidSlot) {
         return false;
     }
 
-    if (!matchedSubs) {
-        return false; // don't bother if nobody is listening
+    if (len > maxPayloadSize || dataOffset + len > loans.slotSize(slot)) {
+        loans.release(slot);
+        return false;
     }
 
-    if (len > topicDataType.m_typeSize || len > topicData.cap) {
-        return false;
+    sizes.record(len);
+
+    if (framed) {
+        FrameWriter fw(loans.buffer(slot), loans.slotSize(slot));
+        fw.commit(len, nextSequence++, toInt64(clock::now()));
+        len = fw.length();
+    }
+
+    return sendSlot(slot, len);
+}
+
+void PublisherImpl::discard(const uint8_t *b)
+{
+    /*
+     * Return a loaned buffer to the pool without sending it.
+     */
+
+    if (shared) {
+        shared->discard(b);
+        return;
     }
 
-    topicData.len = len;
-    return frpub->write(&topicData);
+    int slot = loanedSlot(b);
+    if (slot != LoanPool::InvalidSlot) {
+        loans.release(slot);
+    }
 }
 
 bool PublisherImpl::publish(const uint8_t *b, size_t len)
@@ -116,29 +256,576 @@ bool PublisherImpl::publish(const uint8_t *b, size_t len)
      * Publish some bytes.
      * Callers must have already serialized their data into b.
      *
-     * See reserve()/publishReserved() for a zero-copy API.
+     * The RTPS layer copies b while serializing, so we can hand it
+     * the caller's buffer directly. Framed topics need the frame
+     * header in front, so are sent as a batch of one.
+     *
+     * See loan()/commit() for a zero-copy API.
      */
 
-    assert(!reserved && "publish() called while reserve() is still outstanding");
+    if (framed) {
+        BatchSample s(b, len);
+        return publishBatch(&s, 1) == 1;
+    }
+
+    if (len > maxPayloadSize) {
+        return false;
+    }
+
+    if (shared) {
+        // by reference: copied once, into a shared buffer
+        uint8_t *sb;
+        if (!loan(&sb, len)) {
+            return false;
+        }
+        memcpy(sb, b, len);
+        return commit(sb, len);
+    }
+
+    sizes.record(len);
+    return send(b, len);
+}
 
-    if (!matchedSubs) {
+bool PublisherImpl::send(const uint8_t *b, size_t len)
+{
+    if (!listening()) {
         return false; // don't bother if nobody is listening
     }
 
-    if (len > topicDataType.m_typeSize) {
-        return false;
+    if (queue) {
+        // async: the caller may reuse b once we return, so it must be copied
+        bool accepted;
+        int slot = acquireSlot(len, &accepted);
+        if (slot == LoanPool::InvalidSlot) {
+            return accepted;
+        }
+        memcpy(loans.buffer(slot), b, len);
+        return sendSlot(slot, len);
     }
 
-    if (!topicData.write(b, len)) {
+    ByteBufFragment f = {b, len};
+    return write(&f, 1, len);
+}
+
+bool PublisherImpl::publishGather(const ByteBufFragment *frags, size_t n)
+{
+    /*
+     * Publish the concatenation of several buffers.
+     *
+     * In the common (sync, unframed) case the fragments are gathered
+     * directly into the RTPS payload as it's serialized, so nothing is
+     * copied beforehand. Otherwise they're gathered into a loan slot.
+     */
+
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        len += frags[i].len;
+    }
+
+    if (len > maxPayloadSize) {
         return false;
     }
 
-    return frpub->write(&topicData);
+    if (!framed && !queue && !shared) {
+        sizes.record(len);
+        if (!listening()) {
+            return false; // don't bother if nobody is listening
+        }
+        return write(frags, n, len);
+    }
+
+    uint8_t *b;
+    if (shared) {
+        if (!loan(&b, len)) {
+            return false;
+        }
+    } else {
+        bool accepted;
+        int slot = acquireSlot(dataOffset + (framed ? framePad(len) : len), &accepted);
+        if (slot == LoanPool::InvalidSlot) {
+            return accepted;
+        }
+        b = loans.buffer(slot) + dataOffset;
+    }
+
+    ByteBufTopicData(frags, n).read(b, len);
+    return commit(b, len);
+}
+
+size_t PublisherImpl::publishBatch(const BatchSample *samples, size_t n)
+{
+    /*
+     * Pack as many samples as will fit into each RTPS sample, so a burst of
+     * small messages costs one RTPS write (and one datagram) per frame
+     * rather than one per message.
+     *
+     * Unframed topics have no way to delimit samples on the wire,
+     * so just publish them one at a time.
+     */
+
+    size_t sent = 0;
+
+    if (!framed) {
+        while (sent < n && publish(samples[sent].bytes, samples[sent].len)) {
+            sent++;
+        }
+        return sent;
+    }
+
+    if (!listening()) {
+        return 0; // don't bother if nobody is listening
+    }
+
+    int64_t now = toInt64(clock::now());
+
+    while (sent < n) {
+        const BatchSample &next = samples[sent];
+        if (next.len > maxPayloadSize) {
+            break;
+        }
+
+        // too big for a frame of its own: send it in pieces
+        if (fragmentCount(next.len, topicDataType.m_typeSize) > 1) {
+            int64_t ts = toInt64(next.sourceTimestamp);
+            if (!publishFragments(next, (ts == NSEC_INVALID) ? now : ts)) {
+                break;
+            }
+            sent++;
+            continue;
+        }
+
+        // room for at least the next sample; on dynamic topics, small
+        // samples still get a slot big enough to batch several
+        size_t want = sizeof(FrameHeader) + frameEntrySpace(next.len);
+        bool accepted;
+        int slot = acquireSlot(std::max(want, FRAME_MIN_TYPE_SIZE), &accepted);
+        if (slot == LoanPool::InvalidSlot) {
+            if (!accepted) {
+                break;
+            }
+            sent++; // dropped under OVERFLOW_DROP_NEWEST, as publish() would
+            continue;
+        }
+
+        FrameWriter fw(loans.buffer(slot), loans.slotSize(slot));
+        size_t i = sent;
+        while (i < n && samples[i].len <= maxPayloadSize && fw.fits(samples[i].len)) {
+            const BatchSample &s = samples[i];
+            int64_t ts = toInt64(s.sourceTimestamp);
+            fw.append(s.bytes, s.len, nextSequence++, (ts == NSEC_INVALID) ? now : ts);
+            sizes.record(s.len);
+            i++;
+        }
+
+        if (fw.count() == 0) {
+            loans.release(slot); // next sample is too big
+            break;
+        }
+        if (!sendSlot(slot, fw.length())) {
+            break;
+        }
+        sent = i;
+    }
+
+    return sent;
+}
+
+bool PublisherImpl::publishFragments(const BatchSample &s, int64_t timestamp)
+{
+    /*
+     * Send a sample too big for one RTPS sample as a series of fragment
+     * frames (see frame.h), each written from its own loan slot.
+     *
+     * Gives up if a fragment can't be sent; subscribers discard the
+     * incomplete sample once their reassembly timeout expires.
+     */
+
+    size_t space = fragmentSpace(topicDataType.m_typeSize);
+    int64_t seq = nextSequence++;
+    sizes.record(s.len);
+
+    for (size_t off = 0; off < s.len; off += space) {
+        size_t len = std::min(space, s.len - off);
+        bool accepted;
+        int slot = acquireSlot(sizeof(FrameHeader) + sizeof(FragmentEntry) + len, &accepted);
+        if (slot == LoanPool::InvalidSlot) {
+            return accepted;
+        }
+
+        size_t flen = writeFragment(loans.buffer(slot), seq, timestamp, s.len, off, s.bytes + off,
+                                    len);
+        if (!sendSlot(slot, flen)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifndef COMMKIT_NO_CAPNP
+bool PublisherImpl::publishCapnBuilder()
+{
+    /*
+     * Publish the message in our capnBuilder(), then reset it for the next one.
+     *
+     * A single segment message is already laid out as a flat array in the
+     * builder's buffer, so goes out as is. Anything bigger is gathered
+     * segment by segment.
+     */
+
+    bool ok;
+    const uint8_t *b;
+    size_t len;
+    if (capn.flat(&b, &len)) {
+        ok = publish(b, len);
+    } else {
+        ok = publishSegments(capn.message());
+    }
+
+    capn.reset(capnSegmentSize());
+    return ok;
+}
+
+bool PublisherImpl::publishSegments(capnp::MessageBuilder &mb)
+{
+    /*
+     * Publish a message in capnp's standard stream framing (the layout
+     * messageToFlatArray() produces, and Payload::toReader() expects)
+     * without first flattening it: the segment table is built on the
+     * stack and sent, along with the segments themselves, as a gather list.
+     *
+     * Messages with an unreasonable number of segments are flattened.
+     */
+
+    auto segments = mb.getSegmentsForOutput();
+    size_t nsegs = segments.size();
+
+    if (nsegs == 0 || nsegs > CAPN_MAX_GATHER_SEGMENTS) {
+        kj::Array<capnp::word> words = capnp::messageToFlatArray(mb);
+        auto bytes = words.asBytes();
+        return publish(bytes.begin(), bytes.size());
+    }
+
+    // segment count - 1, then each segment's size in words, padded to a whole word
+    uint32_t table[CAPN_MAX_GATHER_SEGMENTS + 2];
+    table[0] = nsegs - 1;
+    for (size_t i = 0; i < nsegs; ++i) {
+        table[i + 1] = segments[i].size();
+    }
+    if (nsegs % 2 == 0) {
+        table[nsegs + 1] = 0;
+    }
+    size_t tableLen = ((nsegs + 2) / 2) * sizeof(capnp::word);
+
+    ByteBufFragment frags[CAPN_MAX_GATHER_SEGMENTS + 1];
+    frags[0] = {reinterpret_cast<const uint8_t *>(table), tableLen};
+    for (size_t i = 0; i < nsegs; ++i) {
+        const uint8_t *b = reinterpret_cast<const uint8_t *>(segments[i].begin());
+        frags[i + 1] = {b, segments[i].size() * sizeof(capnp::word)};
+    }
+
+    return publishGather(frags, nsegs + 1);
+}
+
+size_t PublisherImpl::capnSegmentSize() const
+{
+    return dynamic ? CAPN_DYNAMIC_SEGMENT_SIZE : maxPayloadSize;
+}
+#endif
+
+int PublisherImpl::loanedSlot(const uint8_t *b) const
+{
+    uintptr_t addr = reinterpret_cast<uintptr_t>(b);
+    if (addr < dataOffset) {
+        return LoanPool::InvalidSlot;
+    }
+    return loans.slotOf(reinterpret_cast<const uint8_t *>(addr - dataOffset));
+}
+
+int PublisherImpl::acquireSlot(size_t len, bool *accepted)
+{
+    /*
+     * A loan slot to send 'len' bytes from. In async mode the pool runs out
+     * as the queue fills, so the overflow policy applies here as in
+     * enqueue(): the oldest queued samples make way, or this one is
+     * dropped. 'accepted' is what publish() should return if it's dropped.
+     */
+
+    *accepted = false;
+    for (;;) {
+        int slot = loans.acquire(len);
+        if (slot != LoanPool::InvalidSlot || !queue) {
+            return slot;
+        }
+
+        QueuedSample oldest;
+        if (overflowPolicy == OVERFLOW_DROP_OLDEST && queue->pop(&oldest)) {
+            loans.release(oldest.slot);
+            drops++;
+            continue;
+        }
+
+        // nothing queued to make way (the slots are on loan, or being
+        // written by the sender), or the policy says not to
+        drops++;
+        *accepted = overflowPolicy == OVERFLOW_DROP_NEWEST;
+        return LoanPool::InvalidSlot;
+    }
+}
+
+bool PublisherImpl::sendSlot(int slot, size_t len)
+{
+    /*
+     * Send 'len' bytes from a loan slot, consuming our reference to it:
+     * written and released right away, or handed to the sender thread in
+     * async mode.
+     */
+
+    if (!listening()) {
+        loans.release(slot);
+        return false; // don't bother if nobody is listening
+    }
+
+    if (queue) {
+        return enqueue(slot, len);
+    }
+
+    ByteBufFragment f = {loans.buffer(slot), len};
+    bool ok = write(&f, 1, len, slot);
+    loans.release(slot);
+    return ok;
+}
+
+bool PublisherImpl::enqueue(int slot, size_t len)
+{
+    /*
+     * Async mode: queue a slot for the sender thread, applying
+     * the overflow policy if the queue is full.
+     */
+
+    QueuedSample qs = {slot, len};
+    while (!queue->push(qs)) {
+        if (overflowPolicy != OVERFLOW_DROP_OLDEST) {
+            loans.release(slot);
+            drops++;
+            return overflowPolicy == OVERFLOW_DROP_NEWEST;
+        }
+
+        // make room; the sender may beat us to it, in which case just retry
+        QueuedSample oldest;
+        if (queue->pop(&oldest)) {
+            loans.release(oldest.slot);
+            drops++;
+        }
+    }
+
+    node->wakeSender();
+    return true;
+}
+
+void PublisherImpl::flushQueue()
+{
+    /*
+     * Write everything queued so far. Runs on the node's sender thread,
+     * so this is where any blocking in the RTPS layer happens. Only our
+     * own flushMtx is held meanwhile, so async publishers can come and go
+     * while another's write is blocked.
+     */
+
+    QueuedSample qs;
+    while (queue->pop(&qs)) {
+        if (listening()) {
+            ByteBufFragment f = {loans.buffer(qs.slot), qs.len};
+            write(&f, 1, qs.len, qs.slot);
+        }
+        loans.release(qs.slot);
+    }
+}
+
+bool PublisherImpl::write(const ByteBufFragment *frags, size_t n, size_t len, int slot)
+{
+    /*
+     * Every sample leaves through here, by up to three routes: copied
+     * straight into the history of subscribers in this process (see
+     * deliverLocal()), to each of our other transports with readers
+     * (see NodeOpts::transports), and over RTPS for the rest. The RTPS
+     * write is skipped entirely when every subscriber is reached another way.
+     *
+     * Framed samples carry their own sequence and timestamp in the frame;
+     * others get them here, as RTPS would on the way out. A sample in a
+     * loan 'slot' may be sent from it directly, by a transport that holds
+     * on to the slot until it's done.
+     */
+
+    updateRoutes();
+    bool local = localCount.load(std::memory_order_acquire) > 0;
+    uint64_t routes = transportRoutes.load(std::memory_order_relaxed);
+
+    int64_t seq = 0;
+    int64_t now = 0;
+    if (local || routes) {
+        seq = framed ? 0 : nextSequence++;
+        now = toInt64(clock::now());
+    }
+
+    if (local) {
+        deliverLocal(frags, n, len, seq, now);
+    }
+
+    bool ok = true;
+    if (routes) {
+        SampleMeta meta = {len, seq, now, reliable, guid, slot, 0};
+        for (size_t i = 0; i < transportWriters.size(); ++i) {
+            if (routes & (uint64_t(1) << i)) {
+                ok = transportWriters[i]->write(frags, n, meta) && ok;
+            }
+        }
+    }
+
+    if (rtpsRoute.load(std::memory_order_relaxed)) {
+        ByteBufTopicData td(frags, n);
+        ok = frpub->write(&td) && ok;
+    }
+    return ok;
+}
+
+ZeroCopyStats PublisherImpl::zeroCopyStats() const
+{
+    ZeroCopyStats all;
+    for (auto &w : transportWriters) {
+        ZeroCopyStats s = w->zeroCopyStats();
+        all.sent += s.sent;
+        all.copied += s.copied;
+        all.fallbacks += s.fallbacks;
+    }
+    return all;
+}
+
+bool PublisherImpl::listening()
+{
+    if (matchedSubs || localCount.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    updateRoutes();
+    return transportRoutes.load(std::memory_order_relaxed) != 0;
+}
+
+void PublisherImpl::updateRoutes()
+{
+    /*
+     * Work out which routes write() needs whenever subscribers come or go,
+     * over RTPS or another transport: each transport anyone outside this
+     * process reads, and RTPS if any matched subscriber outside this
+     * process isn't reached another way.
+     *
+     * Transports' generations only ever go up, so their sum changes
+     * whenever any of them does.
+     */
+
+    uint32_t transportGen = 0;
+    for (auto &w : transportWriters) {
+        transportGen += w->generation();
+    }
+    uint64_t gen =
+        (uint64_t(transportGen) << 32) | matchGeneration.load(std::memory_order_acquire);
+    if (gen == routesGeneration.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(routesMtx);
+    uint64_t routes = 0;
+    for (size_t i = 0; i < transportWriters.size(); ++i) {
+        if (transportWriters[i]->hasReaders()) {
+            routes |= uint64_t(1) << i;
+        }
+    }
+    bool rtps = false;
+    for (auto &p : remoteSubs) {
+        bool reached = false;
+        for (auto &w : transportWriters) {
+            reached = reached || w->reaches(p);
+        }
+        rtps = rtps || !reached;
+    }
+
+    transportRoutes.store(routes, std::memory_order_relaxed);
+    rtpsRoute.store(rtps, std::memory_order_relaxed);
+    routesGeneration.store(gen, std::memory_order_release);
+}
+
+void PublisherImpl::deliverLocal(const ByteBufFragment *frags, size_t n, size_t len,
+                                 int64_t seq, int64_t now)
+{
+    /*
+     * Hand a sample to each attached subscriber, then queue their onMessage
+     * (and onMessageRef) callbacks to the node's dispatch thread, or their
+     * Executor. That's done once localMtx is released, as should the
+     * queue be full, the callbacks run on this thread after all, and they
+     * may well publish (even on this publisher) or create and destroy
+     * subscribers themselves.
+     */
+
+    // thread_local so it's only allocated once; callbacks that publish
+    // again append past our entries and trim back to them when done
+    static thread_local std::vector<SubscriberPtr> notify;
+    size_t first = notify.size();
+
+    {
+        std::lock_guard<std::mutex> guard(localMtx);
+        for (auto s : localSubs) {
+            if (!s->deliverLocal(frags, n, len, seq, now, guid)) {
+                continue;
+            }
+            if (auto sharedSub = s->owner()) {
+                notify.push_back(sharedSub);
+            }
+        }
+    }
+
+    for (size_t i = first; i < notify.size(); ++i) {
+        // moved out, as a callback publishing may grow 'notify' under us
+        SubscriberPtr sharedSub = std::move(notify[i]);
+        SubscriberImpl::notifyLocal(sharedSub);
+    }
+    notify.resize(first);
+}
+
+void PublisherImpl::attachLocal(SubscriberImpl *s)
+{
+    std::lock_guard<std::mutex> guard(localMtx);
+    localSubs.push_back(s);
+    localCount.store(localSubs.size(), std::memory_order_release);
+}
+
+void PublisherImpl::detachLocal(SubscriberImpl *s)
+{
+    /*
+     * Once this returns, we're no longer delivering to 's'.
+     */
+
+    std::lock_guard<std::mutex> guard(localMtx);
+    localSubs.erase(std::remove(localSubs.begin(), localSubs.end(), s), localSubs.end());
+    localCount.store(localSubs.size(), std::memory_order_release);
 }
 
 void PublisherImpl::onPublicationMatched(eprosima::fastrtps::Publisher *,
                                          eprosima::fastrtps::rtps::MatchingInfo &info)
 {
+    // subscribers in this process are delivered to directly; track the
+    // others, who may be reached by shared memory (see updateRoutes())
+    if (!node->isLocal(info.remoteEndpointGuid)) {
+        std::lock_guard<std::mutex> guard(routesMtx);
+        const auto &prefix = info.remoteEndpointGuid.guidPrefix;
+        if (info.status == MATCHED_MATCHING) {
+            remoteSubs.push_back(prefix);
+        } else {
+            auto it = std::find(remoteSubs.begin(), remoteSubs.end(), prefix);
+            if (it != remoteSubs.end()) {
+                remoteSubs.erase(it);
+            }
+        }
+        matchGeneration++;
+    }
+
     switch (info.status) {
     case MATCHED_MATCHING:
         matchedSubs++;
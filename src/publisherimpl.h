@@ -3,6 +3,17 @@
 #include <commkit/publisher.h>
 #include "nodeimpl.h"
 #include "bytebuftopic.h"
+#include "loanpool.h"
+#include "boundedqueue.h"
+#include "capnbuilder.h"
+#include "sizehistogram.h"
+#include "transport.h"
+#include "sharedbuffers.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <fastrtps/participant/Participant.h>
 #include <fastrtps/publisher/Publisher.h>
@@ -11,6 +22,8 @@
 namespace commkit
 {
 
+class SubscriberImpl;
+
 class PublisherImpl : public eprosima::fastrtps::PublisherListener
 {
 public:
@@ -25,16 +38,68 @@ public:
 
     bool init(const PublicationOpts &opts);
 
-    bool reserve(uint8_t **b, size_t len);
-    bool publishReserved(const uint8_t *b, size_t len);
+    bool loan(uint8_t **b, size_t len);
+    bool commit(const uint8_t *b, size_t len);
+    void discard(const uint8_t *b);
+
+    unsigned loansOutstanding() const
+    {
+        return shared ? shared->loaned() : loans.outstanding();
+    }
 
     bool publish(const uint8_t *b, size_t len);
+    bool publishGather(const ByteBufFragment *frags, size_t n);
+    size_t publishBatch(const BatchSample *samples, size_t n);
+
+#ifndef COMMKIT_NO_CAPNP
+    capnp::MessageBuilder &capnBuilder()
+    {
+        return capn.reset(capnSegmentSize());
+    }
+
+    bool capnBuilderOwns(const capnp::MessageBuilder &mb) const
+    {
+        return capn.owns(mb);
+    }
+
+    bool publishCapnBuilder();
+    bool publishSegments(capnp::MessageBuilder &mb);
+#endif
+
+    unsigned queueDepth() const
+    {
+        return queue ? queue->size() : 0;
+    }
+
+    uint64_t queueDrops() const
+    {
+        return drops;
+    }
+
+    PayloadSizeStats payloadSizeStats() const
+    {
+        return sizes.stats();
+    }
+
+    ZeroCopyStats zeroCopyStats() const;
+
+    // async mode: called from the node's sender thread, with flushMtx held
+    void flushQueue();
 
     unsigned matchedSubscribers() const
     {
-        return matchedSubs;
+        return matchedSubs.load();
+    }
+
+    bool isReliable() const
+    {
+        return reliable;
     }
 
+    // intra-process delivery, see NodeImpl::addLocalPublisher()
+    void attachLocal(SubscriberImpl *s);
+    void detachLocal(SubscriberImpl *s);
+
     // XXX: make this const once TopicDataType.getName() is const
     std::string datatype()
     {
@@ -50,14 +115,75 @@ public:
                               eprosima::fastrtps::rtps::MatchingInfo &info);
 
 private:
+    int loanedSlot(const uint8_t *b) const;
+    bool publishFragments(const BatchSample &s, int64_t timestamp);
+#ifndef COMMKIT_NO_CAPNP
+    size_t capnSegmentSize() const;
+#endif
+    int acquireSlot(size_t len, bool *accepted);
+    bool send(const uint8_t *b, size_t len);
+    bool sendSlot(int slot, size_t len);
+    bool enqueue(int slot, size_t len);
+    bool write(const ByteBufFragment *frags, size_t n, size_t len,
+               int slot = LoanPool::InvalidSlot);
+    void deliverLocal(const ByteBufFragment *frags, size_t n, size_t len, int64_t sequence,
+                      int64_t timestamp);
+    bool listening();
+    void updateRoutes();
+
     eprosima::fastrtps::Publisher *frpub;
-    int matchedSubs;
-    bool reserved; // was reserve() called?
+    eprosima::fastrtps::rtps::GUID_t guid;
+    std::atomic<int> matchedSubs; // read by the sender thread, in async mode
     std::shared_ptr<NodeImpl> node;
+    bool reliable;
 
     std::string topicName;
-    ByteBufTopicData topicData;
     ByteBufTopicDataType topicDataType;
+    LoanPool loans;
+
+    bool framed;
+    bool dynamic;
+    bool byReference;
+    size_t maxPayloadSize;              // largest sample, see maxSampleSize()
+    size_t dataOffset;                  // where loaned data starts within a slot
+    std::atomic<int64_t> nextSequence; // for framed samples
+
+    // async mode: loan slots waiting for the sender thread
+    struct QueuedSample {
+        int slot;
+        size_t len;
+    };
+    std::unique_ptr<BoundedQueue<QueuedSample>> queue;
+    OverflowPolicy overflowPolicy;
+    std::atomic<uint64_t> drops;
+    std::mutex flushMtx; // held by the sender thread while it writes for us
+
+    friend class NodeImpl; // for flushMtx
+
+    SizeHistogram sizes;
+
+    // by-reference topics: where samples go, while RTPS carries descriptors
+    std::unique_ptr<SharedBufferPool> shared;
+
+    // subscribers in this process, which write() delivers to directly
+    std::mutex localMtx; // guards localSubs, held while delivering
+    std::vector<SubscriberImpl *> localSubs;
+    std::atomic<unsigned> localCount;
+
+    // our endpoints on transports beside RTPS, highest priority first
+    std::vector<std::unique_ptr<TransportWriter>> transportWriters;
+
+    // which routes write() takes, see updateRoutes()
+    std::mutex routesMtx; // guards remoteSubs, held while updating routes
+    std::vector<eprosima::fastrtps::rtps::GuidPrefix_t> remoteSubs; // matched, not in-process
+    std::atomic<uint32_t> matchGeneration;                         // bumped as remoteSubs changes
+    std::atomic<uint64_t> routesGeneration;
+    std::atomic<uint64_t> transportRoutes; // a bit per transportWriters entry
+    std::atomic<bool> rtpsRoute;
+
+#ifndef COMMKIT_NO_CAPNP
+    CapnBuilder capn;
+#endif
 
     std::weak_ptr<Publisher> pub;
 };
@@ -0,0 +1,595 @@
+#include "sharedbuffers.h"
+#include "threadregistry.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <random>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <linux/memfd.h>
+#endif
+
+namespace commkit
+{
+
+constexpr unsigned SharedBufferPool::MaxReaders;
+
+static constexpr uint32_t BUFFERS_MAGIC = 0x636b6266; // "fbkc"
+static constexpr uint32_t BUFFERS_VERSION = 1;
+static constexpr size_t BUFFERS_ALIGN = 64;
+
+// how long a subscriber waits for a publisher to answer on its control socket
+static constexpr int BUFFERS_CONNECT_TIMEOUT_S = 1;
+
+#ifdef __linux__
+// whether the other end of Unix socket 'fd' runs as the same user we do
+static bool sameUser(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+}
+#endif
+
+enum OwnerState : uint8_t {
+    BUFFER_FREE = 0,   // ours to reuse, once no reader holds it
+    BUFFER_LOANED = 1, // being written, see acquire()
+    BUFFER_HELD = 2,   // one of the last 'history' published
+};
+
+struct SharedBufferPool::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t buffers;
+    uint32_t reserved;
+    uint64_t bufferSize;
+    uint64_t stride;
+    uint64_t dataOffset;
+};
+
+struct SharedBufferPool::BufferState {
+    alignas(BUFFERS_ALIGN) std::atomic<uint64_t> generation;
+    std::atomic<uint64_t> readers; // a bit per subscriber holding the buffer
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared buffer pools need address-free atomics");
+
+/*
+ * Sent to each subscriber as it connects, along with the memfd.
+ */
+struct Hello {
+    uint32_t magic;
+    uint32_t reader; // bit to set in BufferState::readers
+    uint32_t buffers;
+    uint32_t reserved;
+    uint64_t bufferSize;
+    uint64_t stride;
+    uint64_t dataOffset;
+};
+
+static size_t align(size_t n, size_t to)
+{
+    return (n + to - 1) & ~(to - 1);
+}
+
+SharedBufferPool::SharedBufferPool()
+    : poolID(0), memfd(-1), mem(nullptr), memSize(0), data(nullptr), stride(0), nbuffers(0),
+      bufferSize(0), loanCount(0), historyNext(0), listenFd(-1), wakeFd(-1),
+      threads(nullptr)
+{
+}
+
+SharedBufferMap::SharedBufferMap()
+    : poolID(0), sock(-1), header(nullptr), headerSize(0), data(nullptr), dataSize(0), stride(0),
+      nbuffers(0), bufferSize(0), readerBit(0)
+{
+}
+
+#ifdef __linux__
+
+// abstract socket names: nothing to clean up after a crash
+static socklen_t controlAddress(uint64_t id, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "commkit-buffers-%016llx",
+                     static_cast<unsigned long long>(id));
+    return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+SharedBufferPool::~SharedBufferPool()
+{
+    if (control.joinable()) {
+        uint64_t one = 1;
+        ssize_t r = ::write(wakeFd, &one, sizeof(one));
+        (void)r;
+        control.join();
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+    }
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+    if (mem != nullptr) {
+        munmap(mem, memSize);
+    }
+    if (memfd >= 0) {
+        close(memfd);
+    }
+}
+
+SharedBufferPool::BufferState &SharedBufferPool::state(unsigned i) const
+{
+    return reinterpret_cast<BufferState *>(mem + align(sizeof(Header), BUFFERS_ALIGN))[i];
+}
+
+bool SharedBufferPool::init(unsigned buffers, size_t size, unsigned historyDepth,
+                            ThreadRegistry *reg)
+{
+    /*
+     * Lay out the pool: a header and the buffers' states, then the buffers
+     * themselves from a page boundary, so subscribers can map those alone
+     * read only. The memfd is sealed at this size, so subscribers can
+     * trust it won't shrink under them.
+     */
+
+    if (mem != nullptr || buffers == 0 || size == 0 || historyDepth == 0 ||
+        historyDepth >= buffers) {
+        return false;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t headerSize = align(sizeof(Header), BUFFERS_ALIGN) + sizeof(BufferState) * buffers;
+    size_t dataOffset = align(headerSize, page);
+    stride = align(size, BUFFERS_ALIGN);
+    memSize = dataOffset + stride * buffers;
+
+    memfd = syscall(SYS_memfd_create, "commkit-buffers", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, memSize) != 0) {
+        return false;
+    }
+#ifdef F_ADD_SEALS
+    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+
+    void *p = mmap(nullptr, memSize, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    mem = static_cast<uint8_t *>(p);
+    data = mem + dataOffset;
+    nbuffers = buffers;
+    bufferSize = size;
+
+    // the new mapping is zeroed, so this only needs to construct the atomics
+    Header *h = new (mem) Header();
+    h->magic = BUFFERS_MAGIC;
+    h->version = BUFFERS_VERSION;
+    h->buffers = buffers;
+    h->bufferSize = size;
+    h->stride = stride;
+    h->dataOffset = dataOffset;
+    for (unsigned i = 0; i < buffers; ++i) {
+        new (&state(i)) BufferState();
+    }
+
+    owner.reset(new std::atomic<uint8_t>[buffers]);
+    for (unsigned i = 0; i < buffers; ++i) {
+        owner[i] = BUFFER_FREE;
+    }
+    history.assign(historyDepth, -1);
+
+    std::random_device rd;
+    poolID = (uint64_t(rd()) << 32) | rd();
+
+    struct sockaddr_un addr;
+    socklen_t addrLen = controlAddress(poolID, &addr);
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), addrLen) != 0 ||
+        listen(listenFd, MaxReaders) != 0) {
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        return false;
+    }
+
+    threads = reg;
+    control = std::thread(&SharedBufferPool::serve, this);
+    return true;
+}
+
+uint8_t *SharedBufferPool::acquire()
+{
+    /*
+     * Find a buffer that neither we nor any subscriber holds. Readers are
+     * checked again after the generation is bumped, in case one pinned
+     * an old descriptor for it meanwhile (see the class comment).
+     */
+
+    for (unsigned i = 0; i < nbuffers; ++i) {
+        BufferState &s = state(i);
+        uint8_t expected = BUFFER_FREE;
+        if (s.readers.load() != 0 ||
+            !owner[i].compare_exchange_strong(expected, BUFFER_LOANED)) {
+            continue;
+        }
+
+        s.generation.fetch_add(1);
+        if (s.readers.load() != 0) {
+            owner[i] = BUFFER_FREE;
+            continue;
+        }
+
+        loanCount++;
+        return data + i * stride;
+    }
+    return nullptr;
+}
+
+int SharedBufferPool::indexOf(const uint8_t *b) const
+{
+    if (b < data || b >= data + stride * nbuffers || (b - data) % stride != 0) {
+        return -1;
+    }
+    int i = (b - data) / stride;
+    return owner[i] == BUFFER_LOANED ? i : -1;
+}
+
+bool SharedBufferPool::commit(const uint8_t *b, size_t len, BufferDescriptor *d)
+{
+    int i = indexOf(b);
+    if (i < 0) {
+        return false;
+    }
+    if (len > bufferSize) {
+        discard(b);
+        return false;
+    }
+
+    d->pool = poolID;
+    d->buffer = i;
+    d->flags = 0;
+    d->generation = state(i).generation.load();
+    d->offset = 0;
+    d->len = len;
+
+    owner[i] = BUFFER_HELD;
+    loanCount--;
+
+    // the oldest held buffer makes way
+    int oldest;
+    {
+        std::lock_guard<std::mutex> guard(historyMtx);
+        oldest = history[historyNext];
+        history[historyNext] = i;
+        historyNext = (historyNext + 1) % history.size();
+    }
+    if (oldest >= 0) {
+        owner[oldest] = BUFFER_FREE;
+    }
+    return true;
+}
+
+void SharedBufferPool::discard(const uint8_t *b)
+{
+    int i = indexOf(b);
+    if (i >= 0) {
+        owner[i] = BUFFER_FREE;
+        loanCount--;
+    }
+}
+
+void SharedBufferPool::serve()
+{
+    /*
+     * Control thread: hand each subscriber that connects the memfd and a
+     * reader bit, and clear its bits once it hangs up. Subscribers send
+     * nothing; the connection is only there to tell when they've gone.
+     * Anyone can reach an abstract socket, so those running as another
+     * user are turned away.
+     */
+
+    ThreadRegistry::Scope scope(threads, THREAD_BUFFERS, "ck-buffers");
+
+    std::vector<struct pollfd> fds = {{wakeFd, POLLIN, 0}, {listenFd, POLLIN, 0}};
+    std::vector<unsigned> readerOf(2); // per entry in fds
+    uint64_t inUse = 0;
+
+    for (;;) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+
+        for (size_t i = 2; i < fds.size();) {
+            char b;
+            ssize_t r = fds[i].revents ? recv(fds[i].fd, &b, sizeof(b), MSG_DONTWAIT) : 1;
+            if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+                dropReader(readerOf[i]);
+                inUse &= ~(uint64_t(1) << readerOf[i]);
+                close(fds[i].fd);
+                fds.erase(fds.begin() + i);
+                readerOf.erase(readerOf.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int c = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0) {
+                continue;
+            }
+            // the memfd goes writable, for the reader masks: our user only
+            if (!sameUser(c)) {
+                close(c);
+                continue;
+            }
+
+            unsigned reader = 0;
+            while (reader < MaxReaders && (inUse & (uint64_t(1) << reader))) {
+                reader++;
+            }
+
+            Hello hello = {BUFFERS_MAGIC, reader, nbuffers, 0, bufferSize, stride,
+                           uint64_t(data - mem)};
+            struct iovec iov = {&hello, sizeof(hello)};
+            char cbuf[CMSG_SPACE(sizeof(int))] = {};
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = cbuf;
+            msg.msg_controllen = sizeof(cbuf);
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_RIGHTS;
+            cm->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cm), &memfd, sizeof(int));
+
+            // too many readers: hang up, and the subscriber goes without
+            if (reader == MaxReaders || sendmsg(c, &msg, MSG_NOSIGNAL) != sizeof(hello)) {
+                close(c);
+                continue;
+            }
+
+            inUse |= uint64_t(1) << reader;
+            fds.push_back({c, POLLIN, 0});
+            readerOf.push_back(reader);
+        }
+    }
+
+    for (size_t i = 2; i < fds.size(); ++i) {
+        close(fds[i].fd);
+    }
+}
+
+void SharedBufferPool::dropReader(unsigned reader)
+{
+    uint64_t mask = ~(uint64_t(1) << reader);
+    for (unsigned i = 0; i < nbuffers; ++i) {
+        state(i).readers.fetch_and(mask);
+    }
+}
+
+SharedBufferMap::~SharedBufferMap()
+{
+    if (header != nullptr) {
+        munmap(header, headerSize);
+    }
+    if (data != nullptr) {
+        munmap(data, dataSize);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+std::shared_ptr<SharedBufferMap> SharedBufferMap::connect(uint64_t id)
+{
+    /*
+     * Fetch the pool's memfd from its control socket, and map the reader
+     * masks read-write and the buffers read only. We stay connected, so
+     * the publisher knows when we've gone.
+     */
+
+    std::shared_ptr<SharedBufferMap> m(new SharedBufferMap());
+    m->poolID = id;
+
+    m->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (m->sock < 0) {
+        return nullptr;
+    }
+    // connect() waits on a full backlog as a send would
+    struct timeval tv = {BUFFERS_CONNECT_TIMEOUT_S, 0};
+    setsockopt(m->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(m->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // and only map pools of our own user's, not an impostor's
+    struct sockaddr_un addr;
+    socklen_t addrLen = controlAddress(id, &addr);
+    if (::connect(m->sock, reinterpret_cast<struct sockaddr *>(&addr), addrLen) != 0 ||
+        !sameUser(m->sock)) {
+        return nullptr;
+    }
+
+    Hello hello;
+    struct iovec iov = {&hello, sizeof(hello)};
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(m->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(hello)) {
+        return nullptr;
+    }
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (cm == nullptr || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+        return nullptr;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+
+    struct stat st;
+    size_t size = hello.dataOffset + hello.stride * hello.buffers;
+    bool ok = hello.magic == BUFFERS_MAGIC && hello.reader < SharedBufferPool::MaxReaders &&
+              fstat(fd, &st) == 0 && st.st_size == off_t(size);
+
+    void *h = MAP_FAILED;
+    void *d = MAP_FAILED;
+    if (ok) {
+        h = mmap(nullptr, hello.dataOffset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        d = mmap(nullptr, size - hello.dataOffset, PROT_READ, MAP_SHARED, fd, hello.dataOffset);
+    }
+    close(fd);
+
+    if (h != MAP_FAILED) {
+        m->header = static_cast<uint8_t *>(h);
+        m->headerSize = hello.dataOffset;
+    }
+    if (d != MAP_FAILED) {
+        m->data = static_cast<uint8_t *>(d);
+        m->dataSize = size - hello.dataOffset;
+    }
+    if (m->header == nullptr || m->data == nullptr) {
+        return nullptr;
+    }
+
+    const SharedBufferPool::Header *ph = reinterpret_cast<SharedBufferPool::Header *>(m->header);
+    if (ph->magic != BUFFERS_MAGIC || ph->version != BUFFERS_VERSION ||
+        ph->buffers != hello.buffers || ph->stride != hello.stride) {
+        return nullptr;
+    }
+
+    m->nbuffers = hello.buffers;
+    m->bufferSize = hello.bufferSize;
+    m->stride = hello.stride;
+    m->readerBit = uint64_t(1) << hello.reader;
+    m->pins.assign(m->nbuffers, 0);
+    return m;
+}
+
+bool SharedBufferMap::pin(const BufferDescriptor &d)
+{
+    /*
+     * Set our bit, then check the buffer hasn't moved on to another sample
+     * (see SharedBufferPool). Our bit stays set while any sample in the
+     * buffer is pinned.
+     */
+
+    if (d.pool != poolID || d.buffer >= nbuffers || d.offset > bufferSize ||
+        d.len > bufferSize - d.offset) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(pinMtx);
+    if (pins[d.buffer]++ == 0) {
+        readers(d.buffer).fetch_or(readerBit);
+    }
+    if (generation(d.buffer).load() != d.generation) {
+        if (--pins[d.buffer] == 0) {
+            readers(d.buffer).fetch_and(~readerBit);
+        }
+        return false;
+    }
+    return true;
+}
+
+void SharedBufferMap::unpin(unsigned buffer)
+{
+    std::lock_guard<std::mutex> guard(pinMtx);
+    if (buffer < nbuffers && pins[buffer] > 0 && --pins[buffer] == 0) {
+        readers(buffer).fetch_and(~readerBit);
+    }
+}
+
+std::atomic<uint64_t> &SharedBufferMap::readers(unsigned buffer) const
+{
+    size_t states = align(sizeof(SharedBufferPool::Header), BUFFERS_ALIGN);
+    return reinterpret_cast<SharedBufferPool::BufferState *>(header + states)[buffer].readers;
+}
+
+std::atomic<uint64_t> &SharedBufferMap::generation(unsigned buffer) const
+{
+    size_t states = align(sizeof(SharedBufferPool::Header), BUFFERS_ALIGN);
+    return reinterpret_cast<SharedBufferPool::BufferState *>(header + states)[buffer].generation;
+}
+
+bool SharedBufferMap::closed() const
+{
+    struct pollfd p = {sock, POLLIN, 0};
+    return poll(&p, 1, 0) != 0;
+}
+
+#else // __linux__
+
+SharedBufferPool::~SharedBufferPool()
+{
+}
+
+bool SharedBufferPool::init(unsigned, size_t, unsigned, ThreadRegistry *)
+{
+    return false;
+}
+
+uint8_t *SharedBufferPool::acquire()
+{
+    return nullptr;
+}
+
+bool SharedBufferPool::commit(const uint8_t *, size_t, BufferDescriptor *)
+{
+    return false;
+}
+
+void SharedBufferPool::discard(const uint8_t *)
+{
+}
+
+SharedBufferMap::~SharedBufferMap()
+{
+}
+
+std::shared_ptr<SharedBufferMap> SharedBufferMap::connect(uint64_t)
+{
+    return nullptr;
+}
+
+bool SharedBufferMap::pin(const BufferDescriptor &)
+{
+    return false;
+}
+
+void SharedBufferMap::unpin(unsigned)
+{
+}
+
+bool SharedBufferMap::closed() const
+{
+    return true;
+}
+
+#endif // __linux__
+
+} // namespace commkit
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace commkit
+{
+
+class ThreadRegistry;
+
+/*
+ * What goes over the wire on a by-reference topic (see Topic::byReference)
+ * in place of the sample: where to find it in the publisher's buffer pool.
+ */
+struct BufferDescriptor {
+    uint64_t pool;       // SharedBufferPool::id(), which also names its control socket
+    uint32_t buffer;     // index within the pool
+    uint32_t flags;      // reserved, zero
+    uint64_t generation; // the buffer's generation when the sample was written
+    uint64_t offset;     // of the sample within the buffer
+    uint64_t len;
+};
+
+/*
+ * Publisher side of a by-reference topic: a pool of buffers in one memfd,
+ * which subscribers on this host map read only.
+ *
+ * Subscribers get the memfd over a Unix socket, the pool's control channel,
+ * and are each given a bit in the reader mask kept with every buffer. The
+ * memfd is writable, so they can set their bits, so only subscribers
+ * running as the publisher's user (SO_PEERCRED) are given it. A
+ * subscriber holding a sample sets its bit for the buffer; a buffer is only
+ * reused once no bits are set and it's not one of the last 'history' samples
+ * published. A subscriber that goes away, cleanly or not, closes its end of
+ * the socket, and its bits are cleared.
+ *
+ * Every reuse bumps the buffer's generation. A subscriber sets its bit then
+ * checks the generation still matches the descriptor's, while acquire()
+ * bumps the generation then checks no bits are set, so at least one of them
+ * sees the other: descriptors for a recycled buffer are refused, never read.
+ *
+ * Linux only; init() fails elsewhere.
+ */
+class SharedBufferPool
+{
+public:
+    static constexpr unsigned MaxReaders = 64;
+
+    SharedBufferPool();
+    ~SharedBufferPool();
+
+    SharedBufferPool(const SharedBufferPool &) = delete;
+    SharedBufferPool &operator=(const SharedBufferPool &) = delete;
+
+    // the control thread registers with 'threads', if any
+    bool init(unsigned buffers, size_t bufferSize, unsigned history,
+              ThreadRegistry *threads = nullptr);
+
+    uint64_t id() const
+    {
+        return poolID;
+    }
+
+    // a free buffer to write a sample into, or nullptr if there's none
+    uint8_t *acquire();
+
+    // the sample in acquired buffer 'b' is ready to send: describe it, and
+    // hold the buffer as one of the last 'history' samples
+    bool commit(const uint8_t *b, size_t len, BufferDescriptor *d);
+    void discard(const uint8_t *b);
+
+    unsigned loaned() const
+    {
+        return loanCount;
+    }
+
+private:
+    struct Header;
+    struct BufferState;
+
+    int indexOf(const uint8_t *b) const;
+    BufferState &state(unsigned i) const;
+    void serve();
+    void dropReader(unsigned reader);
+
+    uint64_t poolID;
+    int memfd;
+    uint8_t *mem;
+    size_t memSize;
+    uint8_t *data;
+    size_t stride;
+    unsigned nbuffers;
+    size_t bufferSize;
+
+    // our side of each buffer, see acquire() / commit()
+    std::unique_ptr<std::atomic<uint8_t>[]> owner;
+    std::atomic<unsigned> loanCount;
+
+    std::mutex historyMtx; // guards history, historyNext
+    std::vector<int> history;
+    size_t historyNext;
+
+    // control channel: accepts subscribers and notices when they leave
+    int listenFd;
+    int wakeFd;
+    ThreadRegistry *threads;
+    std::thread control;
+
+    friend class SharedBufferMap; // shares Header and BufferState
+};
+
+/*
+ * Subscriber side: one publisher's pool, mapped read only but for the
+ * reader masks. The mapping outlives the publisher; closed() tells when
+ * it's gone. Any thread may pin() and unpin().
+ */
+class SharedBufferMap
+{
+public:
+    ~SharedBufferMap();
+
+    // connect to pool 'id' on this host; null if it can't be reached, or
+    // belongs to another user. May wait a second for an answer
+    static std::shared_ptr<SharedBufferMap> connect(uint64_t id);
+
+    uint64_t id() const
+    {
+        return poolID;
+    }
+
+    // hold d's buffer until unpin(); false if it's already been reused
+    bool pin(const BufferDescriptor &d);
+    void unpin(unsigned buffer);
+
+    uint8_t *sample(const BufferDescriptor &d) const
+    {
+        return data + d.buffer * stride + d.offset;
+    }
+
+    bool closed() const;
+
+private:
+    SharedBufferMap();
+
+    std::atomic<uint64_t> &readers(unsigned buffer) const;
+    std::atomic<uint64_t> &generation(unsigned buffer) const;
+
+    uint64_t poolID;
+    int sock;
+    uint8_t *header;
+    size_t headerSize;
+    uint8_t *data;
+    size_t dataSize;
+    size_t stride;
+    unsigned nbuffers;
+    size_t bufferSize;
+    uint64_t readerBit;
+
+    std::mutex pinMtx; // guards pins, and their reader bits
+    std::vector<unsigned> pins;
+};
+
+} // namespace commkit
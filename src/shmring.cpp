@@ -0,0 +1,500 @@
+#include "shmring.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace commkit
+{
+
+// out of line definitions, for when these are odr-used (e.g. bound to a reference)
+constexpr unsigned ShmRing::MaxPeers;
+constexpr size_t ShmRing::PrefixSize;
+constexpr size_t ShmRing::GuidSize;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory rings need address-free atomics");
+
+static constexpr uint32_t SHM_MAGIC = 0x636b7368; // "hskc"
+static constexpr uint32_t SHM_VERSION = 1;
+static constexpr size_t SHM_ALIGN = 64;
+
+// how long to wait for another process to finish creating a ring
+static constexpr unsigned SHM_OPEN_TRIES = 100;
+static constexpr std::chrono::milliseconds SHM_OPEN_RETRY(10);
+
+// how long a slot may be mid-write before the next writer to come round
+// to it takes it over, its writer being presumed dead
+static constexpr std::chrono::milliseconds SHM_WRITE_STALL(100);
+
+enum PeerState : uint32_t {
+    PEER_FREE = 0,
+    PEER_CLAIMED = 1, // being filled in
+    PEER_ACTIVE = 2,
+};
+
+struct ShmRing::Peer {
+    std::atomic<uint32_t> state;
+    uint32_t kind;
+    int32_t pid;
+    uint8_t prefix[PrefixSize];
+};
+
+struct ShmRing::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slotSize;
+    std::atomic<uint32_t> ready; // set once the creator has initialized everything
+
+    std::atomic<uint32_t> peerGeneration;
+    Peer peers[MaxPeers];
+
+    alignas(SHM_ALIGN) std::atomic<uint64_t> writeIndex;
+    alignas(SHM_ALIGN) std::atomic<uint32_t> notifyCount; // futex word
+    std::atomic<uint32_t> sleepers;
+};
+
+/*
+ * Each slot's seq is 2 * index + 1 while the sample for 'index' is being
+ * written, and 2 * index + 2 once it's complete.
+ */
+struct ShmRing::Slot {
+    std::atomic<uint64_t> seq;
+    uint32_t len;
+    uint32_t reliable;
+    int64_t sequence;
+    int64_t timestamp;
+    uint8_t writer[GuidSize];
+};
+
+static size_t align(size_t n)
+{
+    return (n + SHM_ALIGN - 1) & ~(SHM_ALIGN - 1);
+}
+
+static bool processAlive(int32_t pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// unlink 'name', unless it's since been replaced by a ring other than
+// the one we looked at (inode 'ino')
+static void unlinkIfSame(const std::string &name, ino_t ino)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    bool same = fstat(fd, &st) == 0 && st.st_ino == ino;
+    ::close(fd);
+    if (same) {
+        shm_unlink(name.c_str());
+    }
+}
+
+ShmRing::ShmRing() : mem(nullptr), memSize(0), header(nullptr), stride(0)
+{
+}
+
+ShmRing::~ShmRing()
+{
+    close();
+}
+
+std::string ShmRing::ringName(uint32_t domainID, const std::string &topic)
+{
+    std::string name = "/commkit-" + std::to_string(domainID) + "-";
+    for (char c : topic) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                  c == '-' || c == '.';
+        name += ok ? c : '_';
+    }
+    return name;
+}
+
+bool ShmRing::open(const std::string &name, unsigned slots, size_t slotSize)
+{
+    /*
+     * A ring left behind by processes that have exited is reused, or, if
+     * laid out differently (for a different topic definition, or by
+     * a process that died creating it), recreated. One laid out
+     * differently that's still in use is left alone, and open() fails.
+     */
+
+    if (mem != nullptr || slots == 0 || slotSize == 0 || slotSize > UINT32_MAX) {
+        return false;
+    }
+
+    ino_t stale;
+    if (tryOpen(name, slots, slotSize, &stale)) {
+        return true;
+    }
+    if (stale == 0) {
+        return false;
+    }
+    unlinkIfSame(name, stale);
+    return tryOpen(name, slots, slotSize, &stale);
+}
+
+bool ShmRing::tryOpen(const std::string &name, unsigned slots, size_t slotSize, ino_t *stale)
+{
+    /*
+     * Whoever creates the ring sizes and initializes it, then sets 'ready';
+     * everyone else waits for that, and checks the ring is laid out as they
+     * expect. If it isn't, and no one's using it, *stale is set to its
+     * inode, for open() to replace it.
+     */
+
+    *stale = 0;
+
+    size_t slotStride = align(sizeof(Slot) + slotSize);
+    size_t size = align(sizeof(Header)) + slotStride * slots;
+
+    bool creator = true;
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        if (errno != EEXIST) {
+            return false;
+        }
+        creator = false;
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    struct stat st;
+    if (creator) {
+        if (ftruncate(fd, size) != 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+    } else {
+        // the creator may not have got as far as sizing it
+        unsigned tries = SHM_OPEN_TRIES;
+        while (fstat(fd, &st) == 0 && st.st_size == 0 && tries-- > 0) {
+            std::this_thread::sleep_for(SHM_OPEN_RETRY);
+        }
+        if (st.st_size != off_t(size)) {
+            // never sized, or made for a different topic definition
+            if (unused(fd, st.st_size)) {
+                *stale = st.st_ino;
+            }
+            ::close(fd);
+            return false;
+        }
+    }
+
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+
+    mem = p;
+    memSize = size;
+    stride = slotStride;
+    header = static_cast<Header *>(p);
+
+    if (creator) {
+        ::close(fd);
+        // the new mapping is zeroed, so this only needs to construct the atomics
+        new (header) Header();
+        header->magic = SHM_MAGIC;
+        header->version = SHM_VERSION;
+        header->slots = slots;
+        header->slotSize = slotSize;
+        for (unsigned i = 0; i < slots; ++i) {
+            new (slot(i)) Slot();
+        }
+        header->ready.store(1, std::memory_order_release);
+        return true;
+    }
+
+    unsigned tries = SHM_OPEN_TRIES;
+    while (header->ready.load(std::memory_order_acquire) == 0 && tries-- > 0) {
+        std::this_thread::sleep_for(SHM_OPEN_RETRY);
+    }
+    if (header->ready.load(std::memory_order_acquire) == 0 || header->magic != SHM_MAGIC ||
+        header->version != SHM_VERSION || header->slots != slots ||
+        header->slotSize != slotSize) {
+        if (unused(fd, st.st_size)) {
+            *stale = st.st_ino;
+        }
+        ::close(fd);
+        close();
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+bool ShmRing::unused(int fd, off_t size)
+{
+    /*
+     * Whether the ring open on 'fd' has no live peers, so may be replaced.
+     * One too small to hold a header was never finished; one of another
+     * version, we can't tell, so leave be.
+     */
+
+    if (size < off_t(sizeof(Header))) {
+        return true;
+    }
+    void *p = mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+
+    const Header *h = static_cast<const Header *>(p);
+    bool idle = h->magic == 0 || (h->magic == SHM_MAGIC && h->version == SHM_VERSION);
+    for (unsigned i = 0; idle && i < MaxPeers; ++i) {
+        const Peer &peer = h->peers[i];
+        idle = peer.state.load(std::memory_order_acquire) != PEER_ACTIVE ||
+               !processAlive(peer.pid);
+    }
+    munmap(p, sizeof(Header));
+    return idle;
+}
+
+void ShmRing::close()
+{
+    if (mem != nullptr) {
+        munmap(mem, memSize);
+        mem = nullptr;
+        header = nullptr;
+    }
+}
+
+int ShmRing::addPeer(PeerKind kind, const uint8_t *prefix)
+{
+    /*
+     * Claim a free entry in the peer table, or one left behind by
+     * a process that has exited. Returns -1 if the table is full.
+     */
+
+    for (unsigned i = 0; i < MaxPeers; ++i) {
+        Peer &p = header->peers[i];
+        uint32_t state = p.state.load(std::memory_order_acquire);
+        if (state == PEER_ACTIVE && processAlive(p.pid)) {
+            continue;
+        }
+        if (state == PEER_CLAIMED ||
+            !p.state.compare_exchange_strong(state, PEER_CLAIMED, std::memory_order_acquire)) {
+            continue;
+        }
+
+        p.kind = kind;
+        p.pid = getpid();
+        memcpy(p.prefix, prefix, PrefixSize);
+        p.state.store(PEER_ACTIVE, std::memory_order_release);
+        header->peerGeneration.fetch_add(1);
+        return i;
+    }
+    return -1;
+}
+
+void ShmRing::removePeer(int peer)
+{
+    if (peer >= 0 && unsigned(peer) < MaxPeers) {
+        header->peers[peer].state.store(PEER_FREE, std::memory_order_release);
+        header->peerGeneration.fetch_add(1);
+    }
+}
+
+bool ShmRing::hasPeer(PeerKind kind, const uint8_t *prefix) const
+{
+    for (unsigned i = 0; i < MaxPeers; ++i) {
+        const Peer &p = header->peers[i];
+        if (p.state.load(std::memory_order_acquire) == PEER_ACTIVE && p.kind == kind &&
+            memcmp(p.prefix, prefix, PrefixSize) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ShmRing::hasReaders(const uint8_t *except) const
+{
+    /*
+     * Whether anyone other than participant 'except' (which may be null)
+     * is reading the ring.
+     */
+
+    for (unsigned i = 0; i < MaxPeers; ++i) {
+        const Peer &p = header->peers[i];
+        if (p.state.load(std::memory_order_acquire) == PEER_ACTIVE && p.kind == PEER_READER &&
+            (except == nullptr || memcmp(p.prefix, except, PrefixSize) != 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t ShmRing::peerGeneration() const
+{
+    return header->peerGeneration.load(std::memory_order_acquire);
+}
+
+ShmRing::Slot *ShmRing::slot(uint64_t index) const
+{
+    uint8_t *base = static_cast<uint8_t *>(mem) + align(sizeof(Header));
+    return reinterpret_cast<Slot *>(base + (index % header->slots) * stride);
+}
+
+bool ShmRing::write(const ByteBufFragment *frags, size_t n, const SampleMeta &meta)
+{
+    /*
+     * Claim the next index and fill its slot. Should a writer from a lap
+     * ago still be busy in that slot, wait for it, for SHM_WRITE_STALL at
+     * most: past that it's taken to have died mid-write, and we take the
+     * slot over. Should a later one have got there first, we're too late,
+     * and the sample is dropped. Likewise a writer whose slot was taken
+     * over, if it was only slow after all.
+     */
+
+    if (meta.len > header->slotSize) {
+        return false;
+    }
+
+    uint64_t index = header->writeIndex.fetch_add(1, std::memory_order_relaxed);
+    Slot *s = slot(index);
+
+    uint64_t seq = s->seq.load(std::memory_order_relaxed);
+    std::chrono::steady_clock::time_point stalled{};
+    for (;;) {
+        if (seq > 2 * index) {
+            return false;
+        }
+        if (seq & 1) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (stalled == std::chrono::steady_clock::time_point{}) {
+                stalled = now + SHM_WRITE_STALL;
+            }
+            if (now < stalled) {
+                std::this_thread::yield();
+                seq = s->seq.load(std::memory_order_relaxed);
+                continue;
+            }
+        }
+        if (s->seq.compare_exchange_weak(seq, 2 * index + 1, std::memory_order_acquire)) {
+            break;
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s->len = meta.len;
+    s->reliable = meta.reliable;
+    s->sequence = meta.sequence;
+    s->timestamp = meta.timestamp;
+    memcpy(s->writer, meta.writer, GuidSize);
+    ByteBufTopicData(frags, n).read(reinterpret_cast<uint8_t *>(s + 1), meta.len);
+
+    uint64_t writing = 2 * index + 1;
+    if (!s->seq.compare_exchange_strong(writing, 2 * index + 2, std::memory_order_release)) {
+        return false; // taken over
+    }
+    notify();
+    return true;
+}
+
+uint64_t ShmRing::head() const
+{
+    return header->writeIndex.load(std::memory_order_acquire);
+}
+
+bool ShmRing::peek(uint64_t *cursor, SampleMeta *meta) const
+{
+    for (;;) {
+        uint64_t index = *cursor;
+        const Slot *s = slot(index);
+        uint64_t seq = s->seq.load(std::memory_order_acquire);
+
+        if (seq == 2 * index + 2) {
+            meta->len = s->len;
+            meta->reliable = s->reliable;
+            meta->sequence = s->sequence;
+            meta->timestamp = s->timestamp;
+            memcpy(meta->writer, s->writer, GuidSize);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->seq.load(std::memory_order_relaxed) != seq || meta->len > header->slotSize) {
+                continue; // overwritten while we looked, so we've been lapped
+            }
+            return true;
+        }
+
+        // not written yet, unless the writer died or we've been lapped,
+        // in which case pick up from the oldest sample still in the ring,
+        // less the one about to be overwritten
+        uint64_t w = head();
+        if (seq < 2 * index + 2 && w < index + header->slots) {
+            return false;
+        }
+        *cursor = (w > index + 1) ? w - header->slots + 1 : index + 1;
+    }
+}
+
+bool ShmRing::copy(uint64_t cursor, uint8_t *dst, size_t len) const
+{
+    const Slot *s = slot(cursor);
+    memcpy(dst, s + 1, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s->seq.load(std::memory_order_relaxed) == 2 * cursor + 2;
+}
+
+void ShmRing::notify()
+{
+    header->notifyCount.fetch_add(1);
+    if (header->sleepers.load() == 0) {
+        return;
+    }
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->notifyCount), FUTEX_WAKE, INT32_MAX,
+            nullptr, nullptr, 0);
+#endif
+}
+
+uint32_t ShmRing::notifyCount() const
+{
+    return header->notifyCount.load(std::memory_order_acquire);
+}
+
+void ShmRing::wait(uint32_t seen, std::chrono::milliseconds timeout)
+{
+    /*
+     * Futex wait on Linux, where a wake comes straight from the writer;
+     * elsewhere, poll.
+     */
+
+    header->sleepers.fetch_add(1);
+#ifdef __linux__
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->notifyCount), FUTEX_WAIT, seen, &ts,
+            nullptr, 0);
+#else
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + timeout;
+    while (notifyCount() == seen && std::chrono::steady_clock::now() < end) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+#endif
+    header->sleepers.fetch_sub(1);
+}
+
+} // namespace commkit
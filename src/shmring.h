@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include "bytebuftopic.h"
+
+namespace commkit
+{
+
+/*
+ * A broadcast ring of samples in POSIX shared memory, through which
+ * publishers and subscribers of a topic on the same host exchange samples
+ * without going through the network stack (see TRANSPORT_SHARED_MEMORY).
+ *
+ * Any number of processes map a ring by name, readable and writable only
+ * by the user that created it. A ring stays behind when the last of them
+ * is done with it, to be picked up again; one laid out differently that
+ * nobody's using is replaced. Writers claim slots in turn and never wait
+ * for readers, nor long for a writer that died mid-write. Each slot is
+ * guarded by a sequence number, seqlock style: readers copy a sample out
+ * and check the sequence again before trusting it. A reader that falls
+ * a whole ring behind finds its next slots overwritten, and skips ahead to
+ * the oldest sample still there but the one the next write will overwrite.
+ *
+ * Writers bump a futex word after each sample, so readers can sleep.
+ *
+ * The ring also lists the RTPS participants writing and reading it, so
+ * endpoints can tell which of their RTPS peers they reach this way.
+ */
+class ShmRing
+{
+public:
+    static constexpr unsigned MaxPeers = 64;
+    static constexpr size_t PrefixSize = 12; // an RTPS GUID prefix
+    static constexpr size_t GuidSize = 16;
+
+    enum PeerKind : uint32_t {
+        PEER_WRITER = 1,
+        PEER_READER = 2,
+    };
+
+    struct SampleMeta {
+        size_t len;
+        int64_t sequence;
+        int64_t timestamp; // nanoseconds, publisher's clock
+        bool reliable;     // written by a reliable publisher
+        uint8_t writer[GuidSize];
+    };
+
+    ShmRing();
+    ~ShmRing();
+
+    ShmRing(const ShmRing &) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+
+    // map (creating if need be) the ring 'name', which must have been
+    // created with the same slot count and size if it's in use already
+    bool open(const std::string &name, unsigned slots, size_t slotSize);
+
+    // name for a topic's ring: POSIX shm names allow only one '/'
+    static std::string ringName(uint32_t domainID, const std::string &topic);
+
+    int addPeer(PeerKind kind, const uint8_t *prefix);
+    void removePeer(int peer);
+    bool hasPeer(PeerKind kind, const uint8_t *prefix) const;
+    bool hasReaders(const uint8_t *except) const;
+
+    // changes whenever a peer comes or goes
+    uint32_t peerGeneration() const;
+
+    bool write(const ByteBufFragment *frags, size_t n, const SampleMeta &meta);
+
+    // where a new reader starts: just past the latest sample
+    uint64_t head() const;
+
+    // find the sample at *cursor, skipping ahead past any overwritten ones.
+    // false if there's nothing new.
+    bool peek(uint64_t *cursor, SampleMeta *meta) const;
+
+    // copy out the data of the sample peek() found; false if it has
+    // been overwritten meanwhile and 'dst' holds garbage
+    bool copy(uint64_t cursor, uint8_t *dst, size_t len) const;
+
+    // wake sleeping readers / sleep until woken, a timeout,
+    // or the notify count moves on from 'seen'
+    void notify();
+    uint32_t notifyCount() const;
+    void wait(uint32_t seen, std::chrono::milliseconds timeout);
+
+private:
+    struct Header;
+    struct Peer;
+    struct Slot;
+
+    bool tryOpen(const std::string &name, unsigned slots, size_t slotSize, ino_t *stale);
+    static bool unused(int fd, off_t size);
+    Slot *slot(uint64_t index) const;
+    void close();
+
+    void *mem;
+    size_t memSize;
+    Header *header;
+    size_t stride;
+};
+
+} // namespace commkit
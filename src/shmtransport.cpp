@@ -0,0 +1,219 @@
+#include "shmtransport.h"
+#include "shmring.h"
+#include "loanpool.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+using namespace eprosima::fastrtps;
+
+namespace commkit
+{
+
+// how often a reader thread checks whether it should stop
+static constexpr std::chrono::milliseconds SHM_WAIT_INTERVAL(100);
+
+class ShmWriter : public TransportWriter
+{
+public:
+    ShmWriter(const TransportTopic &t) : peer(-1), self(t.skipSelf ? t.self : nullptr)
+    {
+    }
+
+    ~ShmWriter()
+    {
+        if (peer >= 0) {
+            ring.removePeer(peer);
+        }
+    }
+
+    bool open(const std::string &name, unsigned slots, const TransportTopic &t)
+    {
+        if (!ring.open(name, slots, t.maxSampleSize)) {
+            return false;
+        }
+        peer = ring.addPeer(ShmRing::PEER_WRITER, t.self);
+        return peer >= 0;
+    }
+
+    bool reaches(const rtps::GuidPrefix_t &prefix) const
+    {
+        return ring.hasPeer(ShmRing::PEER_READER, prefix.value);
+    }
+
+    bool hasReaders() const
+    {
+        return ring.hasReaders(self);
+    }
+
+    uint32_t generation() const
+    {
+        return ring.peerGeneration();
+    }
+
+    bool write(const ByteBufFragment *frags, size_t n, const SampleMeta &meta)
+    {
+        ShmRing::SampleMeta m;
+        m.len = meta.len;
+        m.sequence = meta.sequence;
+        m.timestamp = meta.timestamp;
+        m.reliable = meta.reliable;
+        memcpy(m.writer, meta.writer.guidPrefix.value, ShmRing::PrefixSize);
+        memcpy(m.writer + ShmRing::PrefixSize, meta.writer.entityId.value,
+               ShmRing::GuidSize - ShmRing::PrefixSize);
+        return ring.write(frags, n, m);
+    }
+
+private:
+    ShmRing ring;
+    int peer;
+    const uint8_t *self; // null unless our own samples are delivered directly
+};
+
+class ShmReader : public TransportReader
+{
+public:
+    ShmReader(const TransportTopic &t, TransportSink *s, int prio, ThreadRegistry *reg)
+        : peer(-1), self(t.skipSelf ? t.self : nullptr), sink(s), priority(prio), threads(reg),
+          running(false)
+    {
+    }
+
+    ~ShmReader()
+    {
+        if (reader.joinable()) {
+            running = false;
+            ring.notify();
+            reader.join();
+        }
+        if (peer >= 0) {
+            ring.removePeer(peer);
+        }
+    }
+
+    bool open(const std::string &name, unsigned slots, const TransportTopic &t)
+    {
+        if (!ring.open(name, slots, t.maxSampleSize)) {
+            return false;
+        }
+        peer = ring.addPeer(ShmRing::PEER_READER, t.self);
+        return peer >= 0;
+    }
+
+    bool start()
+    {
+        running = true;
+        reader = std::thread(&ShmReader::loop, this);
+        return true;
+    }
+
+    bool covers(const rtps::GuidPrefix_t &prefix) const
+    {
+        return ring.hasPeer(ShmRing::PEER_WRITER, prefix.value);
+    }
+
+private:
+    void loop();
+
+    ShmRing ring;
+    int peer;
+    const uint8_t *self;
+    TransportSink *sink;
+    int priority;
+
+    ThreadRegistry *threads;
+    std::thread reader;
+    std::atomic<bool> running;
+};
+
+void ShmReader::loop()
+{
+    /*
+     * Reader thread: copy each new sample in the ring into the sink,
+     * then sleep until a writer signals more.
+     *
+     * Samples from our own participant are skipped when they were already
+     * delivered directly.
+     */
+
+    ThreadRegistry::Scope scope(threads, THREAD_RECEIVER, "ck-shm-reader");
+    uint64_t cursor = ring.head();
+
+    while (running) {
+        uint32_t seen = ring.notifyCount();
+        bool got = false;
+
+        ShmRing::SampleMeta m;
+        for (; ring.peek(&cursor, &m); cursor++) {
+            if (self && memcmp(m.writer, self, ShmRing::PrefixSize) == 0) {
+                continue;
+            }
+
+            int slot = sink->reserve(m.len);
+            if (slot == LoanPool::InvalidSlot) {
+                continue;
+            }
+            if (!ring.copy(cursor, sink->buffer(slot), m.len)) {
+                sink->discard(slot);
+                continue;
+            }
+
+            SampleMeta meta = {m.len, m.sequence, m.timestamp, m.reliable, {},
+                               LoanPool::InvalidSlot, 0};
+            memcpy(meta.writer.guidPrefix.value, m.writer, ShmRing::PrefixSize);
+            memcpy(meta.writer.entityId.value, m.writer + ShmRing::PrefixSize,
+                   ShmRing::GuidSize - ShmRing::PrefixSize);
+            sink->deliver(slot, meta, priority);
+            got = true;
+        }
+
+        if (got) {
+            sink->flush();
+        }
+
+        ring.wait(seen, SHM_WAIT_INTERVAL);
+    }
+}
+
+bool ShmTransport::configure(const NodeOpts &opts, ParticipantAttributes * /* pa */)
+{
+    domainID = opts.domainID;
+    return desc.ringSlots > 0;
+}
+
+bool ShmTransport::carries(const TransportTopic &t) const
+{
+    // best effort only: a reader the ring laps loses samples, which
+    // a reliable subscriber would only get from RTPS, whose copies it drops
+    return !t.reliable;
+}
+
+std::unique_ptr<TransportWriter> ShmTransport::createWriter(const TransportTopic &t)
+{
+    if (!carries(t)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<ShmWriter> w(new ShmWriter(t));
+    if (!w->open(ShmRing::ringName(domainID, t.name), desc.ringSlots, t)) {
+        return nullptr;
+    }
+    return std::unique_ptr<TransportWriter>(w.release());
+}
+
+std::unique_ptr<TransportReader> ShmTransport::createReader(const TransportTopic &t,
+                                                            TransportSink *sink)
+{
+    if (!carries(t)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<ShmReader> r(new ShmReader(t, sink, desc.priority, threads));
+    if (!r->open(ShmRing::ringName(domainID, t.name), desc.ringSlots, t)) {
+        return nullptr;
+    }
+    return std::unique_ptr<TransportReader>(r.release());
+}
+
+} // namespace commkit
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "transport.h"
+
+namespace commkit
+{
+
+/*
+ * Shared memory: a ShmRing per topic, beside RTPS. Publishers and
+ * subscribers list themselves in the ring, so each side can tell which of
+ * its RTPS peers it reaches this way.
+ */
+class ShmTransport : public Transport
+{
+public:
+    ShmTransport(const TransportDescriptor &d, ThreadRegistry *threads)
+        : Transport(d, threads), domainID(0)
+    {
+    }
+
+    bool configure(const NodeOpts &opts, eprosima::fastrtps::ParticipantAttributes *pa);
+
+    std::unique_ptr<TransportWriter> createWriter(const TransportTopic &t);
+    std::unique_ptr<TransportReader> createReader(const TransportTopic &t, TransportSink *sink);
+
+private:
+    bool carries(const TransportTopic &t) const;
+
+    uint32_t domainID;
+};
+
+} // namespace commkit
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <commkit/publisher.h>
+
+namespace commkit
+{
+
+/*
+ * Lock-free histogram of payload sizes, for PayloadSizeStats.
+ *
+ * Buckets are log-linear: four per power of two, so a reported percentile
+ * is at most 25% above the true value (and never above the observed max).
+ * record() is a couple of relaxed atomic increments, cheap enough for the
+ * publish path.
+ */
+class SizeHistogram
+{
+public:
+    SizeHistogram() : count(0), max(0)
+    {
+        for (unsigned i = 0; i < NumBuckets; ++i) {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    SizeHistogram(const SizeHistogram &) = delete;
+    SizeHistogram &operator=(const SizeHistogram &) = delete;
+
+    void record(size_t len)
+    {
+        buckets[bucketOf(len)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+
+        size_t m = max.load(std::memory_order_relaxed);
+        while (len > m && !max.compare_exchange_weak(m, len, std::memory_order_relaxed)) {
+        }
+    }
+
+    PayloadSizeStats stats() const
+    {
+        PayloadSizeStats s;
+        s.count = count.load(std::memory_order_relaxed);
+        s.max = max.load(std::memory_order_relaxed);
+        s.p50 = percentile(s.count, s.max, 50);
+        s.p90 = percentile(s.count, s.max, 90);
+        s.p99 = percentile(s.count, s.max, 99);
+        return s;
+    }
+
+    static unsigned bucketOf(size_t len)
+    {
+        // sizes below 4 get a bucket each, then four per power of two
+        if (len < 4) {
+            return len;
+        }
+        unsigned bits = 0;
+        for (size_t v = len; v > 1; v >>= 1) {
+            bits++;
+        }
+        unsigned b = (bits - 1) * 4 + ((len >> (bits - 2)) & 3);
+        return b < NumBuckets ? b : NumBuckets - 1;
+    }
+
+    // largest size that falls in bucket 'b'
+    static size_t bucketLimit(unsigned b)
+    {
+        if (b < 4) {
+            return b;
+        }
+        unsigned bits = b / 4 + 1;
+        return ((size_t(4 + (b & 3)) + 1) << (bits - 2)) - 1;
+    }
+
+private:
+    static constexpr unsigned NumBuckets = 4 * 33; // up to 8 GB
+
+    size_t percentile(uint64_t total, size_t maxSeen, unsigned pct) const
+    {
+        if (total == 0) {
+            return 0;
+        }
+
+        uint64_t want = (total * pct + 99) / 100;
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < NumBuckets; ++b) {
+            seen += buckets[b].load(std::memory_order_relaxed);
+            if (seen >= want) {
+                size_t limit = bucketLimit(b);
+                return limit < maxSeen ? limit : maxSeen;
+            }
+        }
+        return maxSeen;
+    }
+
+    std::atomic<uint64_t> buckets[NumBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<size_t> max;
+};
+
+} // namespace commkit
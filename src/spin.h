@@ -0,0 +1,16 @@
+#pragma once
+
+namespace commkit
+{
+
+// in a spin-wait loop: ease off the core (and its sibling) for a moment
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+} // namespace commkit
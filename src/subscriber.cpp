@@ -1,6 +1,7 @@
 #include <commkit/subscriber.h>
 #include "subscriberimpl.h"
 #include "nodeimpl.h"
+#include "loanpool.h"
 
 namespace commkit
 {
@@ -28,16 +29,51 @@ bool Subscriber::take(Payload *p)
     return impl->take(p);
 }
 
+bool Subscriber::takeLoan(PayloadLoan *l)
+{
+    return impl->takeLoan(l);
+}
+
+size_t Subscriber::takeBatch(PayloadLoan *loans, size_t n)
+{
+    return impl->takeBatch(loans, n);
+}
+
+size_t Subscriber::peekBatch(PayloadLoan *loans, size_t n)
+{
+    return impl->peekBatch(loans, n);
+}
+
 void Subscriber::waitForMessage()
 {
     return impl->waitForMessage();
 }
 
+bool Subscriber::spinForMessage(clock::duration timeout)
+{
+    return impl->spinForMessage(timeout);
+}
+
+int Subscriber::eventFd()
+{
+    return impl->eventFd();
+}
+
 unsigned Subscriber::matchedPublishers() const
 {
     return impl->matchedPublishers();
 }
 
+uint64_t Subscriber::reassemblyDrops() const
+{
+    return impl->reassemblyDrops();
+}
+
+LatencyStats Subscriber::latencyStats() const
+{
+    return impl->latencyStats();
+}
+
 std::string Subscriber::datatype()
 {
     return impl->datatype();
@@ -48,12 +84,63 @@ std::string Subscriber::name() const
     return impl->name();
 }
 
+PayloadLoan::PayloadLoan() : slot(LoanPool::InvalidSlot)
+{
+}
+
+PayloadLoan::~PayloadLoan()
+{
+    release();
+}
+
+PayloadLoan::PayloadLoan(PayloadLoan &&other)
+    : payload(other.payload), pool(std::move(other.pool)), shared(std::move(other.shared)),
+      slot(other.slot)
+{
+    other.payload = Payload();
+    other.slot = LoanPool::InvalidSlot;
+}
+
+PayloadLoan &PayloadLoan::operator=(PayloadLoan &&other)
+{
+    if (this != &other) {
+        release();
+        payload = other.payload;
+        pool = std::move(other.pool);
+        shared = std::move(other.shared);
+        slot = other.slot;
+        other.payload = Payload();
+        other.slot = LoanPool::InvalidSlot;
+    }
+    return *this;
+}
+
+void PayloadLoan::release()
+{
+    /*
+     * Hand the buffer back to the Subscriber's pool, or on by-reference
+     * topics, the publisher's.
+     */
+
+    if (pool) {
+        pool->release(slot);
+        pool.reset();
+    }
+    if (shared) {
+        shared->unpin(slot);
+        shared.reset();
+    }
+    payload = Payload();
+    slot = LoanPool::InvalidSlot;
+}
+
 #ifndef COMMKIT_NO_CAPNP
 capnp::FlatArrayMessageReader Payload::toReader(bool *ok)
 {
     /*
-     * Use FlatArrayMessageReader since that's what Publisher uses for now.
-     * Ultimately want a strategy that involves less copying.
+     * Publisher sends capnp's standard stream framing (segment table, then
+     * segments), which FlatArrayMessageReader reads in place, without copying.
+     * The payload must be word aligned; received buffers always are.
      */
 
     using capnp::word;
@@ -1,9 +1,18 @@
 #include "typesimpl.h"
 #include "chronoimpl.h"
 #include "subscriberimpl.h"
+#include "executorimpl.h"
 #include "nodeimpl.h"
+#include "spin.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 #include <fastrtps/Domain.h>
 #include <fastrtps/attributes/SubscriberAttributes.h>
@@ -11,8 +20,47 @@
 namespace commkit
 {
 
+// local delivery sets aside loan slots for up to 'history' samples, as
+// many as fit in LOCAL_SLOTS_BYTES but at least MIN_LOCAL_SLOTS. Beyond
+// that, samples are kept only as free loan slots allow (see acquireLocal())
+static constexpr size_t LOCAL_SLOTS_BYTES = 4 * 1024 * 1024;
+static constexpr size_t MIN_LOCAL_SLOTS = 16;
+
+// by-reference topics: how long before trying a pool we couldn't map again
+static constexpr std::chrono::seconds UNREACHABLE_RETRY(5);
+
+// samples that came by RTPS, which doesn't say when they arrived
+static void clearReceived(Payload *p)
+{
+    p->kernelTimestamp = TIME_POINT_INVALID;
+    p->receiveTimestamp = TIME_POINT_INVALID;
+    p->dispatchTimestamp = TIME_POINT_INVALID;
+}
+
+// LocalSample::received / queued, 0 meaning unknown
+static clock::time_point stampedAt(int64_t ns)
+{
+    return ns == 0 ? TIME_POINT_INVALID : clock::time_point(std::chrono::nanoseconds(ns));
+}
+
+static void fillFramedPayload(Payload *p, const FrameEntry *e, const uint8_t *data)
+{
+    p->bytes = const_cast<uint8_t *>(data);
+    p->len = e->len;
+    p->sequence = e->sequence;
+    p->sourceTimestamp = toTimePoint(e->timestamp);
+    clearReceived(p);
+}
+
 SubscriberImpl::SubscriberImpl(const Topic &t, std::shared_ptr<NodeImpl> n)
-    : frsub(nullptr), matchedPubs(0), node(n), topicName(t.name)
+    : frsub(nullptr), matchedPubs(0), node(n), reliable(false), loanSlots(1), topicName(t.name),
+      loans(std::make_shared<LoanPool>()), dynamic(t.dynamic()), maxPayloadSize(maxSampleSize(t)),
+      framed(t.framed), frameSlot(LoanPool::InvalidSlot), reassembly(std::make_shared<LoanPool>()),
+      reassemblyTimeout(0), reassemblyDropped(0), nextAbandoned(0),
+      wholeSlot(LoanPool::InvalidSlot), wholeRead(false), localDepth(0), localHeld(false),
+      takenSlot(LoanPool::InvalidSlot), byReference(t.byReference), heldBuffer(0), waiters(0),
+      arrivals(0), notifyFd(-1), fdSignalled(false), executor(nullptr), notifying(0), schedule(0),
+      dispatchQueued(false)
 {
     /*
      * NB: we require 'sub' to be initialized separately via setSubscriber(),
@@ -20,17 +68,40 @@ SubscriberImpl::SubscriberImpl(const Topic &t, std::shared_ptr<NodeImpl> n)
      * a shared_ptr to the about to be created Subscriber does not yet exist.
      */
     topicDataType.setName(t.datatype.c_str());
-
-    // ugh, payload size must be defined
-    assert(t.maxPayloadSize > 0 && "Topic::maxPayloadSize must be specified");
-    topicDataType.setSize(t.maxPayloadSize);
+    topicDataType.setSize(rtpsTypeSize(t));
 }
 
 SubscriberImpl::~SubscriberImpl()
 {
+    transportReaders.clear();
+    node->removeLocalSubscriber(this);
+
+    dropFrame();
+    releaseTaken();
+    releaseReference();
+    if (localHeld) {
+        loans->release(localHead.slot);
+    }
+    if (localQueue) {
+        LocalSample ls;
+        while (localQueue->pop(&ls)) {
+            loans->release(ls.slot);
+        }
+    }
+    for (auto &pr : partials) {
+        if (pr.slot != LoanPool::InvalidSlot) {
+            reassembly->release(pr.slot);
+        }
+    }
+
     if (frsub != nullptr) {
         eprosima::fastrtps::Domain::removeSubscriber(frsub);
     }
+#ifdef __linux__
+    if (notifyFd >= 0) {
+        close(notifyFd);
+    }
+#endif
 }
 
 bool SubscriberImpl::init(const SubscriptionOpts &opts)
@@ -45,12 +116,33 @@ bool SubscriberImpl::init(const SubscriptionOpts &opts)
     sa.topic.topicDataType = datatype();
     sa.times.heartbeatResponseDelay = toRtpsDuration(std::chrono::milliseconds(50));
 
+    // by-reference samples can't be framed, and their buffers are sized up front
+    if (byReference && (framed || dynamic)) {
+        return false;
+    }
+
+    reliable = opts.reliable;
     if (opts.reliable) {
         sa.qos.m_reliability.kind = eprosima::fastrtps::RELIABLE_RELIABILITY_QOS;
     } else {
         sa.qos.m_reliability.kind = eprosima::fastrtps::BEST_EFFORT_RELIABILITY_QOS;
     }
 
+#ifdef COMMKIT_RTPS_DYNAMIC_HISTORY
+    if (dynamic) {
+        sa.historyMemoryPolicy = eprosima::fastrtps::rtps::DYNAMIC_RESERVE_MEMORY_MODE;
+    }
+#endif
+
+    // room for every fragment of the last 'history' samples
+    size_t frags = framed ? fragmentCount(maxPayloadSize, topicDataType.m_typeSize) : 1;
+    if (frags > 1) {
+        sa.topic.historyQos.kind = eprosima::fastrtps::KEEP_LAST_HISTORY_QOS;
+        sa.topic.historyQos.depth = std::max(opts.history, 1u) * frags;
+        sa.topic.resourceLimitsQos.max_samples = sa.topic.historyQos.depth;
+        sa.topic.resourceLimitsQos.allocated_samples = std::max(opts.history, 1u);
+    }
+
     // fast-rtps requires datatype to be regsitered before we can
     // create the publisher.
 
@@ -59,8 +151,73 @@ bool SubscriberImpl::init(const SubscriptionOpts &opts)
         eprosima::fastrtps::Domain::registerType(node->part, &topicDataType);
     }
 
-    eprosima::fastrtps::Subscriber *s =
-        eprosima::fastrtps::Domain::createSubscriber(node->part, sa, this);
+    // framed topics keep one extra buffer for the frame being unpacked,
+    // and local delivery (see deliverLocal()) more for its queue.
+    // dynamically sized topics get slots in a range of sizes, and each
+    // sample is put in the smallest that fits.
+    size_t sz = topicDataType.m_typeSize;
+
+    // our other transports only start delivering once everything's ready,
+    // but we must know whether there are any to size things up
+    if (opts.timestamps) {
+        latency.reset(new LatencyHistograms);
+    }
+
+    TransportTopic tt = node->transportTopic(name(), sz, reliable);
+    tt.timestamps = opts.timestamps;
+    for (auto &t : node->transports) {
+        std::unique_ptr<TransportReader> r = t->createReader(tt, this);
+        if (r) {
+            transportReaders.push_back({t->priority(), std::move(r)});
+        }
+    }
+
+    loanSlots = std::max(opts.loanSlots, 1u);
+    unsigned slots = loanSlots + (framed ? 1 : 0);
+    if (node->intraProcess || !transportReaders.empty()) {
+        localDepth = std::max(opts.history, 1u) * frags;
+        localQueue.reset(new BoundedQueue<LocalSample>(localDepth));
+        size_t fit = std::max(MIN_LOCAL_SLOTS, LOCAL_SLOTS_BYTES / std::max<size_t>(sz, 1));
+        slots += std::min(localDepth, fit);
+    }
+    bool ok = dynamic ? loans->initSizeClasses(slots, DYNAMIC_MIN_SLOT_SIZE, sz)
+                      : loans->init(slots, sz);
+    if (!ok) {
+        return false;
+    }
+
+    if (frags > 1) {
+        // enough to cover every sample in reassembly, and one that wouldn't fit
+        Abandoned none = {};
+        none.sequence = -1;
+        abandoned.assign(opts.reassemblyBuffers + 1, none);
+    }
+
+    if (frags > 1 && opts.reassemblyBuffers > 0) {
+        size_t rsz = dynamic ? std::min(opts.maxReassemblySize, maxPayloadSize) : maxPayloadSize;
+        if (!reassembly->init(opts.reassemblyBuffers, rsz)) {
+            return false;
+        }
+
+        Reassembly unused = {};
+        unused.slot = LoanPool::InvalidSlot;
+        partials.assign(opts.reassemblyBuffers, unused);
+        reassemblyTimeout = opts.reassemblyTimeout;
+    }
+
+    // readers were registered before RTPS matching, so publishers know to
+    // reach us through them (see PublisherImpl::updateRoutes())
+    for (auto &tr : transportReaders) {
+        if (!tr.reader->start()) {
+            return false;
+        }
+    }
+
+    eprosima::fastrtps::Subscriber *s;
+    {
+        ThreadRegistry::Adopter adopter(&node->threads, THREAD_RTPS, "ck-rtps");
+        s = eprosima::fastrtps::Domain::createSubscriber(node->part, sa, this);
+    }
     /*
      * fast-rtps may begin delivering callbacks to us before Domain::createSubscriber()
      * has returned. in this case, we capture a pointer to the subscriber in onNewDataMessage()
@@ -75,7 +232,12 @@ bool SubscriberImpl::init(const SubscriptionOpts &opts)
         assert(frsub == s);
     }
 
-    return (frsub != nullptr);
+    if (frsub == nullptr) {
+        return false;
+    }
+
+    node->addLocalSubscriber(this);
+    return true;
 }
 
 bool SubscriberImpl::peek(Payload *p)
@@ -85,40 +247,1114 @@ bool SubscriberImpl::peek(Payload *p)
      * Data returned via 'p' is only valid until next call to peek() or take().
      */
 
+    bool ok = framed ? nextFramed(p, false, nullptr, nullptr)
+                     : byReference ? nextReference(p, false) : nextUnframed(p, false);
+    if (ok && latency) {
+        stamp(p, clock::now(), false);
+    }
+    if (!ok && fdSignalled.load(std::memory_order_relaxed)) {
+        rearmFd();
+    }
+    return ok;
+}
+
+bool SubscriberImpl::take(Payload *p)
+{
+    /*
+     * Reads the next sample and removes it from the buffer.
+     * Data returned via 'p' is only valid until next call to peek() or take().
+     */
+
+    bool ok = framed ? nextFramed(p, true, nullptr, nullptr)
+                     : byReference ? nextReference(p, true) : nextUnframed(p, true);
+    if (ok && latency) {
+        stamp(p, clock::now(), true);
+    }
+    if (!ok && fdSignalled.load(std::memory_order_relaxed)) {
+        rearmFd();
+    }
+    return ok;
+}
+
+bool SubscriberImpl::nextUnframed(Payload *p, bool remove)
+{
+    /*
+     * Shared by peek() / take() on unframed topics: local samples first,
+     * then RTPS ones, into topicData.
+     */
+
+    if (nextLocal(p, remove, nullptr)) {
+        return true;
+    }
+
     eprosima::fastrtps::SampleInfo_t si;
-    if (frsub->readNextData(&topicData, &si) && (si.sampleKind == ALIVE)) {
+    while ((remove ? frsub->takeNextData(&topicData, &si) : frsub->readNextData(&topicData, &si)) &&
+           (si.sampleKind == ALIVE)) {
+        if (deliveredDirectly(si)) {
+            continue;
+        }
         p->bytes = topicData.buf;
         p->len = topicData.len;
         p->sequence = commkit::toInt64(si.sample_identity.sequence_number());
         p->sourceTimestamp = commkit::toTimePoint(si.sourceTimestamp);
+        clearReceived(p);
         return true;
     }
 
     return false;
 }
 
-bool SubscriberImpl::take(Payload *p)
+bool SubscriberImpl::takeLoan(PayloadLoan *l)
 {
     /*
-     * Reads the next sample and removes it from the buffer.
-     * Data returned via 'p' is only valid until next call to peek() or take().
+     * Reads the next sample and removes it from the buffer, like take(),
+     * but deserializes it straight into a buffer from our loan pool
+     * rather than into the shared topicData.
+     *
+     * The sample remains valid until 'l' is released, so callers can hold
+     * several samples at once and needn't copy them out.
+     * Returns false if there's no data, or all loan buffers are in use.
      */
 
     eprosima::fastrtps::SampleInfo_t si;
-    if (frsub->takeNextData(&topicData, &si) && (si.sampleKind == ALIVE)) {
-        p->bytes = topicData.buf;
-        p->len = topicData.len;
-        p->sequence = commkit::toInt64(si.sample_identity.sequence_number());
-        p->sourceTimestamp = commkit::toTimePoint(si.sourceTimestamp);
+    if (nextLoan(l, true, &si) != LOAN_OK) {
+        if (fdSignalled.load(std::memory_order_relaxed)) {
+            rearmFd();
+        }
+        return false;
+    }
+    if (latency) {
+        stamp(&l->payload, clock::now(), true);
+    }
+    return true;
+}
+
+size_t SubscriberImpl::takeBatch(PayloadLoan *l, size_t n)
+{
+    /*
+     * Take up to n samples, as if by repeated takeLoan().
+     */
+
+    size_t filled = fillBatch(l, n, true);
+    if (filled == 0 && fdSignalled.load(std::memory_order_relaxed)) {
+        rearmFd();
+    }
+    if (latency && filled > 0) {
+        // all handed over at once
+        clock::time_point now = clock::now();
+        for (size_t i = 0; i < filled; ++i) {
+            stamp(&l[i].payload, now, true);
+        }
+    }
+    return filled;
+}
+
+size_t SubscriberImpl::peekBatch(PayloadLoan *l, size_t n)
+{
+    /*
+     * Read up to n unread samples without removing them from the buffer.
+     */
+
+    size_t filled = fillBatch(l, n, false);
+    if (filled == 0 && fdSignalled.load(std::memory_order_relaxed)) {
+        rearmFd();
+    }
+    if (latency && filled > 0) {
+        clock::time_point now = clock::now();
+        for (size_t i = 0; i < filled; ++i) {
+            stamp(&l[i].payload, now, false);
+        }
+    }
+    return filled;
+}
+
+size_t SubscriberImpl::fillBatch(PayloadLoan *l, size_t n, bool remove)
+{
+    /*
+     * Shared by takeBatch() / peekBatch(). One SampleInfo_t is reused across
+     * the whole batch, and unlike takeLoan() we carry on past non-ALIVE samples
+     * rather than stopping, so callers see as much data as is available.
+     */
+
+    size_t filled = 0;
+
+    if (framed && !remove) {
+        /*
+         * Peeking on a framed topic: hand out the unread entries of the
+         * current frame, without moving past them.
+         */
+        Payload p;
+        std::shared_ptr<LoanPool> pool;
+        int slot;
+        if (n == 0 || !nextFramed(&p, false, &pool, &slot)) {
+            return 0;
+        }
+
+        if (pool == reassembly) {
+            // a reassembled sample is on its own
+            l[0].release();
+            l[0].payload = p;
+            pool->retain(slot);
+            l[0].pool = pool;
+            l[0].slot = slot;
+            return 1;
+        }
+
+        FrameReader r = frameReader;
+        const FrameEntry *e;
+        const uint8_t *data;
+        while (filled < n && r.next(&e, &data)) {
+            PayloadLoan &pl = l[filled++];
+            pl.release();
+            fillFramedPayload(&pl.payload, e, data);
+            loans->retain(frameSlot);
+            pl.pool = loans;
+            pl.slot = frameSlot;
+        }
+        return filled;
+    }
+
+    eprosima::fastrtps::SampleInfo_t si;
+    while (filled < n) {
+        LoanResult r = nextLoan(&l[filled], remove, &si);
+        if (r == LOAN_OK) {
+            filled++;
+            if (!remove && localHeld) {
+                break; // a peeked local sample stays at the head, see nextLocal()
+            }
+        } else if (r != LOAN_NOT_ALIVE) {
+            break;
+        }
+    }
+    return filled;
+}
+
+SubscriberImpl::LoanResult SubscriberImpl::nextLoan(PayloadLoan *l, bool remove,
+                                                    eprosima::fastrtps::SampleInfo_t *si)
+{
+    /*
+     * On by-reference topics, the loan's descriptor is swapped for a pin
+     * on the buffer it refers to; descriptors for buffers that have since
+     * been reused are skipped.
+     */
+
+    for (;;) {
+        LoanResult r = loanSample(l, remove, si);
+        if (r != LOAN_OK || !byReference) {
+            return r;
+        }
+
+        Payload p;
+        std::shared_ptr<SharedBufferMap> map;
+        unsigned buffer;
+        bool ok = resolveReference(l->payload, &p, &map, &buffer);
+        if (!ok && !remove) {
+            dropLocalHead(l->payload);
+        }
+        l->release();
+        if (ok) {
+            l->payload = p;
+            l->shared = std::move(map);
+            l->slot = buffer;
+            return LOAN_OK;
+        }
+    }
+}
+
+SubscriberImpl::LoanResult SubscriberImpl::loanSample(PayloadLoan *l, bool remove,
+                                                      eprosima::fastrtps::SampleInfo_t *si)
+{
+    l->release();
+
+    if (framed) {
+        // share the frame's (or reassembled sample's) buffer with the loan
+        std::shared_ptr<LoanPool> pool;
+        int slot;
+        if (!nextFramed(&l->payload, remove, &pool, &slot)) {
+            return LOAN_NO_DATA;
+        }
+        pool->retain(slot);
+        l->pool = pool;
+        l->slot = slot;
+        return LOAN_OK;
+    }
+
+    releaseTaken();
+    if (!loanAvailable()) {
+        return LOAN_POOL_EMPTY;
+    }
+
+    // local samples are already in a loan slot; share it
+    int slot;
+    if (nextLocal(&l->payload, remove, &slot)) {
+        if (!remove) {
+            loans->retain(slot);
+        }
+        l->pool = loans;
+        l->slot = slot;
+        return LOAN_OK;
+    }
+
+    // the slot is picked once the sample's size is known, during deserialization.
+    // check one of the largest is free first, or the sample would be lost
+    if (!loans->hasFree(loans->slotSize())) {
+        return LOAN_POOL_EMPTY;
+    }
+
+    ByteBufTopicData td(loans.get());
+    for (;;) {
+        bool got = remove ? frsub->takeNextData(&td, si) : frsub->readNextData(&td, si);
+        if (!got || si->sampleKind != ALIVE) {
+            return got ? LOAN_NOT_ALIVE : LOAN_NO_DATA;
+        }
+        if (!deliveredDirectly(*si)) {
+            break;
+        }
+    }
+
+    slot = td.takeSlot();
+    if (slot == LoanPool::InvalidSlot) {
+        return LOAN_POOL_EMPTY; // raced with another taker
+    }
+
+    l->payload.bytes = td.buf;
+    l->payload.len = td.len;
+    l->payload.sequence = commkit::toInt64(si->sample_identity.sequence_number());
+    l->payload.sourceTimestamp = commkit::toTimePoint(si->sourceTimestamp);
+    clearReceived(&l->payload);
+    l->pool = loans;
+    l->slot = slot;
+    return LOAN_OK;
+}
+
+bool SubscriberImpl::nextFramed(Payload *p, bool advance, std::shared_ptr<LoanPool> *pool,
+                                int *slot)
+{
+    /*
+     * Framed topics: report the next sample from the current frame,
+     * taking a new frame from the RTPS layer once this one is used up.
+     * Fragments are collected as they arrive, and a sample reported once
+     * its last fragment is in.
+     *
+     * The frame lives in one of our loan buffers, and a reassembled sample
+     * in a reassembly buffer; loans of their samples take extra references,
+     * so they stay put until they're all released. Frames from publishers
+     * in this process are already in a loan buffer, and come first.
+     */
+
+    for (;;) {
+        if (wholeSlot != LoanPool::InvalidSlot && !wholeRead) {
+            *p = whole;
+            if (pool) {
+                *pool = reassembly;
+                *slot = wholeSlot;
+            }
+            wholeRead = advance;
+            return true;
+        }
+
+        const FrameEntry *e;
+        const uint8_t *data;
+        if (frameSlot != LoanPool::InvalidSlot && frameReader.peek(&e, &data)) {
+            fillFramedPayload(p, e, data);
+            if (pool) {
+                *pool = loans;
+                *slot = frameSlot;
+            }
+            if (advance) {
+                frameReader.advance();
+            }
+            return true;
+        }
+
+        dropFrame();
+        expireFragments();
+
+        LocalSample ls;
+        if (localQueue && localQueue->pop(&ls)) {
+            uint8_t *b = loans->buffer(ls.slot);
+            if (frameReader.reset(b, ls.len)) {
+                frameSlot = ls.slot;
+            } else {
+                addFragment(b, ls.len, ls.writer);
+                loans->release(ls.slot);
+            }
+            continue;
+        }
+
+        if (!loans->hasFree(loans->slotSize())) {
+            return false;
+        }
+
+        ByteBufTopicData td(loans.get());
+        eprosima::fastrtps::SampleInfo_t si;
+        if (!frsub->takeNextData(&td, &si)) {
+            return false;
+        }
+
+        if (si.sampleKind != ALIVE || deliveredDirectly(si)) {
+            continue; // not for us, try the next one
+        }
+
+        if (frameReader.reset(td.buf, td.len)) {
+            frameSlot = td.takeSlot();
+        } else {
+            addFragment(td.buf, td.len, si.sample_identity.writer_guid());
+        }
+    }
+}
+
+void SubscriberImpl::dropFrame()
+{
+    if (frameSlot != LoanPool::InvalidSlot) {
+        loans->release(frameSlot);
+        frameSlot = LoanPool::InvalidSlot;
+    }
+    if (wholeSlot != LoanPool::InvalidSlot) {
+        reassembly->release(wholeSlot);
+        wholeSlot = LoanPool::InvalidSlot;
+    }
+}
+
+void SubscriberImpl::addFragment(const uint8_t *b, size_t len,
+                                 const eprosima::fastrtps::rtps::GUID_t &writer)
+{
+    /*
+     * Copy a fragment into the reassembly buffer for its sample, starting
+     * a new one if need be, and make the sample 'whole' once complete.
+     *
+     * Each writer's fragments arrive in order and RTPS discards duplicates,
+     * so counting the bytes received tells us when a sample is complete.
+     * With every buffer in use, the oldest incomplete sample is dropped.
+     * A dropped sample is counted once, and the rest of its fragments are
+     * ignored.
+     */
+
+    const FragmentEntry *fe;
+    const uint8_t *data;
+    size_t n;
+    if (!readFragment(b, len, &fe, &data, &n) || fe->total == 0 ||
+        wasAbandoned(writer, fe->sequence)) {
+        return;
+    }
+
+    Reassembly *r = nullptr;
+    Reassembly *unused = nullptr;
+    Reassembly *oldest = nullptr;
+    for (auto &pr : partials) {
+        if (pr.slot == LoanPool::InvalidSlot) {
+            unused = unused ? unused : &pr;
+        } else if (pr.sequence == fe->sequence && pr.writer == writer) {
+            r = &pr;
+            break;
+        } else if (oldest == nullptr || pr.started < oldest->started) {
+            oldest = &pr;
+        }
+    }
+
+    if (r == nullptr) {
+        if (partials.empty() || fe->total > reassembly->slotSize()) {
+            abandon(writer, fe->sequence); // can't ever reassemble this one
+            return;
+        }
+
+        if (unused == nullptr) {
+            dropPartial(oldest);
+            unused = oldest;
+        }
+
+        int s = reassembly->acquire(fe->total);
+        if (s == LoanPool::InvalidSlot) {
+            abandon(writer, fe->sequence); // buffers are all on loan
+            return;
+        }
+
+        r = unused;
+        r->slot = s;
+        r->writer = writer;
+        r->sequence = fe->sequence;
+        r->timestamp = fe->timestamp;
+        r->total = fe->total;
+        r->received = 0;
+        r->started = clock::now();
+    }
+
+    if (fe->total != r->total) {
+        dropPartial(r);
+        return;
+    }
+
+    memcpy(reassembly->buffer(r->slot) + fe->offset, data, n);
+    r->received += n;
+    if (r->received < r->total) {
+        return;
+    }
+
+    assert(wholeSlot == LoanPool::InvalidSlot);
+    wholeSlot = r->slot;
+    wholeRead = false;
+    whole.bytes = reassembly->buffer(r->slot);
+    whole.len = r->total;
+    whole.sequence = r->sequence;
+    whole.sourceTimestamp = toTimePoint(r->timestamp);
+    clearReceived(&whole);
+    r->slot = LoanPool::InvalidSlot;
+}
+
+void SubscriberImpl::dropPartial(Reassembly *r)
+{
+    reassembly->release(r->slot);
+    r->slot = LoanPool::InvalidSlot;
+    abandon(r->writer, r->sequence);
+}
+
+void SubscriberImpl::abandon(const eprosima::fastrtps::rtps::GUID_t &writer, int64_t sequence)
+{
+    reassemblyDropped++;
+    if (!abandoned.empty()) {
+        abandoned[nextAbandoned] = {writer, sequence};
+        nextAbandoned = (nextAbandoned + 1) % abandoned.size();
+    }
+}
+
+bool SubscriberImpl::wasAbandoned(const eprosima::fastrtps::rtps::GUID_t &writer,
+                                  int64_t sequence) const
+{
+    for (auto &a : abandoned) {
+        if (a.sequence == sequence && a.writer == writer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SubscriberImpl::expireFragments()
+{
+    /*
+     * Give up on samples whose remaining fragments are overdue,
+     * so a lost fragment doesn't tie up a buffer for good.
+     *
+     * Only called as samples are taken: partials belong to the reading
+     * thread, so the RTPS listener can't expire them. Until the next
+     * peek() / take(), an overdue sample keeps its buffer.
+     */
+
+    clock::time_point now = clock::now();
+    for (auto &pr : partials) {
+        if (pr.slot != LoanPool::InvalidSlot && now - pr.started > reassemblyTimeout) {
+            dropPartial(&pr);
+        }
+    }
+}
+
+bool SubscriberImpl::deliverLocal(const ByteBufFragment *frags, size_t n, size_t len,
+                                  int64_t sequence, int64_t timestamp,
+                                  const eprosima::fastrtps::rtps::GUID_t &writer)
+{
+    /*
+     * Runs on the publisher's thread: copy the sample into one of our loan
+     * slots and queue it for peek() / take(). Samples are kept as an RTPS
+     * KEEP_LAST history would, the oldest making way for new ones, whether
+     * for room in the queue or for a free slot.
+     *
+     * Returns false if the sample couldn't be delivered, which only happens
+     * when every slot is out on loan.
+     */
+
+    int slot = acquireLocal(len);
+    if (slot == LoanPool::InvalidSlot) {
+        return false;
+    }
+
+    ByteBufTopicData(frags, n).read(loans->buffer(slot), len);
+    int64_t queued = latency ? toInt64(clock::now()) : 0;
+    queueLocal({slot, len, sequence, timestamp, writer, 0, queued});
+    return true;
+}
+
+int SubscriberImpl::acquireLocal(size_t len)
+{
+    if (!localQueue || len > loans->slotSize()) {
+        return LoanPool::InvalidSlot;
+    }
+
+    int slot;
+    while ((slot = loans->acquire(len)) == LoanPool::InvalidSlot) {
+        LocalSample oldest;
+        if (!localQueue->pop(&oldest)) {
+            break;
+        }
+        loans->release(oldest.slot);
+    }
+    return slot;
+}
+
+void SubscriberImpl::queueLocal(const LocalSample &ls)
+{
+    while (localQueue->size() >= localDepth || !localQueue->push(ls)) {
+        LocalSample oldest;
+        if (localQueue->pop(&oldest)) {
+            loans->release(oldest.slot);
+        }
+    }
+    notifyWaiters();
+}
+
+int SubscriberImpl::reserve(size_t len)
+{
+    return acquireLocal(len);
+}
+
+uint8_t *SubscriberImpl::buffer(int slot)
+{
+    return loans->buffer(slot);
+}
+
+void SubscriberImpl::deliver(int slot, const SampleMeta &meta, int priority)
+{
+    /*
+     * A publisher reaching us by more than one transport: keep only the
+     * copies arriving by the highest priority one.
+     */
+
+    for (auto &tr : transportReaders) {
+        if (tr.priority > priority && tr.reader->covers(meta.writer.guidPrefix)) {
+            loans->release(slot);
+            return;
+        }
+    }
+    int64_t queued = latency ? toInt64(clock::now()) : 0;
+    queueLocal({slot, meta.len, meta.sequence, meta.timestamp, meta.writer, meta.received, queued});
+}
+
+void SubscriberImpl::discard(int slot)
+{
+    loans->release(slot);
+}
+
+void SubscriberImpl::flush()
+{
+    if (auto sharedSub = sub.lock()) {
+        notify(sharedSub);
+    }
+}
+
+void SubscriberImpl::notify(const std::shared_ptr<Subscriber> &s)
+{
+    /*
+     * Unattached, this costs a relaxed load. Attached, 'notifying' keeps
+     * detach() from returning, and the Executor from going away, until
+     * we're done with it.
+     */
+
+    SubscriberImpl *impl = s->impl.get();
+    if (impl->executor.load(std::memory_order_relaxed) != nullptr) {
+        impl->notifying++;
+        ExecutorImpl *e = impl->executor.load();
+        if (e != nullptr) {
+            uint64_t was = impl->schedule.fetch_add(1);
+            if (notifiedOf(was) == 0) {
+                e->ready(s, generationOf(was));
+            }
+            impl->notifying--;
+            return;
+        }
+        impl->notifying--;
+    }
+    callHandlers(s);
+}
+
+void SubscriberImpl::notifyLocal(const std::shared_ptr<Subscriber> &s)
+{
+    /*
+     * An Executor queues the handlers anyway, so needs no help. Otherwise
+     * we're queued to the dispatch thread, once until it gets to us: the
+     * handlers take every sample there is by then. Should the queue be
+     * full, the handlers run here after all.
+     */
+
+    SubscriberImpl *impl = s->impl.get();
+    if (impl->executor.load(std::memory_order_relaxed) != nullptr) {
+        notify(s);
+        return;
+    }
+    if (impl->dispatchQueued.exchange(true)) {
+        return;
+    }
+    if (!impl->node->dispatch(s)) {
+        impl->dispatchQueued = false;
+        notify(s);
+    }
+}
+
+void SubscriberImpl::dispatched(const std::shared_ptr<Subscriber> &s)
+{
+    // cleared first, so samples arriving while the handlers run queue us again
+    s->impl->dispatchQueued = false;
+    notify(s);
+}
+
+void SubscriberImpl::callHandlers(const std::shared_ptr<Subscriber> &s)
+{
+    /*
+     * onMessage takes its SubscriberPtr by value, so is only called (and
+     * the pointer copied) if there's a handler to take it.
+     */
+
+    s->onMessageRef(*s);
+    if (s->onMessage.connected()) {
+        s->onMessage(s);
+    }
+}
+
+bool SubscriberImpl::attach(ExecutorImpl *e)
+{
+    /*
+     * A new generation, so anything still queued from before is skipped,
+     * starting from nothing notified.
+     */
+
+    if (executor.load() != nullptr) {
+        return false;
+    }
+    schedule = uint64_t(generationOf(schedule) + 1) << 32;
+    ExecutorImpl *none = nullptr;
+    return executor.compare_exchange_strong(none, e);
+}
+
+void SubscriberImpl::detach(ExecutorImpl *e)
+{
+    ExecutorImpl *expected = e;
+    if (!executor.compare_exchange_strong(expected, nullptr)) {
+        return;
+    }
+    // pairs with notify(): either it sees us detached, or we see it
+    while (notifying.load() != 0) {
+        cpuRelax();
+    }
+}
+
+bool SubscriberImpl::unschedule(uint32_t generation, uint32_t n)
+{
+    uint64_t s = schedule.load();
+    while (generationOf(s) == generation) {
+        if (schedule.compare_exchange_weak(s, s - n)) {
+            return notifiedOf(s) != n;
+        }
+    }
+    return false; // attached again since: that's queued us afresh
+}
+
+bool SubscriberImpl::deliveredDirectly(const eprosima::fastrtps::SampleInfo_t &si) const
+{
+    /*
+     * RTPS copies of samples that reached us directly, from a publisher in
+     * this process or by another transport, are ignored.
+     */
+
+    const eprosima::fastrtps::rtps::GUID_t &writer = si.sample_identity.writer_guid();
+    if (node->isLocal(writer)) {
         return true;
     }
+    for (auto &tr : transportReaders) {
+        if (tr.reader->covers(writer.guidPrefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SubscriberImpl::nextReference(Payload *p, bool remove)
+{
+    /*
+     * By-reference topics: the next descriptor, resolved to the publisher's
+     * buffer. The buffer stays pinned until the next call, as topicData
+     * would; the new one is pinned before the old is released, so peeking
+     * then taking a sample doesn't let its buffer go in between.
+     */
 
+    Payload d;
+    while (nextUnframed(&d, remove)) {
+        std::shared_ptr<SharedBufferMap> map;
+        unsigned buffer;
+        if (resolveReference(d, p, &map, &buffer)) {
+            releaseReference();
+            heldMap = std::move(map);
+            heldBuffer = buffer;
+            return true;
+        }
+        if (!remove) {
+            dropLocalHead(d);
+        }
+    }
+
+    releaseReference();
     return false;
 }
 
+bool SubscriberImpl::resolveReference(const Payload &d, Payload *p,
+                                      std::shared_ptr<SharedBufferMap> *map, unsigned *buffer)
+{
+    /*
+     * Pin the buffer a descriptor refers to, mapping its publisher's pool
+     * first if this is the first we've heard from it. Pools of publishers
+     * that have gone away are unmapped as we go, once nothing is pinned.
+     *
+     * Mapping can take a while to fail (see SharedBufferMap::connect()),
+     * so a pool that couldn't be isn't tried again for UNREACHABLE_RETRY:
+     * its samples are dropped without holding up take() each time.
+     */
+
+    BufferDescriptor bd;
+    if (d.len != sizeof(bd)) {
+        return false;
+    }
+    memcpy(&bd, d.bytes, sizeof(bd));
+
+    {
+        std::lock_guard<std::mutex> guard(mapsMtx);
+        auto it = std::find_if(bufferMaps.begin(), bufferMaps.end(),
+                               [&bd](const std::shared_ptr<SharedBufferMap> &m) {
+                                   return m->id() == bd.pool;
+                               });
+        if (it != bufferMaps.end()) {
+            *map = *it;
+        } else {
+            clock::time_point now = clock::now();
+            auto u = std::find_if(unreachable.begin(), unreachable.end(),
+                                  [&bd](const Unreachable &x) { return x.pool == bd.pool; });
+            if (u != unreachable.end() && now < u->retry) {
+                return false;
+            }
+
+            bufferMaps.erase(std::remove_if(bufferMaps.begin(), bufferMaps.end(),
+                                            [](const std::shared_ptr<SharedBufferMap> &m) {
+                                                return m.use_count() == 1 && m->closed();
+                                            }),
+                             bufferMaps.end());
+            *map = SharedBufferMap::connect(bd.pool);
+            if (!*map) {
+                // not on this host, gone, or another user's
+                unreachable.erase(std::remove_if(unreachable.begin(), unreachable.end(),
+                                                 [now](const Unreachable &x) {
+                                                     return x.retry <= now;
+                                                 }),
+                                  unreachable.end());
+                unreachable.push_back({bd.pool, clock::now() + UNREACHABLE_RETRY});
+                return false;
+            }
+            bufferMaps.push_back(*map);
+        }
+    }
+
+    if (!(*map)->pin(bd)) {
+        return false;
+    }
+
+    *buffer = bd.buffer;
+    p->bytes = (*map)->sample(bd);
+    p->len = bd.len;
+    p->sequence = d.sequence;
+    p->sourceTimestamp = d.sourceTimestamp;
+    p->kernelTimestamp = d.kernelTimestamp;
+    p->receiveTimestamp = d.receiveTimestamp;
+    p->dispatchTimestamp = TIME_POINT_INVALID;
+    return true;
+}
+
+void SubscriberImpl::releaseReference()
+{
+    if (heldMap) {
+        heldMap->unpin(heldBuffer);
+        heldMap.reset();
+    }
+}
+
+void SubscriberImpl::dropLocalHead(const Payload &p)
+{
+    /*
+     * A peeked local sample stays at the head (see nextLocal()), so one
+     * that turns out to be unusable has to be dropped for peeking to move
+     * past it, as it would past an RTPS sample.
+     */
+
+    if (localHeld && p.bytes == loans->buffer(localHead.slot)) {
+        loans->release(localHead.slot);
+        localHeld = false;
+    }
+}
+
+bool SubscriberImpl::nextLocal(Payload *p, bool remove, int *slot)
+{
+    /*
+     * Unframed topics: the next sample from a publisher in this process.
+     *
+     * A peeked sample stays at the head until taken, so unlike RTPS samples,
+     * peeking again returns the same one. A taken sample's slot is handed
+     * to the caller via 'slot' along with our reference, or if 'slot' is
+     * null, kept until the next call, like topicData. A peeking caller
+     * that wants to keep the slot must retain() it.
+     */
+
+    releaseTaken();
+
+    if (!localHeld) {
+        if (!localQueue || !localQueue->pop(&localHead)) {
+            return false;
+        }
+        localHeld = true;
+    }
+
+    p->bytes = loans->buffer(localHead.slot);
+    p->len = localHead.len;
+    p->sequence = localHead.sequence;
+    p->sourceTimestamp = toTimePoint(localHead.timestamp);
+    p->kernelTimestamp = stampedAt(localHead.received);
+    p->receiveTimestamp = stampedAt(localHead.queued);
+    p->dispatchTimestamp = TIME_POINT_INVALID;
+
+    if (slot) {
+        *slot = localHead.slot;
+    }
+    if (remove) {
+        localHeld = false;
+        if (!slot) {
+            takenSlot = localHead.slot;
+        }
+    }
+    return true;
+}
+
+void SubscriberImpl::releaseTaken()
+{
+    if (takenSlot != LoanPool::InvalidSlot) {
+        loans->release(takenSlot);
+        takenSlot = LoanPool::InvalidSlot;
+    }
+}
+
+bool SubscriberImpl::loanAvailable() const
+{
+    /*
+     * Whether another sample may go out on loan. The pool also holds
+     * samples queued by local delivery, which don't count as loans.
+     */
+
+    size_t held = localQueue ? localQueue->size() + (localHeld ? 1 : 0) : 0;
+    return loans->outstanding() < loanSlots + held;
+}
+
+void SubscriberImpl::notifyWaiters()
+{
+    arrivals.fetch_add(1, std::memory_order_release);
+
+    // pairs with the increment in waitForMessage(): either the waiter
+    // sees the new sample, or we see the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(waitMtx);
+        waitCv.notify_all();
+    }
+
+    int fd = notifyFd.load();
+    if (fd >= 0) {
+        signalFd(fd);
+    }
+}
+
+bool SubscriberImpl::partlyRead() const
+{
+    // the rest of a partly read frame counts as unread
+    const FrameEntry *e;
+    const uint8_t *data;
+    if (frameSlot != LoanPool::InvalidSlot && frameReader.peek(&e, &data)) {
+        return true;
+    }
+    if (wholeSlot != LoanPool::InvalidSlot && !wholeRead) {
+        return true;
+    }
+    return localHeld;
+}
+
+bool SubscriberImpl::unread() const
+{
+    return partlyRead() || (localQueue && localQueue->size() > 0) || frsub->getUnreadCount() > 0;
+}
+
+int SubscriberImpl::eventFd()
+{
+    /*
+     * Made the first time it's asked for, so subscribers no one polls
+     * don't each hold a descriptor. Samples that arrived before it was
+     * made mark it readable here.
+     */
+
+#ifdef __linux__
+    if (frsub == nullptr) {
+        return -1;
+    }
+    int fd = notifyFd.load();
+    if (fd >= 0) {
+        return fd;
+    }
+
+    fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) {
+        return -1;
+    }
+    int expected = -1;
+    if (!notifyFd.compare_exchange_strong(expected, fd)) {
+        close(fd);
+        return expected;
+    }
+    if (unread()) {
+        signalFd(fd);
+    }
+    return fd;
+#else
+    return -1;
+#endif // __linux__
+}
+
+void SubscriberImpl::rearmFd()
+{
+    /*
+     * A read found nothing left: the descriptor stops being readable
+     * until notifyWaiters() next writes to it. It's drained before
+     * 'fdSignalled' is cleared, and we look again after, so a sample that
+     * arrives in between either sees it clear and writes, or is seen here.
+     */
+
+#ifdef __linux__
+    int fd = notifyFd.load();
+    if (fd < 0) {
+        return;
+    }
+    uint64_t n;
+    ssize_t r = ::read(fd, &n, sizeof(n));
+    (void)r;
+    fdSignalled = false;
+    if (unread()) {
+        signalFd(fd);
+    }
+#endif // __linux__
+}
+
+void SubscriberImpl::signalFd(int fd)
+{
+    // only the first since rearmFd() need write
+#ifdef __linux__
+    if (!fdSignalled.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t r = ::write(fd, &one, sizeof(one));
+        (void)r;
+    }
+#endif // __linux__
+}
+
+// the time from 'from' to 'to', where both are known and in order
+static void recordStage(SizeHistogram *h, clock::time_point from, clock::time_point to)
+{
+    if (from != TIME_POINT_INVALID && to != TIME_POINT_INVALID && to >= from) {
+        h->record(size_t(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()));
+    }
+}
+
+void SubscriberImpl::stamp(Payload *p, clock::time_point now, bool record)
+{
+    /*
+     * SubscriptionOpts::timestamps: a sample is being handed over. Only
+     * those removed are counted in latencyStats(), so peeking at one
+     * before taking it doesn't count it twice. Stages from sourceTimestamp
+     * compare the publisher's clock with ours; see LatencyStats.
+     */
+
+    p->dispatchTimestamp = now;
+    if (!record) {
+        return;
+    }
+    recordStage(&latency->network, p->sourceTimestamp, p->kernelTimestamp);
+    recordStage(&latency->stack, p->kernelTimestamp, p->receiveTimestamp);
+    recordStage(&latency->dispatch, p->receiveTimestamp, now);
+    recordStage(&latency->total, p->sourceTimestamp, now);
+}
+
+static LatencyStats::Stage stageStats(const SizeHistogram &h)
+{
+    PayloadSizeStats ps = h.stats();
+    LatencyStats::Stage s;
+    s.count = ps.count;
+    s.p50 = std::chrono::nanoseconds(ps.p50);
+    s.p90 = std::chrono::nanoseconds(ps.p90);
+    s.p99 = std::chrono::nanoseconds(ps.p99);
+    s.max = std::chrono::nanoseconds(ps.max);
+    return s;
+}
+
+LatencyStats SubscriberImpl::latencyStats() const
+{
+    LatencyStats ls;
+    if (latency) {
+        ls.network = stageStats(latency->network);
+        ls.stack = stageStats(latency->stack);
+        ls.dispatch = stageStats(latency->dispatch);
+        ls.total = stageStats(latency->total);
+    }
+    return ls;
+}
+
 void SubscriberImpl::waitForMessage()
 {
-    frsub->waitForUnreadMessage();
+    if (partlyRead()) {
+        return;
+    }
+
+    /*
+     * Samples arrive by RTPS or local delivery, both of which notify us.
+     * RTPS copies of local samples count as unread until a take() skips
+     * them, so this may return early while there are local publishers.
+     */
+    std::unique_lock<std::mutex> lk(waitMtx);
+    waiters++;
+    waitCv.wait(lk, [this] {
+        return (localQueue && localQueue->size() > 0) || frsub->getUnreadCount() > 0;
+    });
+    waiters--;
+}
+
+bool SubscriberImpl::spinForMessage(clock::duration timeout)
+{
+    /*
+     * As waitForMessage(), without the condition variable. The local queue
+     * is cheap to look at, and is looked at every time round; RTPS' unread
+     * count takes its lock, so is only asked for as notifications arrive.
+     */
+
+    if (partlyRead()) {
+        return true;
+    }
+
+    clock::time_point end = clock::now() + timeout;
+    uint64_t seen = arrivals.load(std::memory_order_acquire);
+    if (frsub->getUnreadCount() > 0) {
+        return true;
+    }
+    for (;;) {
+        if (localQueue && localQueue->size() > 0) {
+            return true;
+        }
+        uint64_t now = arrivals.load(std::memory_order_acquire);
+        if (now != seen) {
+            seen = now;
+            if (frsub->getUnreadCount() > 0) {
+                return true;
+            }
+        }
+        if (clock::now() >= end) {
+            return false;
+        }
+        cpuRelax();
+    }
 }
 
 void SubscriberImpl::onSubscriptionMatched(eprosima::fastrtps::Subscriber *s,
@@ -151,9 +1387,10 @@ void SubscriberImpl::onNewDataMessage(eprosima::fastrtps::Subscriber *s)
      */
 
     ensureSubIsSet(s);
+    notifyWaiters();
 
     if (auto sharedSub = sub.lock()) {
-        sharedSub->onMessage(sharedSub);
+        notify(sharedSub);
     }
 }
 
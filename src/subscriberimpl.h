@@ -3,6 +3,18 @@
 #include <commkit/subscriber.h>
 #include "nodeimpl.h"
 #include "bytebuftopic.h"
+#include "loanpool.h"
+#include "boundedqueue.h"
+#include "frame.h"
+#include "transport.h"
+#include "sharedbuffers.h"
+#include "sizehistogram.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <fastrtps/rtps/common/all_common.h>
 #include <fastrtps/fastrtps_fwd.h>
@@ -13,7 +25,9 @@
 namespace commkit
 {
 
-class SubscriberImpl : public eprosima::fastrtps::SubscriberListener
+class ExecutorImpl;
+
+class SubscriberImpl : public eprosima::fastrtps::SubscriberListener, public TransportSink
 {
 public:
     SubscriberImpl(const Topic &t, std::shared_ptr<NodeImpl> n);
@@ -29,13 +43,86 @@ public:
 
     bool peek(Payload *p);
     bool take(Payload *p);
+    bool takeLoan(PayloadLoan *l);
+    size_t takeBatch(PayloadLoan *l, size_t n);
+    size_t peekBatch(PayloadLoan *l, size_t n);
     void waitForMessage();
+    bool spinForMessage(clock::duration timeout);
+    int eventFd();
 
     unsigned matchedPublishers() const
     {
         return matchedPubs;
     }
 
+    uint64_t reassemblyDrops() const
+    {
+        return reassemblyDropped;
+    }
+
+    LatencyStats latencyStats() const;
+
+    bool isReliable() const
+    {
+        return reliable;
+    }
+
+    std::shared_ptr<Subscriber> owner() const
+    {
+        return sub.lock();
+    }
+
+    // new samples for s: run its handlers, or queue them to its Executor
+    static void notify(const std::shared_ptr<Subscriber> &s);
+
+    // as notify(), for samples from a publisher in this process: the
+    // handlers run on the node's dispatch thread, not the publisher's
+    static void notifyLocal(const std::shared_ptr<Subscriber> &s);
+    static void dispatched(const std::shared_ptr<Subscriber> &s);
+
+    // s' onMessageRef and onMessage handlers, in that order
+    static void callHandlers(const std::shared_ptr<Subscriber> &s);
+
+    // Executor::add(): handlers are queued to 'e' rather than run as
+    // samples arrive. Fails if attached to another already.
+    bool attach(ExecutorImpl *e);
+    void detach(ExecutorImpl *e);
+
+    bool attachedTo(const ExecutorImpl *e) const
+    {
+        return executor.load() == e;
+    }
+
+    /*
+     * Our place in our Executor's queues: we're queued (or running) from
+     * the first notify() until our handlers have run with nothing more
+     * notified meanwhile, so they never run twice at once, on however many
+     * threads. 'schedule' holds the generation of the attach() we were
+     * queued under above the count of notify()s since.
+     */
+    static uint32_t generationOf(uint64_t schedule)
+    {
+        return uint32_t(schedule >> 32);
+    }
+
+    static uint32_t notifiedOf(uint64_t schedule)
+    {
+        return uint32_t(schedule);
+    }
+
+    uint64_t scheduleState() const
+    {
+        return schedule.load();
+    }
+
+    // after running our handlers for the 'n' notified as they began:
+    // whether more were since, in which case we stay queued
+    bool unschedule(uint32_t generation, uint32_t n);
+
+    // intra-process delivery, called from a PublisherImpl::write()
+    bool deliverLocal(const ByteBufFragment *frags, size_t n, size_t len, int64_t sequence,
+                      int64_t timestamp, const eprosima::fastrtps::rtps::GUID_t &writer);
+
     // XXX: make this const once TopicDataType.getName() is const
     std::string datatype()
     {
@@ -51,16 +138,173 @@ public:
                                eprosima::fastrtps::rtps::MatchingInfo &info);
     void onNewDataMessage(eprosima::fastrtps::Subscriber *s);
 
+    // TransportSink: samples from our TransportReaders, like deliverLocal()
+    int reserve(size_t len);
+    uint8_t *buffer(int slot);
+    void deliver(int slot, const SampleMeta &meta, int priority);
+    void discard(int slot);
+    void flush();
+
 private:
     void ensureSubIsSet(eprosima::fastrtps::Subscriber *s);
 
+    enum LoanResult { LOAN_OK, LOAN_NO_DATA, LOAN_NOT_ALIVE, LOAN_POOL_EMPTY };
+    LoanResult nextLoan(PayloadLoan *l, bool remove, eprosima::fastrtps::SampleInfo_t *si);
+    size_t fillBatch(PayloadLoan *l, size_t n, bool remove);
+
+    bool nextFramed(Payload *p, bool advance, std::shared_ptr<LoanPool> *pool, int *slot);
+    void dropFrame();
+
+    bool nextUnframed(Payload *p, bool remove);
+    LoanResult loanSample(PayloadLoan *l, bool remove, eprosima::fastrtps::SampleInfo_t *si);
+
+    bool nextReference(Payload *p, bool remove);
+    bool resolveReference(const Payload &d, Payload *p, std::shared_ptr<SharedBufferMap> *map,
+                          unsigned *buffer);
+    void releaseReference();
+    void dropLocalHead(const Payload &p);
+
+    bool nextLocal(Payload *p, bool remove, int *slot);
+    void releaseTaken();
+    bool loanAvailable() const;
+    void notifyWaiters();
+    bool partlyRead() const;
+    bool unread() const;
+    void rearmFd();
+    void signalFd(int fd);
+    void stamp(Payload *p, clock::time_point now, bool record);
+
+    struct LocalSample;
+    int acquireLocal(size_t len);
+    void queueLocal(const LocalSample &ls);
+
+    bool deliveredDirectly(const eprosima::fastrtps::SampleInfo_t &si) const;
+
+    struct Reassembly;
+    void addFragment(const uint8_t *b, size_t len, const eprosima::fastrtps::rtps::GUID_t &writer);
+    void dropPartial(Reassembly *r);
+    void abandon(const eprosima::fastrtps::rtps::GUID_t &writer, int64_t sequence);
+    bool wasAbandoned(const eprosima::fastrtps::rtps::GUID_t &writer, int64_t sequence) const;
+    void expireFragments();
+
     eprosima::fastrtps::Subscriber *frsub;
     unsigned matchedPubs;
     std::shared_ptr<NodeImpl> node;
+    bool reliable;
+    unsigned loanSlots;
 
     std::string topicName;
     ByteBufTopicData topicData;
     ByteBufTopicDataType topicDataType;
+    std::shared_ptr<LoanPool> loans; // shared with outstanding PayloadLoans
+
+    bool dynamic;
+    size_t maxPayloadSize; // largest sample, see maxSampleSize()
+
+    // framed topics: the RTPS sample currently being unpacked
+    bool framed;
+    int frameSlot;
+    FrameReader frameReader;
+
+    // framed topics: samples being reassembled from fragments, in buffers
+    // from their own pool (shared with PayloadLoans, like 'loans')
+    struct Reassembly {
+        int slot; // LoanPool::InvalidSlot when not in use
+        eprosima::fastrtps::rtps::GUID_t writer;
+        int64_t sequence;
+        int64_t timestamp;
+        size_t total;
+        size_t received;
+        clock::time_point started;
+    };
+    std::shared_ptr<LoanPool> reassembly;
+    std::vector<Reassembly> partials;
+    clock::duration reassemblyTimeout;
+    uint64_t reassemblyDropped; // samples, not fragments
+
+    // samples recently given up on, whose later fragments are ignored
+    // rather than reassembled (or counted) again; a small ring
+    struct Abandoned {
+        eprosima::fastrtps::rtps::GUID_t writer;
+        int64_t sequence;
+    };
+    std::vector<Abandoned> abandoned;
+    size_t nextAbandoned;
+
+    // the last completed sample; held until we move on, like the current frame
+    int wholeSlot;
+    bool wholeRead;
+    Payload whole;
+
+    // samples delivered by publishers in this process, each copied into one
+    // of our loan slots; the newest 'history' are kept, as RTPS would
+    struct LocalSample {
+        int slot;
+        size_t len;
+        int64_t sequence;
+        int64_t timestamp;
+        eprosima::fastrtps::rtps::GUID_t writer;
+        int64_t received; // SubscriptionOpts::timestamps: by the kernel, or 0
+        int64_t queued;   // and into localQueue, or 0
+    };
+    std::unique_ptr<BoundedQueue<LocalSample>> localQueue;
+    size_t localDepth;
+    LocalSample localHead; // unframed: popped by peek(), not yet taken
+    bool localHeld;
+    int takenSlot; // unframed: the last take(), valid until the next call
+
+    // our endpoints on transports beside RTPS, which deliver into
+    // localQueue as if samples were published in this process
+    struct TransportRoute {
+        int priority;
+        std::unique_ptr<TransportReader> reader;
+    };
+    std::vector<TransportRoute> transportReaders;
+
+    // by-reference topics: the publishers' pools we've mapped, and the
+    // buffer pinned by the last peek() / take(), valid until the next call
+    bool byReference;
+    std::mutex mapsMtx; // guards bufferMaps, unreachable
+    std::vector<std::shared_ptr<SharedBufferMap>> bufferMaps;
+
+    // pools we couldn't map (elsewhere, or gone), and when to try again
+    struct Unreachable {
+        uint64_t pool;
+        clock::time_point retry;
+    };
+    std::vector<Unreachable> unreachable;
+    std::shared_ptr<SharedBufferMap> heldMap;
+    unsigned heldBuffer;
+
+    // waitForMessage(): woken by either RTPS or local delivery
+    std::mutex waitMtx;
+    std::condition_variable waitCv;
+    std::atomic<unsigned> waiters;
+    std::atomic<uint64_t> arrivals; // spinForMessage(): bumped by either
+
+    // eventFd(): -1 until asked for, then written to by either as it goes
+    // from nothing unread ('fdSignalled' false), and drained by rearmFd()
+    std::atomic<int> notifyFd;
+    std::atomic<bool> fdSignalled;
+
+    // Executor::add(): the one we're attached to, and whether we're in its
+    // queue. detach() waits out notify()s that have yet to finish with it.
+    std::atomic<ExecutorImpl *> executor;
+    std::atomic<unsigned> notifying;
+    std::atomic<uint64_t> schedule;
+
+    // notifyLocal(): whether we're in the node's dispatch queue
+    std::atomic<bool> dispatchQueued;
+
+    // SubscriptionOpts::timestamps: durations, in nanoseconds, between
+    // Payload's timestamps, see LatencyStats; null when off
+    struct LatencyHistograms {
+        SizeHistogram network;
+        SizeHistogram stack;
+        SizeHistogram dispatch;
+        SizeHistogram total;
+    };
+    std::unique_ptr<LatencyHistograms> latency;
 
     std::weak_ptr<Subscriber> sub;
 };
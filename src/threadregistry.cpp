@@ -0,0 +1,216 @@
+#include "threadregistry.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
+namespace commkit
+{
+
+#ifdef __linux__
+
+static int currentTid()
+{
+    return int(syscall(SYS_gettid));
+}
+
+static std::string taskName(int tid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+    FILE *f = fopen(path, "r");
+    if (f == nullptr) {
+        return std::string();
+    }
+    char name[32] = {};
+    if (fgets(name, sizeof(name), f) == nullptr) {
+        name[0] = '\0';
+    }
+    fclose(f);
+    name[strcspn(name, "\n")] = '\0';
+    return name;
+}
+
+static bool apply(int tid, const ThreadOpts &o)
+{
+    /*
+     * Affinity first, so a thread made real-time is already where it
+     * should be. Either failing leaves the other applied.
+     */
+
+    bool ok = true;
+    if (o.cpus != 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (unsigned i = 0; i < 64 && i < CPU_SETSIZE; ++i) {
+            if (o.cpus & (uint64_t(1) << i)) {
+                CPU_SET(i, &cpus);
+            }
+        }
+        ok = sched_setaffinity(tid, sizeof(cpus), &cpus) == 0;
+    }
+    if (o.policy >= 0) {
+        sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = o.priority;
+        ok = sched_setscheduler(tid, o.policy, &sp) == 0 && ok;
+    }
+    return ok;
+}
+
+std::vector<int> ThreadRegistry::tasks()
+{
+    std::vector<int> tids;
+    DIR *d = opendir("/proc/self/task");
+    if (d == nullptr) {
+        return tids;
+    }
+    while (struct dirent *e = readdir(d)) {
+        char *end;
+        long tid = strtol(e->d_name, &end, 10);
+        if (end != e->d_name && *end == '\0') {
+            tids.push_back(int(tid));
+        }
+    }
+    closedir(d);
+    std::sort(tids.begin(), tids.end());
+    return tids;
+}
+
+void ThreadRegistry::enter(ThreadRole role, const char *name)
+{
+    pthread_setname_np(pthread_self(), name);
+
+    // adopt() may have got to us first, should we have started alongside
+    // Fast-RTPS' threads
+    leave();
+
+    int tid = currentTid();
+    std::lock_guard<std::mutex> guard(mtx);
+    ThreadInfo ti = {role, tid, name, apply(tid, opts[role])};
+    threads.push_back(ti);
+}
+
+void ThreadRegistry::leave()
+{
+    int tid = currentTid();
+    std::lock_guard<std::mutex> guard(mtx);
+    threads.erase(std::remove_if(threads.begin(), threads.end(),
+                                 [tid](const ThreadInfo &ti) { return ti.tid == tid; }),
+                  threads.end());
+}
+
+void ThreadRegistry::adopt(const std::vector<int> &before, const char *mark, ThreadRole role)
+{
+    std::vector<int> now = tasks();
+    std::lock_guard<std::mutex> guard(mtx);
+    for (int tid : now) {
+        auto known = [tid](const ThreadInfo &ti) { return ti.tid == tid; };
+        if (std::binary_search(before.begin(), before.end(), tid) ||
+            std::any_of(threads.begin(), threads.end(), known)) {
+            continue;
+        }
+        std::string name = taskName(tid);
+        if (name != mark) {
+            continue;
+        }
+        ThreadInfo ti = {role, tid, name, apply(tid, opts[role])};
+        threads.push_back(ti);
+    }
+}
+
+ThreadRegistry::Adopter::Adopter(ThreadRegistry *r, ThreadRole ro, const char *m)
+    : reg(r), role(ro), mark(m)
+{
+    /*
+     * New threads take their name from the thread starting them, and
+     * Fast-RTPS leaves its own as it found them, so whatever is started
+     * while we're named 'mark' is Fast-RTPS'. Its threads' threads are too.
+     */
+
+    name[0] = '\0';
+    if (reg == nullptr) {
+        return;
+    }
+    before = tasks();
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    pthread_setname_np(pthread_self(), mark);
+}
+
+ThreadRegistry::Adopter::~Adopter()
+{
+    if (reg == nullptr) {
+        return;
+    }
+    pthread_setname_np(pthread_self(), name);
+    reg->adopt(before, mark, role);
+}
+
+std::vector<ThreadInfo> ThreadRegistry::list()
+{
+    /*
+     * Adopted threads don't tell us when they finish: drop those gone.
+     */
+
+    std::vector<int> now = tasks();
+    std::lock_guard<std::mutex> guard(mtx);
+    threads.erase(std::remove_if(threads.begin(), threads.end(),
+                                 [&now](const ThreadInfo &ti) {
+                                     return !std::binary_search(now.begin(), now.end(), ti.tid);
+                                 }),
+                  threads.end());
+    return threads;
+}
+
+#else // __linux__
+
+std::vector<int> ThreadRegistry::tasks()
+{
+    return std::vector<int>();
+}
+
+void ThreadRegistry::enter(ThreadRole, const char *)
+{
+}
+
+void ThreadRegistry::leave()
+{
+}
+
+void ThreadRegistry::adopt(const std::vector<int> &, const char *, ThreadRole)
+{
+}
+
+ThreadRegistry::Adopter::Adopter(ThreadRegistry *r, ThreadRole ro, const char *m)
+    : reg(r), role(ro), mark(m)
+{
+    name[0] = '\0';
+}
+
+ThreadRegistry::Adopter::~Adopter()
+{
+}
+
+std::vector<ThreadInfo> ThreadRegistry::list()
+{
+    return std::vector<ThreadInfo>();
+}
+
+#endif // __linux__
+
+void ThreadRegistry::configure(const ThreadOpts *o)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    std::copy(o, o + THREAD_ROLES, opts);
+}
+
+} // namespace commkit
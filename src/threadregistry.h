@@ -0,0 +1,99 @@
+#pragma once
+
+#include <commkit/node.h>
+
+#include <mutex>
+#include <vector>
+
+namespace commkit
+{
+
+/*
+ * The threads a Node runs, and their scheduling (see NodeOpts::threads).
+ *
+ * Our own threads enter() as they start, which applies their role's
+ * ThreadOpts to them, and leave() as they finish. Fast-RTPS starts its
+ * threads without telling us, or naming them, so those are adopted
+ * instead. An Adopter names the calling thread across a call into
+ * Fast-RTPS; the threads it starts inherit that name, which tells them
+ * from the application's threads started meanwhile. They're scheduled
+ * from outside, by thread ID.
+ */
+class ThreadRegistry
+{
+public:
+    ThreadRegistry()
+    {
+    }
+
+    ThreadRegistry(const ThreadRegistry &) = delete;
+    ThreadRegistry &operator=(const ThreadRegistry &) = delete;
+
+    // THREAD_ROLES of them, for threads from now on
+    void configure(const ThreadOpts *o);
+
+    // the calling thread, which is given 'name' (15 characters at most)
+    void enter(ThreadRole role, const char *name);
+    void leave();
+
+    // the threads in the process now, sorted by ID
+    static std::vector<int> tasks();
+
+    // threads started since tasks() returned 'before' and named 'mark', bar
+    // our own, have 'role'
+    void adopt(const std::vector<int> &before, const char *mark, ThreadRole role);
+
+    // threads still running
+    std::vector<ThreadInfo> list();
+
+    // enter() for as long as it's in scope; nothing for a null registry
+    class Scope
+    {
+    public:
+        Scope(ThreadRegistry *r, ThreadRole role, const char *name) : reg(r)
+        {
+            if (reg != nullptr) {
+                reg->enter(role, name);
+            }
+        }
+
+        ~Scope()
+        {
+            if (reg != nullptr) {
+                reg->leave();
+            }
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        ThreadRegistry *reg;
+    };
+
+    // the threads the calling thread starts while it's in scope have 'role'.
+    // the thread is named 'mark' till then, and its own name restored after.
+    class Adopter
+    {
+    public:
+        Adopter(ThreadRegistry *r, ThreadRole role, const char *mark);
+        ~Adopter();
+
+        Adopter(const Adopter &) = delete;
+        Adopter &operator=(const Adopter &) = delete;
+
+    private:
+        ThreadRegistry *reg;
+        ThreadRole role;
+        const char *mark;
+        std::vector<int> before;
+        char name[16];
+    };
+
+private:
+    std::mutex mtx; // guards all below
+    ThreadOpts opts[THREAD_ROLES];
+    std::vector<ThreadInfo> threads;
+};
+
+} // namespace commkit
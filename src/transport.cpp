@@ -0,0 +1,23 @@
+#include "transport.h"
+#include "shmtransport.h"
+#include "udpbatchtransport.h"
+#include "udptransport.h"
+
+namespace commkit
+{
+
+std::unique_ptr<Transport> Transport::create(const TransportDescriptor &d,
+                                             ThreadRegistry *threads)
+{
+    switch (d.kind) {
+    case TRANSPORT_UDP:
+        return std::unique_ptr<Transport>(new UdpTransport(d));
+    case TRANSPORT_SHARED_MEMORY:
+        return std::unique_ptr<Transport>(new ShmTransport(d, threads));
+    case TRANSPORT_UDP_BATCHED:
+        return std::unique_ptr<Transport>(new UdpBatchTransport(d, threads));
+    }
+    return nullptr;
+}
+
+} // namespace commkit
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <commkit/node.h>
+
+#include <fastrtps/rtps/common/all_common.h>
+#include <fastrtps/attributes/ParticipantAttributes.h>
+
+#include "bytebuftopic.h"
+#include "loanpool.h"
+#include "threadregistry.h"
+
+namespace commkit
+{
+
+/*
+ * What travels with a sample besides its bytes, whichever way it goes.
+ */
+struct SampleMeta {
+    size_t len;
+    int64_t sequence;
+    int64_t timestamp; // nanoseconds, publisher's clock
+    bool reliable;     // written by a reliable publisher
+    eprosima::fastrtps::rtps::GUID_t writer;
+    int slot; // the writer's loan holding the sample (see TransportTopic::loans), if it is
+    int64_t received; // nanoseconds, our clock: when the kernel received it, or 0 if unknown
+};
+
+/*
+ * A topic as a transport sees it.
+ */
+struct TransportTopic {
+    std::string name;
+    size_t maxSampleSize; // as sent: serialized, or a whole frame
+    bool reliable;
+    const uint8_t *self; // our participant's GUID prefix
+    bool skipSelf;       // samples within our participant are delivered directly
+    LoanPool *loans;     // a writer's, which may retain() a sample's slot while sending it
+    bool timestamps;     // a reader's: wants SampleMeta::received, where there's one
+};
+
+/*
+ * A publisher's end of a transport.
+ */
+class TransportWriter
+{
+public:
+    virtual ~TransportWriter()
+    {
+    }
+
+    // whether subscribers of the participant with GUID prefix 'prefix'
+    // hear from us this way, so needn't over RTPS
+    virtual bool reaches(const eprosima::fastrtps::rtps::GuidPrefix_t &prefix) const = 0;
+
+    // whether there's anyone to write to at all
+    virtual bool hasReaders() const = 0;
+
+    // changes whenever the answers above might
+    virtual uint32_t generation() const = 0;
+
+    virtual bool write(const ByteBufFragment *frags, size_t n, const SampleMeta &meta) = 0;
+
+    virtual ZeroCopyStats zeroCopyStats() const
+    {
+        return ZeroCopyStats();
+    }
+};
+
+/*
+ * Where a TransportReader puts what it receives: a subscriber's history.
+ * Called from the reader's own threads.
+ */
+class TransportSink
+{
+public:
+    virtual ~TransportSink()
+    {
+    }
+
+    // a buffer to receive a sample of 'len' bytes into, or
+    // LoanPool::InvalidSlot if it must be dropped
+    virtual int reserve(size_t len) = 0;
+    virtual uint8_t *buffer(int slot) = 0;
+
+    // hand over a filled buffer, or give it back unused
+    virtual void deliver(int slot, const SampleMeta &meta, int priority) = 0;
+    virtual void discard(int slot) = 0;
+
+    // a run of deliveries is done: wake the application
+    virtual void flush() = 0;
+};
+
+/*
+ * A subscriber's end of a transport, delivering into a TransportSink
+ * from start() until it's destroyed.
+ */
+class TransportReader
+{
+public:
+    virtual ~TransportReader()
+    {
+    }
+
+    virtual bool start() = 0;
+
+    // whether samples from publishers of the participant with GUID
+    // prefix 'prefix' arrive this way
+    virtual bool covers(const eprosima::fastrtps::rtps::GuidPrefix_t &prefix) const = 0;
+};
+
+/*
+ * A way of exchanging samples with other Nodes, one per TransportDescriptor.
+ *
+ * RTPS itself always carries discovery, and samples for peers nothing else
+ * reaches. A transport may work underneath it, by way of the participant's
+ * configuration (as UDP does), or beside it, with endpoints of its own
+ * alongside each RTPS publisher and subscriber.
+ */
+class Transport
+{
+public:
+    explicit Transport(const TransportDescriptor &d, ThreadRegistry *t = nullptr)
+        : desc(d), threads(t)
+    {
+    }
+
+    virtual ~Transport()
+    {
+    }
+
+    // 'threads' registers any threads it starts
+    static std::unique_ptr<Transport> create(const TransportDescriptor &d,
+                                             ThreadRegistry *threads);
+
+    TransportKind kind() const
+    {
+        return desc.kind;
+    }
+
+    int priority() const
+    {
+        return desc.priority;
+    }
+
+    // called before the participant is created
+    virtual bool configure(const NodeOpts & /* opts */,
+                           eprosima::fastrtps::ParticipantAttributes * /* pa */)
+    {
+        return true;
+    }
+
+    // a topic's endpoints, or null if samples go through RTPS
+    virtual std::unique_ptr<TransportWriter> createWriter(const TransportTopic & /* t */)
+    {
+        return nullptr;
+    }
+
+    virtual std::unique_ptr<TransportReader> createReader(const TransportTopic & /* t */,
+                                                          TransportSink * /* sink */)
+    {
+        return nullptr;
+    }
+
+protected:
+    TransportDescriptor desc;
+    ThreadRegistry *threads; // the Node's, for threads we start
+};
+
+} // namespace commkit
@@ -0,0 +1,706 @@
+#include "udpbatch.h"
+#include "uringreceiver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace commkit
+{
+
+// out of line definition, for when this is odr-used (e.g. bound to a reference)
+constexpr size_t UdpBatch::MaxDatagram;
+constexpr size_t UdpBatch::MaxSegments;
+constexpr size_t UdpBatch::MaxZeroCopyPages;
+
+// io_uring gets buffers enough for a few batches, as it receives while
+// the last is handled
+static const unsigned URING_BUFFERS_PER_BATCH = 4;
+static const unsigned URING_MIN_BUFFERS = 16;
+
+#ifdef __linux__
+
+// room for the control messages we send or receive: a segment size, and
+// when the kernel received a datagram
+static const size_t CONTROL_SPACE = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(timespec));
+
+// a batch of datagrams and the messages describing them
+struct UdpBatch::Buffers {
+    std::vector<uint8_t> data;
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    std::vector<sockaddr_in> addrs;
+    std::vector<uint8_t> control; // CONTROL_SPACE per message, aligned as cmsghdr
+    std::vector<size_t> segments; // received, see segment()
+    std::vector<int64_t> stamps;  // received, see timestamp()
+    std::vector<iovec> gather;    // sendZeroCopy()'s, pointing at the caller's
+
+    Buffers(unsigned batch, size_t maxDatagram)
+        : data(batch * maxDatagram), msgs(batch), iovs(batch), addrs(batch),
+          control(batch * CONTROL_SPACE + alignof(cmsghdr)), segments(batch),
+          stamps(batch)
+    {
+        memset(msgs.data(), 0, batch * sizeof(mmsghdr));
+        for (unsigned i = 0; i < batch; ++i) {
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            iovs[i].iov_base = &data[i * maxDatagram];
+            iovs[i].iov_len = maxDatagram;
+        }
+    }
+
+    uint8_t *controlFor(unsigned i)
+    {
+        uintptr_t p = reinterpret_cast<uintptr_t>(control.data()) + alignof(cmsghdr) - 1;
+        p &= ~uintptr_t(alignof(cmsghdr) - 1);
+        return reinterpret_cast<uint8_t *>(p) + i * CONTROL_SPACE;
+    }
+};
+
+// the size of the datagrams GRO coalesced into a received one, if it did,
+// and when the kernel received it, if asked to say
+static void readControl(msghdr *h, size_t *segment, int64_t *stamp)
+{
+    *segment = 0;
+    *stamp = 0;
+    for (cmsghdr *c = CMSG_FIRSTHDR(h); c != nullptr; c = CMSG_NXTHDR(h, c)) {
+#ifdef UDP_GRO
+        if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+            int sz;
+            memcpy(&sz, CMSG_DATA(c), sizeof(sz));
+            *segment = size_t(sz);
+        }
+#endif
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            *stamp = int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+    }
+}
+
+UdpBatch::UdpBatch()
+    : sock(-1), batch(0), maxDatagram(0), gso(false), gro(false), stamping(false), zerocopy(false),
+      zeroCopyNext(0), sendCount(0), sendUsed(0), sendSyscalls(0), receiveSyscalls(0)
+{
+}
+
+UdpBatch::~UdpBatch()
+{
+    close();
+}
+
+void UdpBatch::close()
+{
+    uring.reset();
+    if (sock >= 0) {
+        ::close(sock);
+        sock = -1;
+    }
+    sending.reset();
+    receiving.reset();
+}
+
+bool UdpBatch::open(uint16_t port, unsigned n, size_t maxLen, bool shared)
+{
+    close();
+    if (n == 0 || maxLen == 0 || maxLen > MaxDatagram) {
+        return false;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return false;
+    }
+
+    int one = 1;
+    if (shared && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) {
+        close();
+        return false;
+    }
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port);
+    if (bind(sock, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) != 0) {
+        close();
+        return false;
+    }
+
+    batch = n;
+    maxDatagram = maxLen;
+    gso = false;
+    gro = false;
+    stamping = false;
+    zerocopy = false;
+    zeroCopyNext = 0;
+    sending.reset(new Buffers(batch, maxDatagram));
+    receiving.reset(new Buffers(batch, maxDatagram));
+    sendCount = 0;
+    sendUsed = 0;
+    return true;
+}
+
+bool UdpBatch::join(uint32_t group)
+{
+    ip_mreq mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.imr_multiaddr.s_addr = group;
+    mr.imr_interface.s_addr = htonl(INADDR_ANY);
+    return setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mr, sizeof(mr)) == 0;
+}
+
+bool UdpBatch::setBufferSizes(uint32_t send, uint32_t receive)
+{
+    int s = int(send);
+    int r = int(receive);
+    return setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &s, sizeof(s)) == 0 &&
+           setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &r, sizeof(r)) == 0;
+}
+
+bool UdpBatch::useGso()
+{
+    /*
+     * Setting the socket's default segment size (to none) is a harmless
+     * way to find out whether the kernel (4.18 on) knows of GSO; each
+     * send still gives its own.
+     */
+
+#ifdef UDP_SEGMENT
+    int none = 0;
+    gso = setsockopt(sock, IPPROTO_UDP, UDP_SEGMENT, &none, sizeof(none)) == 0;
+#endif
+    return gso;
+}
+
+bool UdpBatch::useGro()
+{
+#ifdef UDP_GRO
+    int one = 1;
+    gro = setsockopt(sock, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+#endif
+    return gro;
+}
+
+bool UdpBatch::useBusyPoll(unsigned usec)
+{
+#ifdef SO_BUSY_POLL
+    int v = int(usec);
+    return setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &v, sizeof(v)) == 0;
+#else
+    return false;
+#endif
+}
+
+bool UdpBatch::useTimestamps()
+{
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) != 0) {
+        return false;
+    }
+    stamping = true;
+    return true;
+}
+
+uint16_t UdpBatch::port() const
+{
+    sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    if (getsockname(sock, reinterpret_cast<sockaddr *>(&sa), &len) != 0) {
+        return 0;
+    }
+    return ntohs(sa.sin_port);
+}
+
+bool UdpBatch::send(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags, size_t n,
+                    size_t segment)
+{
+    /*
+     * Gather the datagram into the next free buffer, then point a message
+     * at it per destination. Should the messages run out part way, the
+     * batch is sent and the buffer moved to the front of the next one.
+     *
+     * A buffer of segments goes as one message per destination, for the
+     * kernel to split, with GSO; otherwise as a message per segment.
+     */
+
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        len += frags[i].len;
+    }
+    if (sock < 0 || len > maxDatagram) {
+        return false;
+    }
+
+    bool offload = gso && segment > 0 && len > segment &&
+                   (len + segment - 1) / segment <= MaxSegments;
+    size_t piece = (segment == 0 || offload) ? len : segment;
+
+    bool ok = true;
+    if (sendUsed == batch) {
+        ok = flush();
+    }
+
+    uint8_t *b = &sending->data[sendUsed * maxDatagram];
+    ByteBufTopicData(frags, n).read(b, len);
+    sendUsed++;
+
+    for (size_t i = 0; i < ndst; ++i) {
+        size_t off = 0;
+        do {
+            if (sendCount == batch) {
+                ok = flush() && ok;
+                if (b != sending->data.data()) {
+                    memcpy(sending->data.data(), b, len);
+                    b = sending->data.data();
+                }
+                sendUsed = 1;
+            }
+
+            sockaddr_in &sa = sending->addrs[sendCount];
+            memset(&sa, 0, sizeof(sa));
+            sa.sin_family = AF_INET;
+            sa.sin_addr.s_addr = dst[i].addr;
+            sa.sin_port = dst[i].port;
+
+            mmsghdr &m = sending->msgs[sendCount];
+            m.msg_hdr.msg_namelen = sizeof(sa);
+            m.msg_hdr.msg_control = nullptr;
+            m.msg_hdr.msg_controllen = 0;
+#ifdef UDP_SEGMENT
+            if (offload) {
+                m.msg_hdr.msg_control = sending->controlFor(sendCount);
+                m.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr *c = CMSG_FIRSTHDR(&m.msg_hdr);
+                c->cmsg_level = IPPROTO_UDP;
+                c->cmsg_type = UDP_SEGMENT;
+                c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t sz = uint16_t(segment);
+                memcpy(CMSG_DATA(c), &sz, sizeof(sz));
+            }
+#endif
+            sending->iovs[sendCount].iov_base = b + off;
+            sending->iovs[sendCount].iov_len = std::min(piece, len - off);
+            sendCount++;
+            off += piece;
+        } while (off < len);
+    }
+    return ok;
+}
+
+bool UdpBatch::flush()
+{
+    /*
+     * sendmmsg() stops at the first message it can't send; that one is
+     * given up on and the rest retried. EIO on a segmented message means
+     * the route can't offload it, so later ones aren't.
+     */
+
+    bool ok = true;
+    unsigned off = 0;
+    while (off < sendCount) {
+        int r = sendmmsg(sock, &sending->msgs[off], sendCount - off, 0);
+        sendSyscalls++;
+        if (r > 0) {
+            off += r;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (r < 0 && errno == EIO && sending->msgs[off].msg_hdr.msg_controllen > 0) {
+                gso = false;
+            }
+            off++;
+            ok = false;
+        }
+    }
+    sendCount = 0;
+    sendUsed = 0;
+    return ok;
+}
+
+bool UdpBatch::useZeroCopy()
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int one = 1;
+    zerocopy = setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+    return zerocopy;
+}
+
+int UdpBatch::sendZeroCopy(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags,
+                           size_t n, size_t segment, uint32_t *first)
+{
+    /*
+     * A message per destination, all gathering from the same fragments,
+     * with what's queued sent first to keep things in order. Only runs of
+     * segments GSO can take go this way; pieces of one would each need a
+     * copy of their own to point at.
+     *
+     * The kernel numbers each zero-copy message it takes, from 0 per
+     * socket; it lets go of the number of one it fails. Running short
+     * of the memory it tracks them in (ENOBUFS), or the data spanning
+     * more pages than a datagram can hold on to (EMSGSIZE), leaves us
+     * to copy. Fragments span a page at least, so too many are known
+     * not to fit without asking.
+     */
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        len += frags[i].len;
+    }
+    bool offload = gso && segment > 0 && len > segment &&
+                   (len + segment - 1) / segment <= MaxSegments;
+    if (!zerocopy || sock < 0 || len > MaxDatagram || n > MaxZeroCopyPages ||
+        (segment > 0 && len > segment && !offload)) {
+        return -1;
+    }
+
+    flush();
+
+    sending->gather.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        sending->gather[i].iov_base = const_cast<uint8_t *>(frags[i].bytes);
+        sending->gather[i].iov_len = frags[i].len;
+    }
+
+    *first = zeroCopyNext;
+    int sent = 0;
+    bool copyInstead = false;
+    size_t done = 0;
+    while (done < ndst && !copyInstead) {
+        unsigned count = unsigned(std::min<size_t>(batch, ndst - done));
+        for (unsigned j = 0; j < count; ++j) {
+            sockaddr_in &sa = sending->addrs[j];
+            memset(&sa, 0, sizeof(sa));
+            sa.sin_family = AF_INET;
+            sa.sin_addr.s_addr = dst[done + j].addr;
+            sa.sin_port = dst[done + j].port;
+
+            msghdr &h = sending->msgs[j].msg_hdr;
+            h.msg_namelen = sizeof(sa);
+            h.msg_iov = sending->gather.data();
+            h.msg_iovlen = n;
+            h.msg_control = nullptr;
+            h.msg_controllen = 0;
+#ifdef UDP_SEGMENT
+            if (offload) {
+                h.msg_control = sending->controlFor(j);
+                h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr *c = CMSG_FIRSTHDR(&h);
+                c->cmsg_level = IPPROTO_UDP;
+                c->cmsg_type = UDP_SEGMENT;
+                c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t sz = uint16_t(segment);
+                memcpy(CMSG_DATA(c), &sz, sizeof(sz));
+            }
+#endif
+        }
+
+        unsigned off = 0;
+        while (off < count) {
+            int r = sendmmsg(sock, &sending->msgs[off], count - off, MSG_ZEROCOPY);
+            sendSyscalls++;
+            if (r > 0) {
+                off += r;
+                sent += r;
+                zeroCopyNext += r;
+            } else if (r < 0 && errno == EINTR) {
+                continue;
+            } else if (r < 0 && (errno == ENOBUFS || errno == EMSGSIZE) && sent == 0) {
+                copyInstead = true; // nothing's gone yet, so copy the lot
+                break;
+            } else {
+                off++;
+            }
+        }
+        done += count;
+    }
+
+    // back to how send() expects them
+    for (unsigned j = 0; j < std::min<size_t>(batch, ndst); ++j) {
+        sending->msgs[j].msg_hdr.msg_iov = &sending->iovs[j];
+        sending->msgs[j].msg_hdr.msg_iovlen = 1;
+    }
+    return copyInstead ? -1 : sent;
+#else
+    return -1;
+#endif
+}
+
+bool UdpBatch::zeroCopyDone(uint32_t *lo, uint32_t *hi, bool *copied)
+{
+    /*
+     * Reports arrive on the socket's error queue, consecutive ones merged
+     * into one. Anything else found there is passed over.
+     */
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    union {
+        cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+    } control;
+
+    for (;;) {
+        msghdr h;
+        memset(&h, 0, sizeof(h));
+        h.msg_control = control.buf;
+        h.msg_controllen = sizeof(control.buf);
+        if (recvmsg(sock, &h, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        for (cmsghdr *c = CMSG_FIRSTHDR(&h); c != nullptr; c = CMSG_NXTHDR(&h, c)) {
+            if (c->cmsg_level != SOL_IP || c->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+            sock_extended_err e;
+            memcpy(&e, CMSG_DATA(c), sizeof(e));
+            if (e.ee_origin == SO_EE_ORIGIN_ZEROCOPY && e.ee_errno == 0) {
+                *lo = e.ee_info;
+                *hi = e.ee_data;
+                *copied = (e.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+                return true;
+            }
+        }
+    }
+#else
+    return false;
+#endif
+}
+
+bool UdpBatch::useUring()
+{
+    if (sock < 0) {
+        return false;
+    }
+    std::unique_ptr<UringReceiver> u(new UringReceiver());
+    if (!u->open(sock, std::max(URING_BUFFERS_PER_BATCH * batch, URING_MIN_BUFFERS),
+                 maxDatagram)) {
+        return false;
+    }
+    uring = std::move(u);
+    return true;
+}
+
+int UdpBatch::completionFd() const
+{
+    return uring ? uring->fd() : -1;
+}
+
+int UdpBatch::receive()
+{
+    /*
+     * Should io_uring fail, we carry on with recvmmsg(), which finds
+     * whatever it left on the socket.
+     */
+
+    if (sock < 0) {
+        return -1;
+    }
+
+    if (uring) {
+        int n = uring->receive(batch);
+        if (n >= 0) {
+            return n;
+        }
+        receiveSyscalls += uring->calls();
+        uring.reset();
+    }
+
+    // control messages only come as the socket asks for them, so without
+    // GRO or timestamps there's no room made for them
+    bool control = gro || stamping;
+    for (unsigned i = 0; i < batch; ++i) {
+        msghdr &h = receiving->msgs[i].msg_hdr;
+        h.msg_namelen = sizeof(sockaddr_in);
+        h.msg_control = control ? receiving->controlFor(i) : nullptr;
+        h.msg_controllen = control ? CONTROL_SPACE : 0;
+    }
+
+    for (;;) {
+        int r = recvmmsg(sock, receiving->msgs.data(), batch, MSG_DONTWAIT, nullptr);
+        receiveSyscalls++;
+        if (r >= 0) {
+            for (int i = 0; i < r; ++i) {
+                readControl(&receiving->msgs[i].msg_hdr, &receiving->segments[i],
+                            &receiving->stamps[i]);
+            }
+            return r;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+const uint8_t *UdpBatch::datagram(unsigned i, size_t *len, UdpAddress *from) const
+{
+    if (uring) {
+        return uring->datagram(i, len, from);
+    }
+
+    const mmsghdr &m = receiving->msgs[i];
+    *len = m.msg_len;
+    if (from != nullptr) {
+        from->addr = receiving->addrs[i].sin_addr.s_addr;
+        from->port = receiving->addrs[i].sin_port;
+    }
+    return &receiving->data[i * maxDatagram];
+}
+
+size_t UdpBatch::segment(unsigned i) const
+{
+    return uring ? uring->segment(i) : receiving->segments[i];
+}
+
+int64_t UdpBatch::timestamp(unsigned i) const
+{
+    return uring ? uring->timestamp(i) : receiving->stamps[i];
+}
+
+#else // __linux__
+
+struct UdpBatch::Buffers {
+};
+
+UdpBatch::UdpBatch()
+    : sock(-1), batch(0), maxDatagram(0), gso(false), gro(false), stamping(false), zerocopy(false),
+      zeroCopyNext(0), sendCount(0), sendUsed(0), sendSyscalls(0), receiveSyscalls(0)
+{
+}
+
+UdpBatch::~UdpBatch()
+{
+}
+
+void UdpBatch::close()
+{
+}
+
+bool UdpBatch::open(uint16_t, unsigned, size_t, bool)
+{
+    return false;
+}
+
+bool UdpBatch::join(uint32_t)
+{
+    return false;
+}
+
+bool UdpBatch::setBufferSizes(uint32_t, uint32_t)
+{
+    return false;
+}
+
+uint16_t UdpBatch::port() const
+{
+    return 0;
+}
+
+bool UdpBatch::useGso()
+{
+    return false;
+}
+
+bool UdpBatch::useGro()
+{
+    return false;
+}
+
+bool UdpBatch::useBusyPoll(unsigned)
+{
+    return false;
+}
+
+bool UdpBatch::useTimestamps()
+{
+    return false;
+}
+
+bool UdpBatch::send(const UdpAddress *, size_t, const ByteBufFragment *, size_t, size_t)
+{
+    return false;
+}
+
+bool UdpBatch::flush()
+{
+    return false;
+}
+
+bool UdpBatch::useZeroCopy()
+{
+    return false;
+}
+
+int UdpBatch::sendZeroCopy(const UdpAddress *, size_t, const ByteBufFragment *, size_t, size_t,
+                           uint32_t *)
+{
+    return -1;
+}
+
+bool UdpBatch::zeroCopyDone(uint32_t *, uint32_t *, bool *)
+{
+    return false;
+}
+
+bool UdpBatch::useUring()
+{
+    return false;
+}
+
+int UdpBatch::completionFd() const
+{
+    return -1;
+}
+
+int UdpBatch::receive()
+{
+    return -1;
+}
+
+const uint8_t *UdpBatch::datagram(unsigned, size_t *len, UdpAddress *) const
+{
+    *len = 0;
+    return nullptr;
+}
+
+size_t UdpBatch::segment(unsigned) const
+{
+    return 0;
+}
+
+int64_t UdpBatch::timestamp(unsigned) const
+{
+    return 0;
+}
+
+#endif // __linux__
+
+uint64_t UdpBatch::receiveCalls() const
+{
+    return receiveSyscalls + (uring ? uring->calls() : 0);
+}
+
+} // namespace commkit
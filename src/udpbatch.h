@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "bytebuftopic.h"
+
+namespace commkit
+{
+
+class UringReceiver;
+
+// an IPv4 address and port, both in network byte order
+struct UdpAddress {
+    uint32_t addr;
+    uint16_t port;
+};
+
+/*
+ * A UDP socket that sends and receives datagrams in batches: a sendmmsg()
+ * or recvmmsg() call per batch rather than a syscall per datagram. Both
+ * directions use buffers allocated up front, a batch of each.
+ *
+ * One thread may send while another receives, but neither side is
+ * otherwise thread safe.
+ *
+ * Linux only; open() fails elsewhere.
+ */
+class UdpBatch
+{
+public:
+    static constexpr size_t MaxDatagram = 65507; // UDP over IPv4
+    static constexpr size_t MaxSegments = 64;    // per GSO send (UDP_MAX_SEGMENTS)
+    static constexpr size_t MaxZeroCopyPages = 17; // a zero-copy message spans (MAX_SKB_FRAGS)
+
+    UdpBatch();
+    ~UdpBatch();
+
+    UdpBatch(const UdpBatch &) = delete;
+    UdpBatch &operator=(const UdpBatch &) = delete;
+
+    // bind to 'port' on every interface (0: any free port), to move up to
+    // 'batch' datagrams of up to 'maxDatagram' bytes per call. 'shared'
+    // lets other sockets bind the same port, as for multicast.
+    bool open(uint16_t port, unsigned batch, size_t maxDatagram, bool shared = false);
+
+    // also receive datagrams sent to multicast group 'group'
+    bool join(uint32_t group);
+
+    bool setBufferSizes(uint32_t send, uint32_t receive);
+
+    // send segmented datagrams (see send()) a message per destination, for
+    // the kernel to split up (UDP GSO, Linux 4.18 on); false, sending a
+    // message per segment, where it can't
+    bool useGso();
+
+    // receive runs of datagrams from one sender coalesced into one, where
+    // the kernel can (UDP GRO, Linux 5.0 on); see segment()
+    bool useGro();
+
+    // have receives that find nothing poll the device for up to 'usec'
+    // first (SO_BUSY_POLL, Linux 3.11 on). raising it past the
+    // net.core.busy_read sysctl needs CAP_NET_ADMIN; false if refused.
+    bool useBusyPoll(unsigned usec);
+
+    // have the kernel say when it received each datagram (SO_TIMESTAMPNS),
+    // see timestamp(). safe while another thread receives.
+    bool useTimestamps();
+
+    int fd() const
+    {
+        return sock;
+    }
+
+    // what we're bound to, host byte order
+    uint16_t port() const;
+
+    // queue a datagram, gathered from 'frags', for each of 'ndst'
+    // destinations; the batch is sent whenever it fills up. the data is
+    // copied once, however many destinations there are. with 'segment',
+    // it's sent as datagrams of that many bytes, bar a shorter last one.
+    bool send(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags, size_t n,
+              size_t segment = 0);
+
+    // send everything queued; false if any of it couldn't be
+    bool flush();
+
+    // send with MSG_ZEROCOPY (Linux 5.0 on, for UDP); see sendZeroCopy()
+    bool useZeroCopy();
+
+    // send a datagram at once, as send() then flush() would, but straight
+    // from 'frags' rather than a copy: the kernel may read them until it
+    // reports it's done with each message sent (see zeroCopyDone()),
+    // numbered on from 'first'. how many were, or -1, with nothing sent,
+    // if this can't be done (as for data across more than MaxZeroCopyPages
+    // pages): send() it instead.
+    int sendZeroCopy(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags, size_t n,
+                     size_t segment, uint32_t *first);
+
+    // take a report without blocking: messages 'lo' to 'hi' (wrapping)
+    // are done with, and were 'copied' after all, as over loopback.
+    // false once there are none; they make fd() poll with POLLERR.
+    bool zeroCopyDone(uint32_t *lo, uint32_t *hi, bool *copied);
+
+    unsigned queued() const
+    {
+        return sendCount;
+    }
+
+    // receive through io_uring (see UringReceiver) rather than recvmmsg():
+    // false, carrying on with recvmmsg(), where the kernel can't
+    bool useUring();
+
+    // readable when io_uring has datagrams for us; -1 unless using it.
+    // poll this as well as fd(), which is readable should io_uring stop
+    // receiving for want of buffers.
+    int completionFd() const;
+
+    // take whatever datagrams are waiting, up to a batch, without blocking:
+    // how many, or -1 on error. they're valid until the next call.
+    int receive();
+    const uint8_t *datagram(unsigned i, size_t *len, UdpAddress *from) const;
+
+    // with GRO, the size of each datagram coalesced into datagram i, bar
+    // a shorter last one; 0 if it's just the one
+    size_t segment(unsigned i) const;
+
+    // with useTimestamps(), when the kernel received datagram i:
+    // CLOCK_REALTIME nanoseconds, or 0 if it didn't say
+    int64_t timestamp(unsigned i) const;
+
+    // syscalls made so far, for benchmarks
+    uint64_t sendCalls() const
+    {
+        return sendSyscalls;
+    }
+
+    uint64_t receiveCalls() const;
+
+private:
+    struct Buffers;
+
+    void close();
+
+    int sock;
+    unsigned batch;
+    size_t maxDatagram;
+    bool gso;
+    bool gro;
+    std::atomic<bool> stamping; // useTimestamps() succeeded
+    bool zerocopy;
+    uint32_t zeroCopyNext; // the kernel's number for our next zero-copy message
+
+    std::unique_ptr<Buffers> sending;
+    unsigned sendCount; // messages queued
+    unsigned sendUsed;  // buffers they use; a buffer may go to several destinations
+    uint64_t sendSyscalls;
+
+    std::unique_ptr<Buffers> receiving;
+    std::unique_ptr<UringReceiver> uring; // when receiving through io_uring
+    uint64_t receiveSyscalls;
+};
+
+} // namespace commkit
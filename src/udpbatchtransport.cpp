@@ -0,0 +1,1088 @@
+#include "udpbatchtransport.h"
+#include "loanpool.h"
+#include "spin.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace eprosima::fastrtps;
+
+namespace commkit
+{
+
+static constexpr uint32_t BATCH_MAGIC = 0x62756b63; // "ckub"
+static constexpr uint16_t BATCH_VERSION = 2;
+
+enum BatchKind : uint16_t {
+    BATCH_DATA = 1,
+    BATCH_ANNOUNCE = 2,
+};
+
+// a sample's datagram: this, then the sample, or the piece of it at
+// 'offset' should it be segmented (see TransportDescriptor::segmentSize)
+struct DataHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint64_t topic; // topicHash() of its name
+    uint8_t writer[16];
+    int64_t sequence;
+    int64_t timestamp; // nanoseconds, publisher's clock
+    uint32_t total;    // length of the whole sample
+    uint32_t offset;
+};
+
+// a Node's announcement: this, then 'count' topic hashes
+struct AnnounceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint8_t prefix[12];
+    uint16_t port; // of its data socket
+    uint16_t count;
+};
+
+// discovery goes to RTPS' default multicast group, on a port RTPS leaves
+// unused (its well-known ports use offsets 0, 1, and from 10 up)
+static constexpr uint32_t DISCOVERY_GROUP = 0xefff0001; // 239.255.0.1
+static constexpr uint32_t DISCOVERY_PORT_BASE = 7400;
+static constexpr uint32_t DISCOVERY_DOMAIN_GAIN = 250;
+static constexpr uint32_t DISCOVERY_PORT_OFFSET = 2;
+static constexpr unsigned DISCOVERY_BATCH = 8;
+
+static constexpr std::chrono::seconds ANNOUNCE_PERIOD(1);
+static constexpr std::chrono::seconds REMOTE_LEASE(5);
+
+// how often the io thread checks whether it should stop
+static constexpr std::chrono::milliseconds IO_WAIT_INTERVAL(100);
+
+// busyPoll: how long the io thread spins on the data socket before looking
+// at the rest, and how long receives busy poll the device (SO_BUSY_POLL)
+static constexpr std::chrono::milliseconds SPIN_INTERVAL(1);
+static constexpr unsigned BUSY_POLL_USEC = 50;
+
+// sendmmsg() takes no more than this many messages at once (UIO_MAXIOV)
+static constexpr unsigned MAX_BATCH = 1024;
+
+// a segmented sample still missing pieces after this long is dropped, as
+// are the oldest beyond this many per subscriber
+static constexpr std::chrono::seconds REASSEMBLY_TIMEOUT(1);
+static constexpr size_t MAX_PARTIALS = 8;
+
+// how long a writer going away waits for the kernel to finish its zero-copy
+// sends, after which their loans are left to it
+static constexpr std::chrono::seconds ZERO_COPY_DRAIN_TIMEOUT(1);
+
+// our clock less the realtime clock, nanoseconds
+static int64_t clockOffset()
+{
+    auto steady = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock::now().time_since_epoch());
+    auto realtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    return steady.count() - realtime.count();
+}
+
+static uint64_t topicHash(const std::string &name)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : name) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// a local subscriber: where its samples go, and whose it's had
+struct UdpBatchTransport::ReaderState {
+    // a segmented sample being put together in one of the sink's buffers
+    struct Reassembly {
+        uint8_t writer[16];
+        int64_t sequence;
+        int64_t timestamp;
+        int slot;
+        uint32_t total;
+        uint32_t next; // offset of the piece we're waiting for
+        clock::time_point started;
+    };
+
+    std::mutex mtx; // guards sink and partials, held while delivering
+    TransportSink *sink;
+    int priority;
+    bool skipSelf;
+    std::vector<Reassembly> partials;
+
+    bool take(const DataHeader &h, const uint8_t *b, size_t len, int64_t received);
+    void expire(clock::time_point now);
+
+    // writers heard from directly, and when: RTPS copies of their samples
+    // are dropped until they've been quiet for a lease
+    struct Writer {
+        rtps::GuidPrefix_t prefix;
+        clock::time_point seen;
+    };
+
+    std::mutex writersMtx; // guards writers
+    std::vector<Writer> writers;
+};
+
+bool UdpBatchTransport::ReaderState::take(const DataHeader &h, const uint8_t *b, size_t len,
+                                          int64_t received)
+{
+    /*
+     * Deliver a sample, or put a piece of one in its place: true once a
+     * whole sample has been delivered. Called with mtx held.
+     *
+     * A writer's pieces go out in order, and on one socket mostly arrive
+     * that way, so a piece out of place means one was lost: the sample is
+     * given up on. A segmented sample was received when its last piece was.
+     */
+
+    SampleMeta meta = {h.total, h.sequence, h.timestamp, false, {}, LoanPool::InvalidSlot,
+                       received};
+    memcpy(meta.writer.guidPrefix.value, h.writer, sizeof(meta.writer.guidPrefix.value));
+    memcpy(meta.writer.entityId.value, h.writer + sizeof(meta.writer.guidPrefix.value),
+           sizeof(meta.writer.entityId.value));
+
+    if (h.offset == 0 && len == h.total) {
+        int slot = sink->reserve(len);
+        if (slot == LoanPool::InvalidSlot) {
+            return false;
+        }
+        memcpy(sink->buffer(slot), b, len);
+        sink->deliver(slot, meta, priority);
+        return true;
+    }
+
+    auto r = std::find_if(partials.begin(), partials.end(), [&h](const Reassembly &pr) {
+        return pr.sequence == h.sequence && memcmp(pr.writer, h.writer, sizeof(pr.writer)) == 0;
+    });
+    if (h.offset == 0) {
+        if (r != partials.end()) {
+            sink->discard(r->slot);
+            partials.erase(r);
+        }
+        if (partials.size() >= MAX_PARTIALS) {
+            auto oldest = std::min_element(
+                partials.begin(), partials.end(),
+                [](const Reassembly &x, const Reassembly &y) { return x.started < y.started; });
+            sink->discard(oldest->slot);
+            partials.erase(oldest);
+        }
+
+        int slot = sink->reserve(h.total);
+        if (slot == LoanPool::InvalidSlot) {
+            return false;
+        }
+        Reassembly pr;
+        memcpy(pr.writer, h.writer, sizeof(pr.writer));
+        pr.sequence = h.sequence;
+        pr.timestamp = h.timestamp;
+        pr.slot = slot;
+        pr.total = h.total;
+        pr.next = 0;
+        pr.started = clock::now();
+        partials.push_back(pr);
+        r = partials.end() - 1;
+    } else if (r == partials.end()) {
+        return false; // missed its start
+    }
+
+    if (h.offset != r->next || h.total != r->total || len > r->total - r->next) {
+        sink->discard(r->slot);
+        partials.erase(r);
+        return false;
+    }
+    memcpy(sink->buffer(r->slot) + h.offset, b, len);
+    r->next += uint32_t(len);
+    if (r->next < r->total) {
+        return false;
+    }
+
+    sink->deliver(r->slot, meta, priority);
+    partials.erase(r);
+    return true;
+}
+
+void UdpBatchTransport::ReaderState::expire(clock::time_point now)
+{
+    /*
+     * Give up on samples whose pieces are overdue, and forget writers gone
+     * quiet, so their samples are taken from RTPS again. Called with mtx
+     * held.
+     */
+    for (auto it = partials.begin(); it != partials.end();) {
+        if (now - it->started > REASSEMBLY_TIMEOUT) {
+            sink->discard(it->slot);
+            it = partials.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(writersMtx);
+    writers.erase(
+        std::remove_if(writers.begin(), writers.end(),
+                       [now](const Writer &w) { return now - w.seen > REMOTE_LEASE; }),
+        writers.end());
+}
+
+// a writer's zero-copy sends: the pool their loans are from, until the
+// writer's gone, and how they went
+struct UdpBatchTransport::ZeroCopyOwner {
+    std::mutex mtx; // guards pool, outstanding
+    std::condition_variable drained;
+    LoanPool *pool;
+    unsigned outstanding; // slots retained for sends not yet done with
+
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> copied;
+    std::atomic<uint64_t> fallbacks;
+
+    explicit ZeroCopyOwner(LoanPool *p) : pool(p), outstanding(0), sent(0), copied(0), fallbacks(0)
+    {
+    }
+};
+
+// a zero-copy send the kernel may still be reading from
+struct UdpBatchTransport::ZeroCopySend {
+    uint32_t first;     // the kernel's number for its first message
+    unsigned count;     // of them
+    unsigned remaining; // not yet reported done with
+    bool copied;        // by the kernel, after all
+    int slot;
+    std::shared_ptr<ZeroCopyOwner> owner;
+    std::vector<DataHeader> headers; // sent along with the loan, so kept as long
+};
+
+class UdpBatchWriter : public TransportWriter
+{
+public:
+    UdpBatchWriter(UdpBatchTransport *tp, const TransportTopic &t, size_t seg, size_t zcThreshold)
+        : transport(tp), topic(topicHash(t.name)), self(t.skipSelf ? t.self : nullptr),
+          segment(seg), zeroCopyThreshold(zcThreshold), destGeneration(0), destValid(false)
+    {
+        if (zeroCopyThreshold > 0 && t.loans != nullptr) {
+            zc = std::make_shared<UdpBatchTransport::ZeroCopyOwner>(t.loans);
+        }
+    }
+
+    ~UdpBatchWriter()
+    {
+        // our publisher's pool goes with us, so mustn't be recycled into
+        // once we're gone
+        if (zc) {
+            std::unique_lock<std::mutex> lk(zc->mtx);
+            zc->drained.wait_for(lk, ZERO_COPY_DRAIN_TIMEOUT,
+                                 [this] { return zc->outstanding == 0; });
+            zc->pool = nullptr;
+        }
+    }
+
+    bool reaches(const rtps::GuidPrefix_t &prefix) const
+    {
+        return transport->remoteReads(topic, prefix);
+    }
+
+    bool hasReaders() const
+    {
+        return transport->hasRemotes(topic, self);
+    }
+
+    uint32_t generation() const
+    {
+        return transport->remotesGeneration.load(std::memory_order_acquire);
+    }
+
+    bool write(const ByteBufFragment *frags, size_t n, const SampleMeta &meta)
+    {
+        /*
+         * A sample that doesn't fit one segment goes as a run of them,
+         * each with a header of its own; as many as fit a datagram are
+         * handed over together, for GSO to split.
+         */
+
+        DataHeader h;
+        h.magic = BATCH_MAGIC;
+        h.version = BATCH_VERSION;
+        h.kind = BATCH_DATA;
+        h.topic = topic;
+        memcpy(h.writer, meta.writer.guidPrefix.value, sizeof(meta.writer.guidPrefix.value));
+        memcpy(h.writer + sizeof(meta.writer.guidPrefix.value), meta.writer.entityId.value,
+               sizeof(meta.writer.entityId.value));
+        h.sequence = meta.sequence;
+        h.timestamp = meta.timestamp;
+        h.total = uint32_t(meta.len);
+        h.offset = 0;
+
+        std::lock_guard<std::mutex> guard(destMtx);
+        uint32_t gen = generation();
+        if (!destValid || gen != destGeneration) {
+            transport->destinations(topic, self, &dests);
+            destGeneration = gen;
+            destValid = true;
+        }
+        if (dests.empty()) {
+            return true;
+        }
+
+        // thread_local so they're only allocated once
+        static thread_local std::vector<ByteBufFragment> all;
+        static thread_local std::vector<DataHeader> headers;
+
+        if (segment == 0 || sizeof(h) + meta.len <= segment) {
+            headers.assign(1, h);
+            all.assign(1, {reinterpret_cast<const uint8_t *>(headers.data()), sizeof(h)});
+            all.insert(all.end(), frags, frags + n);
+            return send(all, &headers, 0, meta);
+        }
+
+        size_t piece = segment - sizeof(h);
+        size_t perSend = std::min(UdpBatch::MaxSegments, UdpBatch::MaxDatagram / segment);
+        bool ok = true;
+        for (size_t off = 0; off < meta.len; off += piece * perSend) {
+            all.clear();
+            headers.resize(perSend); // anew, should the last send have kept them
+            for (size_t k = 0; k < perSend && off + k * piece < meta.len; ++k) {
+                size_t at = off + k * piece;
+                headers[k] = h;
+                headers[k].offset = uint32_t(at);
+                all.push_back({reinterpret_cast<const uint8_t *>(&headers[k]), sizeof(h)});
+                slice(frags, n, at, std::min(piece, meta.len - at), &all);
+            }
+            ok = send(all, &headers, segment, meta) && ok;
+        }
+        return ok;
+    }
+
+    ZeroCopyStats zeroCopyStats() const
+    {
+        ZeroCopyStats s;
+        if (zc) {
+            s.sent = zc->sent.load(std::memory_order_relaxed);
+            s.copied = zc->copied.load(std::memory_order_relaxed);
+            s.fallbacks = zc->fallbacks.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+private:
+    // a datagram, or run of them, from 'all', whose headers are in 'headers':
+    // from the sample's loan if it's big enough, otherwise copied
+    bool send(const std::vector<ByteBufFragment> &all, std::vector<DataHeader> *headers,
+              size_t seg, const SampleMeta &meta)
+    {
+        if (zc && meta.len > zeroCopyThreshold) {
+            if (meta.slot != LoanPool::InvalidSlot &&
+                transport->sendZeroCopy(dests.data(), dests.size(), all.data(), all.size(), seg,
+                                        zc, meta.slot, headers)) {
+                return true;
+            }
+            zc->fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+        return transport->send(dests.data(), dests.size(), all.data(), all.size(), seg);
+    }
+
+    // append the fragments covering 'len' bytes of 'frags' from 'off'
+    static void slice(const ByteBufFragment *frags, size_t n, size_t off, size_t len,
+                      std::vector<ByteBufFragment> *out)
+    {
+        for (size_t i = 0; i < n && len > 0; ++i) {
+            if (off >= frags[i].len) {
+                off -= frags[i].len;
+                continue;
+            }
+            size_t take = std::min(len, frags[i].len - off);
+            out->push_back({frags[i].bytes + off, take});
+            len -= take;
+            off = 0;
+        }
+    }
+
+    UdpBatchTransport *transport;
+    uint64_t topic;
+    const uint8_t *self; // null unless our own samples are delivered directly
+    size_t segment;      // see TransportDescriptor::segmentSize
+    size_t zeroCopyThreshold;
+    std::shared_ptr<UdpBatchTransport::ZeroCopyOwner> zc; // unless it's zero
+
+    std::mutex destMtx; // guards dests, destGeneration, destValid
+    std::vector<UdpAddress> dests;
+    uint32_t destGeneration;
+    bool destValid;
+};
+
+class UdpBatchReader : public TransportReader
+{
+public:
+    UdpBatchReader(UdpBatchTransport *tp, uint64_t t,
+                   std::shared_ptr<UdpBatchTransport::ReaderState> s)
+        : transport(tp), topic(t), state(s)
+    {
+    }
+
+    ~UdpBatchReader()
+    {
+        // once the io thread is done with it, nothing more is delivered
+        transport->removeReader(topic, state);
+        std::lock_guard<std::mutex> guard(state->mtx);
+        state->sink = nullptr;
+    }
+
+    bool start()
+    {
+        std::lock_guard<std::mutex> guard(transport->mtx);
+        transport->readers[topic].push_back(state);
+        transport->announce();
+        return true;
+    }
+
+    bool covers(const rtps::GuidPrefix_t &prefix) const
+    {
+        std::lock_guard<std::mutex> guard(state->writersMtx);
+        for (auto &w : state->writers) {
+            if (w.prefix == prefix) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    UdpBatchTransport *transport;
+    uint64_t topic;
+    std::shared_ptr<UdpBatchTransport::ReaderState> state;
+};
+
+UdpBatchTransport::UdpBatchTransport(const TransportDescriptor &d, ThreadRegistry *threads)
+    : Transport(d, threads), domainID(0), sendBufferSize(0), receiveBufferSize(0), started(false),
+      self(), dataPort(0), discoveryPort(0), remotesGeneration(0), flushPending(false),
+      running(false)
+{
+}
+
+UdpBatchTransport::~UdpBatchTransport()
+{
+    {
+        std::lock_guard<std::mutex> guard(sendMtx);
+        running = false;
+    }
+    flushCv.notify_all();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    if (io.joinable()) {
+        io.join();
+    }
+}
+
+bool UdpBatchTransport::configure(const NodeOpts &opts, ParticipantAttributes * /* pa */)
+{
+    domainID = opts.domainID;
+    sendBufferSize = opts.sendSocketBufferSize;
+    receiveBufferSize = opts.listenSocketBufferSize;
+    bool segmentOk = desc.segmentSize == 0 || (desc.segmentSize > sizeof(DataHeader) &&
+                                               desc.segmentSize <= UdpBatch::MaxDatagram);
+    return desc.batchSize > 0 && desc.batchSize <= MAX_BATCH && segmentOk;
+}
+
+bool UdpBatchTransport::carries(const TransportTopic &t) const
+{
+    // best effort only, and unsegmented samples must fit a datagram
+    return !t.reliable && (desc.segmentSize > 0 ||
+                           t.maxSampleSize <= UdpBatch::MaxDatagram - sizeof(DataHeader));
+}
+
+std::unique_ptr<TransportWriter> UdpBatchTransport::createWriter(const TransportTopic &t)
+{
+    if (!carries(t)) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(mtx);
+    if (!start(t.self)) {
+        return nullptr;
+    }
+    return std::unique_ptr<TransportWriter>(
+        new UdpBatchWriter(this, t, desc.segmentSize, desc.zeroCopyThreshold));
+}
+
+std::unique_ptr<TransportReader> UdpBatchTransport::createReader(const TransportTopic &t,
+                                                                 TransportSink *sink)
+{
+    if (!carries(t)) {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (!start(t.self)) {
+            return nullptr;
+        }
+        // the socket's shared, so once one subscriber wants them, all get them
+        if (t.timestamps) {
+            data.useTimestamps();
+        }
+    }
+
+    auto st = std::make_shared<ReaderState>();
+    st->sink = sink;
+    st->priority = desc.priority;
+    st->skipSelf = t.skipSelf;
+    return std::unique_ptr<TransportReader>(new UdpBatchReader(this, topicHash(t.name), st));
+}
+
+bool UdpBatchTransport::start(const uint8_t *prefix)
+{
+    /*
+     * Open the sockets and start our threads along with our first endpoint,
+     * once the participant, and so our GUID prefix, exists. Called with
+     * mtx held; a failure sticks.
+     */
+
+    if (started) {
+        return running;
+    }
+    started = true;
+    memcpy(self.value, prefix, sizeof(self.value));
+
+    uint32_t port = DISCOVERY_PORT_BASE + DISCOVERY_DOMAIN_GAIN * domainID + DISCOVERY_PORT_OFFSET;
+    if (port > UINT16_MAX || !data.open(0, desc.batchSize, UdpBatch::MaxDatagram) ||
+        !data.setBufferSizes(sendBufferSize, receiveBufferSize) ||
+        !discovery.open(uint16_t(port), DISCOVERY_BATCH, UdpBatch::MaxDatagram, true) ||
+        !discovery.join(htonl(DISCOVERY_GROUP))) {
+        return false;
+    }
+    // GSO and GRO where the kernel can; peers may segment even if we don't
+    if (desc.segmentSize > 0) {
+        data.useGso();
+    }
+    data.useGro();
+    if (desc.zeroCopyThreshold > 0) {
+        data.useZeroCopy(); // or copy, as writers will count
+    }
+    if (desc.ioEngine == IO_ENGINE_IO_URING) {
+        data.useUring(); // or carry on with recvmmsg()
+    }
+    if (desc.busyPoll) {
+        data.useBusyPoll(BUSY_POLL_USEC); // or just spin
+    }
+    dataPort = data.port();
+    discoveryPort = uint16_t(port);
+
+    running = true;
+    io = std::thread(&UdpBatchTransport::ioLoop, this);
+    if (desc.batchLatency.count() > 0) {
+        flusher = std::thread(&UdpBatchTransport::flushLoop, this);
+    }
+    return true;
+}
+
+void UdpBatchTransport::ioLoop()
+{
+    /*
+     * Receiver thread: drain the data socket a batch at a time whenever
+     * it's readable, or io_uring has received for it, handle
+     * announcements, and make our own. With busyPoll, rather than sleep
+     * in poll() we spin on the socket, or on io_uring's completions (no
+     * syscalls at all), only polling between spins for the rest.
+     */
+
+    ThreadRegistry::Scope scope(threads, THREAD_RECEIVER, "ck-batch-io");
+
+    pollfd fds[3];
+    fds[0].fd = data.fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = discovery.fd();
+    fds[1].events = POLLIN;
+    fds[2].events = POLLIN;
+
+#ifdef __linux__
+    if (desc.busyPoll && desc.busyPollCpu >= 0 && desc.busyPollCpu < CPU_SETSIZE) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(desc.busyPollCpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); // over THREAD_RECEIVER's
+    }
+#endif // __linux__
+
+    clock::time_point nextAnnounce = clock::now();
+    while (running) {
+        clock::time_point now = clock::now();
+        if (now >= nextAnnounce) {
+            std::vector<std::shared_ptr<ReaderState>> all;
+            {
+                std::lock_guard<std::mutex> guard(mtx);
+                expire(now);
+                announce();
+                for (auto &r : readers) {
+                    all.insert(all.end(), r.second.begin(), r.second.end());
+                }
+            }
+            for (auto &st : all) {
+                std::lock_guard<std::mutex> guard(st->mtx);
+                if (st->sink != nullptr) {
+                    st->expire(now);
+                }
+            }
+            nextAnnounce = now + ANNOUNCE_PERIOD;
+        }
+
+        auto wait = std::min(
+            std::chrono::duration_cast<std::chrono::milliseconds>(nextAnnounce - now),
+            IO_WAIT_INTERVAL);
+        if (desc.busyPoll) {
+            spin(now + SPIN_INTERVAL);
+            wait = std::chrono::milliseconds(0);
+        }
+        fds[2].fd = data.completionFd(); // gone, should io_uring fail
+        if (poll(fds, 3, int(wait.count())) <= 0) {
+            continue;
+        }
+
+        if ((fds[0].revents | fds[2].revents) & POLLIN) {
+            drain();
+        }
+
+        // reports of zero-copy sends done with
+        if (fds[0].revents & POLLERR) {
+            reapZeroCopy();
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int n = discovery.receive();
+            for (int i = 0; i < n; ++i) {
+                size_t len;
+                UdpAddress from;
+                const uint8_t *b = discovery.datagram(i, &len, &from);
+                handleAnnounce(b, len, from);
+            }
+        }
+    }
+}
+
+void UdpBatchTransport::drain()
+{
+    // a full batch means there may well be more waiting
+    int n;
+    while ((n = data.receive()) > 0) {
+        dispatch(n);
+        if (unsigned(n) < desc.batchSize) {
+            break;
+        }
+    }
+}
+
+void UdpBatchTransport::spin(clock::time_point until)
+{
+    while (running && clock::now() < until) {
+        int n = data.receive();
+        if (n > 0) {
+            dispatch(n);
+        } else {
+            cpuRelax();
+        }
+    }
+}
+
+void UdpBatchTransport::flushLoop()
+{
+    /*
+     * Flusher thread: send whatever's queued once it's waited batchLatency.
+     */
+
+    ThreadRegistry::Scope scope(threads, THREAD_FLUSHER, "ck-batch-flush");
+
+    std::unique_lock<std::mutex> lk(sendMtx);
+    while (running) {
+        if (!flushPending) {
+            flushCv.wait(lk);
+        } else if (flushCv.wait_until(lk, flushDeadline) == std::cv_status::timeout) {
+            data.flush();
+            flushPending = false;
+        }
+    }
+    data.flush();
+}
+
+void UdpBatchTransport::dispatch(int n)
+{
+    /*
+     * Hand a batch of received samples to the subscribers of their topics.
+     * Subscribers are picked out under mtx, but delivered to without it,
+     * as their callbacks may well create endpoints of their own. Datagrams
+     * GRO coalesced are split up again first.
+     *
+     * A publisher is recorded as reaching a subscriber this way before its
+     * first sample is delivered, so RTPS copies are ignored until it's
+     * been quiet for a lease.
+     *
+     * Kernel timestamps are on the realtime clock; they're moved to ours
+     * by the clocks' difference, taken once a batch.
+     */
+
+    clock::time_point now = clock::now();
+    int64_t offset = 0;
+    bool stamped = false;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            const uint8_t *d = data.datagram(i, &len, nullptr);
+            size_t seg = data.segment(i) > 0 ? data.segment(i) : len;
+            int64_t received = data.timestamp(i);
+            if (received != 0 && !stamped) {
+                offset = clockOffset();
+                stamped = true;
+            }
+            if (received != 0) {
+                received += offset;
+            }
+
+            for (size_t off = 0; off < len; off += seg) {
+                const uint8_t *b = d + off;
+                size_t blen = std::min(seg, len - off);
+                DataHeader h;
+                if (blen < sizeof(h)) {
+                    continue;
+                }
+                memcpy(&h, b, sizeof(h));
+                if (h.magic != BATCH_MAGIC || h.version != BATCH_VERSION ||
+                    h.kind != BATCH_DATA) {
+                    continue;
+                }
+
+                auto it = readers.find(h.topic);
+                if (it == readers.end()) {
+                    continue;
+                }
+                bool fromSelf = memcmp(h.writer, self.value, sizeof(self.value)) == 0;
+                for (auto &st : it->second) {
+                    if (!(fromSelf && st->skipSelf)) {
+                        pending.push_back({b, blen, received, st});
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto &p : pending) {
+        DataHeader h;
+        memcpy(&h, p.datagram, sizeof(h));
+
+        ReaderState &st = *p.reader;
+        {
+            std::lock_guard<std::mutex> guard(st.writersMtx);
+            rtps::GuidPrefix_t w;
+            memcpy(w.value, h.writer, sizeof(w.value));
+            auto it = std::find_if(
+                st.writers.begin(), st.writers.end(),
+                [&w](const ReaderState::Writer &known) { return known.prefix == w; });
+            if (it == st.writers.end()) {
+                st.writers.push_back({w, now});
+            } else {
+                it->seen = now;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(st.mtx);
+        if (st.sink == nullptr ||
+            !st.take(h, p.datagram + sizeof(h), p.len - sizeof(h), p.received)) {
+            continue;
+        }
+        if (std::find(touched.begin(), touched.end(), p.reader) == touched.end()) {
+            touched.push_back(p.reader);
+        }
+    }
+
+    for (auto &st : touched) {
+        std::lock_guard<std::mutex> guard(st->mtx);
+        if (st->sink != nullptr) {
+            st->sink->flush();
+        }
+    }
+
+    pending.clear();
+    touched.clear();
+}
+
+void UdpBatchTransport::handleAnnounce(const uint8_t *b, size_t len, const UdpAddress &from)
+{
+    /*
+     * Take note of the topics a Node reads, and where it reads them. An
+     * announcement that changes nothing only renews its lease, so
+     * publishers needn't rework their routes once a second.
+     */
+
+    AnnounceHeader h;
+    if (len < sizeof(h)) {
+        return;
+    }
+    memcpy(&h, b, sizeof(h));
+    if (h.magic != BATCH_MAGIC || h.version != BATCH_VERSION || h.kind != BATCH_ANNOUNCE ||
+        len < sizeof(h) + h.count * sizeof(uint64_t)) {
+        return;
+    }
+    const uint8_t *topics = b + sizeof(h);
+    auto topicAt = [topics](unsigned i) {
+        uint64_t t;
+        memcpy(&t, topics + i * sizeof(t), sizeof(t));
+        return t;
+    };
+
+    rtps::GuidPrefix_t prefix;
+    memcpy(prefix.value, h.prefix, sizeof(prefix.value));
+    UdpAddress addr = {from.addr, htons(h.port)};
+    clock::time_point now = clock::now();
+
+    std::lock_guard<std::mutex> guard(mtx);
+
+    unsigned had = 0;
+    bool same = true;
+    for (auto &r : remotes) {
+        if (r.prefix == prefix) {
+            bool listed = false;
+            for (unsigned i = 0; i < h.count && !listed; ++i) {
+                listed = topicAt(i) == r.topic;
+            }
+            same = same && listed && r.addr.addr == addr.addr && r.addr.port == addr.port;
+            had++;
+        }
+    }
+
+    if (same && had == h.count) {
+        for (auto &r : remotes) {
+            if (r.prefix == prefix) {
+                r.seen = now;
+            }
+        }
+        return;
+    }
+
+    remotes.erase(std::remove_if(remotes.begin(), remotes.end(),
+                                 [&prefix](const Remote &r) { return r.prefix == prefix; }),
+                  remotes.end());
+    for (unsigned i = 0; i < h.count; ++i) {
+        remotes.push_back({prefix, topicAt(i), addr, now});
+    }
+    remotesGeneration++;
+}
+
+void UdpBatchTransport::announce()
+{
+    /*
+     * Tell everyone which topics we read. Called with mtx held.
+     */
+
+    std::vector<uint64_t> topics;
+    for (auto &r : readers) {
+        if (!r.second.empty()) {
+            topics.push_back(r.first);
+        }
+    }
+    size_t most = (UdpBatch::MaxDatagram - sizeof(AnnounceHeader)) / sizeof(uint64_t);
+    topics.resize(std::min(topics.size(), most));
+
+    AnnounceHeader h;
+    h.magic = BATCH_MAGIC;
+    h.version = BATCH_VERSION;
+    h.kind = BATCH_ANNOUNCE;
+    memcpy(h.prefix, self.value, sizeof(h.prefix));
+    h.port = dataPort;
+    h.count = uint16_t(topics.size());
+
+    ByteBufFragment frags[2] = {
+        {reinterpret_cast<const uint8_t *>(&h), sizeof(h)},
+        {reinterpret_cast<const uint8_t *>(topics.data()), topics.size() * sizeof(uint64_t)},
+    };
+    UdpAddress group = {htonl(DISCOVERY_GROUP), htons(discoveryPort)};
+    discovery.send(&group, 1, frags, 2);
+    discovery.flush();
+}
+
+void UdpBatchTransport::expire(clock::time_point now)
+{
+    // called with mtx held
+    size_t before = remotes.size();
+    remotes.erase(std::remove_if(remotes.begin(), remotes.end(),
+                                 [now](const Remote &r) { return now - r.seen > REMOTE_LEASE; }),
+                  remotes.end());
+    if (remotes.size() != before) {
+        remotesGeneration++;
+    }
+}
+
+bool UdpBatchTransport::send(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags,
+                             size_t n, size_t segment)
+{
+    /*
+     * Queue a sample for its destinations; it goes once the batch fills,
+     * or batchLatency after the first datagram queued.
+     */
+
+    std::lock_guard<std::mutex> guard(sendMtx);
+    bool ok = data.send(dst, ndst, frags, n, segment);
+    if (desc.batchLatency.count() == 0) {
+        return data.flush() && ok;
+    }
+    if (!flushPending && data.queued() > 0) {
+        flushPending = true;
+        flushDeadline = clock::now() + desc.batchLatency;
+        flushCv.notify_one();
+    }
+    return ok;
+}
+
+bool UdpBatchTransport::sendZeroCopy(const UdpAddress *dst, size_t ndst,
+                                     const ByteBufFragment *frags, size_t n, size_t segment,
+                                     const std::shared_ptr<ZeroCopyOwner> &owner, int slot,
+                                     std::vector<DataHeader> *headers)
+{
+    /*
+     * Send a sample straight from its loan, along with its 'headers',
+     * holding on to both until the kernel's done with them; whoever's
+     * sending gets spare headers back. false, with nothing sent, should
+     * it have to be copied after all.
+     */
+
+    std::lock_guard<std::mutex> guard(sendMtx);
+    uint32_t first;
+    int sent = data.sendZeroCopy(dst, ndst, frags, n, segment, &first);
+    if (sent <= 0) {
+        return false;
+    }
+
+    std::unique_ptr<ZeroCopySend> zs;
+    if (zeroCopySpare.empty()) {
+        zs.reset(new ZeroCopySend());
+    } else {
+        zs = std::move(zeroCopySpare.back());
+        zeroCopySpare.pop_back();
+    }
+    zs->first = first;
+    zs->count = unsigned(sent);
+    zs->remaining = unsigned(sent);
+    zs->copied = false;
+    zs->slot = slot;
+    zs->owner = owner;
+    zs->headers.swap(*headers);
+
+    {
+        std::lock_guard<std::mutex> og(owner->mtx);
+        owner->pool->retain(slot);
+        owner->outstanding++;
+    }
+    zeroCopyPending.push_back(std::move(zs));
+    return true;
+}
+
+void UdpBatchTransport::reapZeroCopy()
+{
+    /*
+     * Give back the loans of zero-copy sends the kernel's done with. Each
+     * report covers a range of its numbers for messages, which may span
+     * several sends, or part of one.
+     */
+
+    std::lock_guard<std::mutex> guard(sendMtx);
+    uint32_t lo, hi;
+    bool copied;
+    while (data.zeroCopyDone(&lo, &hi, &copied)) {
+        uint32_t span = hi - lo + 1;
+        for (auto &zs : zeroCopyPending) {
+            uint32_t into = lo - zs->first; // where the report starts within the send
+            uint32_t from = zs->first - lo; // ...or the send within the report
+            unsigned done = 0;
+            if (into < zs->count) {
+                done = std::min(zs->count - into, span);
+            } else if (from < span) {
+                done = std::min(zs->count, span - from);
+            }
+            zs->remaining -= std::min(done, zs->remaining);
+            zs->copied = zs->copied || (done > 0 && copied);
+        }
+    }
+
+    auto keep = zeroCopyPending.begin();
+    for (auto &zs : zeroCopyPending) {
+        if (zs->remaining > 0) {
+            *keep++ = std::move(zs);
+            continue;
+        }
+
+        ZeroCopyOwner &owner = *zs->owner;
+        (zs->copied ? owner.copied : owner.sent).fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> og(owner.mtx);
+            if (owner.pool != nullptr) {
+                owner.pool->release(zs->slot);
+            }
+            if (--owner.outstanding == 0) {
+                owner.drained.notify_all();
+            }
+        }
+        zs->owner.reset();
+        zeroCopySpare.push_back(std::move(zs));
+    }
+    zeroCopyPending.erase(keep, zeroCopyPending.end());
+}
+
+void UdpBatchTransport::destinations(uint64_t topic, const uint8_t *except,
+                                     std::vector<UdpAddress> *dst)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    dst->clear();
+    for (auto &r : remotes) {
+        bool excepted = except && memcmp(r.prefix.value, except, sizeof(r.prefix.value)) == 0;
+        if (r.topic == topic && !excepted) {
+            dst->push_back(r.addr);
+        }
+    }
+}
+
+bool UdpBatchTransport::remoteReads(uint64_t topic, const rtps::GuidPrefix_t &prefix)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    for (auto &r : remotes) {
+        if (r.topic == topic && r.prefix == prefix) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UdpBatchTransport::hasRemotes(uint64_t topic, const uint8_t *except)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    for (auto &r : remotes) {
+        bool excepted = except && memcmp(r.prefix.value, except, sizeof(r.prefix.value)) == 0;
+        if (r.topic == topic && !excepted) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void UdpBatchTransport::removeReader(uint64_t topic, const std::shared_ptr<ReaderState> &st)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    auto it = readers.find(topic);
+    if (it == readers.end()) {
+        return;
+    }
+    auto &v = it->second;
+    v.erase(std::remove(v.begin(), v.end(), st), v.end());
+    if (v.empty()) {
+        readers.erase(it);
+    }
+    if (running) {
+        announce();
+    }
+}
+
+} // namespace commkit
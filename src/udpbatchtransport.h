@@ -0,0 +1,133 @@
+#pragma once
+
+#include "transport.h"
+#include "udpbatch.h"
+
+#include <commkit/chrono.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace commkit
+{
+
+struct DataHeader;
+
+/*
+ * Batched UDP (see TRANSPORT_UDP_BATCHED): samples go as datagrams of
+ * their own, beside RTPS, each to every subscriber that's asked for them.
+ *
+ * One socket per Node carries every topic's samples; a thread drains it
+ * with recvmmsg() and hands each sample to the subscribers of its topic.
+ * Outgoing datagrams queue up until a batch is full or batchLatency has
+ * passed, then go with one sendmmsg(). With segmentSize, bigger samples
+ * go in pieces, handed to the kernel a run at a time to split (GSO), and
+ * runs received coalesced (GRO) are split up again. Loaned samples over
+ * zeroCopyThreshold go straight from the loan (MSG_ZEROCOPY), which is
+ * retained until the kernel reports, on the socket's error queue, that
+ * it's done with them. With busyPoll, the thread receiving spins rather
+ * than sleeping in poll().
+ *
+ * Subscribers are found through a discovery protocol of our own:
+ * each Node multicasts its participant's GUID prefix, data port and the
+ * topics it reads, when that changes and once a second. Entries not
+ * refreshed for a few seconds are dropped. Both ends must share a byte order.
+ */
+class UdpBatchTransport : public Transport
+{
+public:
+    UdpBatchTransport(const TransportDescriptor &d, ThreadRegistry *threads);
+    ~UdpBatchTransport();
+
+    bool configure(const NodeOpts &opts, eprosima::fastrtps::ParticipantAttributes *pa);
+
+    std::unique_ptr<TransportWriter> createWriter(const TransportTopic &t);
+    std::unique_ptr<TransportReader> createReader(const TransportTopic &t, TransportSink *sink);
+
+private:
+    struct ReaderState;
+    struct ZeroCopyOwner;
+    struct ZeroCopySend;
+
+    // a subscriber elsewhere, as it last announced itself
+    struct Remote {
+        eprosima::fastrtps::rtps::GuidPrefix_t prefix;
+        uint64_t topic;
+        UdpAddress addr;
+        clock::time_point seen;
+    };
+
+    bool carries(const TransportTopic &t) const;
+    bool start(const uint8_t *self);
+    void ioLoop();
+    void drain();
+    void spin(clock::time_point until);
+    void flushLoop();
+
+    void dispatch(int n);
+    void handleAnnounce(const uint8_t *b, size_t len, const UdpAddress &from);
+    void announce();
+    void expire(clock::time_point now);
+
+    // for our endpoints
+    bool send(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags, size_t n,
+              size_t segment);
+    bool sendZeroCopy(const UdpAddress *dst, size_t ndst, const ByteBufFragment *frags, size_t n,
+                      size_t segment, const std::shared_ptr<ZeroCopyOwner> &owner, int slot,
+                      std::vector<DataHeader> *headers);
+    void reapZeroCopy();
+    void destinations(uint64_t topic, const uint8_t *except, std::vector<UdpAddress> *dst);
+    bool remoteReads(uint64_t topic, const eprosima::fastrtps::rtps::GuidPrefix_t &prefix);
+    bool hasRemotes(uint64_t topic, const uint8_t *except);
+    void removeReader(uint64_t topic, const std::shared_ptr<ReaderState> &st);
+
+    uint32_t domainID;
+    uint32_t sendBufferSize;
+    uint32_t receiveBufferSize;
+
+    std::mutex mtx; // guards all below but sending, and the discovery socket
+    bool started;
+    eprosima::fastrtps::rtps::GuidPrefix_t self;
+    UdpBatch discovery;
+    uint16_t dataPort;
+    uint16_t discoveryPort;
+    std::map<uint64_t, std::vector<std::shared_ptr<ReaderState>>> readers; // by topic
+    std::vector<Remote> remotes;
+    std::atomic<uint32_t> remotesGeneration; // bumped as remotes change
+
+    // the data socket: received on by ioLoop(), sent on under sendMtx
+    UdpBatch data;
+    std::mutex sendMtx; // guards data's sending side, flushDeadline, flushPending, zero-copy sends
+    std::condition_variable flushCv;
+    clock::time_point flushDeadline;
+    bool flushPending;
+
+    // zero-copy sends the kernel may still be reading from, oldest first,
+    // and done ones to reuse
+    std::vector<std::unique_ptr<ZeroCopySend>> zeroCopyPending;
+    std::vector<std::unique_ptr<ZeroCopySend>> zeroCopySpare;
+
+    std::atomic<bool> running;
+    std::thread io;
+    std::thread flusher;
+
+    // ioLoop(): samples of the batch being dispatched, and who they went to
+    struct Pending {
+        const uint8_t *datagram; // one GRO may have coalesced with others
+        size_t len;
+        int64_t received; // see SampleMeta
+        std::shared_ptr<ReaderState> reader;
+    };
+    std::vector<Pending> pending;
+    std::vector<std::shared_ptr<ReaderState>> touched;
+
+    friend class UdpBatchWriter;
+    friend class UdpBatchReader;
+};
+
+} // namespace commkit
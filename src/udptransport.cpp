@@ -0,0 +1,23 @@
+#include "udptransport.h"
+
+#include <fastrtps/transport/UDPv4TransportDescriptor.h>
+
+using namespace eprosima::fastrtps;
+
+namespace commkit
+{
+
+bool UdpTransport::configure(const NodeOpts &opts, ParticipantAttributes *pa)
+{
+    auto udp = std::make_shared<rtps::UDPv4TransportDescriptor>();
+    udp->sendBufferSize = opts.sendSocketBufferSize;
+    udp->receiveBufferSize = opts.listenSocketBufferSize;
+
+    pa->rtps.sendSocketBufferSize = opts.sendSocketBufferSize;
+    pa->rtps.listenSocketBufferSize = opts.listenSocketBufferSize;
+    pa->rtps.userTransports.push_back(udp);
+    pa->rtps.useBuiltinTransports = false;
+    return true;
+}
+
+} // namespace commkit
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "transport.h"
+
+namespace commkit
+{
+
+/*
+ * RTPS over UDPv4: Fast-RTPS' own transport, set up explicitly rather
+ * than left to its built-in defaults. Samples go through RTPS, so it has
+ * no endpoints of its own.
+ */
+class UdpTransport : public Transport
+{
+public:
+    explicit UdpTransport(const TransportDescriptor &d) : Transport(d)
+    {
+    }
+
+    bool configure(const NodeOpts &opts, eprosima::fastrtps::ParticipantAttributes *pa);
+};
+
+} // namespace commkit
@@ -0,0 +1,539 @@
+#include "uringreceiver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace commkit
+{
+
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+
+namespace
+{
+
+const unsigned SQ_ENTRIES = 4;
+const unsigned MAX_BUFFERS = 32768; // as the kernel allows a buffer ring
+const uint16_t BUFFER_GROUP = 0;
+
+// room for control messages: a GRO segment size, and a receive timestamp
+const size_t CONTROL_SPACE = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(timespec));
+
+// user_data of our requests
+const uint64_t RECEIVE_TAG = 1;
+const uint64_t CANCEL_TAG = 2;
+
+// there's no libc wrapper for these
+int uringSetup(unsigned entries, io_uring_params *p)
+{
+    return int(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int uringEnter(int fd, unsigned submit, unsigned minComplete, unsigned flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, nullptr, 0));
+}
+
+int uringRegister(int fd, unsigned op, void *arg, unsigned n)
+{
+    return int(syscall(__NR_io_uring_register, fd, op, arg, n));
+}
+
+unsigned loadAcquire(const unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned *p, unsigned v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+void *mapRing(int fd, size_t len, off_t off)
+{
+    void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+} // namespace
+
+// the rings shared with the kernel, and the buffers they hand out
+struct UringReceiver::Rings {
+    void *sqMap;
+    size_t sqMapLen;
+    void *cqMap;
+    size_t cqMapLen;
+    io_uring_sqe *sqes;
+    size_t sqesLen;
+
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *sqFlags;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    io_uring_buf_ring *bufRing;
+    size_t bufRingLen;
+    unsigned bufMask;
+    uint16_t bufTail;
+    std::vector<uint8_t> data;
+    size_t bufLen;
+
+    // what each receive is told: room for the sender's address and
+    // a control message, but the data goes in the buffer
+    msghdr msg;
+
+    // reaped by the last receive(), and buffers to give back
+    struct Received {
+        const uint8_t *payload;
+        size_t len;
+        size_t segment;
+        int64_t stamp;
+        UdpAddress from;
+    };
+    std::vector<Received> received;
+    std::vector<uint16_t> held;
+
+    Rings()
+        : sqMap(nullptr), sqMapLen(0), cqMap(nullptr), cqMapLen(0), sqes(nullptr), sqesLen(0),
+          sqTail(nullptr), sqMask(nullptr), sqArray(nullptr), sqFlags(nullptr), cqHead(nullptr),
+          cqTail(nullptr), cqMask(nullptr), cqes(nullptr), bufRing(nullptr), bufRingLen(0),
+          bufMask(0), bufTail(0), bufLen(0)
+    {
+        memset(&msg, 0, sizeof(msg));
+    }
+
+    ~Rings()
+    {
+        if (bufRing != nullptr) {
+            munmap(bufRing, bufRingLen);
+        }
+        if (sqes != nullptr) {
+            munmap(sqes, sqesLen);
+        }
+        if (cqMap != nullptr && cqMap != sqMap) {
+            munmap(cqMap, cqMapLen);
+        }
+        if (sqMap != nullptr) {
+            munmap(sqMap, sqMapLen);
+        }
+    }
+
+    io_uring_sqe *nextSqe()
+    {
+        io_uring_sqe *s = &sqes[*sqTail & *sqMask];
+        memset(s, 0, sizeof(*s));
+        return s;
+    }
+
+    void submit()
+    {
+        unsigned tail = *sqTail;
+        sqArray[tail & *sqMask] = tail & *sqMask;
+        storeRelease(sqTail, tail + 1);
+    }
+
+    void provide(uint16_t bid)
+    {
+        // not bufRing->bufs, which C++ offsets past an empty struct
+        io_uring_buf &b = reinterpret_cast<io_uring_buf *>(bufRing)[bufTail & bufMask];
+        b.addr = reinterpret_cast<uintptr_t>(&data[bid * bufLen]);
+        b.len = uint32_t(bufLen);
+        b.bid = bid;
+        bufTail++;
+    }
+
+    void publishBuffers()
+    {
+        __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+    }
+};
+
+UringReceiver::UringReceiver() : ring(-1), sock(-1), armed(false), syscalls(0)
+{
+}
+
+UringReceiver::~UringReceiver()
+{
+    close();
+}
+
+bool UringReceiver::open(int s, unsigned buffers, size_t maxDatagram)
+{
+    /*
+     * Set up a ring, provide it our buffers, and arm the receive. The
+     * completion queue has room for a completion per buffer and then some,
+     * so it can't overflow. A kernel that knows io_uring but not multishot
+     * recvmsg fails the request as it's submitted.
+     */
+
+    close();
+    if (buffers == 0 || buffers > MAX_BUFFERS || maxDatagram == 0) {
+        return false;
+    }
+    unsigned n = 1;
+    while (n < buffers) {
+        n <<= 1;
+    }
+
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 2 * n;
+    ring = uringSetup(SQ_ENTRIES, &p);
+    if (ring < 0) {
+        ring = -1;
+        return false;
+    }
+
+    rings.reset(new Rings());
+    Rings &r = *rings;
+
+    r.sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r.cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r.sqMapLen = r.cqMapLen = std::max(r.sqMapLen, r.cqMapLen);
+    }
+    r.sqMap = mapRing(ring, r.sqMapLen, IORING_OFF_SQ_RING);
+    if (r.sqMap == nullptr) {
+        close();
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r.cqMap = r.sqMap;
+    } else if ((r.cqMap = mapRing(ring, r.cqMapLen, IORING_OFF_CQ_RING)) == nullptr) {
+        close();
+        return false;
+    }
+    r.sqesLen = p.sq_entries * sizeof(io_uring_sqe);
+    r.sqes = static_cast<io_uring_sqe *>(mapRing(ring, r.sqesLen, IORING_OFF_SQES));
+    if (r.sqes == nullptr) {
+        close();
+        return false;
+    }
+
+    uint8_t *sq = static_cast<uint8_t *>(r.sqMap);
+    uint8_t *cq = static_cast<uint8_t *>(r.cqMap);
+    r.sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    r.sqMask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    r.sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    r.sqFlags = reinterpret_cast<unsigned *>(sq + p.sq_off.flags);
+    r.cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    r.cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    r.cqMask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    r.cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    // the buffer ring must be page aligned, as mmap()'d memory is
+    r.bufRingLen = n * sizeof(io_uring_buf);
+    void *b = mmap(nullptr, r.bufRingLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (b == MAP_FAILED) {
+        close();
+        return false;
+    }
+    r.bufRing = static_cast<io_uring_buf_ring *>(b);
+    r.bufMask = n - 1;
+
+    // zeroed, tail included, before the kernel sees it
+    memset(b, 0, r.bufRingLen);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uintptr_t>(r.bufRing);
+    reg.ring_entries = n;
+    reg.bgid = BUFFER_GROUP;
+    if (uringRegister(ring, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        close();
+        return false;
+    }
+
+    // each buffer gets a header, the sender's address, control, then the
+    // datagram; aligned so control messages in it are
+    r.bufLen = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + CONTROL_SPACE + maxDatagram;
+    r.bufLen = (r.bufLen + alignof(cmsghdr) - 1) & ~(alignof(cmsghdr) - 1);
+    r.data.resize(n * r.bufLen);
+    for (unsigned i = 0; i < n; ++i) {
+        r.provide(uint16_t(i));
+    }
+    r.publishBuffers();
+    r.msg.msg_namelen = sizeof(sockaddr_in);
+    r.msg.msg_controllen = CONTROL_SPACE;
+    r.received.reserve(n);
+    r.held.reserve(n);
+
+    sock = s;
+    if (!arm()) {
+        close();
+        return false;
+    }
+
+    unsigned head = *r.cqHead;
+    if (head != loadAcquire(r.cqTail)) {
+        const io_uring_cqe &c = r.cqes[head & *r.cqMask];
+        if (c.res < 0 && !(c.flags & IORING_CQE_F_MORE)) {
+            armed = false;
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void UringReceiver::close()
+{
+    /*
+     * The receive is cancelled, and seen to be, before the buffers it
+     * writes into go: the ring itself is torn down asynchronously.
+     */
+
+    if (ring >= 0) {
+        cancel();
+        ::close(ring);
+        ring = -1;
+    }
+    rings.reset();
+    sock = -1;
+    armed = false;
+}
+
+bool UringReceiver::arm()
+{
+    Rings &r = *rings;
+    io_uring_sqe *s = r.nextSqe();
+    s->opcode = IORING_OP_RECVMSG;
+    s->fd = sock;
+    s->addr = reinterpret_cast<uintptr_t>(&r.msg);
+    s->len = 1;
+    s->ioprio = IORING_RECV_MULTISHOT;
+    s->flags = IOSQE_BUFFER_SELECT;
+    s->buf_group = BUFFER_GROUP;
+    s->user_data = RECEIVE_TAG;
+    r.submit();
+
+    int rc;
+    do {
+        rc = uringEnter(ring, 1, 0, 0);
+        syscalls++;
+    } while (rc < 0 && errno == EINTR);
+    armed = rc == 1;
+    return armed;
+}
+
+void UringReceiver::cancel()
+{
+    if (!armed || !rings) {
+        return;
+    }
+    Rings &r = *rings;
+    io_uring_sqe *s = r.nextSqe();
+    s->opcode = IORING_OP_ASYNC_CANCEL;
+    s->addr = RECEIVE_TAG;
+    s->user_data = CANCEL_TAG;
+    r.submit();
+
+    // wait for the receive's last completion
+    unsigned submit = 1;
+    while (armed) {
+        int rc = uringEnter(ring, submit, 1, IORING_ENTER_GETEVENTS);
+        syscalls++;
+        if (rc < 0 && errno != EINTR) {
+            break;
+        }
+        submit = 0;
+
+        unsigned head = *r.cqHead;
+        unsigned tail = loadAcquire(r.cqTail);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &c = r.cqes[head & *r.cqMask];
+            if (c.user_data == RECEIVE_TAG && !(c.flags & IORING_CQE_F_MORE)) {
+                armed = false;
+            }
+        }
+        storeRelease(r.cqHead, head);
+    }
+    armed = false;
+}
+
+void UringReceiver::recycle()
+{
+    Rings &r = *rings;
+    if (r.held.empty()) {
+        return;
+    }
+    for (uint16_t bid : r.held) {
+        r.provide(bid);
+    }
+    r.publishBuffers();
+    r.held.clear();
+}
+
+int UringReceiver::receive(unsigned max)
+{
+    /*
+     * Give back the last call's buffers, then reap. The receive stops
+     * when it runs out of buffers, leaving datagrams queued on the socket;
+     * it's re-armed once everything it did receive has been reaped.
+     */
+
+    if (ring < 0) {
+        return -1;
+    }
+    Rings &r = *rings;
+    recycle();
+    r.received.clear();
+
+    // completions that didn't fit are flushed to the queue on entry
+    if (__atomic_load_n(r.sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+        uringEnter(ring, 0, 0, IORING_ENTER_GETEVENTS);
+        syscalls++;
+    }
+
+    unsigned head = *r.cqHead;
+    unsigned tail = loadAcquire(r.cqTail);
+    bool failed = false;
+    for (; head != tail && r.received.size() < max; ++head) {
+        const io_uring_cqe &c = r.cqes[head & *r.cqMask];
+        if (c.user_data != RECEIVE_TAG) {
+            continue;
+        }
+        if (!(c.flags & IORING_CQE_F_MORE)) {
+            armed = false;
+        }
+        if (c.flags & IORING_CQE_F_BUFFER) {
+            r.held.push_back(uint16_t(c.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        if (c.res < 0) {
+            failed = failed || c.res != -ENOBUFS;
+            continue;
+        }
+        if (!(c.flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        const uint8_t *b = &r.data[r.held.back() * r.bufLen];
+        io_uring_recvmsg_out out;
+        memcpy(&out, b, sizeof(out));
+        if ((out.flags & MSG_TRUNC) || out.namelen < sizeof(sockaddr_in)) {
+            continue;
+        }
+
+        sockaddr_in sa;
+        memcpy(&sa, b + sizeof(out), sizeof(sa));
+        Rings::Received d;
+        d.payload = b + sizeof(out) + r.msg.msg_namelen + r.msg.msg_controllen;
+        d.len = out.payloadlen;
+        d.segment = 0;
+        d.stamp = 0;
+
+        // a GRO segment size and a timestamp, if the socket asked for them
+        msghdr control;
+        memset(&control, 0, sizeof(control));
+        control.msg_control = const_cast<uint8_t *>(b) + sizeof(out) + r.msg.msg_namelen;
+        control.msg_controllen = out.controllen;
+        for (cmsghdr *c = CMSG_FIRSTHDR(&control); c != nullptr; c = CMSG_NXTHDR(&control, c)) {
+#ifdef UDP_GRO
+            if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+                int sz;
+                memcpy(&sz, CMSG_DATA(c), sizeof(sz));
+                d.segment = size_t(sz);
+            }
+#endif
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                d.stamp = int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            }
+        }
+        d.from.addr = sa.sin_addr.s_addr;
+        d.from.port = sa.sin_port;
+        r.received.push_back(d);
+    }
+    storeRelease(r.cqHead, head);
+
+    if (failed || (!armed && head == tail && !arm())) {
+        return -1;
+    }
+    return int(r.received.size());
+}
+
+const uint8_t *UringReceiver::datagram(unsigned i, size_t *len, UdpAddress *from) const
+{
+    const Rings::Received &d = rings->received[i];
+    *len = d.len;
+    if (from != nullptr) {
+        *from = d.from;
+    }
+    return d.payload;
+}
+
+size_t UringReceiver::segment(unsigned i) const
+{
+    return rings->received[i].segment;
+}
+
+int64_t UringReceiver::timestamp(unsigned i) const
+{
+    return rings->received[i].stamp;
+}
+
+#else // __linux__ && IORING_RECV_MULTISHOT
+
+struct UringReceiver::Rings {
+};
+
+UringReceiver::UringReceiver() : ring(-1), sock(-1), armed(false), syscalls(0)
+{
+}
+
+UringReceiver::~UringReceiver()
+{
+}
+
+bool UringReceiver::open(int, unsigned, size_t)
+{
+    return false;
+}
+
+void UringReceiver::close()
+{
+}
+
+int UringReceiver::receive(unsigned)
+{
+    return -1;
+}
+
+const uint8_t *UringReceiver::datagram(unsigned, size_t *len, UdpAddress *) const
+{
+    *len = 0;
+    return nullptr;
+}
+
+size_t UringReceiver::segment(unsigned) const
+{
+    return 0;
+}
+
+int64_t UringReceiver::timestamp(unsigned) const
+{
+    return 0;
+}
+
+#endif // __linux__ && IORING_RECV_MULTISHOT
+
+} // namespace commkit
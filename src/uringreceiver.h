@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "udpbatch.h"
+
+namespace commkit
+{
+
+/*
+ * Receives a UDP socket's datagrams through io_uring. One multishot
+ * recvmsg, armed once, puts each datagram into a buffer taken from a ring
+ * provided up front, and its completion is reaped from memory shared with
+ * the kernel: no syscall per datagram, nor per batch. Syscalls are only
+ * made to re-arm the receive should it stop (as it does when it runs out
+ * of buffers), and by whoever waits on fd().
+ *
+ * Not thread safe. Linux only, and multishot recvmsg needs 6.0 or later;
+ * open() fails where the kernel can't.
+ */
+class UringReceiver
+{
+public:
+    UringReceiver();
+    ~UringReceiver();
+
+    UringReceiver(const UringReceiver &) = delete;
+    UringReceiver &operator=(const UringReceiver &) = delete;
+
+    // receive from 'sock' into 'buffers' buffers (rounded up to a power
+    // of two) of 'maxDatagram' bytes each
+    bool open(int sock, unsigned buffers, size_t maxDatagram);
+    void close();
+
+    // readable when there are completions to reap
+    int fd() const
+    {
+        return ring;
+    }
+
+    // take up to 'max' received datagrams without blocking: how many, or
+    // -1 if receiving has failed for good. they're valid until the next
+    // call, when their buffers are given back.
+    int receive(unsigned max);
+    const uint8_t *datagram(unsigned i, size_t *len, UdpAddress *from) const;
+    size_t segment(unsigned i) const;    // as UdpBatch::segment()
+    int64_t timestamp(unsigned i) const; // as UdpBatch::timestamp()
+
+    // io_uring_enter() calls made so far
+    uint64_t calls() const
+    {
+        return syscalls;
+    }
+
+private:
+    struct Rings;
+
+    bool arm();
+    void cancel();
+    void recycle();
+
+    int ring;
+    int sock;
+    bool armed;
+    uint64_t syscalls;
+    std::unique_ptr<Rings> rings;
+};
+
+} // namespace commkit
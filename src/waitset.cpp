@@ -0,0 +1,104 @@
+#include <commkit/waitset.h>
+#include "waitsetimpl.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace commkit
+{
+
+GuardCondition::GuardCondition() : fd(-1), flag(false)
+{
+#ifdef __linux__
+    fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+}
+
+GuardCondition::~GuardCondition()
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+}
+
+void GuardCondition::trigger()
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    if (flag) {
+        return;
+    }
+    flag = true;
+#ifdef __linux__
+    uint64_t one = 1;
+    ssize_t r = ::write(fd, &one, sizeof(one));
+    (void)r;
+#endif
+}
+
+void GuardCondition::reset()
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    if (!flag) {
+        return;
+    }
+    flag = false;
+#ifdef __linux__
+    uint64_t n;
+    ssize_t r = ::read(fd, &n, sizeof(n));
+    (void)r;
+#endif
+}
+
+WaitSet::WaitSet() : impl(new WaitSetImpl())
+{
+}
+
+WaitSet::~WaitSet()
+{
+}
+
+bool WaitSet::init(const WaitSetOpts &opts)
+{
+    return impl->init(opts);
+}
+
+bool WaitSet::attach(SubscriberPtr s)
+{
+    return impl->attach(std::move(s));
+}
+
+void WaitSet::detach(const SubscriberPtr &s)
+{
+    impl->detach(s);
+}
+
+bool WaitSet::attach(GuardCondition *g)
+{
+    return impl->attach(g);
+}
+
+void WaitSet::detach(GuardCondition *g)
+{
+    impl->detach(g);
+}
+
+size_t WaitSet::wait(clock::duration timeout)
+{
+    return impl->wait(timeout);
+}
+
+const std::vector<SubscriberPtr> &WaitSet::readySubscribers() const
+{
+    return impl->readySubscribers();
+}
+
+const std::vector<GuardCondition *> &WaitSet::readyGuards() const
+{
+    return impl->readyGuards();
+}
+
+} // namespace commkit
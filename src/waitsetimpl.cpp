@@ -0,0 +1,201 @@
+#include "waitsetimpl.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace commkit
+{
+
+WaitSetImpl::WaitSetImpl() : epfd(-1), maxEntries(0), nextId(0)
+{
+}
+
+WaitSetImpl::~WaitSetImpl()
+{
+#ifdef __linux__
+    if (epfd >= 0) {
+        close(epfd);
+    }
+#endif
+}
+
+bool WaitSetImpl::init(const WaitSetOpts &opts)
+{
+    /*
+     * Everything wait() fills in is sized here, for as many as can be
+     * attached, so it never has to grow.
+     */
+
+#ifdef __linux__
+    if (epfd >= 0 || opts.maxEntries == 0) {
+        return false;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        return false;
+    }
+
+    maxEntries = opts.maxEntries;
+    entries.reserve(maxEntries);
+    events.resize(maxEntries);
+    subsReady.reserve(maxEntries);
+    guardsReady.reserve(maxEntries);
+    return true;
+#else
+    (void)opts;
+    return false;
+#endif // __linux__
+}
+
+bool WaitSetImpl::attach(SubscriberPtr s)
+{
+    if (!s) {
+        return false;
+    }
+    Entry e;
+    e.fd = s->eventFd();
+    e.sub = std::move(s);
+    e.guard = nullptr;
+    return add(e);
+}
+
+void WaitSetImpl::detach(const SubscriberPtr &s)
+{
+    if (s) {
+        remove(s->eventFd());
+    }
+}
+
+bool WaitSetImpl::attach(GuardCondition *g)
+{
+    if (g == nullptr) {
+        return false;
+    }
+    Entry e;
+    e.fd = g->fd;
+    e.guard = g;
+    return add(e);
+}
+
+void WaitSetImpl::detach(GuardCondition *g)
+{
+    if (g != nullptr) {
+        remove(g->fd);
+    }
+}
+
+bool WaitSetImpl::add(Entry &e)
+{
+#ifdef __linux__
+    if (epfd < 0 || e.fd < 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mtx);
+    auto same = [&e](const Entry &o) { return o.fd == e.fd; };
+    if (entries.size() >= maxEntries || std::any_of(entries.begin(), entries.end(), same)) {
+        return false;
+    }
+    e.id = nextId++;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = e.id;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, e.fd, &ev) != 0) {
+        return false;
+    }
+    entries.push_back(std::move(e));
+    return true;
+#else
+    (void)e;
+    return false;
+#endif // __linux__
+}
+
+void WaitSetImpl::remove(int fd)
+{
+#ifdef __linux__
+    if (epfd < 0 || fd < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(mtx);
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [fd](const Entry &e) { return e.fd == fd; });
+    if (it != entries.end()) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        entries.erase(it);
+    }
+#else
+    (void)fd;
+#endif // __linux__
+}
+
+// what's left of a wait, for epoll_wait(): rounded up, so we don't wake
+// early and spin out the last fraction of a millisecond
+static int timeoutMs(clock::time_point deadline)
+{
+    clock::time_point now = clock::now();
+    if (deadline <= now) {
+        return 0;
+    }
+    int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     deadline - now + std::chrono::milliseconds(1) - clock::duration(1))
+                     .count();
+    return int(std::min<int64_t>(ms, INT_MAX));
+}
+
+size_t WaitSetImpl::wait(clock::duration timeout)
+{
+    /*
+     * Entries are only looked up once epoll_wait() returns, so attach()
+     * and detach() needn't wait for us. One detached meanwhile is left
+     * out; its id isn't found.
+     */
+
+    subsReady.clear();
+    guardsReady.clear();
+
+#ifdef __linux__
+    if (epfd < 0) {
+        return 0;
+    }
+
+    clock::time_point now = clock::now();
+    clock::time_point deadline =
+        timeout < clock::time_point::max() - now ? now + timeout : clock::time_point::max();
+    int n;
+    do {
+        n = epoll_wait(epfd, events.data(), int(events.size()), timeoutMs(deadline));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> guard(mtx);
+    for (int i = 0; i < n; ++i) {
+        uint64_t id = events[i].data.u64;
+        for (auto &e : entries) {
+            if (e.id != id) {
+                continue;
+            }
+            if (e.sub) {
+                subsReady.push_back(e.sub);
+            } else {
+                guardsReady.push_back(e.guard);
+            }
+            break;
+        }
+    }
+#else
+    (void)timeout;
+#endif // __linux__
+
+    return subsReady.size() + guardsReady.size();
+}
+
+} // namespace commkit
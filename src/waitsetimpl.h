@@ -0,0 +1,69 @@
+#pragma once
+
+#include <commkit/waitset.h>
+#include <commkit/subscriber.h>
+
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+namespace commkit
+{
+
+class WaitSetImpl
+{
+public:
+    WaitSetImpl();
+    ~WaitSetImpl();
+
+    bool init(const WaitSetOpts &opts);
+
+    bool attach(SubscriberPtr s);
+    void detach(const SubscriberPtr &s);
+    bool attach(GuardCondition *g);
+    void detach(GuardCondition *g);
+
+    size_t wait(clock::duration timeout);
+
+    const std::vector<SubscriberPtr> &readySubscribers() const
+    {
+        return subsReady;
+    }
+
+    const std::vector<GuardCondition *> &readyGuards() const
+    {
+        return guardsReady;
+    }
+
+private:
+    // one attached subscriber or guard condition, by the id epoll gives us
+    // back, which unlike a pointer isn't reused should one be detached
+    // while we wait and another attached
+    struct Entry {
+        uint64_t id;
+        int fd;
+        SubscriberPtr sub;
+        GuardCondition *guard;
+    };
+
+    bool add(Entry &e);
+    void remove(int fd);
+
+    int epfd;
+    size_t maxEntries;
+
+    std::mutex mtx; // guards entries, nextId
+    std::vector<Entry> entries;
+    uint64_t nextId;
+
+#ifdef __linux__
+    std::vector<struct epoll_event> events;
+#endif
+    std::vector<SubscriberPtr> subsReady;
+    std::vector<GuardCondition *> guardsReady;
+};
+
+} // namespace commkit
@@ -18,6 +18,9 @@ static void usage(void)
     printf("    -a <name>               name to print in output\n");
     printf("    -p <src-port>           UDP port to receive on\n");
     printf("    -l <bytes-per-packet>   bytes per packet (10000)\n");
+    printf("    -m <packets-per-call>   receive with recvmmsg, batching packets (1)\n");
+    printf("    -u <buffers>            receive with io_uring, into this many (a power of 2)\n");
+    printf("    -g                      receive with UDP GRO, packets coalesced\n");
     printf("    -r <real-time-priority> set thread real time priority\n");
     printf("    -i <interval>           report interval\n");
     printf("    -h                      help\n");
@@ -28,6 +31,9 @@ static void usage(void)
 static char const *opt_name = NULL; /* -a <name> */
 static short opt_port = 0;          /* -p <port> */
 static int opt_length = 10000;      /* -l <bytes-per-packet> */
+static int opt_batch = 1;           /* -m <packets-per-call> */
+static int opt_uring = 0;           /* -u <buffers> */
+static int opt_gro = 0;             /* -g */
 static int opt_prio = 0;            /* -r <prio> */
 static int opt_interval_s = 1;      /* -i <report-interval> */
 static int opt_help = 0;            /* -h */
@@ -37,7 +43,7 @@ static pthread_t recv_tid;
 static void parse_options(int argc, char *const argv[])
 {
     int c;
-    char const *opts = "a:p:l:r:i:h";
+    char const *opts = "a:p:l:m:u:gr:i:h";
 
     while ((c = getopt(argc, argv, opts)) != -1) {
         switch (c) {
@@ -50,6 +56,15 @@ static void parse_options(int argc, char *const argv[])
         case 'l':
             opt_length = atoi(optarg);
             break;
+        case 'm':
+            opt_batch = atoi(optarg);
+            break;
+        case 'u':
+            opt_uring = atoi(optarg);
+            break;
+        case 'g':
+            opt_gro = 1;
+            break;
         case 'r':
             opt_prio = atoi(optarg);
             break;
@@ -73,6 +88,8 @@ int main(int argc, char *argv[])
     unsigned received_new;
     unsigned missed_last = 0;
     unsigned missed_new;
+    unsigned calls_last = 0;
+    unsigned calls_new;
 
     parse_options(argc, argv);
 
@@ -82,9 +99,42 @@ int main(int argc, char *argv[])
     if (opt_port == 0)
         usage();
 
+    if (opt_batch < 1)
+        usage();
+
+    /* a power of two, as the kernel wants */
+    if (opt_uring < 0 || opt_uring > 32768 || (opt_uring & (opt_uring - 1)) != 0)
+        usage();
+
+#ifndef __linux__
+    if (opt_batch != 1) {
+        printf("-m needs recvmmsg (Linux)\n");
+        exit(1);
+    }
+    if (opt_uring != 0) {
+        printf("-u needs io_uring (Linux)\n");
+        exit(1);
+    }
+    if (opt_gro != 0) {
+        printf("-g needs UDP GRO (Linux)\n");
+        exit(1);
+    }
+#endif
+
+    if (opt_gro && (opt_batch != 1 || opt_uring != 0)) {
+        printf("-g goes without -m and -u\n");
+        exit(1);
+    }
+
     arg.length = opt_length;
     arg.priority = opt_prio;
     arg.port = opt_port;
+    arg.batch = opt_batch;
+    arg.uring = opt_uring;
+    arg.gro = opt_gro;
+    arg.received = 0;
+    arg.missed = 0;
+    arg.calls = 0;
 
     if (pthread_create(&recv_tid, NULL, recv_thread, &arg) != 0) {
         perror("pthread_create");
@@ -103,12 +153,15 @@ int main(int argc, char *argv[])
 
         received_new = __atomic_load_n(&arg.received, __ATOMIC_SEQ_CST);
         missed_new = __atomic_load_n(&arg.missed, __ATOMIC_SEQ_CST);
+        calls_new = __atomic_load_n(&arg.calls, __ATOMIC_SEQ_CST);
 
-        printf("%3s: received +%4u (%7u), missed +%4u (%7u)\n", opt_name,
-               received_new - received_last, received_new, missed_new - missed_last, missed_new);
+        printf("%3s: received +%4u (%7u), missed +%4u (%7u), calls +%4u (%7u)\n", opt_name,
+               received_new - received_last, received_new, missed_new - missed_last, missed_new,
+               calls_new - calls_last, calls_new);
 
         received_last = received_new;
         missed_last = missed_new;
+        calls_last = calls_new;
     }
 
     if (pthread_join(recv_tid, NULL) != 0) {
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE /* recvmmsg */
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,9 +8,275 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 #include "receiver.h"
 #include "util.h"
 
+/* count one packet, and any gap in numbering before it */
+static void count_packet(struct recv_thread_args *arg, const char *buf, unsigned *next_msg_num)
+{
+    unsigned msg_num;
+    unsigned gap;
+
+    msg_num = *(const unsigned *)buf;
+    if (*next_msg_num == 0)
+        *next_msg_num = msg_num;
+
+    __atomic_add_fetch(&arg->received, 1, __ATOMIC_SEQ_CST);
+
+    gap = msg_num - *next_msg_num;
+    __atomic_add_fetch(&arg->missed, gap, __ATOMIC_SEQ_CST);
+
+    *next_msg_num = msg_num + 1;
+
+} /* count_packet */
+
+#ifdef __linux__
+/*
+ * Receive with recvmmsg, up to arg->batch packets per call: each call
+ * waits for the first packet, then takes whatever else is already queued.
+ */
+static void recv_loop_mmsg(int fd, struct recv_thread_args *arg, char *bufs)
+{
+    struct mmsghdr msgs[arg->batch];
+    struct iovec iovs[arg->batch];
+    unsigned next_msg_num = 0;
+    int n, i;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < arg->batch; i++) {
+        iovs[i].iov_base = bufs + i * arg->length;
+        iovs[i].iov_len = arg->length;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (1) {
+
+        n = recvmmsg(fd, msgs, arg->batch, MSG_WAITFORONE, NULL);
+        __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
+        if (n < 0) {
+            perror("recvmmsg");
+            return;
+        }
+
+        for (i = 0; i < n; i++)
+            count_packet(arg, iovs[i].iov_base, &next_msg_num);
+
+    } /* while (1) */
+
+} /* recv_loop_mmsg */
+#endif
+
+#ifdef __linux__
+/*
+ * Receive with UDP GRO: the kernel hands over runs of packets from one
+ * sender coalesced into one buffer, along with the size they were, and
+ * they're split up again here. Runs sent with GSO may arrive as they went.
+ */
+static void recv_loop_gro(int fd, struct recv_thread_args *arg)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct iovec iov;
+    unsigned next_msg_num = 0;
+    ssize_t num_bytes, off;
+    int on = 1;
+    int segment;
+    char *buf;
+
+    if (setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0) {
+        perror("setsockopt UDP_GRO");
+        return;
+    }
+
+    /* room for whatever the kernel coalesces */
+    if ((buf = malloc(65536)) == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    while (1) {
+
+        iov.iov_base = buf;
+        iov.iov_len = 65536;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        num_bytes = recvmsg(fd, &msg, 0);
+        __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
+        if (num_bytes < 0) {
+            perror("recvmsg");
+            free(buf);
+            return;
+        }
+
+        /* without the cmsg, it's a packet on its own */
+        segment = num_bytes;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                memcpy(&segment, CMSG_DATA(cm), sizeof(segment));
+        }
+        if (segment <= 0)
+            segment = num_bytes;
+
+        for (off = 0; off < num_bytes; off += segment)
+            count_packet(arg, buf + off, &next_msg_num);
+
+    } /* while (1) */
+
+} /* recv_loop_gro */
+#endif
+
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+/*
+ * Receive with io_uring: one multishot recvmsg fills buffers from a ring
+ * of arg->uring provided up front, and completions are reaped from the
+ * shared completion queue. The only syscalls are to wait when it's empty
+ * and to re-arm the receive when it runs out of buffers. Needs Linux 6.0.
+ */
+static void recv_loop_uring(int fd, struct recv_thread_args *arg, char *bufs)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_ring *br;
+    struct io_uring_buf_reg reg;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    struct msghdr msg;
+    unsigned *sq_tail, *sq_array, *cq_head, *cq_tail;
+    unsigned sq_mask, cq_mask, head, tail, i;
+    unsigned next_msg_num = 0;
+    size_t ring_len, cq_len;
+    char *ring;
+    int armed = 0;  /* a receive is armed, or about to be */
+    int submit = 0; /* ... and its sqe awaits submission */
+    int ring_fd;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 2 * arg->uring;
+    ring_fd = syscall(__NR_io_uring_setup, 4, &p);
+    if (ring_fd < 0) {
+        perror("io_uring_setup");
+        return;
+    }
+
+    ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_len > ring_len)
+        ring_len = cq_len;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        printf("io_uring: kernel too old\n");
+        return;
+    }
+    ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                IORING_OFF_SQ_RING);
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    br = mmap(NULL, arg->uring * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED || sqes == MAP_FAILED || br == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    sq_array = (unsigned *)(ring + p.sq_off.array);
+    sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+    cq_head = (unsigned *)(ring + p.cq_off.head);
+    cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+    /* each buffer gets a header, the sender's address, then the packet */
+    memset(br, 0, arg->uring * sizeof(struct io_uring_buf));
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)br;
+    reg.ring_entries = arg->uring;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        perror("IORING_REGISTER_PBUF_RING");
+        return;
+    }
+    for (i = 0; i < arg->uring; i++) {
+        br->bufs[i].addr = (unsigned long)(bufs + i * arg->length);
+        br->bufs[i].len = arg->length;
+        br->bufs[i].bid = i;
+    }
+    __atomic_store_n(&br->tail, arg->uring, __ATOMIC_RELEASE);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+
+    while (1) {
+
+        if (!armed) {
+            struct io_uring_sqe *sqe = &sqes[*sq_tail & sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = fd;
+            sqe->addr = (unsigned long)&msg;
+            sqe->len = 1;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sq_array[*sq_tail & sq_mask] = *sq_tail & sq_mask;
+            __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+            armed = 1;
+            submit = 1;
+        }
+
+        /* submit any re-arm, and wait if there's nothing to reap */
+        head = *cq_head;
+        if (submit || head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            if (syscall(__NR_io_uring_enter, ring_fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) <
+                    0 &&
+                errno != EINTR) {
+                perror("io_uring_enter");
+                return;
+            }
+            __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
+            submit = 0;
+        }
+
+        tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                armed = 0;
+            if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                printf("io_uring recvmsg: %s\n", strerror(-cqe->res));
+                return;
+            }
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                char *b = bufs + bid * arg->length;
+                struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)b;
+
+                if (cqe->res >= 0)
+                    count_packet(arg, b + sizeof(*out) + msg.msg_namelen, &next_msg_num);
+
+                /* give the buffer straight back */
+                struct io_uring_buf *buf = &br->bufs[br->tail & (arg->uring - 1)];
+                buf->addr = (unsigned long)b;
+                buf->len = arg->length;
+                buf->bid = bid;
+                __atomic_store_n(&br->tail, br->tail + 1, __ATOMIC_RELEASE);
+            }
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    } /* while (1) */
+
+} /* recv_loop_uring */
+#endif
+
 void *recv_thread(void *void_arg)
 {
     struct recv_thread_args *arg = (struct recv_thread_args *)void_arg;
@@ -18,9 +286,7 @@ void *recv_thread(void *void_arg)
     struct sockaddr_in rem_addr;
     socklen_t rem_addr_len;
     ssize_t num_bytes;
-    unsigned msg_num;
     unsigned next_msg_num = 0;
-    unsigned gap;
 
     if (arg->priority != 0) {
         struct sched_param param;
@@ -32,7 +298,13 @@ void *recv_thread(void *void_arg)
         }
     }
 
-    if ((buf = malloc(arg->length)) == NULL) {
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+    /* io_uring buffers hold a header and address before the packet */
+    if (arg->uring > 0)
+        arg->length += sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in);
+#endif
+
+    if ((buf = malloc((arg->uring > 0 ? arg->uring : arg->batch) * arg->length)) == NULL) {
         perror("malloc");
         return NULL;
     }
@@ -54,27 +326,40 @@ void *recv_thread(void *void_arg)
         return NULL;
     }
 
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+    if (arg->uring > 0) {
+        recv_loop_uring(fd, arg, buf);
+        close(fd);
+        return NULL;
+    }
+#endif
+
+#ifdef __linux__
+    if (arg->gro) {
+        recv_loop_gro(fd, arg);
+        close(fd);
+        return NULL;
+    }
+    if (arg->batch > 1) {
+        recv_loop_mmsg(fd, arg, buf);
+        close(fd);
+        return NULL;
+    }
+#endif
+
     while (1) {
 
         memset(&rem_addr, 0, sizeof(rem_addr));
         rem_addr_len = sizeof(rem_addr);
         num_bytes = recvfrom(fd, buf, arg->length, 0, (struct sockaddr *)&rem_addr, &rem_addr_len);
+        __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
         if (num_bytes < 0) {
             perror("recv");
             close(fd);
             return NULL;
         }
 
-        msg_num = *(unsigned *)buf;
-        if (next_msg_num == 0)
-            next_msg_num = msg_num;
-
-        __atomic_add_fetch(&arg->received, 1, __ATOMIC_SEQ_CST);
-
-        gap = msg_num - next_msg_num;
-        __atomic_add_fetch(&arg->missed, gap, __ATOMIC_SEQ_CST);
-
-        next_msg_num = msg_num + 1;
+        count_packet(arg, buf, &next_msg_num);
 
     } /* for (msg_cnt...) */
 
@@ -6,9 +6,13 @@ struct recv_thread_args {
     int length;
     int priority;
     uint16_t port;
+    int batch; /* packets per recvmmsg; 1 for recvfrom */
+    int uring; /* io_uring provided buffers, a power of 2; 0 for neither */
+    int gro;   /* boolean: take packets coalesced with UDP GRO */
     /* out */
     unsigned received;
     unsigned missed;
+    unsigned calls; /* receive syscalls */
 };
 
 extern void *recv_thread(void *void_arg);
@@ -24,6 +24,8 @@ static void usage(void)
     printf("    -b <bursts-per-second>  bursts per second to send (1)\n");
     printf("    -n <packets-per-burst>  packets per burst (1)\n");
     printf("    -l <bytes-per-packet>   bytes per packet (100)\n");
+    printf("    -m <packets-per-call>   send with sendmmsg, batching packets (1)\n");
+    printf("    -g <packets-per-call>   send with UDP GSO, the kernel splitting packets\n");
     printf("    -s                      set socket priority (see code)\n");
     printf("    -r <real-time-priority> set thread real time priority\n");
     printf("    -t <tos>                set IP TOS bits\n");
@@ -39,6 +41,8 @@ static short opt_port = 0;          /* -p <dest-port> UDP port to send to */
 static int opt_bursts = 1;          /* -b <bursts-per-second> */
 static int opt_packets = 1;         /* -n <packets-per-burst> */
 static int opt_length = 100;        /* -l <bytes-per-packet> */
+static int opt_batch = 1;           /* -m <packets-per-call> */
+static int opt_gso = 0;             /* -g <packets-per-call> */
 static int opt_sock = 0;            /* -s */
 static int opt_prio = 0;            /* -r <prio> */
 static int opt_tos = -1;            /* -t <tos> */
@@ -50,7 +54,7 @@ static pthread_t send_tid;
 static void parse_options(int argc, char *const argv[])
 {
     int c;
-    char const *opts = "a:d:p:b:n:l:sr:t:i:h";
+    char const *opts = "a:d:p:b:n:l:m:g:sr:t:i:h";
 
     while ((c = getopt(argc, argv, opts)) != -1) {
         switch (c) {
@@ -72,6 +76,12 @@ static void parse_options(int argc, char *const argv[])
         case 'l':
             opt_length = atoi(optarg);
             break;
+        case 'm':
+            opt_batch = atoi(optarg);
+            break;
+        case 'g':
+            opt_gso = atoi(optarg);
+            break;
         case 's':
             opt_sock = 1;
             break;
@@ -98,6 +108,8 @@ int main(int argc, char *argv[])
     uint64_t report_interval_ns;
     unsigned sent_last = 0;
     unsigned sent_new;
+    unsigned calls_last = 0;
+    unsigned calls_new;
     struct send_thread_args arg;
 
     parse_options(argc, argv);
@@ -111,6 +123,24 @@ int main(int argc, char *argv[])
     if (opt_ip == NULL)
         usage();
 
+    if (opt_batch < 1)
+        usage();
+
+    /* the kernel takes up to 64 segments, in up to 64 KB */
+    if (opt_gso < 0 || opt_gso > 64 || opt_gso * opt_length > 65507)
+        usage();
+
+#ifndef __linux__
+    if (opt_batch != 1) {
+        printf("-m needs sendmmsg (Linux)\n");
+        exit(1);
+    }
+    if (opt_gso != 0) {
+        printf("-g needs UDP GSO (Linux)\n");
+        exit(1);
+    }
+#endif
+
     memset(&arg, 0, sizeof(arg));
 
     if (inet_pton(AF_INET, opt_ip, &arg.dst_ip) != 1)
@@ -123,6 +153,8 @@ int main(int argc, char *argv[])
     arg.sock = opt_sock;
     arg.bursts = opt_bursts;
     arg.packets = opt_packets;
+    arg.batch = opt_batch;
+    arg.gso = opt_gso;
 
     if (pthread_create(&send_tid, NULL, send_thread, &arg) != 0) {
         perror("pthread_create");
@@ -140,10 +172,13 @@ int main(int argc, char *argv[])
             usleep((report_time_ns - now_ns) / 1000);
 
         sent_new = __atomic_load_n(&arg.sent, __ATOMIC_SEQ_CST);
+        calls_new = __atomic_load_n(&arg.calls, __ATOMIC_SEQ_CST);
 
-        printf("%3s:     sent +%4u (%7u)\n", opt_name, sent_new - sent_last, sent_new);
+        printf("%3s:     sent +%4u (%7u), calls +%4u (%7u)\n", opt_name, sent_new - sent_last,
+               sent_new, calls_new - calls_last, calls_new);
 
         sent_last = sent_new;
+        calls_last = calls_new;
     }
 
     if (pthread_join(send_tid, NULL) != 0) {
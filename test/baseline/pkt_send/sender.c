@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* sendmmsg */
 #include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
@@ -10,6 +11,9 @@
 #include <sys/time.h>
 #include <netinet/ip.h>
 #include <netinet/in.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#endif
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sched.h>
@@ -19,6 +23,12 @@
 /* forwards */
 static void set_ip_tos(int fd, uint8_t tos);
 static void set_sock_prio(int fd);
+#ifdef __linux__
+static int send_burst_mmsg(int fd, struct send_thread_args *arg, struct sockaddr_in *rem_addr,
+                           char *bufs, unsigned *pkt_num);
+static int send_burst_gso(int fd, struct send_thread_args *arg, struct sockaddr_in *rem_addr,
+                          char *bufs, unsigned *pkt_num);
+#endif
 
 void *send_thread(void *void_arg)
 {
@@ -27,18 +37,21 @@ void *send_thread(void *void_arg)
     struct sockaddr_in loc_addr;
     struct sockaddr_in rem_addr;
     char *buf;
+    int nbufs;
     uint64_t now_ns;
     uint64_t msg_time_ns;
     uint64_t interval_ns;
     int i;
     unsigned pkt_num = 0;
 
-    if ((buf = malloc(arg->length)) == NULL) {
+    /* a buffer per packet in a batch, as each carries its own number */
+    nbufs = arg->gso > arg->batch ? arg->gso : arg->batch;
+    if ((buf = malloc(nbufs * arg->length)) == NULL) {
         perror("malloc");
         return NULL;
     }
-    for (i = 0; i < arg->length; i++)
-        buf[i] = (char)i;
+    for (i = 0; i < nbufs * arg->length; i++)
+        buf[i] = (char)(i % arg->length);
 
     if (arg->priority != 0) {
         struct sched_param param;
@@ -96,6 +109,23 @@ void *send_thread(void *void_arg)
 
         /* send burst */
 
+#ifdef __linux__
+        if (arg->gso > 0) {
+            if (send_burst_gso(fd, arg, &rem_addr, buf, &pkt_num) != 0) {
+                close(fd);
+                return NULL;
+            }
+            continue;
+        }
+        if (arg->batch > 1) {
+            if (send_burst_mmsg(fd, arg, &rem_addr, buf, &pkt_num) != 0) {
+                close(fd);
+                return NULL;
+            }
+            continue;
+        }
+#endif
+
         for (i = 0; i < arg->packets; i++) {
             /*printf("send %u\n", pkt_num);*/
             *(unsigned *)buf = pkt_num++;
@@ -105,6 +135,7 @@ void *send_thread(void *void_arg)
                 close(fd);
                 return NULL;
             }
+            __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
             __atomic_add_fetch(&arg->sent, 1, __ATOMIC_SEQ_CST);
         }
 
@@ -112,6 +143,104 @@ void *send_thread(void *void_arg)
 
 } /* send_thread */
 
+#ifdef __linux__
+/*
+ * Send a burst with sendmmsg, up to arg->batch packets per call.
+ * Returns 0, or -1 if any packet couldn't be sent.
+ */
+static int send_burst_mmsg(int fd, struct send_thread_args *arg, struct sockaddr_in *rem_addr,
+                           char *bufs, unsigned *pkt_num)
+{
+    struct mmsghdr msgs[arg->batch];
+    struct iovec iovs[arg->batch];
+    int done = 0;
+    int n, i;
+
+    while (done < arg->packets) {
+        n = arg->packets - done;
+        if (n > arg->batch)
+            n = arg->batch;
+
+        memset(msgs, 0, n * sizeof(msgs[0]));
+        for (i = 0; i < n; i++) {
+            char *buf = bufs + i * arg->length;
+            *(unsigned *)buf = (*pkt_num)++;
+            iovs[i].iov_base = buf;
+            iovs[i].iov_len = arg->length;
+            msgs[i].msg_hdr.msg_name = rem_addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(*rem_addr);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
+        if (sendmmsg(fd, msgs, n, 0) != n) {
+            perror("sendmmsg");
+            return -1;
+        }
+        __atomic_add_fetch(&arg->sent, n, __ATOMIC_SEQ_CST);
+        done += n;
+    }
+
+    return 0;
+
+} /* send_burst_mmsg */
+
+/*
+ * Send a burst with UDP GSO: each sendmsg hands the kernel up to arg->gso
+ * packets in one buffer, and it splits them into arg->length datagrams.
+ * Returns 0, or -1 if any packet couldn't be sent.
+ */
+static int send_burst_gso(int fd, struct send_thread_args *arg, struct sockaddr_in *rem_addr,
+                          char *bufs, unsigned *pkt_num)
+{
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct iovec iov;
+    int done = 0;
+    int n, i;
+
+    while (done < arg->packets) {
+        n = arg->packets - done;
+        if (n > arg->gso)
+            n = arg->gso;
+
+        for (i = 0; i < n; i++)
+            *(unsigned *)(bufs + i * arg->length) = (*pkt_num)++;
+        iov.iov_base = bufs;
+        iov.iov_len = n * arg->length;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = rem_addr;
+        msg.msg_namelen = sizeof(*rem_addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (n > 1) {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t *)CMSG_DATA(cm) = arg->length;
+        }
+
+        __atomic_add_fetch(&arg->calls, 1, __ATOMIC_SEQ_CST);
+        if (sendmsg(fd, &msg, 0) != (ssize_t)iov.iov_len) {
+            perror("sendmsg");
+            return -1;
+        }
+        __atomic_add_fetch(&arg->sent, n, __ATOMIC_SEQ_CST);
+        done += n;
+    }
+
+    return 0;
+
+} /* send_burst_gso */
+#endif
+
 /*
  * Set IPPROTO_IP/IP_TOS
  * This sets the IP header TOS field.
@@ -13,8 +13,11 @@ struct send_thread_args {
     int sock;    /* boolean */
     int bursts;  /* bursts/second */
     int packets; /* packets/burst */
+    int batch;   /* packets per sendmmsg; 1 for sendto */
+    int gso;     /* packets per UDP_SEGMENT send; 0 for none */
     /* out */
     unsigned sent;
+    unsigned calls; /* send syscalls */
 };
 
 extern void *send_thread(void *void_args);
@@ -0,0 +1,158 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+
+/*
+ * Per-invocation cost of Callback against Delegate / Signal.
+ *
+ * A subscriber is created (nothing is published), and each way of
+ * connecting a handler is called 'count' (-n) times in a loop, as the
+ * subscriber's own message callbacks are. We report the allocations
+ * connecting took and the time per call:
+ *
+ *   callback:     onMessage, a Callback taking a SubscriberPtr by value
+ *   callback-mbr: the same, bound to a member function
+ *   callback-big: the same, a lambda with captures past std::function's
+ *                 small buffer
+ *   delegate:     a Delegate taking the Subscriber by reference
+ *   delegate-mbr: the same, bound to a member function at compile time
+ *   signal:       onMessageRef, a Signal of such Delegates
+ *
+ * All on one thread: the SubscriberPtr's reference count is never
+ * contended here, as it would be across the threads of a real node.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_callback_commkit";
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t n)
+{
+    allocations++;
+    void *p = malloc(n == 0 ? 1 : n);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static uint64_t handled = 0;
+
+class Handler
+{
+public:
+    void byValue(commkit::SubscriberPtr)
+    {
+        handled++;
+    }
+
+    void byRef(commkit::Subscriber &)
+    {
+        handled++;
+    }
+};
+
+template <typename F>
+static void run(const char *mode, uint64_t connectAllocs, uint64_t count, F call)
+{
+    handled = 0;
+    commkit::clock::time_point start = commkit::clock::now();
+    for (uint64_t i = 0; i < count; ++i) {
+        call();
+    }
+    double elapsed = commkit::toDouble(commkit::clock::now() - start);
+
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(12) << mode << " " << setw(6) << connectAllocs << " " << setw(8) << fixed
+         << setprecision(2) << elapsed / count * 1e9 << (handled == count ? "" : " (missed)")
+         << endl;
+    cout.flags(f); // restore state
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.count = 10000000;
+    if (!TestConfig::parseArgs(argc, argv, config) || config.count <= 0) {
+        TestConfig::usage(prog);
+    }
+    uint64_t count = uint64_t(config.count);
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::Node node;
+    if (!node.init(prog)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+    commkit::Topic topic("CallbackTopic", "bytes", 64);
+    auto sub = node.createSubscriber(topic);
+    if (sub == nullptr || !sub->init(commkit::SubscriptionOpts())) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+    commkit::Subscriber &subRef = *sub;
+
+    Handler h;
+    uint64_t before;
+    typedef commkit::Delegate<void(commkit::Subscriber &)> RefDelegate;
+
+    cout << setw(12) << "mode" << " " << setw(6) << "allocs" << " " << setw(8) << "ns/call"
+         << endl;
+
+    before = allocations;
+    sub->onMessage.connect([](commkit::SubscriberPtr) { handled++; });
+    run("callback", allocations - before, count, [&] { sub->onMessage(sub); });
+
+    before = allocations;
+    sub->onMessage.connect(&Handler::byValue, &h);
+    run("callback-mbr", allocations - before, count, [&] { sub->onMessage(sub); });
+
+    before = allocations;
+    uint64_t a = 1, b = 2, c = 3;
+    sub->onMessage.connect([&h, a, b, c](commkit::SubscriberPtr s) {
+        if (a + b + c != 0) {
+            h.byValue(s);
+        }
+    });
+    run("callback-big", allocations - before, count, [&] { sub->onMessage(sub); });
+    sub->onMessage.disconnect();
+
+    before = allocations;
+    RefDelegate d([](commkit::Subscriber &) { handled++; });
+    run("delegate", allocations - before, count, [&] { d(subRef); });
+
+    before = allocations;
+    RefDelegate dm = RefDelegate::bind<Handler, &Handler::byRef>(&h);
+    run("delegate-mbr", allocations - before, count, [&] { dm(subRef); });
+
+    before = allocations;
+    sub->onMessageRef.connect(&Handler::byRef, &h);
+    run("signal", allocations - before, count, [&] { sub->onMessageRef(subRef); });
+
+    return 0;
+
+} // main
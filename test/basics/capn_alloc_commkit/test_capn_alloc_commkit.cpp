@@ -0,0 +1,164 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include <capnp/any.h>
+#include <capnp/message.h>
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+
+/*
+ * Count heap allocations per capnp publish.
+ *
+ * Publishes the same message repeatedly, first building it in a fresh
+ * capnp::MallocMessageBuilder each time, then in the Publisher's reusable
+ * capnBuilder(), and reports heap allocations and time per publish() for
+ * each. A subscriber in this process keeps the publisher matched; it is
+ * drained between rounds, outside the measured region.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_capn_alloc_commkit";
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t sz)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(sz ? sz : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+// bytes of Data in each message
+static constexpr size_t dataLen = 256;
+static constexpr size_t maxPayload = 1024;
+
+struct AllocStats {
+    uint64_t publishes;
+    uint64_t allocs;
+    commkit::clock::duration elapsed;
+
+    AllocStats() : publishes(0), allocs(0), elapsed(0)
+    {
+    }
+
+    void print(const char *name) const
+    {
+        double n = publishes ? publishes : 1;
+        cout << setw(20) << name << setw(10) << publishes << " publishes " << setw(8) << fixed
+             << setprecision(2) << allocs / n << " allocs/publish " << setw(10)
+             << setprecision(1) << std::chrono::duration<double, std::nano>(elapsed).count() / n
+             << " ns/publish" << endl;
+    }
+};
+
+static void fill(capnp::MessageBuilder &mb, uint64_t seq)
+{
+    auto data = mb.getRoot<capnp::AnyPointer>().initAs<capnp::Data>(dataLen);
+    for (size_t i = 0; i < dataLen; ++i) {
+        data[i] = uint8_t(seq + i);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.count = 10000; // publishes per method
+    config.history = 100;
+    if (!TestConfig::parseArgs(argc, argv, config)) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::Node node;
+    if (!node.init(prog)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+
+    commkit::Topic topic("capn_alloc", "capnp::Data", maxPayload);
+
+    auto pub = node.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.reliable = config.reliable;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        exit(1);
+    }
+
+    auto sub = node.createSubscriber(topic);
+    commkit::SubscriptionOpts subOpts;
+    subOpts.reliable = config.reliable;
+    subOpts.history = config.history;
+    if (sub == nullptr || !sub->init(subOpts)) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    AllocStats mallocStats, reuseStats;
+    commkit::Payload payload;
+
+    for (int i = 0; i < config.count * 2; ++i) {
+
+        if (unsigned(i) % config.history == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            while (sub->take(&payload)) {
+            }
+        }
+
+        bool reuse = i >= config.count;
+        AllocStats &stats = reuse ? reuseStats : mallocStats;
+
+        uint64_t allocsBefore = allocations.load(std::memory_order_relaxed);
+        commkit::clock::time_point start = commkit::clock::now();
+
+        if (reuse) {
+            capnp::MessageBuilder &mb = pub->capnBuilder();
+            fill(mb, i);
+            pub->publish(mb);
+        } else {
+            capnp::MallocMessageBuilder mb;
+            fill(mb, i);
+            pub->publish(mb);
+        }
+
+        stats.elapsed += commkit::clock::now() - start;
+        stats.allocs += allocations.load(std::memory_order_relaxed) - allocsBefore;
+        stats.publishes++;
+    }
+
+    mallocStats.print("MallocMessageBuilder:");
+    reuseStats.print("capnBuilder():");
+
+    return 0;
+
+} // main
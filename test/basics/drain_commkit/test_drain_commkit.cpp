@@ -0,0 +1,151 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "topic_data.h"
+#include "test_config.h"
+
+/*
+ * Compare draining a backlog of samples one at a time via take()
+ * against takeBatch().
+ *
+ * A publisher and subscriber are created in this process. Each round the
+ * publisher sends a burst of 'history' samples, we give them time to arrive,
+ * then time how long the subscriber takes to drain them. Rounds alternate
+ * between the two drain methods.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_drain_commkit";
+
+// samples per takeBatch() call
+static constexpr size_t batchSize = 64;
+
+struct DrainStats {
+    uint64_t samples;
+    commkit::clock::duration elapsed;
+
+    DrainStats() : samples(0), elapsed(0)
+    {
+    }
+
+    double nsPerSample() const
+    {
+        if (samples == 0) {
+            return 0;
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count() / samples;
+    }
+};
+
+static unsigned drainTake(commkit::SubscriberPtr sub)
+{
+    unsigned n = 0;
+    commkit::Payload payload;
+    while (sub->take(&payload)) {
+        n++;
+    }
+    return n;
+}
+
+static unsigned drainBatch(commkit::SubscriberPtr sub)
+{
+    unsigned n = 0;
+    commkit::PayloadLoan loans[batchSize];
+    size_t got;
+    while ((got = sub->takeBatch(loans, batchSize)) > 0) {
+        n += got;
+        for (size_t i = 0; i < got; ++i) {
+            loans[i].release();
+        }
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.reliable = true;
+    config.count = 100; // rounds
+    if (!TestConfig::parseArgs(argc, argv, config)) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::Node node;
+    if (!node.init(prog)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+
+    commkit::Topic topic(TopicData::topicName, TopicData::topicType, sizeof(TopicData));
+
+    auto pub = node.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.reliable = config.reliable;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        exit(1);
+    }
+
+    auto sub = node.createSubscriber(topic);
+    commkit::SubscriptionOpts subOpts;
+    subOpts.reliable = config.reliable;
+    subOpts.history = config.history;
+    subOpts.loanSlots = batchSize;
+    if (sub == nullptr || !sub->init(subOpts)) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    DrainStats takeStats, batchStats;
+    TopicData topicData;
+    memset(&topicData, 0, sizeof(topicData));
+
+    for (int round = 0; round < config.count * 2; ++round) {
+
+        for (unsigned i = 0; i < config.history; ++i) {
+            topicData.sequence = i;
+            pub->publish(reinterpret_cast<const uint8_t *>(&topicData), sizeof(topicData));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        bool batched = (round % 2) != 0;
+        DrainStats &stats = batched ? batchStats : takeStats;
+
+        commkit::clock::time_point start = commkit::clock::now();
+        unsigned n = batched ? drainBatch(sub) : drainTake(sub);
+        stats.elapsed += commkit::clock::now() - start;
+        stats.samples += n;
+    }
+
+    cout << setw(12) << "take():" << setw(10) << takeStats.samples << " samples " << setw(10)
+         << fixed << setprecision(1) << takeStats.nsPerSample() << " ns/sample" << endl;
+    cout << setw(12) << "takeBatch():" << setw(10) << batchStats.samples << " samples " << setw(10)
+         << fixed << setprecision(1) << batchStats.nsPerSample() << " ns/sample" << endl;
+
+    return 0;
+
+} // main
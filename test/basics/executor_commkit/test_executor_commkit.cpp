@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+
+/*
+ * Dispatch latency of onMessage run directly on the listener thread a
+ * sample arrived on, against run by an Executor spinning on a thread of
+ * its own.
+ *
+ * A publisher's Node sends to a subscriber's over RTPS, both in this
+ * process (with intraProcess off, so samples do go by RTPS). Samples go
+ * at the configured rate (-r) for a few seconds (-p) per mode, and we
+ * report the median, 99th and 99.9th percentile latencies, from publish()
+ * to the callback. The difference is the cost of the hand-off: waking the
+ * executor's thread, unless it's already busy.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_executor_commkit";
+
+static constexpr size_t payloadSize = 64;
+
+static std::vector<double> latency_us;
+
+static void onMessage(commkit::Subscriber &sub)
+{
+    commkit::Payload payload;
+    while (sub.take(&payload)) {
+        commkit::clock::duration d = commkit::clock::now() - payload.sourceTimestamp;
+        latency_us.push_back(commkit::toDouble(d) * 1e6);
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * p))];
+}
+
+static bool run(commkit::Node &pubNode, commkit::Node &subNode, const TestConfig::Config &config,
+                const char *mode)
+{
+    bool executor = strcmp(mode, "exec") == 0;
+
+    // a topic each, so the last run's samples don't turn up in this one
+    commkit::Topic topic(std::string("ExecutorTopic_") + mode, "bytes", payloadSize);
+    auto sub = subNode.createSubscriber(topic);
+    commkit::SubscriptionOpts opts;
+    opts.history = config.history;
+    if (sub == nullptr || !sub->init(opts)) {
+        cerr << "error creating subscriber" << endl;
+        return false;
+    }
+    sub->onMessageRef.connect(&onMessage);
+
+    commkit::Executor ex;
+    std::thread spinner;
+    if (executor) {
+        if (!ex.init() || !ex.add(sub)) {
+            cerr << "error creating executor" << endl;
+            return false;
+        }
+        spinner = std::thread([&ex] { ex.spin(); });
+    }
+
+    auto pub = pubNode.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        return false;
+    }
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // latency_us is only touched by whichever thread runs onMessage, and
+    // by us once that's stopped
+    latency_us.clear();
+    latency_us.reserve(size_t(config.rate) * config.print_s * 2);
+
+    uint8_t data[payloadSize];
+    memset(data, 0x5a, sizeof(data));
+    uint64_t sent = 0;
+    commkit::clock::duration interval = std::chrono::nanoseconds(uint64_t(1e9 / config.rate));
+    commkit::clock::time_point next = commkit::clock::now();
+    commkit::clock::time_point end = next + std::chrono::seconds(config.print_s);
+    while (next < end) {
+        std::this_thread::sleep_until(next);
+        sent += pub->publish(data, sizeof(data)) ? 1 : 0;
+        next += interval;
+    }
+
+    // let the last arrive, then stop calling onMessage
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if (executor) {
+        ex.remove(sub);
+        ex.stop();
+        spinner.join();
+    }
+    sub->onMessageRef.disconnect();
+
+    std::vector<double> sorted = latency_us;
+    std::sort(sorted.begin(), sorted.end());
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(6) << mode << " " << setw(8) << sent << " " << setw(8) << sorted.size() << " "
+         << fixed << setprecision(1) << setw(8) << percentile(sorted, 0.5) << " " << setw(8)
+         << percentile(sorted, 0.99) << " " << setw(8) << percentile(sorted, 0.999) << " "
+         << setw(8) << (sorted.empty() ? 0 : sorted.back()) << endl;
+    cout.flags(f); // restore state
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.rate = 1000;
+    config.print_s = 5; // seconds per run
+    if (!TestConfig::parseArgs(argc, argv, config) || config.rate == 0) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    nodeOpts.intraProcess = false;
+
+    commkit::Node pubNode, subNode;
+    if (!pubNode.init(nodeOpts) || !subNode.init(nodeOpts)) {
+        cerr << "error creating nodes" << endl;
+        exit(1);
+    }
+
+    cout << setw(6) << "mode" << " " << setw(8) << "sent" << " " << setw(8) << "recv" << " "
+         << setw(8) << "p50 us" << " " << setw(8) << "p99 us" << " " << setw(8) << "p99.9 us"
+         << " " << setw(8) << "max us" << endl;
+
+    if (!run(pubNode, subNode, config, "direct") || !run(pubNode, subNode, config, "exec")) {
+        exit(1);
+    }
+
+    return 0;
+
+} // main
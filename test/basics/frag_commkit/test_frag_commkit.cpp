@@ -0,0 +1,172 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "simple_stats.h"
+#include "test_config.h"
+
+/*
+ * Loopback throughput and latency for samples too big for one datagram.
+ *
+ * A publisher and subscriber on a framed topic are created in this process,
+ * on a node with large socket buffers and intra-process delivery disabled.
+ * With -b, samples go over batched UDP instead of RTPS, and with -s as well,
+ * in segments handed to the kernel a run at a time (GSO/GRO).
+ * For each sample size we publish at the configured rate (-r) for a few
+ * seconds (-p), and report MB/s received, samples lost or discarded by
+ * reassembly, and latency from publish() to the reassembled sample being
+ * taken (the source timestamp is on the same clock).
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_frag_commkit";
+
+static constexpr size_t maxPayload = 1024 * 1024;
+static const size_t payloadSizes[] = {32 * 1024, 128 * 1024, 512 * 1024, 1024 * 1024};
+
+static std::mutex statsMtx;
+static SimpleStats<double> latency_us;
+static uint64_t receivedBytes;
+static uint64_t receivedSamples;
+
+static void onMessage(commkit::SubscriberPtr sub)
+{
+    commkit::Payload payload;
+    while (sub->take(&payload)) {
+        commkit::clock::duration dt = commkit::clock::now() - payload.sourceTimestamp;
+        std::lock_guard<std::mutex> guard(statsMtx);
+        latency_us.accumulate(std::chrono::duration<double, std::micro>(dt).count());
+        receivedBytes += payload.len;
+        receivedSamples++;
+    }
+}
+
+static void run(commkit::PublisherPtr pub, commkit::SubscriberPtr sub, size_t len,
+                const TestConfig::Config &config)
+{
+    std::vector<uint8_t> buf(len, 0x5a);
+
+    {
+        std::lock_guard<std::mutex> guard(statsMtx);
+        latency_us.reset();
+        receivedBytes = 0;
+        receivedSamples = 0;
+    }
+    uint64_t dropsBefore = sub->reassemblyDrops();
+    uint64_t sent = 0;
+
+    commkit::clock::duration interval = std::chrono::seconds(1) / std::max(config.rate, 1u);
+    commkit::clock::time_point start = commkit::clock::now();
+    commkit::clock::time_point end = start + std::chrono::seconds(config.print_s);
+    commkit::clock::time_point next = start;
+    while (next < end) {
+        std::this_thread::sleep_until(next);
+        sent += pub->publish(buf.data(), len) ? 1 : 0;
+        next += interval;
+    }
+
+    // let the subscriber catch up before sampling
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    double elapsed = commkit::toDouble(commkit::clock::now() - start);
+
+    std::lock_guard<std::mutex> guard(statsMtx);
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(8) << len / 1024 << " " << setw(8) << sent << " " << setw(8) << receivedSamples
+         << " " << setw(8) << sub->reassemblyDrops() - dropsBefore << " " << setw(9) << fixed
+         << setprecision(1) << receivedBytes / elapsed / 1e6 << " " << setw(9)
+         << latency_us.average() << " " << setw(9) << latency_us.max() << endl;
+    cout.flags(f); // restore state
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.rate = 50;
+    config.print_s = 3; // seconds per run
+    config.history = 4;
+    if (!TestConfig::parseArgs(argc, argv, config)) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    nodeOpts.sendSocketBufferSize = 4 * 1024 * 1024;
+    nodeOpts.listenSocketBufferSize = 4 * 1024 * 1024;
+    nodeOpts.intraProcess = false; // measure the network path
+    if (config.batchSize > 0) {
+        commkit::TransportDescriptor batched(commkit::TRANSPORT_UDP_BATCHED);
+        batched.batchSize = config.batchSize;
+        batched.batchLatency = std::chrono::microseconds(config.batchWait_us);
+        if (config.batchUring) {
+            batched.ioEngine = commkit::IO_ENGINE_IO_URING;
+        }
+        batched.segmentSize = config.batchSegment;
+        batched.zeroCopyThreshold = config.zeroCopy;
+        nodeOpts.transports.push_back(batched);
+    }
+
+    commkit::Node node;
+    if (!node.init(nodeOpts)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+
+    commkit::Topic topic("FragTopic", "bytes", maxPayload, true);
+
+    auto pub = node.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.reliable = config.reliable;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        exit(1);
+    }
+
+    auto sub = node.createSubscriber(topic);
+    sub->onMessage.connect(&onMessage);
+    commkit::SubscriptionOpts subOpts;
+    subOpts.reliable = config.reliable;
+    subOpts.history = config.history;
+    subOpts.reassemblyBuffers = 4;
+    if (sub == nullptr || !sub->init(subOpts)) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    cout << (config.reliable ? "reliable" : "best effort") << ", " << config.rate
+         << " samples/s" << endl;
+    cout << setw(8) << "KB" << " " << setw(8) << "sent" << " " << setw(8) << "recv" << " "
+         << setw(8) << "dropped" << " " << setw(9) << "MB/s" << " " << setw(9) << "avg us"
+         << " " << setw(9) << "max us" << endl;
+
+    for (size_t len : payloadSizes) {
+        run(pub, sub, len, config);
+    }
+
+    return 0;
+
+} // main
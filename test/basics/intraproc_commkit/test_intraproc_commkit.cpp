@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "resources.h"
+#include "simple_stats.h"
+#include "test_config.h"
+
+/*
+ * Intra-process delivery versus loopback.
+ *
+ * A publisher and subscriber on the same topic are created in this process,
+ * first with NodeOpts::intraProcess (samples are copied straight into the
+ * subscriber's history, and its handler run on the node's dispatch
+ * thread), then without (samples go through RTPS and the loopback
+ * interface). For each sample size we publish at the configured
+ * rate (-r) for a few seconds (-p), and report samples received, latency
+ * from publish() to the sample being taken in the subscriber's onMessage
+ * callback (the source timestamp is on the same clock), and CPU load.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_intraproc_commkit";
+
+static constexpr size_t maxPayload = 16 * 1024;
+static const size_t payloadSizes[] = {64, 1024, 16 * 1024};
+
+static std::mutex statsMtx;
+static SimpleStats<double> latency_us;
+
+static void onMessage(commkit::SubscriberPtr sub)
+{
+    commkit::Payload payload;
+    while (sub->take(&payload)) {
+        commkit::clock::duration dt = commkit::clock::now() - payload.sourceTimestamp;
+        std::lock_guard<std::mutex> guard(statsMtx);
+        latency_us.accumulate(std::chrono::duration<double, std::micro>(dt).count());
+    }
+}
+
+static void run(commkit::PublisherPtr pub, size_t len, const TestConfig::Config &config)
+{
+    std::vector<uint8_t> buf(len, 0x5a);
+
+    {
+        std::lock_guard<std::mutex> guard(statsMtx);
+        latency_us.reset();
+    }
+    uint64_t sent = 0;
+
+    Resources resources;
+    commkit::clock::duration interval = std::chrono::seconds(1) / std::max(config.rate, 1u);
+    commkit::clock::time_point start = commkit::clock::now();
+    commkit::clock::time_point end = start + std::chrono::seconds(config.print_s);
+    commkit::clock::time_point next = start;
+    while (next < end) {
+        std::this_thread::sleep_until(next);
+        sent += pub->publish(buf.data(), len) ? 1 : 0;
+        next += interval;
+    }
+
+    // let the subscriber catch up before sampling
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    resources.sample();
+
+    std::lock_guard<std::mutex> guard(statsMtx);
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(8) << len << " " << setw(8) << sent << " " << setw(8) << latency_us.count()
+         << " " << setw(9) << fixed << setprecision(1) << latency_us.average() << " " << setw(9)
+         << latency_us.min() << " " << setw(9) << latency_us.max() << " " << setw(5)
+         << resources.cpuLoad() * 100.0 << "%" << endl;
+    cout.flags(f); // restore state
+}
+
+static void runAll(bool intraProcess, const TestConfig::Config &config)
+{
+    /*
+     * Everything is created and destroyed in here, so that the next
+     * call gets a fresh node with its own options.
+     */
+
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    nodeOpts.intraProcess = intraProcess;
+
+    commkit::Node node;
+    if (!node.init(nodeOpts)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+
+    commkit::Topic topic("IntraprocTopic", "bytes", maxPayload);
+
+    auto pub = node.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.reliable = config.reliable;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        exit(1);
+    }
+
+    auto sub = node.createSubscriber(topic);
+    sub->onMessage.connect(&onMessage);
+    commkit::SubscriptionOpts subOpts;
+    subOpts.reliable = config.reliable;
+    subOpts.history = config.history;
+    if (sub == nullptr || !sub->init(subOpts)) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    cout << (intraProcess ? "intra-process" : "loopback") << ", "
+         << (config.reliable ? "reliable" : "best effort") << ", " << config.rate << " samples/s"
+         << endl;
+    cout << setw(8) << "bytes" << " " << setw(8) << "sent" << " " << setw(8) << "recv" << " "
+         << setw(9) << "avg us" << " " << setw(9) << "min us" << " " << setw(9) << "max us"
+         << " " << setw(6) << "cpu" << endl;
+
+    for (size_t len : payloadSizes) {
+        run(pub, len, config);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.rate = 1000;
+    config.print_s = 3; // seconds per run
+    if (!TestConfig::parseArgs(argc, argv, config)) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    runAll(true, config);
+    runAll(false, config);
+
+    return 0;
+
+} // main
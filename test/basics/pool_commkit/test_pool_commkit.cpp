@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+
+/*
+ * Scaling of an Executor with worker threads (ExecutorOpts::threads)
+ * across many topics.
+ *
+ * A publisher per topic sends, round robin, from this thread at the
+ * configured rate (-r, samples/sec in all) for a few seconds (-p), to
+ * subscribers in this process attached to an Executor. Each sample costs
+ * its handler workUs of CPU. For 1, 2, 4... workers, up to the number of
+ * cores, we report samples handled per second and the median, 99th and
+ * 99.9th percentile latencies, from publish() to the handler taking it.
+ * Once the rate is more than the workers can keep up with, throughput
+ * flattens and latency climbs.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_pool_commkit";
+
+static constexpr unsigned topics = 32;
+static constexpr double workUs = 20;
+
+// one per subscriber: its callbacks never run at once, so needn't lock
+struct Handled {
+    std::vector<double> latency_us;
+};
+
+static void busy(double us)
+{
+    commkit::clock::time_point end =
+        commkit::clock::now() + std::chrono::nanoseconds(int64_t(us * 1e3));
+    while (commkit::clock::now() < end) {
+    }
+}
+
+static void onMessage(Handled *h, commkit::Subscriber &sub)
+{
+    commkit::Payload payload;
+    while (sub.take(&payload)) {
+        busy(workUs);
+        commkit::clock::duration d = commkit::clock::now() - payload.sourceTimestamp;
+        h->latency_us.push_back(commkit::toDouble(d) * 1e6);
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * p))];
+}
+
+static bool run(commkit::Node &node, unsigned workers, const TestConfig::Config &config)
+{
+    commkit::ExecutorOpts opts;
+    opts.threads = workers;
+    opts.maxSubscribers = topics;
+    commkit::Executor ex;
+    if (!ex.init(opts)) {
+        cerr << "error creating executor" << endl;
+        return false;
+    }
+
+    std::vector<commkit::PublisherPtr> pubs;
+    std::vector<commkit::SubscriberPtr> subs;
+    std::vector<std::unique_ptr<Handled>> handled;
+    for (unsigned i = 0; i < topics; ++i) {
+        // topics of their own, so the last run's samples don't turn up
+        std::string name = "PoolTopic_" + std::to_string(workers) + "_" + std::to_string(i);
+        commkit::Topic topic(name, "bytes", 64);
+
+        auto sub = node.createSubscriber(topic);
+        commkit::SubscriptionOpts subOpts;
+        subOpts.history = config.history;
+        auto pub = node.createPublisher(topic);
+        if (sub == nullptr || !sub->init(subOpts) || pub == nullptr ||
+            !pub->init(commkit::PublicationOpts())) {
+            cerr << "error creating topic " << name << endl;
+            return false;
+        }
+
+        handled.emplace_back(new Handled);
+        handled.back()->latency_us.reserve(size_t(config.rate) * config.print_s * 2 / topics);
+        Handled *h = handled.back().get();
+        sub->onMessageRef.connect([h](commkit::Subscriber &s) { onMessage(h, s); });
+        if (!ex.add(sub)) {
+            cerr << "error attaching subscriber" << endl;
+            return false;
+        }
+        pubs.push_back(pub);
+        subs.push_back(sub);
+    }
+
+    uint8_t data[64];
+    memset(data, 0x5a, sizeof(data));
+    commkit::clock::duration interval = std::chrono::nanoseconds(uint64_t(1e9 / config.rate));
+    commkit::clock::time_point start = commkit::clock::now();
+    commkit::clock::time_point next = start;
+    commkit::clock::time_point end = start + std::chrono::seconds(config.print_s);
+    uint64_t sent = 0;
+    while (next < end) {
+        std::this_thread::sleep_until(next);
+        pubs[sent % topics]->publish(data, sizeof(data));
+        sent++;
+        next += interval;
+    }
+
+    // let the workers finish up, then stop calling the handlers
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    for (auto &s : subs) {
+        ex.remove(s);
+    }
+    double elapsed = commkit::toDouble(commkit::clock::now() - start);
+
+    std::vector<double> latency_us;
+    for (auto &h : handled) {
+        latency_us.insert(latency_us.end(), h->latency_us.begin(), h->latency_us.end());
+    }
+    std::sort(latency_us.begin(), latency_us.end());
+
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(7) << workers << " " << setw(8) << sent << " " << setw(8) << latency_us.size()
+         << " " << setw(9) << fixed << setprecision(0) << latency_us.size() / elapsed << " "
+         << setprecision(1) << setw(8) << percentile(latency_us, 0.5) << " " << setw(8)
+         << percentile(latency_us, 0.99) << " " << setw(8) << percentile(latency_us, 0.999)
+         << endl;
+    cout.flags(f); // restore state
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.rate = 100000;
+    config.print_s = 3; // seconds per run
+    config.history = 100;
+    if (!TestConfig::parseArgs(argc, argv, config) || config.rate == 0) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::Node node;
+    if (!node.init(prog)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+
+    cout << topics << " topics, " << workUs << " us per sample" << endl;
+    cout << setw(7) << "workers" << " " << setw(8) << "sent" << " " << setw(8) << "handled" << " "
+         << setw(9) << "per sec" << " " << setw(8) << "p50 us" << " " << setw(8) << "p99 us"
+         << " " << setw(8) << "p99.9 us" << endl;
+
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned workers = 1;; workers *= 2) {
+        workers = std::min(workers, cores);
+        if (!run(node, workers, config)) {
+            exit(1);
+        }
+        if (workers == cores) {
+            break;
+        }
+    }
+
+    return 0;
+
+} // main
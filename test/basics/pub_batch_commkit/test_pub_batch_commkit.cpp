@@ -0,0 +1,138 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+#include "resources.h"
+
+/*
+ * Publish throughput, publish() versus publishBatch().
+ *
+ * A publisher and subscriber on a framed topic are created in this process.
+ * For each payload size, we publish as fast as possible for a few seconds
+ * (-p), first one sample per publish(), then batchSize samples per
+ * publishBatch(), and report messages/sec sent and received, and CPU.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_pub_batch_commkit";
+
+static constexpr size_t maxPayload = 1024;
+static constexpr size_t batchSize = 32;
+static const size_t payloadSizes[] = {16, 64, 256, 1024};
+
+static std::atomic<uint64_t> received(0);
+
+static void onMessage(commkit::SubscriberPtr sub)
+{
+    commkit::Payload payload;
+    while (sub->take(&payload)) {
+        received++;
+    }
+}
+
+static void run(commkit::PublisherPtr pub, size_t len, bool batched, unsigned seconds)
+{
+    std::vector<uint8_t> buf(len * batchSize);
+    std::vector<commkit::BatchSample> samples;
+    for (size_t i = 0; i < batchSize; ++i) {
+        samples.push_back(commkit::BatchSample(&buf[i * len], len));
+    }
+
+    Resources resources;
+    received = 0;
+    uint64_t sent = 0;
+
+    commkit::clock::time_point start = commkit::clock::now();
+    commkit::clock::time_point end = start + std::chrono::seconds(seconds);
+    while (commkit::clock::now() < end) {
+        if (batched) {
+            sent += pub->publishBatch(samples.data(), samples.size());
+        } else {
+            for (size_t i = 0; i < batchSize; ++i) {
+                sent += pub->publish(samples[i].bytes, len) ? 1 : 0;
+            }
+        }
+    }
+    double elapsed = commkit::toDouble(commkit::clock::now() - start);
+
+    // let the subscriber catch up before sampling
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    resources.sample();
+
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(6) << len << " " << setw(8) << (batched ? "batch" : "single") << " " << setw(12)
+         << fixed << setprecision(0) << sent / elapsed << " " << setw(12) << received / elapsed
+         << " " << setw(6) << setprecision(1) << resources.cpuLoad() * 100.0 << "%" << endl;
+    cout.flags(f); // restore state
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.print_s = 3; // seconds per run
+    if (!TestConfig::parseArgs(argc, argv, config)) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::Node node;
+    if (!node.init(prog)) {
+        cerr << "error creating node" << endl;
+        exit(1);
+    }
+
+    commkit::Topic topic("BatchTopic", "bytes", maxPayload, true);
+
+    auto pub = node.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.reliable = config.reliable;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        exit(1);
+    }
+
+    auto sub = node.createSubscriber(topic);
+    sub->onMessage.connect(&onMessage);
+    commkit::SubscriptionOpts subOpts;
+    subOpts.reliable = config.reliable;
+    subOpts.history = config.history;
+    if (sub == nullptr || !sub->init(subOpts)) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    cout << setw(6) << "bytes" << " " << setw(8) << "mode" << " " << setw(12) << "sent/s" << " "
+         << setw(12) << "recv/s" << " " << setw(7) << "cpu" << endl;
+
+    for (size_t len : payloadSizes) {
+        run(pub, len, false, config.print_s);
+        run(pub, len, true, config.print_s);
+    }
+
+    return 0;
+
+} // main
@@ -48,8 +48,25 @@ int main(int argc, char *argv[])
     Resources resources;
 
     cout << "create node" << endl;
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    if (config.sharedMemory) {
+        nodeOpts.transports.push_back(
+            commkit::TransportDescriptor(commkit::TRANSPORT_SHARED_MEMORY, 1));
+    }
+    if (config.batchSize > 0) {
+        commkit::TransportDescriptor batched(commkit::TRANSPORT_UDP_BATCHED);
+        batched.batchSize = config.batchSize;
+        batched.batchLatency = std::chrono::microseconds(config.batchWait_us);
+        if (config.batchUring) {
+            batched.ioEngine = commkit::IO_ENGINE_IO_URING;
+        }
+        batched.segmentSize = config.batchSegment;
+        batched.zeroCopyThreshold = config.zeroCopy;
+        nodeOpts.transports.push_back(batched);
+    }
     commkit::Node node;
-    if (!node.init(prog)) {
+    if (!node.init(nodeOpts)) {
         cerr << "error" << endl;
         exit(1);
     }
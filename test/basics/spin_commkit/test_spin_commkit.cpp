@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+
+/*
+ * Latency of small samples over batched UDP, received blocking and spinning.
+ *
+ * A publisher's Node sends to a subscriber's, both in this process. Each
+ * mode gets a subscriber Node of its own, and a thread reading from it:
+ *
+ *   block: the transport's thread sleeps in poll(), and the reader in
+ *          waitForMessage(), each woken as samples arrive
+ *   spin:  the transport's thread spins on its socket (busyPoll, pinned
+ *          with -k), and the reader in spinForMessage()
+ *
+ * Samples go at the configured rate (-r) for a few seconds (-p), and we
+ * report the median, 99th and 99.9th percentile latencies, from publish()
+ * to take(), then where the median sample's time went (network, stack and
+ * dispatch, see LatencyStats). Spinning costs two cores: on fewer, the
+ * spinners compete with each other and with the publisher, and the tail
+ * suffers for it.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_spin_commkit";
+
+static constexpr size_t payloadSize = 64;
+
+static std::atomic<bool> reading;
+
+static void reader(commkit::SubscriberPtr sub, bool spin, std::vector<double> *latency_us)
+{
+    while (reading) {
+        if (spin) {
+            if (!sub->spinForMessage(std::chrono::milliseconds(100))) {
+                continue;
+            }
+        } else {
+            sub->waitForMessage();
+        }
+        commkit::Payload payload;
+        while (sub->take(&payload)) {
+            commkit::clock::duration d = commkit::clock::now() - payload.sourceTimestamp;
+            latency_us->push_back(commkit::toDouble(d) * 1e6);
+        }
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * p))];
+}
+
+static bool run(commkit::Node &pubNode, const commkit::NodeOpts &subOpts,
+                const commkit::Topic &topic, const TestConfig::Config &config, const char *mode)
+{
+    bool spin = strcmp(mode, "spin") == 0;
+    commkit::NodeOpts nodeOpts = subOpts;
+    nodeOpts.transports[0].busyPoll = spin;
+
+    commkit::Node subNode;
+    if (!subNode.init(nodeOpts)) {
+        cerr << "error creating subscriber node" << endl;
+        return false;
+    }
+    auto sub = subNode.createSubscriber(topic);
+    commkit::SubscriptionOpts opts;
+    opts.history = config.history;
+    opts.timestamps = true;
+    if (sub == nullptr || !sub->init(opts)) {
+        cerr << "error creating subscriber" << endl;
+        return false;
+    }
+
+    auto pub = pubNode.createPublisher(topic);
+    commkit::PublicationOpts pubOpts;
+    pubOpts.history = config.history;
+    if (pub == nullptr || !pub->init(pubOpts)) {
+        cerr << "error creating publisher" << endl;
+        return false;
+    }
+    while (pub->matchedSubscribers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // and for the subscriber to be found by the batched transport
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    std::vector<double> latency_us;
+    latency_us.reserve(size_t(config.rate) * config.print_s * 2);
+    reading = true;
+    std::thread t(reader, sub, spin, &latency_us);
+
+    uint8_t data[payloadSize];
+    memset(data, 0x5a, sizeof(data));
+    uint64_t sent = 0;
+    commkit::clock::duration interval = std::chrono::nanoseconds(uint64_t(1e9 / config.rate));
+    commkit::clock::time_point next = commkit::clock::now();
+    commkit::clock::time_point end = next + std::chrono::seconds(config.print_s);
+    while (next < end) {
+        std::this_thread::sleep_until(next);
+        sent += pub->publish(data, sizeof(data)) ? 1 : 0;
+        next += interval;
+    }
+
+    // let the last arrive, then wake a blocked reader to see it's done
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    reading = false;
+    pub->publish(data, sizeof(data));
+    t.join();
+
+    std::sort(latency_us.begin(), latency_us.end());
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(5) << mode << " " << setw(8) << sent << " " << setw(8) << latency_us.size()
+         << " " << fixed << setprecision(1) << setw(8) << percentile(latency_us, 0.5) << " "
+         << setw(8) << percentile(latency_us, 0.99) << " " << setw(8)
+         << percentile(latency_us, 0.999) << " " << setw(8)
+         << (latency_us.empty() ? 0 : latency_us.back()) << endl;
+
+    commkit::LatencyStats ls = sub->latencyStats();
+    cout << setw(5) << "" << " p50 us: network " << commkit::toDouble(ls.network.p50) * 1e6
+         << ", stack " << commkit::toDouble(ls.stack.p50) * 1e6 << ", dispatch "
+         << commkit::toDouble(ls.dispatch.p50) * 1e6 << endl;
+    cout.flags(f); // restore state
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.rate = 10000;
+    config.print_s = 5; // seconds per run
+    config.batchSize = 32;
+    if (!TestConfig::parseArgs(argc, argv, config) || config.batchSize == 0 || config.rate == 0) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    // sent at once, so latency is the receiving side's
+    commkit::TransportDescriptor batched(commkit::TRANSPORT_UDP_BATCHED);
+    batched.batchSize = config.batchSize;
+    if (config.batchUring) {
+        batched.ioEngine = commkit::IO_ENGINE_IO_URING;
+    }
+
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    nodeOpts.transports.push_back(batched);
+
+    commkit::Node pubNode;
+    if (!pubNode.init(nodeOpts)) {
+        cerr << "error creating publisher node" << endl;
+        exit(1);
+    }
+
+    commkit::NodeOpts subOpts = nodeOpts;
+    subOpts.transports.clear();
+    batched.busyPollCpu = config.busyPollCpu;
+    subOpts.transports.push_back(batched);
+
+    cout << setw(5) << "mode" << " " << setw(8) << "sent" << " " << setw(8) << "recv" << " "
+         << setw(8) << "p50 us" << " " << setw(8) << "p99 us" << " " << setw(8) << "p99.9 us"
+         << " " << setw(8) << "max us" << endl;
+
+    commkit::Topic topic("SpinTopic", "bytes", payloadSize);
+    if (!run(pubNode, subOpts, topic, config, "block") ||
+        !run(pubNode, subOpts, topic, config, "spin")) {
+        exit(1);
+    }
+
+    return 0;
+
+} // main
@@ -14,6 +14,7 @@
 #include "topic_data.h"
 #include "test_config.h"
 #include "resources.h"
+#include "simple_stats.h"
 
 using std::cerr;
 using std::cout;
@@ -32,6 +33,9 @@ commkit::clock::duration printInterval;
 
 static Resources resources;
 
+// latency of samples received since the last print, microseconds
+static SimpleStats<double> latency_us;
+
 // sequence number in last packet received
 static int64_t lastSeq = commkit::SEQUENCE_NUMBER_INVALID;
 
@@ -47,8 +51,10 @@ static void onDisconnect(const commkit::SubscriberPtr sub)
 
 static void onMessage(commkit::SubscriberPtr sub)
 {
-    commkit::Payload payload;
-    while (sub->take(&payload)) {
+    commkit::PayloadLoan loan;
+    while (sub->takeLoan(&loan)) {
+
+        const commkit::Payload &payload = *loan;
 
         commkit::clock::time_point now = commkit::clock::now();
 
@@ -58,9 +64,6 @@ static void onMessage(commkit::SubscriberPtr sub)
             continue;
         }
 
-        TopicData topicData;
-        memcpy(&topicData, payload.bytes, sizeof(TopicData));
-
         // look for and print gaps in sequence number
         if (lastSeq != commkit::SEQUENCE_NUMBER_INVALID && (payload.sequence - lastSeq) != 1) {
             cout << "gap: " << payload.sequence - lastSeq - 1 << endl;
@@ -69,6 +72,7 @@ static void onMessage(commkit::SubscriberPtr sub)
 
         // look for long latencies (assumes same system pub/sub)
         commkit::clock::duration latency = now - payload.sourceTimestamp;
+        latency_us.accumulate(std::chrono::duration<double, std::micro>(latency).count());
         if (latency > std::chrono::milliseconds(10)) {
             cout << "latency: " << fixed << setprecision(3) << commkit::toDouble(latency) << endl;
         }
@@ -79,8 +83,11 @@ static void onMessage(commkit::SubscriberPtr sub)
             std::ios::fmtflags f(cout.flags()); // save state
             cout << setw(18) << left << prog << right << " " << setw(10) << fixed << setprecision(3)
                  << commkit::toDouble(now - timeZero) << ": " << setw(6) << payload.sequence << " "
-                 << setw(5) << fixed << setprecision(1) << cpu * 100.0 << "%" << endl;
+                 << setw(5) << fixed << setprecision(1) << cpu * 100.0 << "% latency avg "
+                 << setw(7) << latency_us.average() << " max " << setw(7) << latency_us.max()
+                 << " us" << endl;
             cout.flags(f); // restore state
+            latency_us.reset();
             printNext += printInterval;
         }
     }
@@ -102,8 +109,27 @@ int main(int argc, char *argv[])
     printNext = timeZero;
 
     cout << "create node" << endl;
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    if (config.sharedMemory) {
+        nodeOpts.transports.push_back(
+            commkit::TransportDescriptor(commkit::TRANSPORT_SHARED_MEMORY, 1));
+    }
+    if (config.batchSize > 0) {
+        commkit::TransportDescriptor batched(commkit::TRANSPORT_UDP_BATCHED);
+        batched.batchSize = config.batchSize;
+        batched.batchLatency = std::chrono::microseconds(config.batchWait_us);
+        if (config.batchUring) {
+            batched.ioEngine = commkit::IO_ENGINE_IO_URING;
+        }
+        batched.segmentSize = config.batchSegment;
+        batched.zeroCopyThreshold = config.zeroCopy;
+        batched.busyPoll = config.busyPoll;
+        batched.busyPollCpu = config.busyPollCpu;
+        nodeOpts.transports.push_back(batched);
+    }
     commkit::Node node;
-    if (!node.init(prog)) {
+    if (!node.init(nodeOpts)) {
         cerr << "error" << endl;
         exit(1);
     }
@@ -9,7 +9,7 @@ bool TestConfig::parseArgs(int argc, char *argv[], Config &config)
 {
     char *endptr;
     int c;
-    while ((c = getopt(argc, argv, "a:h:l:n:p:q:r:?")) != -1) {
+    while ((c = getopt(argc, argv, "a:b:h:k:l:mn:p:q:r:s:uw:z:?")) != -1) {
 
         switch (c) {
 
@@ -23,6 +23,13 @@ bool TestConfig::parseArgs(int argc, char *argv[], Config &config)
             }
             break;
 
+        case 'b': // batched UDP transport (datagrams per syscall, integer; commkit only)
+            config.batchSize = strtol(optarg, &endptr, 0);
+            if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
+                return false;
+            }
+            break;
+
         case 'h': // history (depth, integer)
             config.history = strtol(optarg, &endptr, 0);
             if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
@@ -30,6 +37,14 @@ bool TestConfig::parseArgs(int argc, char *argv[], Config &config)
             }
             break;
 
+        case 'k': // batched UDP receive spins, on this CPU (integer, -1 for any; commkit only)
+            config.busyPollCpu = strtol(optarg, &endptr, 0);
+            if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
+                return false;
+            }
+            config.busyPoll = true;
+            break;
+
         case 'l': // lease duration (seconds, double)
             if (optarg == NULL || *optarg == '\0') {
                 return false;
@@ -40,6 +55,10 @@ bool TestConfig::parseArgs(int argc, char *argv[], Config &config)
             }
             break;
 
+        case 'm': // same host peers via shared memory (commkit only)
+            config.sharedMemory = true;
+            break;
+
         case 'n': // count (messages, integer)
             config.count = strtol(optarg, &endptr, 0);
             if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
@@ -71,6 +90,31 @@ bool TestConfig::parseArgs(int argc, char *argv[], Config &config)
             }
             break;
 
+        case 's': // batched UDP segment size (bytes, integer; commkit only)
+            config.batchSegment = strtol(optarg, &endptr, 0);
+            if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
+                return false;
+            }
+            break;
+
+        case 'u': // batched UDP receives through io_uring (commkit only)
+            config.batchUring = true;
+            break;
+
+        case 'w': // batched UDP send wait (microseconds, integer; commkit only)
+            config.batchWait_us = strtol(optarg, &endptr, 0);
+            if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
+                return false;
+            }
+            break;
+
+        case 'z': // batched UDP zero-copy threshold (bytes, integer; commkit only)
+            config.zeroCopy = strtol(optarg, &endptr, 0);
+            if (optarg == NULL || *optarg == '\0' || *endptr != '\0') {
+                return false;
+            }
+            break;
+
         case '?': // help
             // caller expected to print usage
             return false;
@@ -95,6 +139,16 @@ void TestConfig::usage(const char *name)
     std::cout << "       [-l duration]    lease duration, seconds" << std::endl;
     std::cout << "       [-a interval]    announce interval, seconds" << std::endl;
     std::cout << "       [-p interval]    print interval, seconds" << std::endl;
+    std::cout << "       [-m]             shared memory to same host peers" << std::endl;
+    std::cout << "       [-b count]       batched UDP, datagrams per syscall" << std::endl;
+    std::cout << "       [-w usec]        batched UDP, longest wait to fill a batch" << std::endl;
+    std::cout << "       [-u]             batched UDP, receive with io_uring" << std::endl;
+    std::cout << "       [-s bytes]       batched UDP, segment large samples (GSO/GRO)"
+              << std::endl;
+    std::cout << "       [-z bytes]       batched UDP, zero-copy sends of loans over this"
+              << std::endl;
+    std::cout << "       [-k cpu]         batched UDP, receive by spinning, on cpu (-1 any)"
+              << std::endl;
     std::cout << "       [-?]             print this" << std::endl;
     exit(1);
 }
@@ -27,9 +27,19 @@ struct Config {
     unsigned print_s;
     double lease_s;
     double renew_s;
+    bool sharedMemory;
+    unsigned batchSize;    // batched UDP transport if non-zero
+    unsigned batchWait_us; // its batchLatency
+    bool batchUring;       // its ioEngine is io_uring
+    unsigned batchSegment; // its segmentSize
+    unsigned zeroCopy;     // its zeroCopyThreshold
+    bool busyPoll;         // its busyPoll
+    int busyPollCpu;       // and busyPollCpu
     Config()
         : reliable(false), rate(defaultRate), count(defaultCount), history(defaultHistory),
-          print_s(defaultPrint_s), lease_s(defaultLease_s), renew_s(defaultRenew_s)
+          print_s(defaultPrint_s), lease_s(defaultLease_s), renew_s(defaultRenew_s),
+          sharedMemory(false), batchSize(0), batchWait_us(0), batchUring(false),
+          batchSegment(0), zeroCopy(0), busyPoll(false), busyPollCpu(-1)
     {
     }
 };
@@ -0,0 +1,172 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include <sys/resource.h>
+
+#include <fastrtps/log/Log.h>
+#include <commkit/commkit.h>
+
+#include "test_config.h"
+
+/*
+ * Publisher CPU with and without zero-copy sends over batched UDP.
+ *
+ * Three nodes are created in this process: a subscriber's, and two
+ * publishers', one copying samples into its sends as usual and one sending
+ * them straight from their loans (zeroCopyThreshold, or -z). For each
+ * sample size, each publisher in turn loan()s and commit()s samples at
+ * targetRate bytes/sec for a few seconds (-p), and we report samples sent
+ * and received, the publishing thread's CPU (sends happen on it), and how
+ * the sends went (Publisher::zeroCopyStats()).
+ *
+ * Over loopback the kernel copies zero-copy sends as it delivers them,
+ * and says so ('copied'), so the saving only shows going out of a NIC.
+ */
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::setprecision;
+using std::setw;
+
+static const char *prog = "test_zerocopy_commkit";
+
+static constexpr size_t maxPayload = 60000;
+static const size_t payloadSizes[] = {16000, 32000, 60000};
+static constexpr double targetRate = 128e6; // bytes/sec
+
+static std::atomic<uint64_t> received(0);
+
+static void onMessage(commkit::SubscriberPtr sub)
+{
+    commkit::Payload payload;
+    while (sub->take(&payload)) {
+        received++;
+    }
+}
+
+// CPU this thread has used, seconds
+static double threadCpu()
+{
+    struct rusage r;
+    if (getrusage(RUSAGE_THREAD, &r) != 0) {
+        return 0;
+    }
+    return r.ru_utime.tv_sec + r.ru_stime.tv_sec + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6;
+}
+
+static void run(commkit::PublisherPtr pub, const char *mode, size_t len, unsigned seconds)
+{
+    received = 0;
+    uint64_t sent = 0;
+    commkit::ZeroCopyStats before = pub->zeroCopyStats();
+
+    commkit::clock::duration interval = std::chrono::nanoseconds(uint64_t(len / targetRate * 1e9));
+    commkit::clock::time_point start = commkit::clock::now();
+    commkit::clock::time_point end = start + std::chrono::seconds(seconds);
+    commkit::clock::time_point next = start;
+    double cpu = threadCpu();
+    while (next < end) {
+        std::this_thread::sleep_until(next);
+        uint8_t *b;
+        if (pub->loan(&b, len)) {
+            memset(b, 0x5a, len);
+            sent += pub->commit(b, len) ? 1 : 0;
+        }
+        next += interval;
+    }
+    cpu = threadCpu() - cpu;
+    double elapsed = commkit::toDouble(commkit::clock::now() - start);
+
+    // let the subscriber catch up, and the kernel report on the last sends
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    commkit::ZeroCopyStats after = pub->zeroCopyStats();
+
+    std::ios::fmtflags f(cout.flags()); // save state
+    cout << setw(6) << len << " " << setw(5) << mode << " " << setw(8) << sent << " " << setw(8)
+         << received << " " << setw(7) << fixed << setprecision(1) << sent * len / elapsed / 1e6
+         << " " << setw(6) << cpu / elapsed * 100.0 << "% " << setw(8)
+         << after.sent - before.sent << " " << setw(8) << after.copied - before.copied << " "
+         << setw(9) << after.fallbacks - before.fallbacks << endl;
+    cout.flags(f); // restore state
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "built " __DATE__ " " __TIME__ << endl;
+
+    TestConfig::Config config;
+    config.print_s = 3; // seconds per run
+    config.batchSize = 32;
+    config.zeroCopy = 1024;
+    if (!TestConfig::parseArgs(argc, argv, config) || config.batchSize == 0) {
+        TestConfig::usage(prog);
+    }
+
+    eprosima::Log::setVerbosity(eprosima::VERB_ERROR);
+
+    commkit::TransportDescriptor batched(commkit::TRANSPORT_UDP_BATCHED);
+    batched.batchSize = config.batchSize;
+    batched.batchLatency = std::chrono::microseconds(config.batchWait_us);
+
+    commkit::NodeOpts nodeOpts;
+    nodeOpts.name = prog;
+    nodeOpts.sendSocketBufferSize = 4 * 1024 * 1024;
+    nodeOpts.listenSocketBufferSize = 4 * 1024 * 1024;
+    nodeOpts.transports.push_back(batched);
+
+    commkit::Node subNode, copyNode, zeroCopyNode;
+    bool ok = subNode.init(nodeOpts) && copyNode.init(nodeOpts);
+    nodeOpts.transports[0].zeroCopyThreshold = config.zeroCopy;
+    if (!ok || !zeroCopyNode.init(nodeOpts)) {
+        cerr << "error creating nodes" << endl;
+        exit(1);
+    }
+
+    commkit::Topic topic("ZeroCopyTopic", "bytes", maxPayload);
+
+    // slots enough to cover those the kernel has yet to finish with
+    commkit::PublicationOpts pubOpts;
+    pubOpts.history = config.history;
+    pubOpts.loanSlots = 64;
+    auto copyPub = copyNode.createPublisher(topic);
+    auto zeroCopyPub = zeroCopyNode.createPublisher(topic);
+    if (copyPub == nullptr || !copyPub->init(pubOpts) || zeroCopyPub == nullptr ||
+        !zeroCopyPub->init(pubOpts)) {
+        cerr << "error creating publishers" << endl;
+        exit(1);
+    }
+
+    auto sub = subNode.createSubscriber(topic);
+    commkit::SubscriptionOpts subOpts;
+    subOpts.history = config.history;
+    if (sub == nullptr || !sub->init(subOpts)) {
+        cerr << "error creating subscriber" << endl;
+        exit(1);
+    }
+    sub->onMessage.connect(&onMessage);
+
+    while (copyPub->matchedSubscribers() == 0 || zeroCopyPub->matchedSubscribers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    cout << setw(6) << "bytes" << " " << setw(5) << "mode" << " " << setw(8) << "sent" << " "
+         << setw(8) << "recv" << " " << setw(7) << "MB/s" << " " << setw(7) << "cpu" << " "
+         << setw(8) << "zc" << " " << setw(8) << "copied" << " " << setw(9) << "fallbacks"
+         << endl;
+
+    for (size_t len : payloadSizes) {
+        run(copyPub, "copy", len, config.print_s);
+        run(zeroCopyPub, "zc", len, config.print_s);
+    }
+
+    return 0;
+
+} // main
@@ -2,19 +2,42 @@
 #include <gtest/gtest.h>
 #include <commkit/commkit.h>
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#ifndef COMMKIT_NO_CAPNP
+#include <capnp/any.h>
+#include <capnp/message.h>
+#endif
 
 TEST(BasicsTest, Basic)
 {
     /*
      * Create a pub and sub on different nodes,
      * ensure we can send a trivial message between them.
+     * Over RTPS: intraProcess would have them delivered to directly.
      */
 
+    commkit::NodeOpts opts;
+    opts.name = "basic";
+    opts.intraProcess = false;
     commkit::Node n1, n2;
-    EXPECT_TRUE(n1.init("node1"));
-    EXPECT_TRUE(n2.init("node2"));
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
 
     auto t = commkit::Topic("T", "uint32_t", sizeof(uint32_t));
 
@@ -53,3 +76,975 @@ TEST(BasicsTest, Basic)
         EXPECT_EQ(npub, nsub);
     }
 }
+
+TEST(BasicsTest, TakeLoan)
+{
+    /*
+     * Samples taken via takeLoan() stay valid while later samples are taken.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "takeloan";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    auto t = commkit::Topic("TL", "uint32_t", sizeof(uint32_t));
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    popts.history = 4;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 4;
+    sopts.loanSlots = 2;
+    EXPECT_TRUE(sub->init(sopts));
+
+    unsigned tries = 100;
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    commkit::PayloadLoan a, b, c;
+    ASSERT_TRUE(sub->takeLoan(&a));
+    ASSERT_TRUE(sub->takeLoan(&b));
+
+    // pool of 2 is exhausted
+    EXPECT_FALSE(sub->takeLoan(&c));
+
+    uint32_t va, vb;
+    memcpy(&va, a->bytes, sizeof(va));
+    memcpy(&vb, b->bytes, sizeof(vb));
+    EXPECT_EQ(va, 0u);
+    EXPECT_EQ(vb, 1u);
+    EXPECT_NE(a->bytes, b->bytes);
+
+    a.release();
+    EXPECT_FALSE(a.valid());
+    ASSERT_TRUE(sub->takeLoan(&c));
+    uint32_t vc;
+    memcpy(&vc, c->bytes, sizeof(vc));
+    EXPECT_EQ(vc, 2u);
+}
+
+TEST(BasicsTest, TakeBatch)
+{
+    /*
+     * peekBatch() leaves samples to be taken, and takeBatch() fills as
+     * many loans as there are samples and free loan slots, which come
+     * back as loans are released.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "batch";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    auto t = commkit::Topic("TB", "uint32_t", sizeof(uint32_t));
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    popts.history = 8;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 8;
+    sopts.loanSlots = 3;
+    EXPECT_TRUE(sub->init(sopts));
+
+    unsigned tries = 100;
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    auto value = [](const commkit::PayloadLoan &l) {
+        uint32_t v;
+        memcpy(&v, l->bytes, sizeof(v));
+        return v;
+    };
+
+    commkit::PayloadLoan a[4], b[4];
+    ASSERT_EQ(sub->peekBatch(a, 2), 2u);
+    EXPECT_EQ(value(a[0]), 0u);
+    EXPECT_EQ(value(a[1]), 1u);
+    a[0].release();
+    a[1].release();
+
+    // the peeked samples are still there; three loan slots, three samples
+    ASSERT_EQ(sub->takeBatch(a, 4), 3u);
+    EXPECT_EQ(value(a[0]), 0u);
+    EXPECT_EQ(value(a[1]), 1u);
+    EXPECT_EQ(value(a[2]), 2u);
+    EXPECT_EQ(sub->takeBatch(b, 4), 0u);
+
+    // a released loan frees a slot; only one sample is left
+    a[1].release();
+    ASSERT_EQ(sub->takeBatch(b, 4), 1u);
+    EXPECT_EQ(value(b[0]), 3u);
+    EXPECT_FALSE(b[1].valid());
+    EXPECT_EQ(value(a[0]), 0u);
+
+    for (auto &l : a) {
+        l.release();
+    }
+    b[0].release();
+    EXPECT_EQ(sub->takeBatch(b, 4), 0u);
+}
+
+TEST(BasicsTest, EmptySample)
+{
+    /*
+     * A zero length sample is a sample like any other, whether taken by
+     * copy or on loan.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "empty";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    auto t = commkit::Topic("ES", "uint32_t", sizeof(uint32_t));
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    popts.history = 8;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 8;
+    EXPECT_TRUE(sub->init(sopts));
+
+    unsigned tries = 100;
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+
+    uint32_t v = 7;
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(&v);
+    EXPECT_TRUE(pub->publish(b, 0));
+    EXPECT_TRUE(pub->publish(b, 0));
+    EXPECT_TRUE(pub->publish(b, 0));
+    EXPECT_TRUE(pub->publish(b, sizeof(v)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    commkit::Payload p;
+    ASSERT_TRUE(sub->take(&p));
+    EXPECT_EQ(p.len, 0u);
+
+    commkit::PayloadLoan l;
+    ASSERT_TRUE(sub->takeLoan(&l));
+    EXPECT_TRUE(l.valid());
+    EXPECT_EQ(l->len, 0u);
+    l.release();
+
+    commkit::PayloadLoan a[4];
+    ASSERT_EQ(sub->takeBatch(a, 4), 2u);
+    EXPECT_EQ(a[0]->len, 0u);
+    ASSERT_EQ(a[1]->len, sizeof(v));
+    EXPECT_EQ(memcmp(a[1]->bytes, b, sizeof(v)), 0);
+    EXPECT_FALSE(sub->take(&p));
+}
+
+TEST(BasicsTest, PublishBatch)
+{
+    /*
+     * A batch arrives as the samples published, in order, each with its own
+     * source timestamp, whether packed into frames or not.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "publishbatch";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    for (bool framed : {false, true}) {
+        auto t = commkit::Topic(framed ? "PBF" : "PB", "uint32_t", 256, framed);
+
+        auto pub = n1.createPublisher(t);
+        commkit::PublicationOpts popts;
+        popts.reliable = true;
+        popts.history = 8;
+        EXPECT_TRUE(pub->init(popts));
+
+        auto sub = n2.createSubscriber(t);
+        commkit::SubscriptionOpts sopts;
+        sopts.reliable = true;
+        sopts.history = 8;
+        EXPECT_TRUE(sub->init(sopts));
+
+        unsigned tries = 100;
+        while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_GT(tries--, 0);
+        }
+
+        uint32_t values[5];
+        commkit::BatchSample batch[5];
+        commkit::clock::time_point base = commkit::clock::now() - std::chrono::seconds(1);
+        for (uint32_t i = 0; i < 5; ++i) {
+            values[i] = 100 + i;
+            batch[i] = commkit::BatchSample(reinterpret_cast<const uint8_t *>(&values[i]),
+                                            sizeof(values[i]),
+                                            base + std::chrono::milliseconds(i));
+        }
+        EXPECT_EQ(pub->publishBatch(batch, 5), 5u);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        commkit::Payload p;
+        int64_t lastSeq = commkit::SEQUENCE_NUMBER_INVALID;
+        for (uint32_t i = 0; i < 5; ++i) {
+            ASSERT_TRUE(sub->take(&p)) << framed << " " << i;
+            ASSERT_EQ(p.len, sizeof(uint32_t));
+            uint32_t v;
+            memcpy(&v, p.bytes, sizeof(v));
+            EXPECT_EQ(v, 100 + i);
+            EXPECT_EQ(p.sourceTimestamp, batch[i].sourceTimestamp);
+            if (lastSeq != commkit::SEQUENCE_NUMBER_INVALID) {
+                EXPECT_GT(p.sequence, lastSeq);
+            }
+            lastSeq = p.sequence;
+        }
+        EXPECT_FALSE(sub->take(&p));
+    }
+}
+
+TEST(BasicsTest, AsyncPublish)
+{
+    /*
+     * An async publisher's samples go out from the node's sender thread.
+     * When they come faster than it sends, the overflow policy decides
+     * which are dropped, and what publish() says about it; every sample is
+     * either sent or counted in queueDrops().
+     */
+
+    commkit::Node n;
+    EXPECT_TRUE(n.init("async"));
+
+    const commkit::OverflowPolicy policies[] = {commkit::OVERFLOW_DROP_OLDEST,
+                                                commkit::OVERFLOW_DROP_NEWEST,
+                                                commkit::OVERFLOW_FAIL};
+    for (auto policy : policies) {
+        auto t = commkit::Topic("Async" + std::to_string(int(policy)), "uint32_t",
+                                sizeof(uint32_t));
+
+        struct Seen {
+            std::atomic<unsigned> count;
+            std::atomic<uint32_t> last;
+        } seen;
+        seen.count = 0;
+        seen.last = UINT32_MAX;
+
+        auto sub = n.createSubscriber(t);
+        commkit::SubscriptionOpts sopts;
+        sopts.history = 16;
+        EXPECT_TRUE(sub->init(sopts));
+        sub->onMessageRef.connect([&seen](commkit::Subscriber &s) {
+            commkit::Payload p;
+            while (s.take(&p)) {
+                uint32_t v;
+                memcpy(&v, p.bytes, sizeof(v));
+                seen.last = v;
+                seen.count++;
+            }
+        });
+
+        auto pub = n.createPublisher(t);
+        commkit::PublicationOpts popts;
+        popts.async = true;
+        popts.asyncQueueDepth = 1;
+        popts.overflowPolicy = policy;
+        EXPECT_TRUE(pub->init(popts));
+
+        constexpr uint32_t count = 1000;
+        unsigned failed = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i))) {
+                failed++;
+            }
+        }
+
+        unsigned tries = 100;
+        while (pub->queueDepth() > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_GT(tries--, 0);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        sub->onMessageRef.disconnect();
+
+        uint64_t drops = pub->queueDrops();
+        if (policy == commkit::OVERFLOW_FAIL) {
+            EXPECT_EQ(failed, drops) << policy;
+        } else {
+            EXPECT_EQ(failed, 0u) << policy;
+        }
+        EXPECT_LE(seen.count.load() + drops, count) << policy;
+        EXPECT_GT(seen.count.load(), 0u) << policy;
+
+        // the newest sample always makes it
+        if (policy == commkit::OVERFLOW_DROP_OLDEST) {
+            EXPECT_EQ(seen.last.load(), count - 1);
+        }
+    }
+}
+
+TEST(BasicsTest, Fragmented)
+{
+    /*
+     * Samples too big for one datagram are fragmented and reassembled
+     * on framed topics, and can be taken on loan.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "fragmented";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    auto t = commkit::Topic("FRAG", "bytes", 300 * 1024, true);
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    EXPECT_TRUE(pub->init(popts));
+
+    // room in the history for both samples, big and small
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 2;
+    EXPECT_TRUE(sub->init(sopts));
+
+    unsigned tries = 100;
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+
+    std::vector<uint8_t> big(200 * 1024);
+    for (size_t i = 0; i < big.size(); ++i) {
+        big[i] = uint8_t(i * 13);
+    }
+    uint32_t small = 7;
+
+    EXPECT_TRUE(pub->publish(big.data(), big.size()));
+    EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&small), sizeof(small)));
+
+    tries = 100;
+    commkit::PayloadLoan l;
+    while (!sub->takeLoan(&l)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+    ASSERT_EQ(l->len, big.size());
+    EXPECT_EQ(memcmp(l->bytes, big.data(), big.size()), 0);
+
+    // the loan keeps the reassembled sample while we move on
+    commkit::Payload p;
+    tries = 100;
+    while (!sub->take(&p)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+    EXPECT_EQ(p.len, sizeof(small));
+    EXPECT_EQ(memcmp(l->bytes, big.data(), big.size()), 0);
+    EXPECT_EQ(sub->reassemblyDrops(), 0u);
+}
+
+TEST(BasicsTest, FragmentDrops)
+{
+    /*
+     * A fragmented sample that can't be reassembled is counted as one
+     * drop, however many fragments it came in.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "fragdrops";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    auto t = commkit::Topic("FRAGD", "bytes", 300 * 1024, true);
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 4;
+    sopts.reassemblyBuffers = 1;
+    EXPECT_TRUE(sub->init(sopts));
+
+    unsigned tries = 100;
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+
+    std::vector<uint8_t> big(200 * 1024, 0x5a);
+    EXPECT_TRUE(pub->publish(big.data(), big.size()));
+
+    tries = 100;
+    commkit::PayloadLoan l;
+    while (!sub->takeLoan(&l)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+    ASSERT_EQ(l->len, big.size());
+
+    // the loan holds the only reassembly buffer, so there's nowhere to
+    // put the next one
+    uint32_t small = 7;
+    EXPECT_TRUE(pub->publish(big.data(), big.size()));
+    EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&small), sizeof(small)));
+
+    commkit::Payload p;
+    tries = 100;
+    while (!sub->take(&p)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+    EXPECT_EQ(p.len, sizeof(small));
+    EXPECT_EQ(sub->reassemblyDrops(), 1u);
+}
+
+TEST(BasicsTest, IntraProcess)
+{
+    /*
+     * A pub and sub in the same process are connected directly:
+     * samples are ready to take as soon as publish() returns, and
+     * the subscriber keeps the newest 'history' of them. Handlers run
+     * on the node's dispatch thread, not the publisher's.
+     */
+
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init("node1"));
+    EXPECT_TRUE(n2.init("node2"));
+
+    auto t = commkit::Topic("IP", "uint32_t", sizeof(uint32_t));
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 2;
+    EXPECT_TRUE(sub->init(sopts));
+
+    std::atomic<unsigned> calls(0), refCalls(0);
+    std::atomic<bool> onPublisherThread(false);
+    std::thread::id self = std::this_thread::get_id();
+    sub->onMessage.connect([&calls, &onPublisherThread, self](commkit::SubscriberPtr) {
+        onPublisherThread = onPublisherThread || std::this_thread::get_id() == self;
+        calls++;
+    });
+    commkit::Subscriber *raw = sub.get();
+    sub->onMessageRef.connect([&refCalls, raw](commkit::Subscriber &s) {
+        EXPECT_EQ(&s, raw);
+        refCalls++;
+    });
+
+    // no waiting for discovery
+    uint32_t v = 7;
+    EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&v), sizeof(v)));
+
+    unsigned tries = 100;
+    while (calls.load() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ASSERT_GT(tries--, 0);
+    }
+    EXPECT_EQ(calls.load(), 1u);
+    EXPECT_EQ(refCalls.load(), 1u);
+    EXPECT_FALSE(onPublisherThread.load());
+
+    commkit::Payload p;
+    ASSERT_TRUE(sub->take(&p));
+    uint32_t got;
+    memcpy(&got, p.bytes, sizeof(got));
+    EXPECT_EQ(got, 7u);
+    EXPECT_FALSE(sub->take(&p));
+
+    for (uint32_t i = 0; i < 5; ++i) {
+        EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i)));
+    }
+
+    int64_t prevSeq = 0;
+    for (uint32_t want = 3; want < 5; ++want) {
+        ASSERT_TRUE(sub->take(&p));
+        memcpy(&got, p.bytes, sizeof(got));
+        EXPECT_EQ(got, want);
+        EXPECT_GT(p.sequence, prevSeq);
+        prevSeq = p.sequence;
+    }
+    EXPECT_FALSE(sub->take(&p));
+}
+
+TEST(BasicsTest, IntraProcessConflict)
+{
+    /*
+     * Nodes on one domain share their participant, so must agree on
+     * intraProcess and transports.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "direct";
+    commkit::Node n1, n2, n3, n4, n5, n6;
+    EXPECT_TRUE(n1.init(opts));
+
+    // UDP is there whether asked for or not
+    opts.name = "same";
+    opts.transports.clear();
+    EXPECT_TRUE(n4.init(opts));
+
+    opts.name = "shared";
+    opts.transports.push_back(commkit::TransportDescriptor(commkit::TRANSPORT_SHARED_MEMORY, 1));
+    EXPECT_FALSE(n5.init(opts));
+
+    opts.name = "batched";
+    opts.transports.assign(1, commkit::TransportDescriptor(commkit::TRANSPORT_UDP_BATCHED, 1));
+    EXPECT_FALSE(n6.init(opts));
+
+    opts.name = "indirect";
+    opts.transports.assign(1, commkit::TransportDescriptor(commkit::TRANSPORT_UDP));
+    opts.intraProcess = false;
+    EXPECT_FALSE(n2.init(opts));
+
+    opts.domainID = commkit::NodeOpts::DefaultDomain + 1;
+    EXPECT_TRUE(n3.init(opts));
+}
+
+TEST(BasicsTest, Timestamps)
+{
+    /*
+     * With SubscriptionOpts::timestamps, a sample says when it was queued
+     * for us and handed over, and goes into latencyStats() once taken.
+     * There's no kernel time for samples from this process.
+     */
+
+    commkit::Node n;
+    EXPECT_TRUE(n.init("timestamps"));
+
+    auto t = commkit::Topic("TS", "uint32_t", sizeof(uint32_t));
+    auto pub = n.createPublisher(t);
+    EXPECT_TRUE(pub->init(commkit::PublicationOpts()));
+
+    auto plain = n.createSubscriber(t);
+    EXPECT_TRUE(plain->init(commkit::SubscriptionOpts()));
+    auto sub = n.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.timestamps = true;
+    EXPECT_TRUE(sub->init(sopts));
+
+    uint32_t v = 7;
+    EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&v), sizeof(v)));
+
+    commkit::Payload p;
+    ASSERT_TRUE(plain->take(&p));
+    EXPECT_EQ(p.receiveTimestamp, commkit::TIME_POINT_INVALID);
+    EXPECT_EQ(p.dispatchTimestamp, commkit::TIME_POINT_INVALID);
+    EXPECT_EQ(plain->latencyStats().total.count, 0u);
+
+    // peeking doesn't count
+    ASSERT_TRUE(sub->peek(&p));
+    EXPECT_NE(p.dispatchTimestamp, commkit::TIME_POINT_INVALID);
+    EXPECT_EQ(sub->latencyStats().total.count, 0u);
+
+    ASSERT_TRUE(sub->take(&p));
+    EXPECT_EQ(p.kernelTimestamp, commkit::TIME_POINT_INVALID);
+    ASSERT_NE(p.receiveTimestamp, commkit::TIME_POINT_INVALID);
+    EXPECT_LE(p.sourceTimestamp, p.receiveTimestamp);
+    EXPECT_LE(p.receiveTimestamp, p.dispatchTimestamp);
+
+    commkit::LatencyStats ls = sub->latencyStats();
+    EXPECT_EQ(ls.network.count, 0u);
+    EXPECT_EQ(ls.stack.count, 0u);
+    EXPECT_EQ(ls.dispatch.count, 1u);
+    EXPECT_EQ(ls.total.count, 1u);
+    EXPECT_LE(ls.dispatch.max, ls.total.max);
+}
+
+#ifdef __linux__
+TEST(BasicsTest, EventFd)
+{
+    /*
+     * One thread waits on 100 subscribers with a single epoll set. Each
+     * one's descriptor is readable once published to, and stops being so
+     * once it's drained.
+     */
+
+    constexpr int count = 100;
+
+    commkit::Node n;
+    EXPECT_TRUE(n.init("eventfd"));
+
+    std::vector<commkit::PublisherPtr> pubs;
+    std::vector<commkit::SubscriberPtr> subs;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT_GE(ep, 0);
+    for (int i = 0; i < count; ++i) {
+        auto t = commkit::Topic("EventFd" + std::to_string(i), "uint32_t", sizeof(uint32_t));
+        auto sub = n.createSubscriber(t);
+        ASSERT_EQ(sub->eventFd(), -1); // not until init()
+        ASSERT_TRUE(sub->init(commkit::SubscriptionOpts()));
+        auto pub = n.createPublisher(t);
+        ASSERT_TRUE(pub->init(commkit::PublicationOpts()));
+
+        int fd = sub->eventFd();
+        ASSERT_GE(fd, 0);
+        EXPECT_EQ(sub->eventFd(), fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        ASSERT_EQ(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev), 0);
+        subs.push_back(sub);
+        pubs.push_back(pub);
+    }
+
+    struct epoll_event events[count];
+    EXPECT_EQ(epoll_wait(ep, events, count, 0), 0);
+
+    // every other one, from another thread
+    std::thread publisher([&pubs] {
+        for (uint32_t i = 0; i < count; i += 2) {
+            pubs[i]->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i));
+        }
+    });
+
+    std::vector<int> received(count, 0);
+    int total = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (total < count / 2 && std::chrono::steady_clock::now() < deadline) {
+        int ready = epoll_wait(ep, events, count, 100);
+        for (int e = 0; e < ready; ++e) {
+            uint32_t i = events[e].data.u32;
+            commkit::Payload p;
+            while (subs[i]->take(&p)) {
+                ASSERT_EQ(p.len, sizeof(uint32_t));
+                uint32_t v;
+                memcpy(&v, p.bytes, sizeof(v));
+                EXPECT_EQ(v, i);
+                received[i]++;
+                total++;
+            }
+        }
+    }
+    publisher.join();
+
+    EXPECT_EQ(total, count / 2);
+    for (int i = 0; i < count; ++i) {
+        EXPECT_EQ(received[i], i % 2 == 0 ? 1 : 0) << i;
+    }
+
+    // all drained (allowing for RTPS copies of what was published here,
+    // which a take() skips)
+    for (int i = 0; i < 10 && epoll_wait(ep, events, count, 0) > 0; ++i) {
+        commkit::Payload p;
+        for (auto &s : subs) {
+            EXPECT_FALSE(s->take(&p));
+        }
+    }
+    EXPECT_EQ(epoll_wait(ep, events, count, 0), 0);
+
+    // samples that came before the descriptor was asked for count too
+    auto t = commkit::Topic("EventFdLate", "uint32_t", sizeof(uint32_t));
+    auto late = n.createSubscriber(t);
+    ASSERT_TRUE(late->init(commkit::SubscriptionOpts()));
+    auto pub = n.createPublisher(t);
+    ASSERT_TRUE(pub->init(commkit::PublicationOpts()));
+    uint32_t v = 1;
+    EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&v), sizeof(v)));
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = count;
+    ASSERT_EQ(epoll_ctl(ep, EPOLL_CTL_ADD, late->eventFd(), &ev), 0);
+    EXPECT_EQ(epoll_wait(ep, events, count, 0), 1);
+
+    close(ep);
+}
+
+TEST(BasicsTest, SharedMemoryTransport)
+{
+    /*
+     * With direct delivery off, a pub and sub on the same participant
+     * still find each other through the shared memory transport, and the
+     * subscriber keeps only that copy of each sample, not RTPS's as well.
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "shm";
+    opts.domainID = commkit::NodeOpts::DefaultDomain + 1;
+    opts.intraProcess = false;
+    opts.transports.push_back(commkit::TransportDescriptor(commkit::TRANSPORT_SHARED_MEMORY, 1));
+    opts.transports.push_back(commkit::TransportDescriptor(commkit::TRANSPORT_SHARED_MEMORY, 2));
+
+    commkit::Node n;
+    EXPECT_FALSE(n.init(opts)); // one of each kind
+    opts.transports.pop_back();
+    ASSERT_TRUE(n.init(opts));
+
+    auto t = commkit::Topic("SHMT", "uint32_t", sizeof(uint32_t));
+
+    // best effort: reliable topics stay with RTPS
+    auto sub = n.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.history = 10;
+    EXPECT_TRUE(sub->init(sopts));
+
+    auto pub = n.createPublisher(t);
+    EXPECT_TRUE(pub->init(commkit::PublicationOpts()));
+
+    // no waiting for RTPS discovery
+    for (uint32_t i = 0; i < 3; ++i) {
+        EXPECT_TRUE(pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i)));
+    }
+
+    std::vector<uint32_t> got;
+    for (int tries = 0; tries < 100 && got.size() < 3; ++tries) {
+        commkit::Payload p;
+        if (sub->take(&p)) {
+            uint32_t v;
+            memcpy(&v, p.bytes, sizeof(v));
+            got.push_back(v);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    EXPECT_EQ(got, std::vector<uint32_t>({0, 1, 2}));
+
+    // RTPS may catch up meanwhile; its copies are dropped
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    commkit::Payload p;
+    EXPECT_FALSE(sub->take(&p));
+}
+#endif
+
+#ifdef __linux__
+TEST(BasicsTest, ByReference)
+{
+    /*
+     * A sample reserve()d on a by-reference topic is read by the subscriber
+     * in the publisher's buffer, which isn't reused while it's on loan.
+     */
+
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init("node1"));
+    EXPECT_TRUE(n2.init("node2"));
+
+    auto t = commkit::Topic("BR", "frame", 1024 * 1024);
+    t.byReference = true;
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    popts.sharedBuffers = 3;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    sopts.history = 2;
+    EXPECT_TRUE(sub->init(sopts));
+
+    uint8_t *b;
+    ASSERT_TRUE(pub->reserve(&b, t.maxPayloadSize));
+    memset(b, 0x5a, t.maxPayloadSize);
+    EXPECT_TRUE(pub->publishReserved(b, t.maxPayloadSize));
+
+    commkit::PayloadLoan l;
+    ASSERT_TRUE(sub->takeLoan(&l));
+    EXPECT_EQ(l->len, t.maxPayloadSize);
+    EXPECT_EQ(l->bytes[0], 0x5a);
+    EXPECT_EQ(l->bytes[t.maxPayloadSize - 1], 0x5a);
+
+    // one buffer is on loan to us, and another kept as history
+    uint8_t *b2, *b3;
+    ASSERT_TRUE(pub->reserve(&b2, 16));
+    EXPECT_NE(b2, b);
+    EXPECT_TRUE(pub->publishReserved(b2, 16));
+    ASSERT_TRUE(pub->reserve(&b3, 16));
+    EXPECT_NE(b3, b);
+    pub->discard(b3);
+
+    l.release();
+    commkit::Payload p;
+    ASSERT_TRUE(sub->take(&p));
+    EXPECT_EQ(p.len, 16u);
+    EXPECT_FALSE(sub->take(&p));
+}
+#endif
+
+#ifndef COMMKIT_NO_CAPNP
+TEST(BasicsTest, CapnMultiSegment)
+{
+    /*
+     * A message spanning several segments is gathered on send
+     * and readable in place with toReader().
+     */
+
+    commkit::NodeOpts opts;
+    opts.name = "capnmulti";
+    opts.intraProcess = false;
+    commkit::Node n1, n2;
+    EXPECT_TRUE(n1.init(opts));
+    EXPECT_TRUE(n2.init(opts));
+
+    auto t = commkit::Topic("CMS", "capnp::Data", 8192);
+
+    auto pub = n1.createPublisher(t);
+    commkit::PublicationOpts popts;
+    popts.reliable = true;
+    EXPECT_TRUE(pub->init(popts));
+
+    auto sub = n2.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.reliable = true;
+    EXPECT_TRUE(sub->init(sopts));
+
+    unsigned tries = 100;
+    while (pub->matchedSubscribers() == 0 || sub->matchedPublishers() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_GT(tries--, 0);
+    }
+
+    // tiny first segment, so the data lands in a second one
+    capnp::MallocMessageBuilder mb(16, capnp::AllocationStrategy::FIXED_SIZE);
+    auto data = mb.getRoot<capnp::AnyPointer>().initAs<capnp::Data>(4000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = uint8_t(i);
+    }
+    ASSERT_GT(mb.getSegmentsForOutput().size(), 1u);
+
+    EXPECT_TRUE(pub->publish(mb));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    commkit::Payload p;
+    ASSERT_TRUE(sub->take(&p));
+
+    bool ok;
+    auto reader = p.toReader(&ok);
+    ASSERT_TRUE(ok);
+    auto rdata = reader.getRoot<capnp::AnyPointer>().getAs<capnp::Data>();
+    ASSERT_EQ(rdata.size(), 4000u);
+    for (size_t i = 0; i < rdata.size(); ++i) {
+        ASSERT_EQ(rdata[i], uint8_t(i));
+    }
+}
+#endif
+
+#ifdef __linux__
+TEST(BasicsTest, Threads)
+{
+    /*
+     * Every thread running for a node, Fast-RTPS' as well as ours, is
+     * listed with its role, and scheduled as NodeOpts::threads asks, as
+     * /proc/self/task shows. A second Node asking otherwise is refused.
+     */
+
+    // a CPU we may run on, that a cpus mask can name
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    unsigned cpu = 0;
+    while (cpu < 63 && !CPU_ISSET(cpu, &allowed)) {
+        cpu++;
+    }
+
+    commkit::NodeOpts opts;
+    opts.name = "threads";
+    opts.domainID = commkit::NodeOpts::DefaultDomain + 2;
+    opts.transports.push_back(commkit::TransportDescriptor(commkit::TRANSPORT_UDP_BATCHED, 1));
+    opts.threads[commkit::THREAD_RTPS].policy = SCHED_BATCH;
+    opts.threads[commkit::THREAD_RTPS].cpus = uint64_t(1) << cpu;
+    opts.threads[commkit::THREAD_RECEIVER].policy = SCHED_IDLE;
+
+    commkit::Node n;
+    ASSERT_TRUE(n.init(opts));
+
+    // the threads are the domain's: another Node on it must ask for the same
+    commkit::Node same, other;
+    opts.name = "threads-same";
+    EXPECT_TRUE(same.init(opts));
+    opts.name = "threads-other";
+    opts.threads[commkit::THREAD_RECEIVER].policy = SCHED_BATCH;
+    EXPECT_FALSE(other.init(opts));
+
+    // the batched transport starts its threads with its first endpoint
+    auto t = commkit::Topic("THR", "uint32_t", sizeof(uint32_t));
+    auto sub = n.createSubscriber(t);
+    ASSERT_TRUE(sub->init(commkit::SubscriptionOpts()));
+
+    unsigned rtps = 0, receivers = 0;
+    for (auto &ti : n.threads()) {
+        std::string task = "/proc/self/task/" + std::to_string(ti.tid);
+        std::ifstream statFile(task + "/stat");
+        std::string stat((std::istreambuf_iterator<char>(statFile)),
+                         std::istreambuf_iterator<char>());
+        ASSERT_FALSE(stat.empty());
+
+        // policy is field 41, counting from the state, field 3, after the name
+        std::istringstream fields(stat.substr(stat.rfind(')') + 1));
+        std::string field;
+        for (int i = 3; i <= 41 && fields >> field; ++i) {
+        }
+        int policy = std::stoi(field);
+
+        std::ifstream status(task + "/status");
+        std::string line, cpus;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 18, "Cpus_allowed_list:") == 0) {
+                cpus = line.substr(line.find_first_not_of(" \t", 18));
+            }
+        }
+
+        EXPECT_TRUE(ti.applied) << ti.name;
+        if (ti.role == commkit::THREAD_RTPS) {
+            rtps++;
+            EXPECT_EQ(policy, SCHED_BATCH) << ti.name;
+            EXPECT_EQ(cpus, std::to_string(cpu)) << ti.name;
+        } else if (ti.role == commkit::THREAD_RECEIVER) {
+            receivers++;
+            EXPECT_EQ(policy, SCHED_IDLE) << ti.name;
+            EXPECT_EQ(ti.name, "ck-batch-io");
+        }
+    }
+    EXPECT_GT(rtps, 0u);
+    EXPECT_EQ(receivers, 1u);
+}
+#endif
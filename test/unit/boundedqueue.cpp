@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include "../src/boundedqueue.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(BoundedQueueTest, Basic)
+{
+    commkit::BoundedQueue<int> q(3);
+    EXPECT_EQ(q.capacity(), 4u); // rounded up to a power of two
+
+    int v;
+    EXPECT_FALSE(q.pop(&v));
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(q.push(i));
+    }
+    EXPECT_FALSE(q.push(4));
+    EXPECT_EQ(q.size(), 4u);
+
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(q.pop(&v));
+        EXPECT_EQ(v, i);
+    }
+    EXPECT_FALSE(q.pop(&v));
+    EXPECT_EQ(q.size(), 0u);
+}
+
+TEST(BoundedQueueTest, Producers)
+{
+    /*
+     * Several producers, one consumer: everything pushed comes out once,
+     * and each producer's values stay in order.
+     */
+
+    constexpr int producers = 4;
+    constexpr int perProducer = 20000;
+
+    commkit::BoundedQueue<int> q(64);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.push_back(std::thread([&q, p] {
+            for (int i = 0; i < perProducer; ++i) {
+                while (!q.push(p * perProducer + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        }));
+    }
+
+    std::vector<int> last(producers, -1);
+    int received = 0;
+    while (received < producers * perProducer) {
+        int v;
+        if (!q.pop(&v)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = v / perProducer;
+        EXPECT_GT(v % perProducer, last[p]);
+        last[p] = v % perProducer;
+        received++;
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(q.size(), 0u);
+}
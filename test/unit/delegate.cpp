@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <commkit/callback.h>
+#include <commkit/delegate.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+using commkit::Callback;
+using commkit::Delegate;
+using commkit::Signal;
+
+class Adder
+{
+public:
+    Adder() : total(0)
+    {
+    }
+
+    void add(int v)
+    {
+        total += v;
+    }
+
+    int total;
+};
+
+TEST(DelegateTest, Targets)
+{
+    Delegate<int(int)> empty;
+    EXPECT_FALSE(empty);
+
+    int base = 10;
+    Delegate<int(int)> lambda([&base](int v) { return base + v; });
+    ASSERT_TRUE(lambda);
+    EXPECT_EQ(lambda(5), 15);
+
+    Adder a;
+    auto direct = Delegate<void(int)>::bind<Adder, &Adder::add>(&a);
+    direct(2);
+    auto bound = Delegate<void(int)>::bind(&Adder::add, &a);
+    bound(3);
+    EXPECT_EQ(a.total, 5);
+
+    // arguments by reference stay references
+    Delegate<void(int &)> inc([](int &v) { v++; });
+    int v = 1;
+    inc(v);
+    EXPECT_EQ(v, 2);
+}
+
+TEST(DelegateTest, Lifetime)
+{
+    /*
+     * Captures are copied with the Delegate, and destroyed with it.
+     */
+
+    auto p = std::make_shared<int>(7);
+    {
+        Delegate<int()> d([p]() { return *p; });
+        EXPECT_EQ(p.use_count(), 2);
+
+        Delegate<int()> copy(d);
+        EXPECT_EQ(p.use_count(), 3);
+        EXPECT_EQ(copy(), 7);
+
+        d.reset();
+        EXPECT_FALSE(d);
+        EXPECT_EQ(p.use_count(), 2);
+
+        d = copy;
+        EXPECT_EQ(p.use_count(), 3);
+        copy = Delegate<int()>();
+        EXPECT_EQ(p.use_count(), 2);
+        EXPECT_EQ(d(), 7);
+
+        Delegate<int()> moved(std::move(d));
+        EXPECT_FALSE(d);
+        EXPECT_EQ(p.use_count(), 2);
+        EXPECT_EQ(moved(), 7);
+    }
+    EXPECT_EQ(p.use_count(), 1);
+}
+
+TEST(DelegateTest, Signal)
+{
+    Signal<void(int), 3> sig;
+    EXPECT_FALSE(sig.connected());
+    sig(1); // nothing to call
+
+    std::vector<int> order;
+    Adder a;
+    int first = sig.connect([&order](int v) { order.push_back(v); });
+    int second = sig.connect(&Adder::add, &a);
+    int third = sig.connect([&order](int v) { order.push_back(-v); });
+    EXPECT_EQ(first, 0);
+    EXPECT_EQ(second, 1);
+    EXPECT_EQ(third, 2);
+    EXPECT_EQ(sig.connect([](int) {}), -1); // full
+
+    sig(4);
+    EXPECT_EQ(order, std::vector<int>({4, -4}));
+    EXPECT_EQ(a.total, 4);
+
+    // a freed slot is taken again, and runs in its place, ahead of later ones
+    sig.disconnect(first);
+    sig(1);
+    EXPECT_EQ(order, std::vector<int>({4, -4, -1}));
+    EXPECT_EQ(sig.connect([&order](int v) { order.push_back(v * 10); }), first);
+    sig(2);
+    EXPECT_EQ(order, std::vector<int>({4, -4, -1, 20, -2}));
+
+    sig.disconnect();
+    EXPECT_FALSE(sig.connected());
+    sig(3);
+    EXPECT_EQ(a.total, 7);
+}
+
+TEST(DelegateTest, CallbackMember)
+{
+    // Callback binds member functions of any arity without std::bind
+    Adder a;
+    Callback<void(int)> cb;
+    EXPECT_FALSE(cb.connected());
+    cb.connect(&Adder::add, &a);
+    EXPECT_TRUE(cb.connected());
+    cb(6);
+    EXPECT_EQ(a.total, 6);
+}
@@ -0,0 +1,264 @@
+#include <gtest/gtest.h>
+#include <commkit/commkit.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+TEST(ExecutorTest, Tasks)
+{
+    /*
+     * Posted tasks run in order on the spinning thread, and no more than
+     * queueDepth wait at once.
+     */
+
+    commkit::Executor ex;
+    EXPECT_FALSE(ex.post([] {})); // not yet initialized
+    commkit::ExecutorOpts opts;
+    opts.queueDepth = 4;
+    ASSERT_TRUE(ex.init(opts));
+
+    std::vector<int> order;
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(ex.post([&order, i] { order.push_back(i); }));
+    }
+    EXPECT_FALSE(ex.post([&order] { order.push_back(-1); }));
+
+    EXPECT_TRUE(ex.spinOnce(std::chrono::milliseconds(0)));
+    EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3}));
+    EXPECT_FALSE(ex.spinOnce(std::chrono::milliseconds(1)));
+
+    // from another thread, waking us up
+    std::thread poster([&ex, &order] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ex.post([&order] { order.push_back(4); });
+    });
+    EXPECT_TRUE(ex.spinOnce(std::chrono::seconds(5)));
+    poster.join();
+    EXPECT_EQ(order.back(), 4);
+}
+
+TEST(ExecutorTest, Timers)
+{
+    commkit::Executor ex;
+    ASSERT_TRUE(ex.init());
+
+    unsigned fast = 0, slow = 0;
+    int id = ex.addTimer(std::chrono::milliseconds(5), [&fast] { fast++; });
+    ex.addTimer(std::chrono::milliseconds(20), [&slow, &ex] {
+        if (++slow == 3) {
+            ex.stop();
+        }
+    });
+    EXPECT_GE(id, 0);
+
+    commkit::clock::time_point start = commkit::clock::now();
+    ex.spin();
+    commkit::clock::duration elapsed = commkit::clock::now() - start;
+    EXPECT_EQ(slow, 3u);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(60));
+    EXPECT_GE(fast, 6u);
+
+    // once removed, the fast one's quiet
+    ex.removeTimer(id);
+    unsigned was = fast;
+    ex.spinOnce(std::chrono::milliseconds(30));
+    EXPECT_EQ(fast, was);
+}
+
+TEST(ExecutorTest, TimerWhileIdle)
+{
+    /*
+     * A timer added while spin() sleeps with nothing to do fires on time,
+     * not once spin() next wakes up on its own.
+     */
+
+    commkit::Executor ex;
+    ASSERT_TRUE(ex.init());
+
+    std::atomic<bool> fired(false);
+    commkit::clock::time_point added, firedAt;
+    std::thread spinner([&ex] { ex.spin(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    added = commkit::clock::now();
+    ex.addTimer(std::chrono::milliseconds(10), [&] {
+        if (!fired) {
+            firedAt = commkit::clock::now();
+            fired = true;
+            ex.stop();
+        }
+    });
+    spinner.join();
+
+    ASSERT_TRUE(fired);
+    EXPECT_GE(firedAt - added, std::chrono::milliseconds(10));
+    EXPECT_LT(firedAt - added, std::chrono::milliseconds(500));
+}
+
+TEST(ExecutorTest, Pool)
+{
+    /*
+     * With worker threads, tasks run on them, several at once, and a timer
+     * never overlaps itself however slow it is.
+     */
+
+    commkit::ExecutorOpts opts;
+    opts.threads = 4;
+    commkit::Executor ex;
+    ASSERT_TRUE(ex.init(opts));
+
+    // one reference each for the tasks to capture, so they fit a Delegate
+    struct {
+        std::atomic<unsigned> ran, running, mostRunning, onCaller;
+        std::atomic<unsigned> ticks, inTimer, overlapped;
+        std::thread::id caller;
+    } c;
+    c.ran = c.running = c.mostRunning = c.onCaller = 0;
+    c.ticks = c.inTimer = c.overlapped = 0;
+    c.caller = std::this_thread::get_id();
+
+    for (unsigned i = 0; i < 200; ++i) {
+        EXPECT_TRUE(ex.post([&c] {
+            unsigned now = ++c.running;
+            unsigned most = c.mostRunning;
+            while (now > most && !c.mostRunning.compare_exchange_weak(most, now)) {
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            c.running--;
+            c.onCaller += std::this_thread::get_id() == c.caller ? 1 : 0;
+            c.ran++;
+        }));
+    }
+
+    ex.addTimer(std::chrono::milliseconds(1), [&c] {
+        c.overlapped += c.inTimer++ > 0 ? 1 : 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        c.inTimer--;
+        c.ticks++;
+    });
+
+    commkit::clock::time_point deadline = commkit::clock::now() + std::chrono::seconds(10);
+    while ((c.ran < 200 || c.ticks < 5) && commkit::clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(c.ran, 200u);
+    EXPECT_EQ(c.onCaller, 0u);
+    EXPECT_GT(c.mostRunning, 1u);
+    EXPECT_GE(c.ticks, 5u);
+    EXPECT_EQ(c.overlapped, 0u);
+}
+
+TEST(ExecutorTest, Subscribers)
+{
+    /*
+     * An attached subscriber's callbacks run in spinOnce(), not on the
+     * publishing thread, once for however many samples arrived first.
+     */
+
+    commkit::Node n;
+    ASSERT_TRUE(n.init("executor"));
+
+    auto t = commkit::Topic("EX", "uint32_t", sizeof(uint32_t));
+    auto pub = n.createPublisher(t);
+    ASSERT_TRUE(pub->init(commkit::PublicationOpts()));
+    auto sub = n.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.history = 8;
+    ASSERT_TRUE(sub->init(sopts));
+
+    std::thread::id ranOn;
+    std::atomic<unsigned> calls(0), taken(0);
+    sub->onMessage.connect([&](commkit::SubscriberPtr s) {
+        ranOn = std::this_thread::get_id();
+        calls++;
+        commkit::Payload p;
+        while (s->take(&p)) {
+            taken++;
+        }
+    });
+
+    commkit::Executor ex, other;
+    ASSERT_TRUE(ex.init());
+    ASSERT_TRUE(other.init());
+    ASSERT_TRUE(ex.add(sub));
+    EXPECT_FALSE(other.add(sub)); // one at a time
+
+    std::thread publisher([&pub] {
+        for (uint32_t i = 0; i < 3; ++i) {
+            pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i));
+        }
+    });
+    publisher.join();
+    EXPECT_EQ(calls, 0u);
+
+    EXPECT_TRUE(ex.spinOnce(std::chrono::seconds(1)));
+    EXPECT_EQ(calls, 1u);
+    EXPECT_EQ(taken, 3u);
+    EXPECT_EQ(ranOn, std::this_thread::get_id());
+
+    // detached, callbacks run as samples arrive again (RTPS copies of
+    // local samples may call them too)
+    ex.remove(sub);
+    uint32_t v = 3;
+    pub->publish(reinterpret_cast<const uint8_t *>(&v), sizeof(v));
+    EXPECT_GE(calls, 2u);
+    EXPECT_TRUE(other.add(sub));
+}
+
+TEST(ExecutorTest, PoolOrder)
+{
+    /*
+     * On a pool, one subscriber's callbacks still run one at a time, and
+     * take its samples in order, as they're published from another thread.
+     */
+
+    commkit::Node n;
+    ASSERT_TRUE(n.init("executor-pool"));
+
+    auto t = commkit::Topic("EXP", "uint32_t", sizeof(uint32_t));
+    auto pub = n.createPublisher(t);
+    ASSERT_TRUE(pub->init(commkit::PublicationOpts()));
+    auto sub = n.createSubscriber(t);
+    commkit::SubscriptionOpts sopts;
+    sopts.history = 1000;
+    ASSERT_TRUE(sub->init(sopts));
+
+    struct {
+        std::atomic<unsigned> inHandler, overlapped, taken, outOfOrder;
+        int64_t last;
+    } c;
+    c.inHandler = c.overlapped = c.taken = c.outOfOrder = 0;
+    c.last = 0;
+    sub->onMessageRef.connect([&c](commkit::Subscriber &s) {
+        c.overlapped += c.inHandler++ > 0 ? 1 : 0;
+        commkit::Payload p;
+        while (s.take(&p)) {
+            c.outOfOrder += p.sequence <= c.last ? 1 : 0;
+            c.last = p.sequence;
+            c.taken++;
+        }
+        c.inHandler--;
+    });
+
+    commkit::ExecutorOpts opts;
+    opts.threads = 4;
+    commkit::Executor ex;
+    ASSERT_TRUE(ex.init(opts));
+    ASSERT_TRUE(ex.add(sub));
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        pub->publish(reinterpret_cast<const uint8_t *>(&i), sizeof(i));
+    }
+    commkit::clock::time_point deadline = commkit::clock::now() + std::chrono::seconds(10);
+    while (c.taken < 1000 && commkit::clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ex.remove(sub);
+
+    EXPECT_EQ(c.taken, 1000u);
+    EXPECT_EQ(c.overlapped, 0u);
+    EXPECT_EQ(c.outOfOrder, 0u);
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include "../src/frame.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+TEST(FrameTest, RoundTrip)
+{
+    std::vector<uint64_t> storage(64);
+    uint8_t *buf = reinterpret_cast<uint8_t *>(storage.data());
+    size_t cap = storage.size() * sizeof(uint64_t);
+
+    const uint8_t a[] = {1, 2, 3};
+    const uint8_t b[] = {4, 5, 6, 7, 8, 9, 10, 11, 12};
+
+    commkit::FrameWriter fw(buf, cap);
+    EXPECT_TRUE(fw.append(a, sizeof(a), 10, 100));
+    EXPECT_TRUE(fw.append(b, sizeof(b), 11, 200));
+    EXPECT_EQ(fw.count(), 2u);
+
+    commkit::FrameReader fr;
+    ASSERT_TRUE(fr.reset(buf, fw.length()));
+
+    const commkit::FrameEntry *e;
+    const uint8_t *data;
+    ASSERT_TRUE(fr.next(&e, &data));
+    EXPECT_EQ(e->sequence, 10);
+    EXPECT_EQ(e->timestamp, 100);
+    ASSERT_EQ(e->len, sizeof(a));
+    EXPECT_EQ(memcmp(data, a, sizeof(a)), 0);
+
+    // samples stay 8 byte aligned
+    ASSERT_TRUE(fr.peek(&e, &data));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(data) % 8, 0u);
+    ASSERT_TRUE(fr.next(&e, &data));
+    EXPECT_EQ(e->sequence, 11);
+    ASSERT_EQ(e->len, sizeof(b));
+    EXPECT_EQ(memcmp(data, b, sizeof(b)), 0);
+
+    EXPECT_FALSE(fr.next(&e, &data));
+}
+
+TEST(FrameTest, Full)
+{
+    uint64_t storage[8];
+    uint8_t *buf = reinterpret_cast<uint8_t *>(storage);
+
+    commkit::FrameWriter fw(buf, sizeof(storage));
+    uint8_t big[sizeof(storage)] = {0};
+    EXPECT_FALSE(fw.fits(sizeof(big)));
+    EXPECT_FALSE(fw.append(big, sizeof(big), 1, 1));
+    EXPECT_TRUE(fw.append(big, sizeof(storage) - commkit::FRAME_DATA_OFFSET, 1, 1));
+    EXPECT_EQ(fw.length(), sizeof(storage));
+}
+
+TEST(FrameTest, Invalid)
+{
+    uint64_t storage[8] = {0};
+    uint8_t *buf = reinterpret_cast<uint8_t *>(storage);
+
+    commkit::FrameReader fr;
+    EXPECT_FALSE(fr.reset(buf, sizeof(storage)));
+    EXPECT_FALSE(fr.reset(buf, 2));
+
+    // entry claims more data than was received
+    commkit::FrameWriter fw(buf, sizeof(storage));
+    uint8_t data[16] = {0};
+    fw.append(data, sizeof(data), 1, 1);
+    ASSERT_TRUE(fr.reset(buf, fw.length() - 1));
+    const commkit::FrameEntry *e;
+    const uint8_t *d;
+    EXPECT_FALSE(fr.next(&e, &d));
+}
+
+TEST(FrameTest, Fragments)
+{
+    // 1000 byte samples, 256 byte RTPS samples
+    const size_t typeSize = 256;
+    const size_t space = commkit::fragmentSpace(typeSize);
+    EXPECT_EQ(commkit::fragmentCount(16, typeSize), 1u);
+    EXPECT_EQ(commkit::fragmentCount(1000, typeSize), (1000 + space - 1) / space);
+
+    std::vector<uint8_t> sample(1000);
+    for (size_t i = 0; i < sample.size(); ++i) {
+        sample[i] = uint8_t(i * 7);
+    }
+
+    std::vector<uint64_t> storage(typeSize / sizeof(uint64_t));
+    uint8_t *buf = reinterpret_cast<uint8_t *>(storage.data());
+    std::vector<uint8_t> out(sample.size());
+    size_t got = 0;
+
+    for (size_t off = 0; off < sample.size(); off += space) {
+        size_t n = std::min(space, sample.size() - off);
+        size_t len = commkit::writeFragment(buf, 42, 4200, sample.size(), off, &sample[off], n);
+        EXPECT_LE(len, typeSize);
+
+        // not a batch frame
+        commkit::FrameReader fr;
+        EXPECT_FALSE(fr.reset(buf, len));
+
+        const commkit::FragmentEntry *e;
+        const uint8_t *data;
+        size_t dataLen;
+        ASSERT_TRUE(commkit::readFragment(buf, len, &e, &data, &dataLen));
+        EXPECT_EQ(e->sequence, 42);
+        EXPECT_EQ(e->timestamp, 4200);
+        EXPECT_EQ(e->total, sample.size());
+        EXPECT_EQ(e->offset, off);
+        ASSERT_EQ(dataLen, n);
+        memcpy(&out[e->offset], data, dataLen);
+        got += dataLen;
+
+        // truncated header, or data past the end of the sample
+        EXPECT_FALSE(commkit::readFragment(buf, 8, &e, &data, &dataLen));
+        reinterpret_cast<commkit::FragmentEntry *>(buf + sizeof(commkit::FrameHeader))->total =
+            off + n - 1;
+        EXPECT_FALSE(commkit::readFragment(buf, len, &e, &data, &dataLen));
+    }
+
+    EXPECT_EQ(got, sample.size());
+    EXPECT_EQ(out, sample);
+}
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <commkit/commkit.h>
+#include "../src/loanpool.h"
+
+#include <cstdint>
+#include <set>
+
+TEST(LoanPoolTest, AcquireRelease)
+{
+    commkit::LoanPool pool;
+    ASSERT_TRUE(pool.init(3, 100));
+    EXPECT_EQ(pool.capacity(), 3u);
+    EXPECT_EQ(pool.slotSize(), 100u);
+
+    // every slot is distinct and cache line aligned
+    std::set<int> slots;
+    for (unsigned i = 0; i < pool.capacity(); ++i) {
+        int s = pool.acquire();
+        ASSERT_NE(s, commkit::LoanPool::InvalidSlot);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(pool.buffer(s)) % commkit::LoanPool::CacheLineSize,
+                  0);
+        EXPECT_EQ(pool.slotOf(pool.buffer(s)), s);
+        slots.insert(s);
+    }
+    EXPECT_EQ(slots.size(), 3u);
+    EXPECT_EQ(pool.outstanding(), 3u);
+
+    // exhausted
+    EXPECT_EQ(pool.acquire(), commkit::LoanPool::InvalidSlot);
+
+    int s = *slots.begin();
+    EXPECT_TRUE(pool.release(s));
+    EXPECT_EQ(pool.slotOf(pool.buffer(s)), commkit::LoanPool::InvalidSlot);
+    EXPECT_EQ(pool.acquire(), s);
+}
+
+TEST(LoanPoolTest, Refcount)
+{
+    commkit::LoanPool pool;
+    ASSERT_TRUE(pool.init(1, 16));
+
+    int s = pool.acquire();
+    pool.retain(s);
+    EXPECT_FALSE(pool.release(s));
+    EXPECT_EQ(pool.acquire(), commkit::LoanPool::InvalidSlot);
+    EXPECT_TRUE(pool.release(s));
+    EXPECT_EQ(pool.outstanding(), 0u);
+}
+
+TEST(LoanPoolTest, SlotOf)
+{
+    commkit::LoanPool pool;
+    ASSERT_TRUE(pool.init(2, 16));
+
+    int s = pool.acquire();
+    EXPECT_EQ(pool.slotOf(pool.buffer(s) + 1), commkit::LoanPool::InvalidSlot);
+    EXPECT_EQ(pool.slotOf(nullptr), commkit::LoanPool::InvalidSlot);
+    uint8_t local;
+    EXPECT_EQ(pool.slotOf(&local), commkit::LoanPool::InvalidSlot);
+}
+
+TEST(LoanPoolTest, SizeClasses)
+{
+    commkit::LoanPool pool;
+    ASSERT_TRUE(pool.initSizeClasses(2, 256, 5000));
+    EXPECT_EQ(pool.capacity(), 8u); // 256, 1024, 4096, 5000
+    EXPECT_EQ(pool.slotSize(), 5000u);
+
+    // smallest class that fits
+    int a = pool.acquire(100);
+    ASSERT_NE(a, commkit::LoanPool::InvalidSlot);
+    EXPECT_EQ(pool.slotSize(a), 256u);
+    int b = pool.acquire(1000);
+    EXPECT_EQ(pool.slotSize(b), 1024u);
+    int c = pool.acquire(4097);
+    EXPECT_EQ(pool.slotSize(c), 5000u);
+    EXPECT_EQ(pool.acquire(5001), commkit::LoanPool::InvalidSlot);
+
+    // falls back to a bigger class once the right one is used up
+    int d = pool.acquire(100);
+    int e = pool.acquire(100);
+    EXPECT_EQ(pool.slotSize(d), 256u);
+    EXPECT_EQ(pool.slotSize(e), 1024u);
+
+    for (int s : {a, b, c, d, e}) {
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(pool.buffer(s)) % commkit::LoanPool::CacheLineSize,
+                  0u);
+        EXPECT_EQ(pool.slotOf(pool.buffer(s)), s);
+    }
+
+    EXPECT_TRUE(pool.hasFree(5000));
+    int f = pool.acquire(5000);
+    EXPECT_EQ(pool.slotSize(f), 5000u);
+    EXPECT_FALSE(pool.hasFree(5000));
+    EXPECT_TRUE(pool.hasFree(4096));
+}
+
+TEST(LoanPoolTest, PublisherLoans)
+{
+    /*
+     * Publisher reports pool exhaustion via loan() returning false,
+     * and loans can be handed back in any order.
+     */
+
+    commkit::Node n;
+    EXPECT_TRUE(n.init("loans"));
+
+    auto pub = n.createPublisher(commkit::Topic("Loans", "uint32_t", sizeof(uint32_t)));
+    commkit::PublicationOpts opts;
+    opts.loanSlots = 2;
+    ASSERT_TRUE(pub->init(opts));
+
+    uint8_t *a, *b, *c;
+    EXPECT_FALSE(pub->loan(&a, sizeof(uint32_t) + 1));
+    ASSERT_TRUE(pub->loan(&a, sizeof(uint32_t)));
+    ASSERT_TRUE(pub->loan(&b, sizeof(uint32_t)));
+    EXPECT_NE(a, b);
+    EXPECT_FALSE(pub->loan(&c, sizeof(uint32_t)));
+    EXPECT_EQ(pub->loansOutstanding(), 2u);
+
+    // nobody is listening, so commit() reports failure but still frees the slot
+    EXPECT_FALSE(pub->commit(b, sizeof(uint32_t)));
+    pub->discard(a);
+    EXPECT_EQ(pub->loansOutstanding(), 0u);
+
+    // can't commit something that isn't on loan
+    EXPECT_FALSE(pub->commit(a, sizeof(uint32_t)));
+}
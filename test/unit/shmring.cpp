@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include "../src/shmring.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using commkit::ShmRing;
+
+// a ring name of our own, removed again when the test is done
+class ShmRingTest : public ::testing::Test
+{
+protected:
+    void SetUp()
+    {
+        name = "/commkit-test-" + std::to_string(getpid());
+        shm_unlink(name.c_str());
+    }
+
+    void TearDown()
+    {
+        shm_unlink(name.c_str());
+    }
+
+    static bool write(ShmRing &r, int64_t seq, const std::vector<uint8_t> &b)
+    {
+        ByteBufFragment f = {b.data(), b.size()};
+        ShmRing::SampleMeta m = {};
+        m.len = b.size();
+        m.sequence = seq;
+        m.timestamp = seq * 10;
+        m.reliable = true;
+        return r.write(&f, 1, m);
+    }
+
+    std::string name;
+};
+
+TEST_F(ShmRingTest, WriteRead)
+{
+    ShmRing w, r;
+    ASSERT_TRUE(w.open(name, 4, 16));
+    ASSERT_TRUE(r.open(name, 4, 16));
+
+    const uint8_t prefix[ShmRing::PrefixSize] = {1};
+    ASSERT_GE(w.addPeer(ShmRing::PEER_WRITER, prefix), 0);
+    ShmRing other;
+    EXPECT_FALSE(other.open(name, 8, 16)); // laid out differently, and in use
+
+    uint64_t cursor = r.head();
+    ShmRing::SampleMeta m;
+    EXPECT_FALSE(r.peek(&cursor, &m));
+
+    std::vector<uint8_t> b = {1, 2, 3};
+    EXPECT_TRUE(write(w, 1, b));
+    EXPECT_FALSE(write(w, 2, std::vector<uint8_t>(17))); // too big
+
+    ASSERT_TRUE(r.peek(&cursor, &m));
+    EXPECT_EQ(m.len, 3u);
+    EXPECT_EQ(m.sequence, 1);
+    EXPECT_EQ(m.timestamp, 10);
+    EXPECT_TRUE(m.reliable);
+
+    uint8_t out[16];
+    ASSERT_TRUE(r.copy(cursor, out, m.len));
+    EXPECT_EQ(memcmp(out, b.data(), b.size()), 0);
+
+    cursor++;
+    EXPECT_FALSE(r.peek(&cursor, &m));
+}
+
+TEST_F(ShmRingTest, Stale)
+{
+    /*
+     * A ring laid out differently that nobody's using any more is
+     * replaced, rather than keeping everyone else off it for good.
+     */
+
+    {
+        ShmRing old;
+        ASSERT_TRUE(old.open(name, 4, 16));
+    }
+
+    ShmRing r;
+    ASSERT_TRUE(r.open(name, 8, 32));
+    EXPECT_TRUE(write(r, 1, std::vector<uint8_t>(32)));
+
+    ShmRing same;
+    EXPECT_TRUE(same.open(name, 8, 32));
+}
+
+TEST_F(ShmRingTest, Lapped)
+{
+    /*
+     * A reader that falls more than a ring behind skips to the oldest
+     * sample still there, bar the next one to be overwritten.
+     */
+
+    ShmRing r;
+    ASSERT_TRUE(r.open(name, 4, 8));
+
+    uint64_t cursor = r.head();
+    for (int64_t seq = 1; seq <= 10; ++seq) {
+        ASSERT_TRUE(write(r, seq, std::vector<uint8_t>(8, uint8_t(seq))));
+    }
+
+    ShmRing::SampleMeta m;
+    std::vector<int64_t> got;
+    for (; r.peek(&cursor, &m); cursor++) {
+        uint8_t out[8];
+        ASSERT_TRUE(r.copy(cursor, out, m.len));
+        EXPECT_EQ(out[0], uint8_t(m.sequence));
+        got.push_back(m.sequence);
+    }
+    EXPECT_EQ(got, std::vector<int64_t>({8, 9, 10}));
+}
+
+TEST_F(ShmRingTest, Peers)
+{
+    ShmRing r;
+    ASSERT_TRUE(r.open(name, 4, 8));
+
+    const uint8_t a[ShmRing::PrefixSize] = {1};
+    const uint8_t b[ShmRing::PrefixSize] = {2};
+
+    uint32_t gen = r.peerGeneration();
+    int writer = r.addPeer(ShmRing::PEER_WRITER, a);
+    ASSERT_GE(writer, 0);
+    EXPECT_NE(r.peerGeneration(), gen);
+    EXPECT_TRUE(r.hasPeer(ShmRing::PEER_WRITER, a));
+    EXPECT_FALSE(r.hasPeer(ShmRing::PEER_READER, a));
+    EXPECT_FALSE(r.hasReaders(nullptr));
+
+    int reader = r.addPeer(ShmRing::PEER_READER, a);
+    ASSERT_GE(reader, 0);
+    EXPECT_TRUE(r.hasReaders(nullptr));
+    EXPECT_FALSE(r.hasReaders(a)); // only ourselves
+    EXPECT_TRUE(r.hasReaders(b));
+
+    r.removePeer(reader);
+    EXPECT_FALSE(r.hasReaders(nullptr));
+    r.removePeer(writer);
+    EXPECT_FALSE(r.hasPeer(ShmRing::PEER_WRITER, a));
+}
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include "../src/sizehistogram.h"
+
+TEST(SizeHistogramTest, Buckets)
+{
+    using commkit::SizeHistogram;
+
+    // every size is within its bucket's limit, and above the previous one's
+    for (size_t len = 0; len < 100000; ++len) {
+        unsigned b = SizeHistogram::bucketOf(len);
+        EXPECT_LE(len, SizeHistogram::bucketLimit(b));
+        if (b > 0) {
+            EXPECT_GT(len, SizeHistogram::bucketLimit(b - 1));
+        }
+    }
+}
+
+TEST(SizeHistogramTest, Stats)
+{
+    commkit::SizeHistogram h;
+    EXPECT_EQ(h.stats().count, 0u);
+    EXPECT_EQ(h.stats().p99, 0u);
+
+    // 90 small, 9 medium, 1 large
+    for (unsigned i = 0; i < 90; ++i) {
+        h.record(100);
+    }
+    for (unsigned i = 0; i < 9; ++i) {
+        h.record(4000);
+    }
+    h.record(60000);
+
+    commkit::PayloadSizeStats s = h.stats();
+    EXPECT_EQ(s.count, 100u);
+    EXPECT_EQ(s.max, 60000u);
+    EXPECT_GE(s.p50, 100u);
+    EXPECT_LE(s.p50, 125u);
+    EXPECT_GE(s.p90, 100u);
+    EXPECT_LE(s.p90, 125u);
+    EXPECT_GE(s.p99, 4000u);
+    EXPECT_LE(s.p99, 5000u);
+}
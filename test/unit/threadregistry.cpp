@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include "../src/threadregistry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using commkit::ThreadInfo;
+using commkit::ThreadOpts;
+using commkit::ThreadRegistry;
+
+#ifdef __linux__
+
+// a thread's scheduling policy, as /proc/self/task/<tid>/stat has it
+static int taskPolicy(int tid)
+{
+    std::ifstream f("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string stat((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    size_t end = stat.rfind(')'); // the name may hold spaces
+    if (end == std::string::npos) {
+        return -1;
+    }
+    // from the state, field 3, to the policy, field 41
+    std::istringstream fields(stat.substr(end + 1));
+    std::string field;
+    for (int i = 3; i <= 41 && fields >> field; ++i) {
+    }
+    return std::stoi(field);
+}
+
+// and the CPUs it may run on, as /proc/self/task/<tid>/status has them
+static std::string taskCpus(int tid)
+{
+    std::ifstream f("/proc/self/task/" + std::to_string(tid) + "/status");
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.compare(0, 18, "Cpus_allowed_list:") == 0) {
+            return line.substr(line.find_first_not_of(" \t", 18));
+        }
+    }
+    return std::string();
+}
+
+// the first CPU we may run on that a ThreadOpts::cpus mask can name
+static unsigned allowedCpu()
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    sched_getaffinity(0, sizeof(cpus), &cpus);
+    for (unsigned i = 0; i < 64; ++i) {
+        if (CPU_ISSET(i, &cpus)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static const ThreadInfo *find(const std::vector<ThreadInfo> &threads, int tid)
+{
+    for (auto &ti : threads) {
+        if (ti.tid == tid) {
+            return &ti;
+        }
+    }
+    return nullptr;
+}
+
+TEST(ThreadRegistryTest, Roles)
+{
+    /*
+     * Our own threads are scheduled as their role asks as they enter(),
+     * named, and listed until they leave(). SCHED_BATCH needs no privilege.
+     */
+
+    unsigned cpu = allowedCpu();
+    ThreadOpts opts[commkit::THREAD_ROLES];
+    opts[commkit::THREAD_RECEIVER].policy = SCHED_BATCH;
+    opts[commkit::THREAD_RECEIVER].cpus = uint64_t(1) << cpu;
+
+    ThreadRegistry reg;
+    reg.configure(opts);
+
+    std::atomic<int> tid(0), sender(0);
+    std::atomic<bool> done(false);
+    std::thread receiver([&] {
+        ThreadRegistry::Scope scope(&reg, commkit::THREAD_RECEIVER, "ck-test-rx");
+        tid = int(syscall(SYS_gettid));
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::thread other([&] {
+        ThreadRegistry::Scope scope(&reg, commkit::THREAD_SENDER, "ck-test-tx");
+        sender = int(syscall(SYS_gettid));
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    while (tid == 0 || sender == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::vector<ThreadInfo> threads = reg.list();
+    ASSERT_EQ(threads.size(), 2u);
+    const ThreadInfo *ti = find(threads, tid);
+    ASSERT_NE(ti, nullptr);
+    EXPECT_EQ(ti->role, commkit::THREAD_RECEIVER);
+    EXPECT_EQ(ti->name, "ck-test-rx");
+    EXPECT_TRUE(ti->applied);
+    EXPECT_EQ(taskPolicy(tid), SCHED_BATCH);
+    EXPECT_EQ(taskCpus(tid), std::to_string(cpu));
+
+    // left as started
+    ti = find(threads, sender);
+    ASSERT_NE(ti, nullptr);
+    EXPECT_EQ(ti->role, commkit::THREAD_SENDER);
+    EXPECT_TRUE(ti->applied);
+    EXPECT_EQ(taskPolicy(sender), SCHED_OTHER);
+
+    done = true;
+    receiver.join();
+    other.join();
+    EXPECT_TRUE(reg.list().empty());
+}
+
+TEST(ThreadRegistryTest, Adopt)
+{
+    /*
+     * Threads started by others, as Fast-RTPS starts its own, are adopted
+     * if the Adopter's thread started them, and dropped from the list once
+     * gone. Those another thread starts meanwhile are left alone.
+     */
+
+    ThreadOpts opts[commkit::THREAD_ROLES];
+    opts[commkit::THREAD_RTPS].policy = SCHED_IDLE;
+
+    ThreadRegistry reg;
+    reg.configure(opts);
+
+    std::atomic<bool> done(false);
+    auto idle = [&] {
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+    std::thread before(idle);
+
+    std::vector<int> tasks = ThreadRegistry::tasks();
+    EXPECT_TRUE(std::is_sorted(tasks.begin(), tasks.end()));
+    EXPECT_GE(tasks.size(), 2u);
+
+    // another thread starting one of its own as we adopt
+    std::atomic<bool> spawn(false), spawned(false);
+    std::thread elsewhere;
+    std::thread spawner([&] {
+        while (!spawn) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        elsewhere = std::thread(idle);
+        spawned = true;
+    });
+
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    std::thread started;
+    {
+        ThreadRegistry::Adopter adopter(&reg, commkit::THREAD_RTPS, "ck-test-rtps");
+        started = std::thread(idle);
+        spawn = true;
+        while (!spawned) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    spawner.join();
+
+    std::vector<ThreadInfo> threads = reg.list();
+    ASSERT_EQ(threads.size(), 1u);
+    EXPECT_EQ(threads[0].role, commkit::THREAD_RTPS);
+    EXPECT_EQ(threads[0].name, "ck-test-rtps");
+    EXPECT_TRUE(threads[0].applied);
+    EXPECT_EQ(taskPolicy(threads[0].tid), SCHED_IDLE);
+
+    // our name is back
+    char restored[16] = {};
+    pthread_getname_np(pthread_self(), restored, sizeof(restored));
+    EXPECT_STREQ(restored, name);
+
+    // adopting again finds nothing new
+    reg.adopt(tasks, "ck-test-rtps", commkit::THREAD_RTPS);
+    EXPECT_EQ(reg.list().size(), 1u);
+
+    done = true;
+    before.join();
+    started.join();
+    elsewhere.join();
+    EXPECT_TRUE(reg.list().empty());
+}
+
+#endif // __linux__
@@ -0,0 +1,363 @@
+#include <gtest/gtest.h>
+#include "../src/udpbatch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+
+using commkit::UdpAddress;
+using commkit::UdpBatch;
+
+// wait a while for at least one datagram
+static int receiveSome(UdpBatch &u)
+{
+    for (int i = 0; i < 100; ++i) {
+        int n = u.receive();
+        if (n != 0) {
+            return n;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return 0;
+}
+
+TEST(UdpBatchTest, SendReceive)
+{
+    /*
+     * A batch goes out in one sendmmsg() once it's full, and comes
+     * back in one recvmmsg().
+     */
+
+    UdpBatch tx, rx;
+    ASSERT_TRUE(tx.open(0, 4, 64));
+    ASSERT_TRUE(rx.open(0, 8, 64));
+    UdpAddress to = {htonl(INADDR_LOOPBACK), htons(rx.port())};
+
+    for (uint8_t i = 0; i < 4; ++i) {
+        uint8_t b[3] = {i, i, i};
+        ByteBufFragment f[2] = {{b, 1}, {b + 1, 2}};
+        EXPECT_TRUE(tx.send(&to, 1, f, 2));
+    }
+    EXPECT_EQ(tx.queued(), 4u);
+    EXPECT_EQ(tx.sendCalls(), 0u);
+
+    // a fifth won't fit, so the four go first
+    uint8_t b = 4;
+    ByteBufFragment f = {&b, 1};
+    EXPECT_TRUE(tx.send(&to, 1, &f, 1));
+    EXPECT_EQ(tx.sendCalls(), 1u);
+    EXPECT_EQ(tx.queued(), 1u);
+    EXPECT_TRUE(tx.flush());
+    EXPECT_EQ(tx.sendCalls(), 2u);
+
+    std::vector<uint8_t> got;
+    while (got.size() < 5) {
+        int n = receiveSome(rx);
+        ASSERT_GT(n, 0);
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            UdpAddress from;
+            const uint8_t *d = rx.datagram(i, &len, &from);
+            EXPECT_EQ(len, d[0] == 4 ? 1u : 3u);
+            EXPECT_EQ(ntohs(from.port), tx.port());
+            got.push_back(d[0]);
+        }
+    }
+    EXPECT_EQ(got, std::vector<uint8_t>({0, 1, 2, 3, 4}));
+    EXPECT_EQ(rx.receive(), 0);
+}
+
+TEST(UdpBatchTest, Destinations)
+{
+    /*
+     * A datagram for more destinations than a batch holds is split
+     * across batches, and still arrives intact at every one.
+     */
+
+    UdpBatch tx;
+    ASSERT_TRUE(tx.open(0, 2, 64));
+
+    UdpBatch rx[3];
+    UdpAddress to[3];
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(rx[i].open(0, 2, 64));
+        to[i] = {htonl(INADDR_LOOPBACK), htons(rx[i].port())};
+    }
+
+    uint8_t a = 1;
+    ByteBufFragment fa = {&a, 1};
+    EXPECT_TRUE(tx.send(to, 1, &fa, 1));
+
+    const uint8_t b[] = "hello";
+    ByteBufFragment fb = {b, sizeof(b)};
+    EXPECT_TRUE(tx.send(to, 3, &fb, 1));
+    EXPECT_TRUE(tx.flush());
+
+    for (int i = 0; i < 3; ++i) {
+        std::vector<std::string> got;
+        while (got.size() < (i == 0 ? 2u : 1u)) {
+            int n = receiveSome(rx[i]);
+            ASSERT_GT(n, 0);
+            for (int j = 0; j < n; ++j) {
+                size_t len;
+                const uint8_t *d = rx[i].datagram(j, &len, nullptr);
+                got.push_back(std::string(reinterpret_cast<const char *>(d), len));
+            }
+        }
+        EXPECT_EQ(got.back(), std::string("hello", sizeof(b)));
+    }
+}
+
+TEST(UdpBatchTest, TooBig)
+{
+    UdpBatch u;
+    EXPECT_FALSE(u.open(0, 4, UdpBatch::MaxDatagram + 1));
+    ASSERT_TRUE(u.open(0, 4, 8));
+
+    uint8_t b[9] = {};
+    ByteBufFragment f = {b, sizeof(b)};
+    UdpAddress to = {htonl(INADDR_LOOPBACK), htons(u.port())};
+    EXPECT_FALSE(u.send(&to, 1, &f, 1));
+    EXPECT_EQ(u.queued(), 0u);
+}
+
+TEST(UdpBatchTest, Uring)
+{
+    /*
+     * Through io_uring, more datagrams than there are buffers all arrive,
+     * in order, with the receive re-armed as buffers run out.
+     */
+
+    UdpBatch tx, rx;
+    ASSERT_TRUE(tx.open(0, 4, 64));
+    ASSERT_TRUE(rx.open(0, 4, 64));
+    if (!rx.useUring()) {
+        std::cout << "io_uring unavailable, skipping" << std::endl;
+        return;
+    }
+    EXPECT_GE(rx.completionFd(), 0);
+    UdpAddress to = {htonl(INADDR_LOOPBACK), htons(rx.port())};
+
+    const unsigned count = 100;
+    for (unsigned i = 0; i < count; ++i) {
+        ByteBufFragment f = {reinterpret_cast<const uint8_t *>(&i), sizeof(i)};
+        EXPECT_TRUE(tx.send(&to, 1, &f, 1));
+    }
+    EXPECT_TRUE(tx.flush());
+
+    std::vector<unsigned> got;
+    while (got.size() < count) {
+        int n = receiveSome(rx);
+        ASSERT_GT(n, 0);
+        ASSERT_LE(n, 4);
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            UdpAddress from;
+            const uint8_t *d = rx.datagram(i, &len, &from);
+            ASSERT_EQ(len, sizeof(unsigned));
+            EXPECT_EQ(ntohs(from.port), tx.port());
+            unsigned v;
+            memcpy(&v, d, sizeof(v));
+            got.push_back(v);
+        }
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        EXPECT_EQ(got[i], i);
+    }
+    EXPECT_EQ(rx.receive(), 0);
+    EXPECT_GE(rx.completionFd(), 0);
+    EXPECT_LT(rx.receiveCalls(), count / 4);
+}
+
+// split what's received back into the datagrams sent, whether or not
+// GRO coalesced them
+static std::vector<std::string> receiveSegments(UdpBatch &u, size_t count)
+{
+    std::vector<std::string> got;
+    while (got.size() < count) {
+        int n = receiveSome(u);
+        if (n <= 0) {
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            const char *d = reinterpret_cast<const char *>(u.datagram(i, &len, nullptr));
+            size_t seg = u.segment(i) > 0 ? u.segment(i) : len;
+            for (size_t off = 0; off < len; off += seg) {
+                got.push_back(std::string(d + off, std::min(seg, len - off)));
+            }
+        }
+    }
+    return got;
+}
+
+TEST(UdpBatchTest, Segments)
+{
+    /*
+     * A buffer sent in segments arrives as the same datagrams, with GSO
+     * and GRO or without.
+     */
+
+    std::string sample;
+    for (int i = 0; i < 950; ++i) {
+        sample.push_back(char('a' + i / 100));
+    }
+    ByteBufFragment f = {reinterpret_cast<const uint8_t *>(sample.data()), sample.size()};
+
+    for (int offload = 0; offload < 2; ++offload) {
+        UdpBatch tx, rx;
+        ASSERT_TRUE(tx.open(0, 16, 2000));
+        ASSERT_TRUE(rx.open(0, 4, 2000));
+        bool gso = offload && tx.useGso();
+        if (offload && !(gso && rx.useGro())) {
+            std::cout << "GSO/GRO unavailable" << std::endl;
+        }
+        UdpAddress to = {htonl(INADDR_LOOPBACK), htons(rx.port())};
+
+        // a message for the lot, or one per segment
+        EXPECT_TRUE(tx.send(&to, 1, &f, 1, 100));
+        EXPECT_EQ(tx.queued(), gso ? 1u : 10u);
+        EXPECT_TRUE(tx.flush());
+
+        std::vector<std::string> got = receiveSegments(rx, 10);
+        ASSERT_EQ(got.size(), 10u);
+        for (size_t i = 0; i < got.size(); ++i) {
+            EXPECT_EQ(got[i], sample.substr(i * 100, 100));
+        }
+    }
+}
+
+TEST(UdpBatchTest, ZeroCopy)
+{
+    /*
+     * Zero-copy messages go at once, after whatever's queued, and the
+     * kernel reports each one done with, by number (over loopback, having
+     * copied it after all).
+     */
+
+    UdpBatch tx, rx;
+    ASSERT_TRUE(tx.open(0, 4, 2000));
+    ASSERT_TRUE(rx.open(0, 8, 2000));
+    if (!tx.useZeroCopy()) {
+        std::cout << "MSG_ZEROCOPY unavailable, skipping" << std::endl;
+        return;
+    }
+    UdpAddress to[2] = {{htonl(INADDR_LOOPBACK), htons(rx.port())},
+                        {htonl(INADDR_LOOPBACK), htons(rx.port())}};
+
+    uint8_t queued = 'q';
+    ByteBufFragment q = {&queued, 1};
+    EXPECT_TRUE(tx.send(to, 1, &q, 1));
+
+    std::vector<uint8_t> sample(1500, 'z');
+    ByteBufFragment f[2] = {{sample.data(), 500}, {sample.data() + 500, 1000}};
+    uint32_t first = 99;
+    EXPECT_EQ(tx.sendZeroCopy(to, 2, f, 2, 0, &first), 2);
+    EXPECT_EQ(first, 0u);
+    EXPECT_EQ(tx.queued(), 0u);
+    EXPECT_EQ(tx.sendZeroCopy(to, 1, f, 2, 0, &first), 1);
+    EXPECT_EQ(first, 2u);
+
+    std::vector<size_t> lens;
+    while (lens.size() < 4) {
+        int n = receiveSome(rx);
+        ASSERT_GT(n, 0);
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            const uint8_t *d = rx.datagram(i, &len, nullptr);
+            EXPECT_EQ(d[0], len == 1 ? 'q' : 'z');
+            lens.push_back(len);
+        }
+    }
+    EXPECT_EQ(lens, std::vector<size_t>({1, 1500, 1500, 1500}));
+
+    // reports may be merged, but cover messages 0 to 2 between them
+    unsigned reported = 0;
+    for (int i = 0; i < 100 && reported < 3; ++i) {
+        uint32_t lo, hi;
+        bool copied;
+        while (tx.zeroCopyDone(&lo, &hi, &copied)) {
+            EXPECT_EQ(lo, reported);
+            EXPECT_LE(hi, 2u);
+            reported = hi + 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(reported, 3u);
+}
+
+TEST(UdpBatchTest, BusyPoll)
+{
+    /*
+     * Receives busy polling the device, as a spinning receiver has them.
+     * Raising the time past the sysctl takes CAP_NET_ADMIN, but lowering it
+     * doesn't, and receives keep finding datagrams either way.
+     */
+
+    UdpBatch tx, rx;
+    ASSERT_TRUE(tx.open(0, 4, 64));
+    ASSERT_TRUE(rx.open(0, 4, 64));
+    EXPECT_TRUE(rx.useBusyPoll(0));
+    UdpAddress to = {htonl(INADDR_LOOPBACK), htons(rx.port())};
+
+    uint8_t b = 7;
+    ByteBufFragment f = {&b, 1};
+    EXPECT_TRUE(tx.send(&to, 1, &f, 1));
+    EXPECT_TRUE(tx.flush());
+
+    int n = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (n == 0 && std::chrono::steady_clock::now() < end) {
+        n = rx.receive();
+    }
+    ASSERT_EQ(n, 1);
+    size_t len;
+    EXPECT_EQ(rx.datagram(0, &len, nullptr)[0], 7);
+    EXPECT_EQ(len, 1u);
+}
+
+TEST(UdpBatchTest, Timestamps)
+{
+    /*
+     * Once asked, the kernel says when it received each datagram, by
+     * recvmmsg() or through io_uring alike; until then it doesn't.
+     */
+
+    for (bool useUring : {false, true}) {
+        UdpBatch tx, rx;
+        ASSERT_TRUE(tx.open(0, 4, 64));
+        ASSERT_TRUE(rx.open(0, 4, 64));
+        if (useUring && !rx.useUring()) {
+            std::cout << "io_uring unavailable, skipping" << std::endl;
+            continue;
+        }
+        UdpAddress to = {htonl(INADDR_LOOPBACK), htons(rx.port())};
+
+        uint8_t b = 0;
+        ByteBufFragment f = {&b, 1};
+        EXPECT_TRUE(tx.send(&to, 1, &f, 1));
+        EXPECT_TRUE(tx.flush());
+        ASSERT_EQ(receiveSome(rx), 1);
+        EXPECT_EQ(rx.timestamp(0), 0);
+
+        EXPECT_TRUE(rx.useTimestamps());
+        timespec before;
+        clock_gettime(CLOCK_REALTIME, &before);
+        EXPECT_TRUE(tx.send(&to, 1, &f, 1));
+        EXPECT_TRUE(tx.flush());
+        ASSERT_EQ(receiveSome(rx), 1);
+        timespec after;
+        clock_gettime(CLOCK_REALTIME, &after);
+
+        int64_t stamp = rx.timestamp(0);
+        EXPECT_GE(stamp, int64_t(before.tv_sec) * 1000000000 + before.tv_nsec);
+        EXPECT_LE(stamp, int64_t(after.tv_sec) * 1000000000 + after.tv_nsec);
+    }
+}